@@ -0,0 +1,307 @@
+#include "BatchSynthesis.h"
+#include "Model.h"
+#include "PolygonMesh.h"
+#include "AppearanceModel.h"
+#include "DetailSynthesis.h"
+#include "SynthesisTool.h"
+#include "ParameterMgr.h"
+
+#include <highgui.h>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+#else
+#include <unistd.h>
+#endif
+
+static double processMemoryMB()
+{
+  // working set of the whole process, the workers share it
+#ifdef _WIN32
+  PROCESS_MEMORY_COUNTERS pmc;
+  if (GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc)))
+  {
+    return pmc.WorkingSetSize / (1024.0 * 1024.0);
+  }
+  return 0.0;
+#else
+  long n_pages = 0, n_resident = 0;
+  std::ifstream statm("/proc/self/statm");
+  if (statm >> n_pages >> n_resident)
+  {
+    return n_resident * double(sysconf(_SC_PAGESIZE)) / (1024.0 * 1024.0);
+  }
+  return 0.0;
+#endif
+}
+
+static void loadMask(const std::string& file_name, cv::Mat& mask)
+{
+  // 8 bit image to 0~1 float mask, empty if it can't be read
+  cv::Mat img = cv::imread(file_name, CV_LOAD_IMAGE_GRAYSCALE);
+  if (img.empty())
+  {
+    std::cout << "Can't read mask " << file_name << std::endl;
+    mask = cv::Mat();
+    return;
+  }
+  img.convertTo(mask, CV_32FC1, 1.0 / 255.0);
+}
+
+SynthesisSourceCache::SynthesisSourceCache(int capacity_)
+{
+  capacity = capacity_ > 0 ? capacity_ : 1;
+  n_hit = 0;
+  n_miss = 0;
+}
+
+std::shared_ptr<SynthesisSource> SynthesisSourceCache::get(const std::string& app_mod_path, const std::string& src_mask_file, bool need_d1, bool& is_hit)
+{
+  std::string key = app_mod_path + "|" + src_mask_file;
+  std::shared_ptr<SynthesisSource> source;
+  {
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    std::map<std::string, CacheEntry>::iterator it = entries.find(key);
+    if (it != entries.end())
+    {
+      source = it->second.first;
+      lru.splice(lru.begin(), lru, it->second.second);
+      ++n_hit;
+      is_hit = true;
+    }
+    else
+    {
+      source.reset(new SynthesisSource);
+      lru.push_front(key);
+      entries[key] = CacheEntry(source, lru.begin());
+      ++n_miss;
+      is_hit = false;
+
+      // evicted sources stay alive until the jobs using them are finished
+      while ((int)entries.size() > capacity)
+      {
+        std::cout << "Source cache evicts " << lru.back() << std::endl;
+        entries.erase(lru.back());
+        lru.pop_back();
+      }
+    }
+  }
+
+  // load outside of the cache lock, workers waiting for another source are not blocked
+  this->load(source.get(), app_mod_path, src_mask_file, need_d1);
+  return source;
+}
+
+void SynthesisSourceCache::load(SynthesisSource* source, const std::string& app_mod_path, const std::string& src_mask_file, bool need_d1)
+{
+  std::lock_guard<std::mutex> lock(source->load_mutex);
+  if (!source->is_loaded)
+  {
+    std::cout << std::endl << "Load Appearance Model " << app_mod_path << std::endl;
+    source->app_mod.reset(new AppearanceModel());
+    source->app_mod->importAppMod("app_model.xml", app_mod_path);
+
+    cv::Mat origin_mask;
+    if (!src_mask_file.empty())
+    {
+      loadMask(src_mask_file, origin_mask);
+    }
+    if (origin_mask.empty())
+    {
+      // use all the faces seen in the source photo
+      const cv::Mat& primitive_ID = source->app_mod->getPrimitiveID();
+      origin_mask = cv::Mat::ones(primitive_ID.rows, primitive_ID.cols, CV_32FC1);
+    }
+    source->app_mod->get_mask_from_origin_image_to_uv(origin_mask, source->src_mask);
+    source->is_loaded = true;
+  }
+
+  if (need_d1 && !source->d1_tool)
+  {
+    std::shared_ptr<SynthesisTool> d1_tool(new SynthesisTool);
+    DetailSynthesis detail_synthesis;
+    detail_synthesis.prepareD1Source(source->app_mod.get(), source->src_mask, d1_tool);
+    source->d1_tool = d1_tool;
+  }
+}
+
+void SynthesisSourceCache::clear()
+{
+  std::lock_guard<std::mutex> lock(cache_mutex);
+  entries.clear();
+  lru.clear();
+}
+
+BatchSynthesis::BatchSynthesis()
+{
+  n_worker = LG::GlobalParameterMgr::GetInstance()->get_parameter<int>("Synthesis:batch_workers");
+  source_cache.reset(new SynthesisSourceCache(LG::GlobalParameterMgr::GetInstance()->get_parameter<int>("Synthesis:batch_cache_size")));
+  next_job = 0;
+  total_time = 0.0;
+}
+
+BatchSynthesis::~BatchSynthesis()
+{}
+
+bool BatchSynthesis::loadJobList(std::string file_name)
+{
+  std::ifstream infile(file_name);
+  if (!infile)
+  {
+    std::cout << "Can't open job list " << file_name << std::endl;
+    return false;
+  }
+
+  std::string line;
+  while (std::getline(infile, line))
+  {
+    if (line.empty() || line[0] == '#') continue;
+
+    std::stringstream line_stream(line);
+    BatchSynthesisJob job;
+    if (!(line_stream >> job.type >> job.app_mod_path >> job.tar_path >> job.tar_name))
+    {
+      std::cout << "Skip job: " << line << std::endl;
+      continue;
+    }
+    line_stream >> job.src_mask_file >> job.tar_mask_file;
+    if (job.src_mask_file == "-") job.src_mask_file.clear();
+    if (job.tar_mask_file == "-") job.tar_mask_file.clear();
+    if (job.type != "d0" && job.type != "d1")
+    {
+      std::cout << "Unknown synthesis type " << job.type << ", skip job: " << line << std::endl;
+      continue;
+    }
+    jobs.push_back(job);
+  }
+
+  std::cout << jobs.size() << " jobs loaded from " << file_name << std::endl;
+  return true;
+}
+
+void BatchSynthesis::run()
+{
+  reports.clear();
+  reports.resize(jobs.size());
+  next_job = 0;
+
+  int n_thread = std::max(1, std::min(n_worker, (int)jobs.size()));
+  std::cout << "Batch synthesis of " << jobs.size() << " targets with " << n_thread << " workers" << std::endl;
+
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  std::vector<std::thread> workers;
+  for (int i = 0; i < n_thread; ++i)
+  {
+    workers.push_back(std::thread(&BatchSynthesis::workerLoop, this));
+  }
+  for (size_t i = 0; i < workers.size(); ++i)
+  {
+    workers[i].join();
+  }
+  total_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  std::cout << "Batch synthesis finished in " << total_time << " seconds, source cache hit "
+    << source_cache->getHitCount() << " miss " << source_cache->getMissCount() << std::endl;
+}
+
+void BatchSynthesis::workerLoop()
+{
+  // each worker has its own DetailSynthesis, it keeps per target state
+  DetailSynthesis detail_synthesis;
+  while (true)
+  {
+    int job_id;
+    {
+      std::lock_guard<std::mutex> lock(job_mutex);
+      if (next_job >= (int)jobs.size()) break;
+      job_id = next_job++;
+    }
+    this->runJob(job_id, &detail_synthesis);
+  }
+}
+
+void BatchSynthesis::runJob(int job_id, DetailSynthesis* detail_synthesis)
+{
+  BatchSynthesisJob& job = jobs[job_id];
+  BatchSynthesisReport& report = reports[job_id];
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  report.tar_name = job.tar_path + "/" + job.tar_name;
+  report.mem_before = processMemoryMB();
+
+  bool need_d1 = (job.type == "d1");
+  std::shared_ptr<SynthesisSource> source = source_cache->get(job.app_mod_path, job.src_mask_file, need_d1, report.source_cached);
+
+  // prepare the target as TexSynHandler::setSynthesisModel does
+  std::shared_ptr<Model> tar_model(new Model(job.tar_path, job.tar_name));
+  int resolution = LG::GlobalParameterMgr::GetInstance()->get_parameter<int>("Synthesis:resolution");
+  std::shared_ptr<AppearanceModel> tar_app_mod(new AppearanceModel());
+  tar_app_mod->setResolution(resolution);
+  tar_app_mod->setBaseMesh(tar_model->getPolygonMesh());
+  detail_synthesis->setCurResolution(resolution);
+  // seeded per job rather than per worker, a target gives the same result whichever worker runs it
+  unsigned int base_seed = (unsigned int)LG::GlobalParameterMgr::GetInstance()->get_parameter<int>("Synthesis:rand_seed");
+  detail_synthesis->setRandomSeed(base_seed + (unsigned int)job_id);
+
+  cv::Mat tar_mask;
+  this->loadTargetMask(job, resolution, tar_mask);
+
+  if (need_d1)
+  {
+    detail_synthesis->generateD1Feature(tar_app_mod.get(), tar_model, true);
+    detail_synthesis->synthesisD1(source->app_mod.get(), tar_app_mod.get(), tar_model, source->src_mask, tar_mask, source->d1_tool);
+    report.result = detail_synthesis->applyD1Displacement(tar_model, tar_mask);
+  }
+  else
+  {
+    detail_synthesis->generateD0Feature(tar_app_mod.get(), tar_model);
+    report.result = detail_synthesis->synthesisD0(source->app_mod.get(), tar_app_mod.get(), tar_model, source->src_mask, tar_mask);
+  }
+
+  report.mem_after = processMemoryMB();
+  report.wall_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  std::cout << "Target " << report.tar_name << " finished in " << report.wall_time << " seconds, "
+    << "working set " << report.mem_after << " MB" << std::endl;
+}
+
+void BatchSynthesis::loadTargetMask(BatchSynthesisJob& job, int resolution, cv::Mat& tar_mask)
+{
+  if (!job.tar_mask_file.empty())
+  {
+    loadMask(job.tar_mask_file, tar_mask);
+  }
+  if (tar_mask.empty())
+  {
+    tar_mask = cv::Mat::ones(resolution, resolution, CV_32FC1);
+  }
+  else if (tar_mask.rows != resolution || tar_mask.cols != resolution)
+  {
+    cv::resize(tar_mask.clone(), tar_mask, cv::Size(resolution, resolution), 0, 0, cv::INTER_NEAREST);
+  }
+}
+
+void BatchSynthesis::exportReport(std::string file_name)
+{
+  std::ofstream outFile(file_name);
+  if (!outFile)
+  {
+    std::cout << "Can't write report " << file_name << std::endl;
+    return;
+  }
+
+  outFile << "# target\tcached source\twall time (s)\tworking set before (MB)\tworking set after (MB)\tresult" << std::endl;
+  for (size_t i = 0; i < reports.size(); ++i)
+  {
+    outFile << reports[i].tar_name << "\t" << reports[i].source_cached << "\t" << reports[i].wall_time << "\t"
+      << reports[i].mem_before << "\t" << reports[i].mem_after << "\t" << reports[i].result << std::endl;
+  }
+  outFile << "# total time: " << total_time << " s, workers: " << n_worker
+    << ", source cache hit: " << source_cache->getHitCount() << ", miss: " << source_cache->getMissCount() << std::endl;
+  outFile.close();
+}
@@ -0,0 +1,118 @@
+#ifndef BatchSynthesis_H
+#define BatchSynthesis_H
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <list>
+#include <map>
+#include <mutex>
+#include <cv.h>
+
+class AppearanceModel;
+class DetailSynthesis;
+class SynthesisTool;
+
+// one target of the batch, a line of the job list:
+// d0|d1 app_mod_path tar_path tar_name [src_mask_file|-] [tar_mask_file|-]
+struct BatchSynthesisJob
+{
+  std::string type;          // "d0" or "d1"
+  std::string app_mod_path;  // folder of the source app_model.xml
+  std::string tar_path;      // folder of the target mesh, results are written here
+  std::string tar_name;      // obj file name of the target
+  std::string src_mask_file; // mask on the source photo, empty for all visible faces
+  std::string tar_mask_file; // mask in the target uv space, empty for the whole map
+};
+
+struct BatchSynthesisReport
+{
+  std::string tar_name;
+  std::string result;
+  bool source_cached;
+  double wall_time;  // seconds
+  double mem_before; // working set of the process in MB
+  double mem_after;
+
+  BatchSynthesisReport() : source_cached(false), wall_time(0.0), mem_before(0.0), mem_after(0.0) {};
+};
+
+// source appearance model and the data derived from it,
+// shared by all the targets synthesized from the same source
+struct SynthesisSource
+{
+  std::shared_ptr<AppearanceModel> app_mod;
+  cv::Mat src_mask;                       // in uv space
+  std::shared_ptr<SynthesisTool> d1_tool; // pyramids of the masked D1 maps, built on the first D1 job
+  std::mutex load_mutex;
+  bool is_loaded;
+
+  SynthesisSource() : is_loaded(false) {};
+};
+
+// least recently used cache of the sources, keyed by app_mod_path and source mask
+class SynthesisSourceCache
+{
+public:
+  SynthesisSourceCache(int capacity_ = 4);
+  ~SynthesisSourceCache() {};
+
+  std::shared_ptr<SynthesisSource> get(const std::string& app_mod_path, const std::string& src_mask_file, bool need_d1, bool& is_hit);
+  void clear();
+  int getHitCount() { return n_hit; };
+  int getMissCount() { return n_miss; };
+
+private:
+  void load(SynthesisSource* source, const std::string& app_mod_path, const std::string& src_mask_file, bool need_d1);
+
+private:
+  typedef std::list<std::string> LRUList;
+  typedef std::pair<std::shared_ptr<SynthesisSource>, LRUList::iterator> CacheEntry;
+
+  int capacity;
+  int n_hit;
+  int n_miss;
+  LRUList lru; // most recently used at the front
+  std::map<std::string, CacheEntry> entries;
+  std::mutex cache_mutex;
+
+private:
+  SynthesisSourceCache(const SynthesisSourceCache&);
+  void operator = (const SynthesisSourceCache&);
+};
+
+// headless synthesis of many targets, does not need the MainWindow
+class BatchSynthesis
+{
+public:
+  BatchSynthesis();
+  ~BatchSynthesis();
+
+  bool loadJobList(std::string file_name);
+  void addJob(BatchSynthesisJob& job) { jobs.push_back(job); };
+  void run();
+  void exportReport(std::string file_name);
+
+  void setWorkerNum(int n) { n_worker = n; };
+  void setCacheSize(int n) { source_cache.reset(new SynthesisSourceCache(n)); };
+
+private:
+  void workerLoop();
+  void runJob(int job_id, DetailSynthesis* detail_synthesis);
+  void loadTargetMask(BatchSynthesisJob& job, int resolution, cv::Mat& tar_mask);
+
+private:
+  std::vector<BatchSynthesisJob> jobs;
+  std::vector<BatchSynthesisReport> reports;
+  std::shared_ptr<SynthesisSourceCache> source_cache;
+  int n_worker;
+  int next_job;
+  std::mutex job_mutex;
+  double total_time;
+
+private:
+  BatchSynthesis(const BatchSynthesis&);
+  void operator = (const BatchSynthesis&);
+};
+
+#endif // !BatchSynthesis_H
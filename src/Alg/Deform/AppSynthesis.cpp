@@ -16,12 +16,26 @@
 #include "ImageUtility.h"
 #include "ParameterMgr.h"
 #include "YMLHandler.h"
+#include "DebugExporter.h"
 #include <fstream>
 #include "BasicHeader.h"
 
 using namespace LG;
 
 std::string DetailSynthesis::synthesisD0(AppearanceModel* app_mod_src, AppearanceModel* app_mod_tar, std::shared_ptr<Model> tar_model)
+{
+  // masks are drawn in the ui and passed by the global parameters
+  cv::Mat src_mask;
+  app_mod_src->get_mask_from_origin_image_to_uv(
+    GlobalParameterMgr::GetInstance()->get_parameter<cv::Mat>("Synthesis:SrcAppOriginImageMask").clone(),
+    src_mask
+    );
+  cv::Mat tar_mask = GlobalParameterMgr::GetInstance()->get_parameter<cv::Mat>("Synthesis:TarAppMask").clone();
+
+  return this->synthesisD0(app_mod_src, app_mod_tar, tar_model, src_mask, tar_mask);
+}
+
+std::string DetailSynthesis::synthesisD0(AppearanceModel* app_mod_src, AppearanceModel* app_mod_tar, std::shared_ptr<Model> tar_model, cv::Mat& src_mask, cv::Mat& tar_mask)
 {
 	// 0. prepare the sample vertices on the target mesh
 	std::shared_ptr<GeometryTransfer> geometry_transfer(new GeometryTransfer);
@@ -38,11 +52,6 @@ std::string DetailSynthesis::synthesisD0(AppearanceModel* app_mod_src, Appearanc
 	std::vector<cv::Mat> src_feature_map;
 	app_mod_src->getD0Features(src_feature_map);
    // cv::Mat src_mask = GlobalParameterMgr::GetInstance()->get_parameter<cv::Mat>("Synthesis:SrcAppMask").clone();// GLOBAL::m_mat_source_mask0_.clone();
-	cv::Mat src_mask;
-	app_mod_src->get_mask_from_origin_image_to_uv(
-		GlobalParameterMgr::GetInstance()->get_parameter<cv::Mat>("Synthesis:SrcAppOriginImageMask").clone(),
-		src_mask
-		);
 	/*ImageUtility::generateMultiMask(src_feature_map[0].clone(), src_mask);*/
 
 	// 1.1 generate mask from source image
@@ -60,8 +69,6 @@ std::string DetailSynthesis::synthesisD0(AppearanceModel* app_mod_src, Appearanc
 // 	cv::Mat tar_mask(tar_feature_map[0].rows, tar_feature_map[0].cols, CV_32FC1, 1);
 // 	ImageUtility::generateMaskFromStroke(tar_feature_map[0].clone(), stroke, tar_mask);
 
-	cv::Mat tar_mask = GlobalParameterMgr::GetInstance()->get_parameter<cv::Mat>("Synthesis:TarAppMask").clone();
-
 	std::vector<int> cur_sampled_tar_models;
 	ShapeUtility::vertexFilterFromParaMask(sampled_tar_model, cur_sampled_tar_models, tar_para_shape->vertex_set, tar_para_shape->cut_shape->getPolygonMesh(), tar_mask);
 
@@ -82,6 +89,7 @@ std::string DetailSynthesis::synthesisD0(AppearanceModel* app_mod_src, Appearanc
 	syn_tool->best_random_size = GlobalParameterMgr::GetInstance()->get_parameter<int>("Synthesis:rand_size");
 	syn_tool->lamd_occ = GlobalParameterMgr::GetInstance()->get_parameter<double>("Synthesis:occ");
 	syn_tool->bias_rate = GlobalParameterMgr::GetInstance()->get_parameter<double>("Synthesis:bias_rate");
+	syn_tool->rand_seed = this->getRandomSeed();
 	syn_tool->setExportPath(tar_model->getOutputPath());
 	syn_tool->doNNFOptimization(masked_src_feature_map, masked_tar_feature_map);
 
@@ -200,9 +208,38 @@ void DetailSynthesis::debugSynthesisD0(std::string app_mod_path, std::shared_ptr
 
 void DetailSynthesis::synthesisD1(AppearanceModel* app_mod_src, AppearanceModel* app_mod_tar, std::shared_ptr<Model> tar_model)
 {
+  // masks are drawn in the ui and passed by the global parameters
+  cv::Mat src_mask;
+  app_mod_src->get_mask_from_origin_image_to_uv(
+    GlobalParameterMgr::GetInstance()->get_parameter<cv::Mat>("Synthesis:SrcAppOriginImageMask").clone(),
+    src_mask
+    );
+  cv::Mat tar_mask = GlobalParameterMgr::GetInstance()->get_parameter<cv::Mat>("Synthesis:TarAppMask").clone();
+
+  this->synthesisD1(app_mod_src, app_mod_tar, tar_model, src_mask, tar_mask);
+}
+
+void DetailSynthesis::prepareD1Source(AppearanceModel* app_mod_src, cv::Mat& src_mask, SynToolPtr src_tool)
+{
+  // pyramids of the masked source D1 maps, built once and shared by
+  // every synthesisD1 using this appearance model
   std::vector<cv::Mat> src_feature_map;
   app_mod_src->getD1Features(src_feature_map);
+  std::vector<cv::Mat> src_detail_map;
+  app_mod_src->getD1Details(src_detail_map);
 
+  std::vector<cv::Mat> masked_src_feature_map;
+  ImageUtility::generateMaskedMatVec(src_feature_map, masked_src_feature_map, src_mask);
+  std::vector<cv::Mat> masked_src_detail_map;
+  ImageUtility::generateMaskedMatVec(src_detail_map, masked_src_detail_map, src_mask);
+
+  src_tool->levels = GlobalParameterMgr::GetInstance()->get_parameter<int>("Synthesis:pry_levels");
+  src_tool->initSource(masked_src_feature_map, masked_src_detail_map);
+  src_tool->packSource();
+}
+
+void DetailSynthesis::synthesisD1(AppearanceModel* app_mod_src, AppearanceModel* app_mod_tar, std::shared_ptr<Model> tar_model, cv::Mat& src_mask, cv::Mat& tar_uv_mask, SynToolPtr src_tool)
+{
   std::vector<cv::Mat> src_detail_map;
   app_mod_src->getD1Details(src_detail_map);
 
@@ -251,7 +288,7 @@ void DetailSynthesis::synthesisD1(AppearanceModel* app_mod_src, AppearanceModel*
   app_mod_src->getCCAMin(cca_min);
   app_mod_src->getCCAMax(cca_max);
   ImageUtility::centralizeMat(new_X, 0, cca_min, cca_max, true);
-  YMLHandler::saveToMat(tar_model->getOutputPath(), "test.mat", new_X);
+  DebugExporter::GetInstance()->writeMat(DebugExporter::EXPORT_STAGE, tar_model->getOutputPath(), "test.mat", new_X);
   cv::Mat feature_map_backup = tar_feature_map[0].clone();
   tar_feature_map.clear();
   tar_feature_map.resize(new_X.cols);
@@ -283,21 +320,9 @@ void DetailSynthesis::synthesisD1(AppearanceModel* app_mod_src, AppearanceModel*
   //ImageUtility::generateMultiMask(src_detail_map[0].clone(), src_mask);
   //cv::Mat tar_mask(tar_feature_map[0].rows, tar_feature_map[0].cols, CV_32FC1, 1);
   //ImageUtility::generateMultiMask(feature_map_backup.clone(), tar_mask);
-  cv::Mat src_mask;
-  app_mod_src->get_mask_from_origin_image_to_uv(
-    GlobalParameterMgr::GetInstance()->get_parameter<cv::Mat>("Synthesis:SrcAppOriginImageMask").clone(),
-    src_mask
-    );
-  cv::Mat tar_mask = GlobalParameterMgr::GetInstance()->get_parameter<cv::Mat>("Synthesis:TarAppMask").clone();
-
+  cv::Mat tar_mask = tar_uv_mask.clone(); // modified below
 
-  // 2. make the masked source and target feature map
-  // 2.1 masked source
-  std::vector<cv::Mat> masked_src_feature_map;
-  ImageUtility::generateMaskedMatVec(src_feature_map, masked_src_feature_map, src_mask);
-  std::vector<cv::Mat> masked_src_detail_map;
-  ImageUtility::generateMaskedMatVec(src_detail_map, masked_src_detail_map, src_mask);
-  // 2.2 masked target
+  // 2. make the masked target feature map, the masked source is made with the pyramids
   std::vector<cv::Mat> masked_tar_feature_map;
   ImageUtility::generateMaskedMatVec(tar_feature_map, masked_tar_feature_map, tar_mask);
 
@@ -313,6 +338,14 @@ void DetailSynthesis::synthesisD1(AppearanceModel* app_mod_src, AppearanceModel*
   syn_tool->bias_rate = GlobalParameterMgr::GetInstance()->get_parameter<double>("Synthesis:bias_rate");
   syn_tool->beta_func_center = GlobalParameterMgr::GetInstance()->get_parameter<double>("Synthesis:beta_center");
   syn_tool->beta_func_mult = GlobalParameterMgr::GetInstance()->get_parameter<double>("Synthesis:beta_mult");
+  syn_tool->use_parallel_nnf = GlobalParameterMgr::GetInstance()->get_parameter<bool>("Synthesis:parallel_nnf");
+  syn_tool->benchmark_parallel_nnf = GlobalParameterMgr::GetInstance()->get_parameter<bool>("Synthesis:benchmark_parallel_nnf");
+  syn_tool->use_vote_mode = GlobalParameterMgr::GetInstance()->get_parameter<bool>("Synthesis:vote_mode");
+  syn_tool->nnf_tile_size = GlobalParameterMgr::GetInstance()->get_parameter<int>("Synthesis:nnf_tile_size");
+  syn_tool->rand_seed = this->getRandomSeed();
+  syn_tool->use_window_search = GlobalParameterMgr::GetInstance()->get_parameter<bool>("Synthesis:window_search");
+  syn_tool->use_candidate_index = GlobalParameterMgr::GetInstance()->get_parameter<bool>("Synthesis:candidate_index");
+  syn_tool->ann_oversample = GlobalParameterMgr::GetInstance()->get_parameter<int>("Synthesis:ann_oversample");
 
   std::ofstream paraOutput(tar_model->getOutputPath() + "/synpara.txt");
   if (paraOutput)
@@ -325,10 +358,26 @@ void DetailSynthesis::synthesisD1(AppearanceModel* app_mod_src, AppearanceModel*
     paraOutput << "bias rate: " << syn_tool->bias_rate << std::endl;
     paraOutput << "beta center: " << syn_tool->beta_func_center << std::endl;
     paraOutput << "beta mult: " << syn_tool->beta_func_mult << std::endl;
+    paraOutput << "parallel nnf: " << syn_tool->use_parallel_nnf << std::endl;
+    paraOutput << "vote mode: " << syn_tool->use_vote_mode << std::endl;
+    paraOutput << "random seed: " << syn_tool->rand_seed << std::endl;
+    paraOutput << "window search: " << syn_tool->use_window_search << std::endl;
+    paraOutput << "candidate index: " << syn_tool->use_candidate_index << " oversample " << syn_tool->ann_oversample << std::endl;
     paraOutput.close();
   }
 
-  syn_tool->init(masked_src_feature_map, masked_tar_feature_map, masked_src_detail_map);
+  if (!src_tool || !syn_tool->shareSource(*src_tool))
+  {
+    // no source given, or one built with other pyramid levels
+    src_tool.reset(new SynthesisTool);
+    this->prepareD1Source(app_mod_src, src_mask, src_tool);
+    syn_tool->shareSource(*src_tool);
+  }
+  syn_tool->initTarget(masked_tar_feature_map);
+  if (GlobalParameterMgr::GetInstance()->get_parameter<bool>("Synthesis:benchmark_candidate_index"))
+  {
+    syn_tool->benchmarkCandidateIndex(syn_tool->levels - 1);
+  }
   syn_tool->doSynthesisNew();
 
   // 4. merge the detail map together
@@ -13,6 +13,10 @@
 #include "GeometryTransfer.h"
 
 #include "KDTreeWrapper.h"
+#include "UVGBuffer.h"
+#include "CCASolver.h"
+#include "DebugExporter.h"
+#include "FeatureCache.h"
 #include "ShapeUtility.h"
 #include "ImageUtility.h"
 #include "obj_writer.h"
@@ -68,6 +72,8 @@ void MouseDraw(int event,int x,int y,int flags,void* param)
 DetailSynthesis::DetailSynthesis()
 {
   resolution = 1024;
+  rand_seed = 0;
+  has_rand_seed = false;
   normalize_max = -1.0;
 
   mesh_para = nullptr;
@@ -81,6 +87,15 @@ DetailSynthesis::~DetailSynthesis()
 
 }
 
+unsigned int DetailSynthesis::getRandomSeed()
+{
+  if (has_rand_seed)
+  {
+    return rand_seed;
+  }
+  return (unsigned int)LG::GlobalParameterMgr::GetInstance()->get_parameter<int>("Synthesis:rand_seed");
+}
+
 void DetailSynthesis::testMeshPara(std::shared_ptr<Model> model)
 {
   /*cv::FileStorage fs(model->getDataPath() + "/displacement.xml", cv::FileStorage::READ);
@@ -126,6 +141,7 @@ void DetailSynthesis::prepareFeatureMap(std::shared_ptr<Model> model)
 
   ShapeUtility::computeSymmetry(model);
   ShapeUtility::computeNormalizedHeight(model);
+  model->getFeatureCache()->flush();
 
   //ShapeUtility::computeDirectionalOcclusion(model);
 
@@ -188,36 +204,36 @@ void DetailSynthesis::computeFeatureMap(ParaShape* para_shape, std::vector<std::
   std::shared_ptr<KDTreeWrapper> kdTree = para_shape->kdTree_UV;
   STLVectori v_set = para_shape->vertex_set;
 
-  int f_id;
-  std::vector<int> v_ids;
-  std::vector<float> bary_coord;
-  std::vector<float> pt(2, 0);
+  UVGBuffer* uv_gbuffer = para_shape->getUVGBuffer(resolution);
+
+  // visible tag of the faces in the cut shape, so the texel loop doesn't search the set
+  std::vector<char> visible_tag(para_shape->face_set.size(), 0);
+  for (size_t i = 0; i < para_shape->face_set.size(); ++i)
+  {
+    visible_tag[i] = visible_faces.find(para_shape->face_set[i]) != visible_faces.end() ? 1 : 0;
+  }
 
   int n_filled_pixel = 0;
 
-  for(int x = 0; x < resolution; x ++)
+  // every texel is written by one thread only
+#pragma omp parallel for schedule(static) reduction(+:n_filled_pixel)
+  for (int y = 0; y < resolution; y ++)
   {
-    for(int y = 0; y < resolution; y ++)
+    for (int x = 0; x < resolution; x ++)
     {
-      pt[0] = float(x) / resolution;
-      pt[1] = float(y) / resolution;
-      if (ShapeUtility::findClosestUVFace(pt, para_shape, bary_coord, f_id, v_ids))
+      int f_id = uv_gbuffer->faceId(x, y);
+      if (f_id >= 0 && visible_tag[f_id])
       {
-        if (visible_faces.find(para_shape->face_set[f_id]) != visible_faces.end())
-        {
-          for (int i = 0; i < dim_feature; ++i)
-          {
-            para_shape->feature_map[i].at<float>(resolution - y - 1,x) = bary_coord[0] * feature_list[v_set[v_ids[0]]][i] + bary_coord[1] * feature_list[v_set[v_ids[1]]][i] + bary_coord[2] * feature_list[v_set[v_ids[2]]][i];
-          }
-          n_filled_pixel ++;
-        }
-        else
+        const float* bary_coord = uv_gbuffer->baryCoord(x, y);
+        const unsigned int* v_ids = uv_gbuffer->vertexIds(f_id);
+        const std::vector<float>& feature_0 = feature_list[v_set[v_ids[0]]];
+        const std::vector<float>& feature_1 = feature_list[v_set[v_ids[1]]];
+        const std::vector<float>& feature_2 = feature_list[v_set[v_ids[2]]];
+        for (int i = 0; i < dim_feature; ++i)
         {
-          for (int i = 0; i < dim_feature; ++i)
-          {
-            para_shape->feature_map[i].at<float>(resolution - y - 1,x) = -1.0;
-          }
+          para_shape->feature_map[i].at<float>(resolution - y - 1,x) = bary_coord[0] * feature_0[i] + bary_coord[1] * feature_1[i] + bary_coord[2] * feature_2[i];
         }
+        n_filled_pixel ++;
       }
       else
       {
@@ -226,51 +242,6 @@ void DetailSynthesis::computeFeatureMap(ParaShape* para_shape, std::vector<std::
           para_shape->feature_map[i].at<float>(resolution - y - 1,x) = -1.0;
         }
       }
-
-      //// put feature into feature map from feature_list
-      //if (visible_faces.find(para_shape->face_set[f_id]) != visible_faces.end())
-      //{
-      //  for (int i = 0; i < dim_feature; ++i)
-      //  {
-      //    if (inside_para)
-      //    {
-      //      para_shape->feature_map[i].at<float>(resolution - y - 1,x) = bary_coord[0] * feature_list[v_set[v_ids[0]]][i] + bary_coord[1] * feature_list[v_set[v_ids[1]]][i] + bary_coord[2] * feature_list[v_set[v_ids[2]]][i];
-      //    }
-      //    else
-      //    {
-      //      para_shape->feature_map[i].at<float>(resolution - y - 1,x) = -1.0;
-      //    }
-      //  }
-      //}
-      //else
-      //{
-      //  for (int i = 0; i < dim_feature; ++i)
-      //  {
-      //    para_shape->feature_map[i].at<float>(resolution - y - 1,x) = -1.0;
-      //  }
-      //}
-
-
-      /*float v1_normal_original_mesh[3],v2_normal_original_mesh[3],v3_normal_original_mesh[3];
-      v1_normal_original_mesh[0] = mesh_para->normal_original_mesh[3 * v_set[id1]];
-      v1_normal_original_mesh[1] = mesh_para->normal_original_mesh[3 * v_set[id1] + 1];
-      v1_normal_original_mesh[2] = mesh_para->normal_original_mesh[3 * v_set[id1] + 2];
-      v2_normal_original_mesh[0] = mesh_para->normal_original_mesh[3 * v_set[id2]];
-      v2_normal_original_mesh[1] = mesh_para->normal_original_mesh[3 * v_set[id2] + 1];
-      v2_normal_original_mesh[2] = mesh_para->normal_original_mesh[3 * v_set[id2] + 2];
-      v3_normal_original_mesh[0] = mesh_para->normal_original_mesh[3 * v_set[id3]];
-      v3_normal_original_mesh[1] = mesh_para->normal_original_mesh[3 * v_set[id3] + 1];
-      v3_normal_original_mesh[2] = mesh_para->normal_original_mesh[3 * v_set[id3] + 2];*/
-
-      /*feature_map.at<float>(x,y,0) = lambda[0] * v1_normal_original_mesh[0] + lambda[1] * v2_normal_original_mesh[0] + lambda[2] * v3_normal_original_mesh[0];
-      feature_map.at<float>(x,y,1) = lambda[0] * v1_normal_original_mesh[1] + lambda[1] * v2_normal_original_mesh[1] + lambda[2] * v3_normal_original_mesh[1];
-      feature_map.at<float>(x,y,2) = lambda[0] * v1_normal_original_mesh[2] + lambda[1] * v2_normal_original_mesh[2] + lambda[2] * v3_normal_original_mesh[2];*/
-      /*feature_map.at<cv::Vec3f>(x,y)[0] = lambda[0] * v1_normal_original_mesh[0] + lambda[1] * v2_normal_original_mesh[0] + lambda[2] * v3_normal_original_mesh[0];
-      feature_map.at<cv::Vec3f>(x,y)[1] = lambda[0] * v1_normal_original_mesh[1] + lambda[1] * v2_normal_original_mesh[1] + lambda[2] * v3_normal_original_mesh[1];
-      feature_map.at<cv::Vec3f>(x,y)[2] = lambda[0] * v1_normal_original_mesh[2] + lambda[1] * v2_normal_original_mesh[2] + lambda[2] * v3_normal_original_mesh[2];*/
-      /*feature_map[0].at<float>(x,y) = lambda[0] * v1_normal_original_mesh[0] + lambda[1] * v2_normal_original_mesh[0] + lambda[2] * v3_normal_original_mesh[0];
-      feature_map[1].at<float>(x,y) = lambda[0] * v1_normal_original_mesh[1] + lambda[1] * v2_normal_original_mesh[1] + lambda[2] * v3_normal_original_mesh[1];
-      feature_map[2].at<float>(x,y) = lambda[0] * v1_normal_original_mesh[2] + lambda[1] * v2_normal_original_mesh[2] + lambda[2] * v3_normal_original_mesh[2];*/
     }
   }
   para_shape->n_filled_feature = n_filled_pixel;
@@ -393,7 +364,7 @@ void DetailSynthesis::computeDisplacementMap(ParaShape* para_shape, VertexList&
   displacement_max = std::numeric_limits<double>::min(), displacement_min = std::numeric_limits<double>::max();
 
   AdjList adjFaces_list = shape->getVertexShareFaces();
-  std::vector<float> pt(2, 0);
+  UVGBuffer* uv_gbuffer = para_shape->getUVGBuffer(resolution);
   for(int x = 0; x < resolution; x ++)
   {
     for(int y = 0; y < resolution; y ++)
@@ -444,13 +415,11 @@ void DetailSynthesis::computeDisplacementMap(ParaShape* para_shape, VertexList&
       //    id3 = v3_id;
       //  }
       //}
-      pt[0] = float(x) / resolution;
-      pt[1] = float(y) / resolution;
       int face_id;
       std::vector<int> id;
       std::vector<float> lambda;
       //ShapeUtility::findFaceId(x, y, resolution, kdTree, adjFaces_list, shape, face_id, lambda, id1, id2, id3);
-      if(ShapeUtility::findClosestUVFace(pt, para_shape, lambda, face_id, id))
+      if(uv_gbuffer->lookup(x, y, lambda, face_id, id))
       {
         if (visible_faces.find(para_shape->face_set[face_id]) != visible_faces.end())
         {
@@ -548,7 +517,6 @@ void DetailSynthesis::computeDetailMap(ParaShape* para_shape, std::vector<cv::Ma
   STLVectori v_set = para_shape->vertex_set;
 
   AdjList adjFaces_list = shape->getVertexShareFaces();
-  std::vector<float> pt(2, 0);
 
   cv::Mat uv_mask(resolution, resolution, CV_32FC1, 0.0);
   
@@ -558,6 +526,7 @@ void DetailSynthesis::computeDetailMap(ParaShape* para_shape, std::vector<cv::Ma
     detail_max.push_back(-std::numeric_limits<float>::max());
   }
   std::cout << "dim_detail.size :" << dim_detail << std::endl;
+  UVGBuffer* uv_gbuffer = para_shape->getUVGBuffer(resolution);
   for(int x = 0; x < resolution; x ++)
   {
     for(int y = 0; y < resolution; y ++)
@@ -608,12 +577,10 @@ void DetailSynthesis::computeDetailMap(ParaShape* para_shape, std::vector<cv::Ma
       //    id3 = v3_id;
       //  }
       //}
-      pt[0] = float(x) / resolution;
-      pt[1] = float(y) / resolution;
       int face_id;
       std::vector<int> id;
       std::vector<float> lambda;
-      if(ShapeUtility::findClosestUVFace(pt, para_shape, lambda, face_id, id))
+      if(uv_gbuffer->lookup(x, y, lambda, face_id, id))
       {
 
         //ShapeUtility::findFaceId(x, y, resolution, kdTree, adjFaces_list, shape, face_id, lambda, id1, id2, id3);
@@ -844,21 +811,19 @@ void DetailSynthesis::computeDisplacementMap(LG::PolygonMesh* height_mesh, std::
   std::vector<float> disp_records;
   float perc = 0;
 
-  std::vector<float> pt(2, 0);
+  UVGBuffer* tar_uv_gbuffer = tar_para_shape->getUVGBuffer(resolution);
+  UVGBuffer* src_uv_gbuffer = src_para_shape->getUVGBuffer(resolution);
   for(int x = 0; x < resolution; x ++)
   {
     for(int y = 0; y < resolution; y ++)
     {
-      pt[0] = float(x) / resolution;
-      pt[1] = float(y) / resolution;
       int tar_face_id, src_face_id;
       std::vector<int> tar_ids, src_ids;
       std::vector<float> tar_lambda, src_lambda;
       //ShapeUtility::findFaceId(x, y, resolution, kdTree, adjFaces_list, shape, face_id, lambda, id1, id2, id3);
 
-      bool in_tar_uv_mesh = ShapeUtility::findClosestUVFace(pt, tar_para_shape.get(), tar_lambda, tar_face_id, tar_ids);
-      pt[0] = float(x) / resolution; pt[1] = float(y) / resolution;
-      bool in_src_uv_mesh = ShapeUtility::findClosestUVFace(pt, src_para_shape.get(), src_lambda, src_face_id, src_ids);
+      bool in_tar_uv_mesh = tar_uv_gbuffer->lookup(x, y, tar_lambda, tar_face_id, tar_ids);
+      bool in_src_uv_mesh = src_uv_gbuffer->lookup(x, y, src_lambda, src_face_id, src_ids);
       bool in_visible_faces = visible_faces.find(src_face_id) == visible_faces.end() ? false : true;
       bool in_uv_mask = uv_mask.at<float>(resolution - 1 - y, x) > 0.5 ? true : false;
       /*int closest_v_id = ShapeUtility::closestVertex(src_para_shape->cut_shape->getPolygonMesh(), src_ids, tar_para_shape->cut_shape->getPolygonMesh(), i);
@@ -1003,22 +968,20 @@ void DetailSynthesis::computeDisplacementMap(cv::Mat& final_height, std::shared_
   displacement_max = std::numeric_limits<double>::min(), displacement_min = std::numeric_limits<double>::max();
 
   double z_scale = src_model->getZScale();
-  std::vector<float> pt(2, 0);
 
+  UVGBuffer* tar_uv_gbuffer = tar_para_shape->getUVGBuffer(resolution);
+  UVGBuffer* src_uv_gbuffer = src_para_shape->getUVGBuffer(resolution);
   for(int x = 0; x < resolution; x ++)
   {
     for(int y = 0; y < resolution; y ++)
     {
-      pt[0] = float(x) / resolution;
-      pt[1] = float(y) / resolution;
       int tar_face_id, src_face_id;
       std::vector<int> tar_ids, src_ids;
       std::vector<float> tar_lambda, src_lambda;
       //ShapeUtility::findFaceId(x, y, resolution, kdTree, adjFaces_list, shape, face_id, lambda, id1, id2, id3);
 
-      bool in_tar_uv_mesh = ShapeUtility::findClosestUVFace(pt, tar_para_shape.get(), tar_lambda, tar_face_id, tar_ids);
-      pt[0] = float(x) / resolution; pt[1] = float(y) / resolution;
-      bool in_src_uv_mesh = ShapeUtility::findClosestUVFace(pt, src_para_shape.get(), src_lambda, src_face_id, src_ids);
+      bool in_tar_uv_mesh = tar_uv_gbuffer->lookup(x, y, tar_lambda, tar_face_id, tar_ids);
+      bool in_src_uv_mesh = src_uv_gbuffer->lookup(x, y, src_lambda, src_face_id, src_ids);
       bool in_visible_faces = visible_faces.find(src_face_id) == visible_faces.end() ? false : true;
       bool in_uv_mask = uv_mask.at<float>(resolution - 1 - y, x) > 0.5 ? true : false;
       if (in_tar_uv_mesh && in_src_uv_mesh && in_visible_faces && in_uv_mask)
@@ -1759,6 +1722,7 @@ void DetailSynthesis::patchSynthesis(std::shared_ptr<Model> model)
       model->findCrspPatch(int(i), crsp_patch, candidate);
       
       syn_tool.reset(new SynthesisTool);
+      syn_tool->rand_seed = this->getRandomSeed();
       syn_tool->init(mesh_para->shape_patches[crsp_patch].feature_map, mesh_para->shape_patches[i].feature_map, mesh_para->shape_patches[crsp_patch].detail_map);
       syn_tool->doSynthesisNew();
       
@@ -1787,7 +1751,7 @@ void DetailSynthesis::mergeSynthesis(ParaShape* para_shape, std::shared_ptr<Mode
   STLVectori v_set = mesh_para->unseen_part->vertex_set;
 
   AdjList adjFaces_list = shape->getVertexShareFaces();
-  std::vector<float> pt(2, 0);
+  UVGBuffer* uv_gbuffer = para_shape->getUVGBuffer(resolution);
   for(int x = 0; x < resolution; x ++)
   {
     for(int y = 0; y < resolution; y ++)
@@ -1838,12 +1802,10 @@ void DetailSynthesis::mergeSynthesis(ParaShape* para_shape, std::shared_ptr<Mode
       //    id3 = v3_id;
       //  }
       //}
-      pt[0] = float(x) / resolution;
-      pt[1] = float(y) / resolution;
       int face_id;
       std::vector<int> id;
       std::vector<float> lambda;
-      if(ShapeUtility::findClosestUVFace(pt, para_shape, lambda, face_id, id))
+      if(uv_gbuffer->lookup(x, y, lambda, face_id, id))
       {
         int patch_id = 0;
         int f_id_patch = 0;
@@ -2006,6 +1968,8 @@ void DetailSynthesis::doTransfer(std::shared_ptr<Model> src_model, std::shared_p
   ShapeUtility::computeSymmetry(tar_model);
   ShapeUtility::computeCurvature(tar_model);
   //ShapeUtility::computeSolidAngleCurvature(tar_model);
+  src_model->getFeatureCache()->flush();
+  tar_model->getFeatureCache()->flush();
 
   // 3. third do CCA, skip for now
 
@@ -2174,14 +2138,11 @@ void DetailSynthesis::doTransfer(std::shared_ptr<Model> src_model, std::shared_p
     }
   }
   std::cout << "re-compute feature map finished!\n";
-  cv::imwrite(tar_model->getOutputPath() + "/tar_feature1.png", tar_para_shape->feature_map[0] *255);
-  cv::imwrite(tar_model->getOutputPath() + "/tar_feature2.png", tar_para_shape->feature_map[1] *255);
-  cv::imwrite(tar_model->getOutputPath() + "/tar_feature3.png", tar_para_shape->feature_map[2] *255);
-  cv::imwrite(tar_model->getOutputPath() + "/tar_feature4.png", tar_para_shape->feature_map[3] *255);
-  cv::imwrite(src_model->getOutputPath() + "/src_feature1.png", src_para_shape->feature_map[0] *255);
-  cv::imwrite(src_model->getOutputPath() + "/src_feature2.png", src_para_shape->feature_map[1] *255);
-  cv::imwrite(src_model->getOutputPath() + "/src_feature3.png", src_para_shape->feature_map[2] *255);
-  cv::imwrite(src_model->getOutputPath() + "/src_feature4.png", src_para_shape->feature_map[3] *255);
+  for (int i = 0; i < 4; ++i)
+  {
+    DebugExporter::GetInstance()->writeScaled(DebugExporter::EXPORT_STAGE, tar_model->getOutputPath() + "/tar_feature" + std::to_string(i + 1) + ".png", tar_para_shape->feature_map[i], 255);
+    DebugExporter::GetInstance()->writeScaled(DebugExporter::EXPORT_STAGE, src_model->getOutputPath() + "/src_feature" + std::to_string(i + 1) + ".png", src_para_shape->feature_map[i], 255);
+  }
 
   // 5. do synthesis
   int transfer_finished = 0;
@@ -2220,6 +2181,14 @@ void DetailSynthesis::doTransfer(std::shared_ptr<Model> src_model, std::shared_p
     syn_tool->bias_rate = LG::GlobalParameterMgr::GetInstance()->get_parameter<double>("Synthesis:bias_rate");
     syn_tool->beta_func_center = LG::GlobalParameterMgr::GetInstance()->get_parameter<double>("Synthesis:beta_center");
     syn_tool->beta_func_mult = LG::GlobalParameterMgr::GetInstance()->get_parameter<double>("Synthesis:beta_mult");
+    syn_tool->use_parallel_nnf = LG::GlobalParameterMgr::GetInstance()->get_parameter<bool>("Synthesis:parallel_nnf");
+    syn_tool->benchmark_parallel_nnf = LG::GlobalParameterMgr::GetInstance()->get_parameter<bool>("Synthesis:benchmark_parallel_nnf");
+    syn_tool->use_vote_mode = LG::GlobalParameterMgr::GetInstance()->get_parameter<bool>("Synthesis:vote_mode");
+    syn_tool->nnf_tile_size = LG::GlobalParameterMgr::GetInstance()->get_parameter<int>("Synthesis:nnf_tile_size");
+    syn_tool->rand_seed = this->getRandomSeed();
+    syn_tool->use_window_search = LG::GlobalParameterMgr::GetInstance()->get_parameter<bool>("Synthesis:window_search");
+    syn_tool->use_candidate_index = LG::GlobalParameterMgr::GetInstance()->get_parameter<bool>("Synthesis:candidate_index");
+    syn_tool->ann_oversample = LG::GlobalParameterMgr::GetInstance()->get_parameter<int>("Synthesis:ann_oversample");
     //syn_tool->init(mesh_para->seen_part->feature_map, tar_para_shape->feature_map, mesh_para->seen_part->detail_map);
 
     std::ofstream paraOutput(tar_model->getOutputPath() + "/synpara.txt");
@@ -2233,10 +2202,19 @@ void DetailSynthesis::doTransfer(std::shared_ptr<Model> src_model, std::shared_p
       paraOutput << "bias rate: " << syn_tool->bias_rate << std::endl;
       paraOutput << "beta center: " << syn_tool->beta_func_center << std::endl;
       paraOutput << "beta mult: " << syn_tool->beta_func_mult << std::endl;
+      paraOutput << "parallel nnf: " << syn_tool->use_parallel_nnf << std::endl;
+      paraOutput << "vote mode: " << syn_tool->use_vote_mode << std::endl;
+      paraOutput << "random seed: " << syn_tool->rand_seed << std::endl;
+      paraOutput << "window search: " << syn_tool->use_window_search << std::endl;
+      paraOutput << "candidate index: " << syn_tool->use_candidate_index << " oversample " << syn_tool->ann_oversample << std::endl;
       paraOutput.close();
     }
 
     syn_tool->init(masked_src_feature_map, masked_tar_feature_map, masked_src_detail_map);
+    if (LG::GlobalParameterMgr::GetInstance()->get_parameter<bool>("Synthesis:benchmark_candidate_index"))
+    {
+      syn_tool->benchmarkCandidateIndex(syn_tool->levels - 1);
+    }
     syn_tool->doSynthesisNew();
 
     // 4. merge the detail map together
@@ -2704,6 +2682,7 @@ void DetailSynthesis::doGeometryTransfer(std::shared_ptr<Model> src_model, std::
       syn_tool->best_random_size = LG::GlobalParameterMgr::GetInstance()->get_parameter<int>("Synthesis:rand_size");
       syn_tool->lamd_occ = LG::GlobalParameterMgr::GetInstance()->get_parameter<double>("Synthesis:occ");
       syn_tool->bias_rate = LG::GlobalParameterMgr::GetInstance()->get_parameter<double>("Synthesis:bias_rate");
+      syn_tool->rand_seed = this->getRandomSeed();
       syn_tool->setExportPath(tar_model->getOutputPath());
       syn_tool->doNNFOptimization(masked_src_feature_map, masked_tar_feature_map);
 
@@ -3098,6 +3077,7 @@ void DetailSynthesis::generateD0Feature(AppearanceModel* app_mod, std::shared_pt
   ShapeUtility::computeNormalizedHeight(src_model);
   ShapeUtility::computeDirectionalOcclusion(src_model);
   ShapeUtility::computeSymmetry(src_model);
+  src_model->getFeatureCache()->flush();
   PolygonMesh* poly_mesh = src_model->getPolygonMesh();
   PolygonMesh::Vertex_attribute<Scalar> normalized_height = poly_mesh->vertex_attribute<Scalar>("v:NormalizedHeight");
   PolygonMesh::Vertex_attribute<STLVectorf> directional_occlusion = poly_mesh->vertex_attribute<STLVectorf>("v:DirectionalOcclusion");
@@ -3160,6 +3140,7 @@ void DetailSynthesis::generateD1Feature(AppearanceModel* app_mod, std::shared_pt
   ShapeUtility::computeSymmetry(src_model);
   //ShapeUtility::computeSolidAngleCurvature(src_model);
   ShapeUtility::computeCurvature(src_model);
+  src_model->getFeatureCache()->flush();
 
   PolygonMesh* poly_mesh = src_model->getPolygonMesh();
   PolygonMesh::Vertex_attribute<Scalar> normalized_height = poly_mesh->vertex_attribute<Scalar>("v:NormalizedHeight");
@@ -3214,10 +3195,12 @@ void DetailSynthesis::generateD1Feature(AppearanceModel* app_mod, std::shared_pt
   }
 
   cv::Mat cca_X_mat(count, feature_map.size(), CV_32FC1);
-  cv::Mat cca_Y_mat(count, detail_map.size(), CV_32FC1);
 
   std::cout << "n_filled = " << count << std::endl;
 
+  // one pass over the filled texels, the CCA only keeps the moments
+  CCASolver cca_solver(int(feature_map.size()), int(detail_map.size()));
+  std::vector<float> cca_y(detail_map.size(), 0);
   count = 0;
   std::vector<std::pair<int, int> > src_pos;
   for (int i = 0; i < resolution; i++)
@@ -3232,29 +3215,36 @@ void DetailSynthesis::generateD1Feature(AppearanceModel* app_mod, std::shared_pt
         }
         for (int k = 0; k < detail_map.size(); k++)
         {
-          cca_Y_mat.at<float>(count, k) = detail_map[k].at<float>(i, j);
+          cca_y[k] = detail_map[k].at<float>(i, j);
         }
+        cca_solver.addSample(cca_X_mat.ptr<float>(count), &cca_y[0]);
         ++count;
         src_pos.push_back(std::pair<int, int>(i, j));
       }
     }
   }
 
-  YMLHandler::saveToMat(src_model->getOutputPath(), "cca_X_mat.mat", cca_X_mat);
-  YMLHandler::saveToMat(src_model->getOutputPath(), "cca_Y_mat.mat", cca_Y_mat);
-
-  std::cout << std::endl << "Compute CCA from matlab" << std::endl;
-  system("pause");
-
-  cv::FileStorage fs3(src_model->getOutputPath() + "/cca_mat.xml", cv::FileStorage::READ);
   cv::Mat cca_mat;
-  fs3["cca_mat"] >> cca_mat;
+  std::vector<double> cca_correlation;
+  double cca_regularization = LG::GlobalParameterMgr::GetInstance()->get_parameter<double>("Synthesis:cca_regularization");
+  if (!cca_solver.solve(cca_regularization, cca_mat, cca_correlation))
+  {
+    std::cout << "CCA failed, D1 features are not projected." << std::endl;
+    src_model->updateShape(old_src_v_list);
+    return;
+  }
+  std::cout << "CCA correlation:";
+  for (size_t i = 0; i < cca_correlation.size(); ++i)
+  {
+    std::cout << " " << cca_correlation[i];
+  }
+  std::cout << std::endl;
 
   cv::Mat new_X = cca_X_mat * cca_mat;
   std::vector<float> cca_min;
   std::vector<float> cca_max;
   ImageUtility::centralizeMat(new_X, 0, cca_min, cca_max, false);
-  YMLHandler::saveToMat(src_model->getOutputPath(), "test.mat", new_X);
+  DebugExporter::GetInstance()->writeMat(DebugExporter::EXPORT_STAGE, src_model->getOutputPath(), "test.mat", new_X);
   feature_map.clear();
   feature_map.resize(new_X.cols);
   for (int i = 0; i < feature_map.size(); i++)
@@ -86,12 +86,18 @@ public:
   
   // Appearance Model based synthesis
   void setCurResolution(int res) { resolution = res; };
+  void setRandomSeed(unsigned int seed) { rand_seed = seed; has_rand_seed = true; };
+  unsigned int getRandomSeed(); // the seed set for this instance, "Synthesis:rand_seed" otherwise
   void debugSynthesisD0(std::string app_mod_path, std::shared_ptr<Model> tar_model);
   void debugSynthesisD1(std::string app_mod_path, std::shared_ptr<Model> tar_model);
   std::string runSynthesisD0(std::string app_mod_path, AppearanceModel* app_mod_tar, std::shared_ptr<Model> tar_model);
   void runSynthesisD1(std::string app_mod_path, AppearanceModel* app_mod_tar, std::shared_ptr<Model> tar_model);
   std::string synthesisD0(AppearanceModel* app_mod_src, AppearanceModel* app_mod_tar, std::shared_ptr<Model> tar_model);
   void synthesisD1(AppearanceModel* app_mod_src, AppearanceModel* app_mod_tar, std::shared_ptr<Model> tar_model);
+  // masks given explicitly (source and target in uv space), used without the ui
+  std::string synthesisD0(AppearanceModel* app_mod_src, AppearanceModel* app_mod_tar, std::shared_ptr<Model> tar_model, cv::Mat& src_mask, cv::Mat& tar_mask);
+  void synthesisD1(AppearanceModel* app_mod_src, AppearanceModel* app_mod_tar, std::shared_ptr<Model> tar_model, cv::Mat& src_mask, cv::Mat& tar_uv_mask, SynToolPtr src_tool = nullptr);
+  void prepareD1Source(AppearanceModel* app_mod_src, cv::Mat& src_mask, SynToolPtr src_tool);
   std::string applyD1Displacement(std::shared_ptr<Model> tar_model, cv::Mat& mask);
 
   // generate d1 from aligned for debug
@@ -116,6 +122,8 @@ private:
   std::vector<GLActor> actors;
   std::vector<GLActor> syn_actors;
   int resolution;
+  unsigned int rand_seed;
+  bool has_rand_seed;
   double normalize_max;
   std::vector<float> detail_min, detail_max;
   float displacement_min, displacement_max;
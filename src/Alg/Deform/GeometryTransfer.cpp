@@ -10,6 +10,7 @@
 #include "MoveConstraint.h"
 
 #include "KDTreeWrapper.h"
+#include "ParameterMgr.h"
 #include "obj_writer.h"
 
 #include <fstream>
@@ -105,16 +106,10 @@ std::string GeometryTransfer::transferDeformation(std::shared_ptr<Model> tar_mod
   move_constraint->setLamdMove(lamd_move);
 
   solver->initCholesky();
-  int max_iter = 20;
-  int cur_iter = 0;
-  do 
-  {
-    solver->runOneStep();
-    ++cur_iter;
-
-    std::cout << "The " << cur_iter << "th iteration finished" << std::endl;
-
-  } while (cur_iter < max_iter);
+  solver->max_iter = LG::GlobalParameterMgr::GetInstance()->get_parameter<int>("GeometryTransfer:max_iter");
+  solver->converge_tol = float(LG::GlobalParameterMgr::GetInstance()->get_parameter<double>("GeometryTransfer:converge_tol"));
+  solver->anderson_m = LG::GlobalParameterMgr::GetInstance()->get_parameter<int>("GeometryTransfer:anderson_m");
+  solver->solve();
 
   std::vector<float> new_vertex_list(solver->P_Opt.data(), solver->P_Opt.data() + solver->P_Opt.rows() * solver->P_Opt.cols());
 
@@ -207,16 +202,10 @@ void GeometryTransfer::transferDeformation(LG::PolygonMesh* tar_mesh, const std:
   move_constraint->setLamdMove(lamd_move);
 
   solver->initCholesky();
-  int max_iter = 20;
-  int cur_iter = 0;
-  do
-  {
-    solver->runOneStep();
-    ++cur_iter;
-
-    std::cout << "The " << cur_iter << "th iteration finished" << std::endl;
-
-  } while (cur_iter < max_iter);
+  solver->max_iter = LG::GlobalParameterMgr::GetInstance()->get_parameter<int>("GeometryTransfer:max_iter");
+  solver->converge_tol = float(LG::GlobalParameterMgr::GetInstance()->get_parameter<double>("GeometryTransfer:converge_tol"));
+  solver->anderson_m = LG::GlobalParameterMgr::GetInstance()->get_parameter<int>("GeometryTransfer:anderson_m");
+  solver->solve();
 
   std::vector<float> new_vertex_list(solver->P_Opt.data(), solver->P_Opt.data() + solver->P_Opt.rows() * solver->P_Opt.cols());
 
@@ -295,16 +284,10 @@ void GeometryTransfer::debugDeformation(std::shared_ptr<Model> tar_model)
   move_constraint->setLamdMove(5.0f);
 
   solver->initCholesky();
-  int max_iter = 20;
-  int cur_iter = 0;
-  do 
-  {
-    solver->runOneStep();
-    ++cur_iter;
-
-    std::cout << "The " << cur_iter << "th iteration finished" << std::endl;
-
-  } while (cur_iter < max_iter);
+  solver->max_iter = LG::GlobalParameterMgr::GetInstance()->get_parameter<int>("GeometryTransfer:max_iter");
+  solver->converge_tol = float(LG::GlobalParameterMgr::GetInstance()->get_parameter<double>("GeometryTransfer:converge_tol"));
+  solver->anderson_m = LG::GlobalParameterMgr::GetInstance()->get_parameter<int>("GeometryTransfer:anderson_m");
+  solver->solve();
 
   std::vector<float> new_vertex_list(solver->P_Opt.data(), solver->P_Opt.data() + solver->P_Opt.rows() * solver->P_Opt.cols());
 
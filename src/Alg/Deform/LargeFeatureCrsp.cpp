@@ -4,6 +4,9 @@
 #include "CurvesUtility.h"
 #include "ParameterMgr.h"
 
+#include <algorithm>
+#include <limits>
+
 void LargeFeatureCrsp::buildCrsp(std::map<CurvePt, CurvePt>& crsp)
 {
   // Build corresponding point pair between source curves and target curves
@@ -573,7 +576,11 @@ void LargeFeatureCrsp::refineCrsp(std::map<CurvePt, CrspCurvePt>& crsp_map_out,
   }
 
   crsp_map_out.clear();
-  std::vector<std::pair<int, int>> test_tar, test_src, test_path;
+  // observations and candidate hidden points of each source curve, the
+  // curves are decoded independently afterwards
+  std::vector<std::vector<CurvePt>> curves_test_src(n_src_curves.size());
+  std::vector<std::vector<CurvePt>> curves_test_tar(n_src_curves.size());
+  std::vector<std::vector<CurvePt>> curves_test_path(n_src_curves.size());
   std::set<std::pair<double, double>> src_pts;
   std::set<std::pair<double, double>>::iterator src_pts_it;
   /*test_src.clear();
@@ -581,8 +588,8 @@ void LargeFeatureCrsp::refineCrsp(std::map<CurvePt, CrspCurvePt>& crsp_map_out,
   std::set<int> tar_id_candidate;*/
   for(size_t i = 0; i < n_src_curves.size(); i ++)
   {
-    test_src.clear();
-    test_tar.clear();
+    std::vector<CurvePt>& test_src = curves_test_src[i];
+    std::vector<CurvePt>& test_tar = curves_test_tar[i];
     std::set<int> tar_id_candidate;
     for(size_t j = 0; j < n_src_curves[i].size(); j ++)
     {
@@ -660,17 +667,33 @@ void LargeFeatureCrsp::refineCrsp(std::map<CurvePt, CrspCurvePt>& crsp_map_out,
         }
       }
     }
-    if(test_tar.size() != 0)
+  }
+
+  CURVES hmm_source_curves, hmm_target_curves;
+  feature_model->NormalizedSourceCurves(hmm_source_curves);
+  feature_model->NormalizedTargetCurves(hmm_target_curves);
+  HMMParameters hmm_paras;
+  getHMMParameters(hmm_paras);
+#pragma omp parallel for schedule(dynamic)
+  for (int i = 0; i < int(n_src_curves.size()); ++i)
+  {
+    if(curves_test_tar[i].size() != 0)
     {
-      solveHMM(test_src, test_tar, test_path, false);
-      for(size_t j = 0; j < test_path.size(); j ++)
-      {
-        double2 diff = n_src_curves[test_src[j].first][test_src[j].second] - n_tar_curves[test_path[j].first][test_path[j].second];
-        double cur_score = sqrt(diff.x * diff.x + diff.y * diff.y);
-        cur_score = pow(feature_model->target_edges_sp_sl[test_path[j].first][test_path[j].second], paras[1]) / pow(cur_score + 0.0001, paras[2]);
-        cur_score *= pow(fabs(feature_model->src_avg_direction[test_src[j].first].dot(feature_model->sampled_target_curves_average_dir[test_path[j].first][test_path[j].second])), angle_weight) ;
-        crsp_map_out[CurvePt(test_src[j])] = CrspCurvePt(test_path[j], cur_score);
-      }
+      solveHMM(curves_test_src[i], curves_test_tar[i], curves_test_path[i], false, hmm_source_curves, hmm_target_curves, hmm_paras);
+    }
+  }
+
+  for(size_t i = 0; i < n_src_curves.size(); i ++)
+  {
+    std::vector<CurvePt>& test_src = curves_test_src[i];
+    std::vector<CurvePt>& test_path = curves_test_path[i];
+    for(size_t j = 0; j < test_path.size(); j ++)
+    {
+      double2 diff = n_src_curves[test_src[j].first][test_src[j].second] - n_tar_curves[test_path[j].first][test_path[j].second];
+      double cur_score = sqrt(diff.x * diff.x + diff.y * diff.y);
+      cur_score = pow(feature_model->target_edges_sp_sl[test_path[j].first][test_path[j].second], paras[1]) / pow(cur_score + 0.0001, paras[2]);
+      cur_score *= pow(fabs(feature_model->src_avg_direction[test_src[j].first].dot(feature_model->sampled_target_curves_average_dir[test_path[j].first][test_path[j].second])), angle_weight) ;
+      crsp_map_out[CurvePt(test_src[j])] = CrspCurvePt(test_path[j], cur_score);
     }
   }
   if (LG::GlobalParameterMgr::GetInstance()->get_parameter<int>("SField:crsp_type") == 2)
@@ -808,148 +831,158 @@ void LargeFeatureCrsp::refineCrsp(std::map<CurvePt, CrspCurvePt>& crsp_map_out,
 }
 
 
-void LargeFeatureCrsp::solveHMM(std::vector<std::pair<int, int>>& observations, std::vector<std::pair<int, int>>& hidden, std::vector<std::pair<int, int>>& path, bool is_source_hidden)
+void LargeFeatureCrsp::getHMMParameters(HMMParameters& paras)
 {
-  path.clear();
-  path.resize(observations.size());
+  paras.a = LG::GlobalParameterMgr::GetInstance()->get_parameter<double>("SField:a");
+  paras.b = LG::GlobalParameterMgr::GetInstance()->get_parameter<double>("SField:b");
+  paras.c = LG::GlobalParameterMgr::GetInstance()->get_parameter<double>("SField:c");
+  paras.d = LG::GlobalParameterMgr::GetInstance()->get_parameter<double>("SField:d");
+  paras.e = LG::GlobalParameterMgr::GetInstance()->get_parameter<double>("SField:e");
+  paras.beam_width = LG::GlobalParameterMgr::GetInstance()->get_parameter<int>("SField:hmm_beam_width");
+}
 
+void LargeFeatureCrsp::solveHMM(std::vector<std::pair<int, int>>& observations, std::vector<std::pair<int, int>>& hidden, std::vector<std::pair<int, int>>& path, bool is_source_hidden)
+{
   CURVES source_curves, target_curves;
   this->feature_model->NormalizedSourceCurves(source_curves);
   this->feature_model->NormalizedTargetCurves(target_curves);
 
-  std::vector<double> paras(3, 0);
-  paras[1] = LG::GlobalParameterMgr::GetInstance()->get_parameter<double>("SField:a");
-  paras[2] = LG::GlobalParameterMgr::GetInstance()->get_parameter<double>("SField:b");
-  double para_c = LG::GlobalParameterMgr::GetInstance()->get_parameter<double>("SField:c");
-  double para_d = LG::GlobalParameterMgr::GetInstance()->get_parameter<double>("SField:d");
-  double para_e = LG::GlobalParameterMgr::GetInstance()->get_parameter<double>("SField:e");
+  HMMParameters paras;
+  getHMMParameters(paras);
+  solveHMM(observations, hidden, path, is_source_hidden, source_curves, target_curves, paras);
+}
+
+void LargeFeatureCrsp::solveHMM(const std::vector<CurvePt>& observations, const std::vector<CurvePt>& hidden, std::vector<CurvePt>& path, bool is_source_hidden,
+  const CURVES& source_curves, const CURVES& target_curves, const HMMParameters& paras)
+{
+  // Viterbi decoding of the hidden point of each observation. Costs are
+  // negative log probabilities: the emission cost of a hidden point is
+  // 0.5 / score^2 of the pair, the transition cost from hidden k to hidden j
+  // penalizes the step k->j differing from the observation step in length
+  // and in direction. Only the beam_width cheapest states of a step are
+  // expanded as predecessors of the next one, the path is recovered from
+  // backpointers.
+  path.clear();
+  int n_obs = int(observations.size());
+  int n_hidden = int(hidden.size());
+  if (n_obs == 0 || n_hidden == 0)
+  {
+    return;
+  }
+
+  const CURVES& observation_curves = is_source_hidden ? target_curves : source_curves;
+  const CURVES& hidden_curves = is_source_hidden ? source_curves : target_curves;
 
-  std::vector<std::vector<double>> probability_score;
-  probability_score.resize(observations.size());
-  double max = std::numeric_limits<double>::min();
-  for(size_t i = 0; i < observations.size(); i ++)
+  // emission costs, n_obs x n_hidden
+  std::vector<double> emission(size_t(n_obs) * n_hidden);
+#pragma omp parallel for schedule(static)
+  for (int i = 0; i < n_obs; ++i)
   {
-    for(size_t j = 0; j < hidden.size(); j ++)
+    for (int j = 0; j < n_hidden; ++j)
     {
-      double cur_score;
-      double angle;
-      double2 diff;
-      if(is_source_hidden)
-      {
-        diff = target_curves[observations[i].first][observations[i].second] - source_curves[hidden[j].first][hidden[j].second];
-        paras[0] = feature_model->target_edges_sp_sl[observations[i].first][observations[i].second];
-        //angle = fabs(feature_model->src_avg_direction[hidden[j].first].dot(feature_model->tar_avg_direction[observations[i].first])) ;
-        angle = fabs(feature_model->src_avg_direction[hidden[j].first].dot(feature_model->sampled_target_curves_average_dir[observations[i].first][observations[i].second])) ;
-      }
-      else
-      {
-        diff = target_curves[hidden[j].first][hidden[j].second] - source_curves[observations[i].first][observations[i].second];
-        paras[0] = feature_model->target_edges_sp_sl[hidden[j].first][hidden[j].second];
-        //angle = fabs(feature_model->src_avg_direction[observations[i].first].dot(feature_model->tar_avg_direction[hidden[j].first])) ;
-        angle = fabs(feature_model->src_avg_direction[observations[i].first].dot(feature_model->sampled_target_curves_average_dir[hidden[j].first][hidden[j].second])) ;
-      }
-      cur_score = sqrt(diff.x * diff.x + diff.y * diff.y);
-      cur_score = pow(paras[0], paras[1]) / pow(cur_score + 0.0001, paras[2]);
-      cur_score *= pow(angle, para_c);
-      //probability_score[i].push_back(exp((-0.5) * pow((1 / cur_score), 2))); // the computation method can be modified
-      //probability_score[i].push_back(cur_score);
-      double cur_pow_score = (0.5) * pow((1 / cur_score), 2);
-      probability_score[i].push_back(cur_pow_score);
-      /*if (cur_pow_score > max)
-      {
-          max = cur_pow_score;
-      }*/
+      const CurvePt& tar_pt = is_source_hidden ? observations[i] : hidden[j];
+      const CurvePt& src_pt = is_source_hidden ? hidden[j] : observations[i];
+      double diff_x = target_curves[tar_pt.first][tar_pt.second].x - source_curves[src_pt.first][src_pt.second].x;
+      double diff_y = target_curves[tar_pt.first][tar_pt.second].y - source_curves[src_pt.first][src_pt.second].y;
+      double angle = fabs(feature_model->src_avg_direction[src_pt.first].dot(feature_model->sampled_target_curves_average_dir[tar_pt.first][tar_pt.second]));
+      double cur_score = sqrt(diff_x * diff_x + diff_y * diff_y);
+      cur_score = pow(feature_model->target_edges_sp_sl[tar_pt.first][tar_pt.second], paras.a) / pow(cur_score + 0.0001, paras.b);
+      cur_score *= pow(angle, paras.c);
+      emission[size_t(i) * n_hidden + j] = (0.5) * pow((1 / cur_score), 2);
     }
   }
 
+  // hidden points side by side, the transition cost is evaluated from these
+  std::vector<double> hidden_x(n_hidden), hidden_y(n_hidden);
+  for (int j = 0; j < n_hidden; ++j)
+  {
+    hidden_x[j] = hidden_curves[hidden[j].first][hidden[j].second].x;
+    hidden_y[j] = hidden_curves[hidden[j].first][hidden[j].second].y;
+  }
+  double min_mag = is_source_hidden ? 1e-4 : 1e-9;
+  int beam_width = (paras.beam_width <= 0 || paras.beam_width > n_hidden) ? n_hidden : paras.beam_width;
 
-  std::vector<std::vector<std::pair<int, int>>> candidate_path;
-  std::vector<double> probability;
-  candidate_path.resize(hidden.size());
-  probability.resize(hidden.size());
-  for(size_t i = 0; i < observations.size(); i ++)
+  std::vector<double> cost(emission.begin(), emission.begin() + n_hidden);
+  std::vector<int> back_pointer(size_t(n_obs) * n_hidden, 0);
+  std::vector<int> beam(n_hidden);
+  std::vector<double> beam_x(n_hidden), beam_y(n_hidden), beam_cost(n_hidden), pruning_key(n_hidden);
+  std::vector<double> new_cost(n_hidden);
+  for (int i = 1; i < n_obs; ++i)
   {
-    if(i == 0)
+    // predecessors of this step in increasing hidden order, so that ties
+    // resolve as in a full scan
+    for (int j = 0; j < n_hidden; ++j) beam[j] = j;
+    int n_beam = n_hidden;
+    if (beam_width < n_hidden)
     {
-      for(size_t j = 0; j < hidden.size(); j ++)
-      {
-        probability[j] = probability_score[i][j];
-        candidate_path[j].push_back(hidden[j]);
-      }
+      for (int j = 0; j < n_hidden; ++j) pruning_key[j] = (cost[j] == cost[j]) ? cost[j] : std::numeric_limits<double>::max();
+      std::nth_element(beam.begin(), beam.begin() + beam_width, beam.end(),
+        [&pruning_key](int l, int r) { return pruning_key[l] < pruning_key[r] || (pruning_key[l] == pruning_key[r] && l < r); });
+      n_beam = beam_width;
+      std::sort(beam.begin(), beam.begin() + n_beam);
     }
-    else
+    for (int k = 0; k < n_beam; ++k)
+    {
+      beam_x[k] = hidden_x[beam[k]];
+      beam_y[k] = hidden_y[beam[k]];
+      beam_cost[k] = cost[beam[k]];
+    }
+
+    const CurvePt& cur_obs = observations[i];
+    const CurvePt& last_obs = observations[i - 1];
+    double obs_x = observation_curves[cur_obs.first][cur_obs.second].x - observation_curves[last_obs.first][last_obs.second].x;
+    double obs_y = observation_curves[cur_obs.first][cur_obs.second].y - observation_curves[last_obs.first][last_obs.second].y;
+    double obs_len2 = obs_x * obs_x + obs_y * obs_y;
+    double obs_len = sqrt(obs_len2);
+
+    const double* cur_emission = &emission[size_t(i) * n_hidden];
+    int* cur_back_pointer = &back_pointer[size_t(i) * n_hidden];
+#pragma omp parallel for schedule(static)
+    for (int j = 0; j < n_hidden; ++j)
     {
-      std::vector<std::vector<std::pair<int, int>>> newest_candidate_path;
-      newest_candidate_path.resize(hidden.size());
-      std::vector<double> newest_probability;
-      newest_probability.resize(hidden.size());
-      for(size_t j = 0; j < hidden.size(); j ++)
+      int best_path = beam[0];
+      double best_path_probability = std::numeric_limits<double>::max();
+      for (int k = 0; k < n_beam; ++k)
       {
-        size_t best_path = 0;
-        //double best_path_probability = std::numeric_limits<double>::min();
-        double best_path_probability = std::numeric_limits<double>::max();
-        for(size_t k = 0; k < hidden.size(); k ++)
+        double hidden_diff_x = hidden_x[j] - beam_x[k];
+        double hidden_diff_y = hidden_y[j] - beam_y[k];
+        double hidden_len2 = hidden_diff_x * hidden_diff_x + hidden_diff_y * hidden_diff_y;
+        double length_ratio = hidden_len2 / obs_len2;
+        double cos_penalty = hidden_diff_x * obs_x + hidden_diff_y * obs_y;
+        double mag = sqrt(hidden_len2) * obs_len;
+        if (mag < min_mag) cos_penalty = 0;
+        else cos_penalty = cos_penalty / mag;
+        double length_term = (length_ratio - 1) / paras.d;
+        double cos_term = (cos_penalty - 1) / paras.e;
+        double probability_continuity_k2j = 0.5 * (length_term * length_term) + 0.5 * (cos_term * cos_term);
+        double cur_probability = beam_cost[k] + probability_continuity_k2j + cur_emission[j];
+        if (cur_probability < best_path_probability)
         {
-          double probability_continuity_k2j;
-          double2 hidden_diff, observation_diff;
-          if(is_source_hidden)
-          {
-            observation_diff = target_curves[observations[i].first][observations[i].second] - target_curves[observations[i - 1].first][observations[i - 1].second];
-            hidden_diff = source_curves[hidden[j].first][hidden[j].second] - source_curves[hidden[k].first][hidden[k].second];
-            probability_continuity_k2j = (hidden_diff.x * hidden_diff.x + hidden_diff.y * hidden_diff.y) / (observation_diff.x * observation_diff.x + observation_diff.y * observation_diff.y);
-            //probability_continuity_k2j = exp(-0.5 * pow((probability_continuity_k2j - 1) / 0.05, 2));
-            //probability_continuity_k2j = 1;
-            double cos_penalty = (hidden_diff.x * observation_diff.x + hidden_diff.y * observation_diff.y);
-            double mag = hidden_diff.norm() * observation_diff.norm();
-            if (mag < 1e-4) cos_penalty = 0;
-            else cos_penalty = cos_penalty / mag ;
-			probability_continuity_k2j = 0.5 * pow((probability_continuity_k2j - 1) / para_d, 2) + 0.5 * pow((cos_penalty - 1) / para_e, 2);
-          }
-          else
-          {
-            hidden_diff = target_curves[hidden[j].first][hidden[j].second] - target_curves[hidden[k].first][hidden[k].second];
-            observation_diff = source_curves[observations[i].first][observations[i].second] - source_curves[observations[i - 1].first][observations[i - 1].second];
-            probability_continuity_k2j = (hidden_diff.x * hidden_diff.x + hidden_diff.y * hidden_diff.y) / (observation_diff.x * observation_diff.x + observation_diff.y * observation_diff.y);
-            //probability_continuity_k2j = exp(-0.5 * pow((probability_continuity_k2j - 1) / 0.05, 2));
-            //probability_continuity_k2j = 1;
-            double cos_penalty = (hidden_diff.x * observation_diff.x + hidden_diff.y * observation_diff.y);
-            double mag = hidden_diff.norm() * observation_diff.norm();
-            if (mag < 1e-9) cos_penalty = 0;
-            else cos_penalty = cos_penalty / mag ;
-			probability_continuity_k2j = 0.5 * pow((probability_continuity_k2j - 1) / para_d, 2) + 0.5 * pow((cos_penalty - 1) / para_e, 2);
-          }
-          if((probability[k] + probability_continuity_k2j + probability_score[i][j]) < best_path_probability)
-          {
-            best_path_probability = probability[k] + probability_continuity_k2j + probability_score[i][j];
-            best_path = k;
-          }
+          best_path_probability = cur_probability;
+          best_path = beam[k];
         }
-        newest_candidate_path[j] = (candidate_path[best_path]);
-        newest_candidate_path[j].push_back(hidden[j]);
-        newest_probability[j] = best_path_probability;
-      }
-      for(size_t j = 0; j < candidate_path.size(); j ++)
-      {
-        candidate_path[j] = newest_candidate_path[j];
-        probability[j] = newest_probability[j];
-        /*if(probability[j] == std::numeric_limits<double>::max())
-        {
-          std::cout << "" << std::endl;
-        }*/
       }
+      new_cost[j] = best_path_probability;
+      cur_back_pointer[j] = best_path;
     }
+    cost.swap(new_cost);
   }
 
-  //double max_probability = std::numeric_limits<double>::min();
+  int path_id = 0;
   double max_probability = std::numeric_limits<double>::max();
-  size_t path_id;
-  for(size_t i = 0; i < probability.size(); i ++)
+  for (int j = 0; j < n_hidden; ++j)
   {
-    if(probability[i] < max_probability)
+    if (cost[j] < max_probability)
     {
-      max_probability = probability[i];
-      path_id = i;
+      max_probability = cost[j];
+      path_id = j;
     }
   }
-  path = candidate_path[path_id];
+
+  path.resize(n_obs);
+  for (int i = n_obs - 1; i >= 0; --i)
+  {
+    path[i] = hidden[path_id];
+    path_id = back_pointer[size_t(i) * n_hidden + path_id];
+  }
 }
@@ -24,6 +24,16 @@ public:
   void buildCrsp(std::map<CurvePt, CurvePt>& crsp, CURVES& curves_in);
   void solveHMM(std::vector<std::pair<int, int>>& observations, std::vector<std::pair<int, int>>& hidden, std::vector<std::pair<int, int>>& path, bool is_source_hidden);
 
+private:
+  struct HMMParameters
+  {
+    double a, b, c, d, e; // SField:a to SField:e
+    int beam_width;       // states kept as predecessors per step, 0 keeps all (exact Viterbi)
+  };
+  void getHMMParameters(HMMParameters& paras);
+  void solveHMM(const std::vector<CurvePt>& observations, const std::vector<CurvePt>& hidden, std::vector<CurvePt>& path, bool is_source_hidden,
+    const CURVES& source_curves, const CURVES& target_curves, const HMMParameters& paras);
+
 private:
   FeatureGuided* feature_model;
 
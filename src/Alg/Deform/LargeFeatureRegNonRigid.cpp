@@ -117,6 +117,9 @@ void LargeFeatureReg::updateScalarFieldGrad(const std::vector<double>& X, std::v
       double2 n_curve_pt = (double2(v_proj[0] / v_proj[3], v_proj[1] / v_proj[3]) + feature_model->curve_translate - double2(0.5, 0.5)) * feature_model->curve_scale + double2(0.5, 0.5);
       double field_grad_x, field_grad_y, field_value;
       feature_model->target_scalar_field->getDistanceMapGrad(n_curve_pt, field_grad_x, field_grad_y, field_value);
+      // d(n_curve_pt)/d(proj) = curve_scale
+      field_grad_x *= feature_model->curve_scale;
+      field_grad_y *= feature_model->curve_scale;
       grad[3 * vid + 0] += (field_grad_x * (v_proj[3] * vpPMV_mat(0, 0) - v_proj[0] * vpPMV_mat(3, 0)) / (v_proj[3] * v_proj[3])
                         + field_grad_y * (v_proj[3] * vpPMV_mat(1, 0) - v_proj[1] * vpPMV_mat(3, 0)) / (v_proj[3] * v_proj[3])) * 2 * field_value;
       grad[3 * vid + 1] += (field_grad_x * (v_proj[3] * vpPMV_mat(0, 1) - v_proj[0] * vpPMV_mat(3, 1)) / (v_proj[3] * v_proj[3])
@@ -62,26 +62,24 @@ void ARAP::initConstraint(LG::PolygonMesh* poly_mesh)
       int vj = poly_mesh->to_vertex(hevc).idx();
       double wij = laplacian_cot[poly_mesh->edge(hevc)];
 
-      weight_list.push_back(Triplet(3 * i + 0, 3 * vj + 0, wij));
-      weight_list.push_back(Triplet(3 * i + 1, 3 * vj + 1, wij));
-      weight_list.push_back(Triplet(3 * i + 2, 3 * vj + 2, wij));
+      weight_list.push_back(Triplet(i, vj, wij));
 
       wi += (float)wij;
     }
 
-    weight_sum_list.push_back(Triplet(3 * i + 0, 3 * i + 0, wi));
-    weight_sum_list.push_back(Triplet(3 * i + 1, 3 * i + 1, wi));
-    weight_sum_list.push_back(Triplet(3 * i + 2, 3 * i + 2, wi));
+    weight_sum_list.push_back(Triplet(i, i, wi));
   }
 
   SparseMatrix Weight_sum_matrx;
-  Weight_sum_matrx.resize(3*P_Num, 3*P_Num);
+  Weight_sum_matrx.resize(P_Num, P_Num);
   Weight_sum_matrx.setFromTriplets(weight_sum_list.begin(), weight_sum_list.end());
 
-  Weight_matrix.resize(3*P_Num, 3*P_Num);
+  Weight_matrix.resize(P_Num, P_Num);
   Weight_matrix.setFromTriplets(weight_list.begin(), weight_list.end());
 
   L_matrix = Weight_sum_matrx - Weight_matrix;
+
+  this->buildNeighborTable();
 }
 
 void ARAP::initConstraint(VertexList& vertex_list, FaceList& face_list, AdjList& adj_list)
@@ -138,26 +136,45 @@ void ARAP::buildLaplacianMatrix()
       }
       else wij = computeWij(&P_vec.data()[3*i], &P_vec.data()[3*id_j], &P_vec.data()[3*share_vertex[0]]);
 
-      weight_list.push_back(Triplet(3 * i + 0, 3 * id_j + 0, wij));
-      weight_list.push_back(Triplet(3 * i + 1, 3 * id_j + 1, wij));
-      weight_list.push_back(Triplet(3 * i + 2, 3 * id_j + 2, wij));
+      weight_list.push_back(Triplet(i, id_j, wij));
 
       wi += wij;
     }
 
-    weight_sum_list.push_back(Triplet(3 * i + 0, 3 * i + 0, wi));
-    weight_sum_list.push_back(Triplet(3 * i + 1, 3 * i + 1, wi));
-    weight_sum_list.push_back(Triplet(3 * i + 2, 3 * i + 2, wi));
+    weight_sum_list.push_back(Triplet(i, i, wi));
   }
 
   SparseMatrix Weight_sum_matrx;
-  Weight_sum_matrx.resize(3*P_Num, 3*P_Num);
+  Weight_sum_matrx.resize(P_Num, P_Num);
   Weight_sum_matrx.setFromTriplets(weight_sum_list.begin(), weight_sum_list.end());
 
-  Weight_matrix.resize(3*P_Num, 3*P_Num);
+  Weight_matrix.resize(P_Num, P_Num);
   Weight_matrix.setFromTriplets(weight_list.begin(), weight_list.end());
 
   L_matrix = Weight_sum_matrx - Weight_matrix;
+
+  this->buildNeighborTable();
+}
+
+void ARAP::buildNeighborTable()
+{
+  adj_offset.resize(P_Num + 1);
+  adj_offset[0] = 0;
+  for (int i = 0; i < P_Num; ++i)
+  {
+    adj_offset[i + 1] = adj_offset[i] + (int)adj_list[i].size();
+  }
+
+  adj_index.resize(adj_offset[P_Num]);
+  adj_weight.resize(adj_offset[P_Num]);
+  for (int i = 0; i < P_Num; ++i)
+  {
+    for (size_t j = 0; j < adj_list[i].size(); ++j)
+    {
+      adj_index[adj_offset[i] + j] = adj_list[i][j];
+      adj_weight[adj_offset[i] + j] = Weight_matrix.coeff(i, adj_list[i][j]);
+    }
+  }
 }
 
 void ARAP::findShareVertex(int pi, int pj, STLVectori& share_vertex)
@@ -208,40 +225,72 @@ void ARAP::projection()
 
 void ARAP::updateRi()
 {
-  Matrix3f Si;
-  MatrixXf Di;
-  Matrix3Xf Pi_Prime;
-  Matrix3Xf Pi;
-  for (int i = 0; i != P_Num; ++i)
+  // Si = sum_j wij * (pi - pj) * (pi' - pj')^T, accumulated in place for a batch of
+  // vertices and then decomposed together, one vertex per SIMD lane of the SVD kernel
+  const float* P = P_vec.data();
+  const float* P_Opt = solver->P_Opt.data();
+  int n_batch = (P_Num + WUNDER_SVD_BATCH - 1) / WUNDER_SVD_BATCH;
+  int n_negative = 0;
+
+#pragma omp parallel for schedule(static) reduction(+:n_negative)
+  for (int batch = 0; batch < n_batch; ++batch)
   {
-    Di = MatrixXf::Zero(adj_list[i].size(), adj_list[i].size());
-    Pi_Prime.resize(3, adj_list[i].size());
-    Pi.resize(3, adj_list[i].size());
-    // if there is not any single unconnected point this for loop can have a more efficient representation
-    for (decltype(adj_list[i].size()) j = 0; j != adj_list[i].size(); ++j)
+    float a[9][WUNDER_SVD_BATCH], u[9][WUNDER_SVD_BATCH], s[3][WUNDER_SVD_BATCH], v[9][WUNDER_SVD_BATCH];
+    for (int lane = 0; lane < WUNDER_SVD_BATCH; ++lane)
     {
-      Di(j, j) = Weight_matrix.coeffRef(3 * i, 3 * adj_list[i][j]);
-
-      Pi.col(j) = Vector3f(P_vec[3 * i + 0] - P_vec[3 * adj_list[i][j] + 0],
-                           P_vec[3 * i + 1] - P_vec[3 * adj_list[i][j] + 1],
-                           P_vec[3 * i + 2] - P_vec[3 * adj_list[i][j] + 2]);
-      
-      Pi_Prime.col(j) = Vector3f(solver->P_Opt[3 * i + 0] - solver->P_Opt[3 * adj_list[i][j] + 0],
-                                 solver->P_Opt[3 * i + 1] - solver->P_Opt[3 * adj_list[i][j] + 1],
-                                 solver->P_Opt[3 * i + 2] - solver->P_Opt[3 * adj_list[i][j] + 2]);
+      int i = batch * WUNDER_SVD_BATCH + lane;
+      float Si[9] = { 0, 0, 0, 0, 0, 0, 0, 0, 0 }; // column major
+      if (i < P_Num)
+      {
+        for (int k = adj_offset[i]; k < adj_offset[i + 1]; ++k)
+        {
+          int j = adj_index[k];
+          float w = adj_weight[k];
+          float e[3] = { P[3 * i + 0] - P[3 * j + 0], P[3 * i + 1] - P[3 * j + 1], P[3 * i + 2] - P[3 * j + 2] };
+          float e_opt[3] = { P_Opt[3 * i + 0] - P_Opt[3 * j + 0], P_Opt[3 * i + 1] - P_Opt[3 * j + 1], P_Opt[3 * i + 2] - P_Opt[3 * j + 2] };
+          for (int col = 0; col < 3; ++col)
+          {
+            float we = w * e_opt[col];
+            Si[3 * col + 0] += e[0] * we;
+            Si[3 * col + 1] += e[1] * we;
+            Si[3 * col + 2] += e[2] * we;
+          }
+        }
+      }
+      else
+      {
+        // padding lane
+        Si[0] = Si[4] = Si[8] = 1.0f;
+      }
+      for (int k = 0; k < 9; ++k) a[k][lane] = Si[k];
     }
-    Si = Pi * Di * Pi_Prime.transpose();
-    Matrix3f Ui;
-    Vector3f Wi;
-    Matrix3f Vi;
-    wunderSVD3x3(Si, Ui, Wi, Vi);
-    R[i] = Vi * Ui.transpose();
-
-    if (R[i].determinant() < 0)
+
+    wunderSVD3x3Batch(a, u, s, v);
+
+    for (int lane = 0; lane < WUNDER_SVD_BATCH; ++lane)
     {
-      std::cout << "determinant is negative!" << std::endl;
+      int i = batch * WUNDER_SVD_BATCH + lane;
+      if (i >= P_Num) break;
+
+      Matrix3f Ui, Vi;
+      for (int col = 0; col < 3; ++col)
+      {
+        for (int row = 0; row < 3; ++row)
+        {
+          Ui(row, col) = u[3 * col + row][lane];
+          Vi(row, col) = v[3 * col + row][lane];
+        }
+      }
+      R[i] = Vi * Ui.transpose();
+
+      if (R[i].determinant() < 0) ++n_negative;
     }
   }
+
+  if (n_negative > 0)
+  {
+    std::cout << "determinant is negative! " << n_negative << " vertices" << std::endl;
+  }
 }
 
 void ARAP::update()
@@ -252,16 +301,21 @@ void ARAP::update()
 
 void ARAP::updatedvec()
 {
-  Eigen::Matrix3Xf d = Eigen::Matrix3Xf::Zero(3, P_Num);
-  for (int i = 0; i != P_Num; ++i)
+  d_vec.resize(3 * P_Num);
+  const float* P = P_vec.data();
+  float* d = d_vec.data();
+
+  // every vertex only writes its own 3 entries
+#pragma omp parallel for schedule(static)
+  for (int i = 0; i < P_Num; ++i)
   {
-    // if there is not any single unconnected point this for loop can have a more efficient representation
-    for (decltype(adj_list[i].size()) j = 0; j != adj_list[i].size(); ++j)
+    Vector3f di(0, 0, 0);
+    for (int k = adj_offset[i]; k < adj_offset[i + 1]; ++k)
     {
-      Vector3f P_diff;
-      P_diff << P_vec[3 * i + 0] - P_vec[3 * adj_list[i][j] + 0],
-                P_vec[3 * i + 1] - P_vec[3 * adj_list[i][j] + 1],
-                P_vec[3 * i + 2] - P_vec[3 * adj_list[i][j] + 2];
+      int j = adj_index[k];
+      Vector3f P_diff(P[3 * i + 0] - P[3 * j + 0],
+                      P[3 * i + 1] - P[3 * j + 1],
+                      P[3 * i + 2] - P[3 * j + 2]);
 
       // TODO: try to make the scale possible ?
       //Vector3f P_Opt_diff;
@@ -270,11 +324,12 @@ void ARAP::updatedvec()
       //              solver->P_Opt[3 * i + 2] - solver->P_Opt[3 * adj_list[i][j] + 2];
       //float scale = P_Opt_diff.norm() / P_diff.norm();
 
-      d.col(i) += (Weight_matrix.coeffRef(3 * i, 3 * adj_list[i][j]) / 2) * (R[i] + R[adj_list[i][j]]) * P_diff;
+      di += (adj_weight[k] / 2) * ((R[i] + R[j]) * P_diff);
     }
+    d[3 * i + 0] = di[0];
+    d[3 * i + 1] = di[1];
+    d[3 * i + 2] = di[2];
   }
-
-  d_vec = Eigen::Map<VectorXf>(d.data(), 3 * P_Num, 1);
 }
 
 void ARAP::getRightHand(VectorXf& right_hand)
@@ -284,7 +339,34 @@ void ARAP::getRightHand(VectorXf& right_hand)
 
 void ARAP::getLinearSys(SparseMatrix& linear_sys)
 {
-  linear_sys = this->lamd_ARAP * this->L_matrix;
+  expandCoordBlock(this->lamd_ARAP * this->L_matrix, linear_sys);
+}
+
+void ARAP::getLinearSysBlock(SparseMatrix& linear_sys_block)
+{
+  linear_sys_block = this->lamd_ARAP * this->L_matrix;
+}
+
+float ARAP::getEnergy()
+{
+  // 1/4 sum_i sum_j wij * |(pi' - pj') - Ri * (pi - pj)|^2, every edge is seen from both ends
+  const float* P = P_vec.data();
+  const float* P_Opt = solver->P_Opt.data();
+  double energy = 0.0;
+
+#pragma omp parallel for schedule(static) reduction(+:energy)
+  for (int i = 0; i < P_Num; ++i)
+  {
+    for (int k = adj_offset[i]; k < adj_offset[i + 1]; ++k)
+    {
+      int j = adj_index[k];
+      Vector3f e(P[3 * i + 0] - P[3 * j + 0], P[3 * i + 1] - P[3 * j + 1], P[3 * i + 2] - P[3 * j + 2]);
+      Vector3f e_opt(P_Opt[3 * i + 0] - P_Opt[3 * j + 0], P_Opt[3 * i + 1] - P_Opt[3 * j + 1], P_Opt[3 * i + 2] - P_Opt[3 * j + 2]);
+      energy += 0.25 * adj_weight[k] * (e_opt - R[i] * e).squaredNorm();
+    }
+  }
+
+  return this->lamd_ARAP * float(energy);
 }
 
 void ARAP::setSolver(std::shared_ptr<Solver> solver)
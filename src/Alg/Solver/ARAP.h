@@ -20,6 +20,9 @@ public:
   virtual void projection();
   virtual void getRightHand(VectorXf& right_hand);
   virtual void getLinearSys(SparseMatrix& linear_sys);
+  virtual bool isCoordDecoupled() { return true; };
+  virtual void getLinearSysBlock(SparseMatrix& linear_sys_block);
+  virtual float getEnergy();
   virtual void setSolver(std::shared_ptr<Solver> solver);
 
   void initConstraint(VertexList& vertex_list, FaceList& face_list, AdjList& adj_list);
@@ -37,12 +40,14 @@ private:
   void updateRi();
   // update d vec
   void updatedvec();
+  // flatten adj_list and the weights into CSR arrays, after Weight_matrix is built
+  void buildNeighborTable();
 
 private:
   float lamd_ARAP;
   int P_Num;
 
-  SparseMatrix L_matrix;
+  SparseMatrix L_matrix; // N x N, the same for x, y and z
   SparseMatrix Weight_matrix;
   VectorXf d_vec;
   VectorXf P_vec;
@@ -50,6 +55,12 @@ private:
   std::vector<Vector3i> triangle_list; // sorted
   std::vector<Matrix3f> R;
 
+  // neighbors of vertex i are adj_index[adj_offset[i]] ~ adj_index[adj_offset[i + 1] - 1]
+  // adj_weight is the same entry of Weight_matrix, no sparse lookup in the local step
+  STLVectori adj_offset;
+  STLVectori adj_index;
+  STLVectorf adj_weight;
+
 
   std::shared_ptr<Solver> solver;
 
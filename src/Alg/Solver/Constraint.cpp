@@ -9,4 +9,40 @@ Constraint::Constraint()
 Constraint::~Constraint()
 {
 
+}
+
+void Constraint::expandCoordBlock(const SparseMatrix& block, SparseMatrix& linear_sys)
+{
+  TripletList triplets;
+  triplets.reserve(3 * block.nonZeros());
+  for (int k = 0; k < block.outerSize(); ++k)
+  {
+    for (SparseMatrix::InnerIterator it(block, k); it; ++it)
+    {
+      triplets.push_back(Triplet(3 * it.row() + 0, 3 * it.col() + 0, it.value()));
+      triplets.push_back(Triplet(3 * it.row() + 1, 3 * it.col() + 1, it.value()));
+      triplets.push_back(Triplet(3 * it.row() + 2, 3 * it.col() + 2, it.value()));
+    }
+  }
+  linear_sys.resize(3 * block.rows(), 3 * block.cols());
+  linear_sys.setFromTriplets(triplets.begin(), triplets.end());
+}
+
+float Constraint::targetEnergy(const SparseMatrix& block, const VectorXf& p, const VectorXf& t)
+{
+  float energy = 0.0f;
+  for (int k = 0; k < block.outerSize(); ++k)
+  {
+    for (SparseMatrix::InnerIterator it(block, k); it; ++it)
+    {
+      if (it.row() != it.col()) continue;
+
+      int v_id = int(it.row());
+      Vector3f diff(p[3 * v_id + 0] - t[3 * v_id + 0],
+                    p[3 * v_id + 1] - t[3 * v_id + 1],
+                    p[3 * v_id + 2] - t[3 * v_id + 2]);
+      energy += 0.5f * it.value() * diff.squaredNorm();
+    }
+  }
+  return energy;
 }
\ No newline at end of file
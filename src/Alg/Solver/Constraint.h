@@ -45,6 +45,25 @@ public:
   virtual void getLinearSys(SparseMatrix& linear_sys) = 0;
   virtual void setSolver(std::shared_ptr<Solver> solver) = 0;
 
+  // a constraint whose linear system treats x, y and z the same way returns
+  // true and gives the N x N block, the 3N x 3N system is the block on each
+  // coordinate. if all constraints do, the solver only factorizes the block.
+  // constraints coupling the coordinates keep the default.
+  virtual bool isCoordDecoupled() { return false; };
+  virtual void getLinearSysBlock(SparseMatrix& linear_sys_block) {};
+
+  // energy at solver->P_Opt with the current projection, called after
+  // projection() and update(). the solver uses it to detect convergence,
+  // constraints that don't implement it count as 0
+  virtual float getEnergy() { return 0.0f; };
+
+protected:
+  // block (N x N) -> interleaved 3N x 3N system
+  static void expandCoordBlock(const SparseMatrix& block, SparseMatrix& linear_sys);
+  // 1/2 sum_i w_i * |p_i - t_i|^2 for the vertices on the diagonal of a
+  // per coordinate block, p and t are interleaved xyz
+  static float targetEnergy(const SparseMatrix& block, const VectorXf& p, const VectorXf& t);
+
 private:
   Constraint(const Constraint&); // not implemented
   void operator = (const Constraint&); // not implemented
@@ -102,27 +102,28 @@ void FastMassSpring::initEdgeGraph(
 
 void FastMassSpring::buildMatrix()
 {
+  // all matrices are per coordinate, x, y and z use the same ones
   TripletList L_triplets;
-  this->L_strech_matrix.resize(3 * this->P_Num, 3 * this->P_Num);
+  this->L_strech_matrix.resize(this->P_Num, this->P_Num);
   this->fillLMatrix(L_triplets, this->strech_edges);
   this->L_strech_matrix.setFromTriplets(L_triplets.begin(), L_triplets.end());
 
   L_triplets.clear();
-  this->L_bending_matrix.resize(3 * this->P_Num, 3 * this->P_Num);
+  this->L_bending_matrix.resize(this->P_Num, this->P_Num);
   this->fillLMatrix(L_triplets, this->bending_edges);
   this->L_bending_matrix.setFromTriplets(L_triplets.begin(), L_triplets.end());
 
   TripletList J_triplets;
   this->J_strech_matrix.resize(
-    3 * this->P_Num,
-    3 * (this->strech_edges.size() + this->bending_edges.size()));
+    this->P_Num,
+    this->strech_edges.size() + this->bending_edges.size());
   this->fillJMatrix(J_triplets, this->strech_edges, 0);
   this->J_strech_matrix.setFromTriplets(J_triplets.begin(), J_triplets.end());
 
   J_triplets.clear();
   this->J_bending_matrix.resize(
-    3 * this->P_Num,
-    3 * (this->strech_edges.size() + this->bending_edges.size()));
+    this->P_Num,
+    this->strech_edges.size() + this->bending_edges.size());
   this->fillJMatrix(J_triplets, this->bending_edges, this->strech_edges.size());
   this->J_bending_matrix.setFromTriplets(J_triplets.begin(), J_triplets.end());
 }
@@ -131,13 +132,10 @@ void FastMassSpring::fillLMatrix(TripletList& triplets, Edges& edges)
 {
   for (auto& i : edges)
   {
-    for (int j = 0; j < 3; ++j)
-    {
-      triplets.push_back(Triplet(3 * i.first + j, 3 * i.first + j, 1));
-      triplets.push_back(Triplet(3 * i.first + j, 3 * i.second + j, -1));
-      triplets.push_back(Triplet(3 * i.second + j, 3 * i.first + j, -1));
-      triplets.push_back(Triplet(3 * i.second + j, 3 * i.second + j, 1));
-    }
+    triplets.push_back(Triplet(i.first, i.first, 1));
+    triplets.push_back(Triplet(i.first, i.second, -1));
+    triplets.push_back(Triplet(i.second, i.first, -1));
+    triplets.push_back(Triplet(i.second, i.second, 1));
   }
 }
 
@@ -145,11 +143,8 @@ void FastMassSpring::fillJMatrix(TripletList& triplets, Edges& edges, int edge_c
 {
   for (decltype(edges.size()) i = 0; i != edges.size(); ++i)
   {
-    for (int j = 0; j < 3; ++j)
-    {
-      triplets.push_back(Triplet(3 * edges[i].first + j, 3 * (i + edge_counts) + j, 1));
-      triplets.push_back(Triplet(3 * edges[i].second + j, 3 * (i + edge_counts) + j, -1));
-    }
+    triplets.push_back(Triplet(edges[i].first, i + edge_counts, 1));
+    triplets.push_back(Triplet(edges[i].second, i + edge_counts, -1));
   }
 }
 
@@ -245,10 +240,16 @@ void FastMassSpring::projection()
 
 void FastMassSpring::update()
 {
-  this->right_hand =
+  // d_vector and right_hand are interleaved xyz, as rows of an n x 3 matrix
+  // they are multiplied by the per coordinate J in one go
+  int n_edge = int(this->d_vector.size() / 3);
+  Eigen::Map<const Eigen::Matrix<float, Eigen::Dynamic, 3, Eigen::RowMajor> > d_mat(this->d_vector.data(), n_edge, 3);
+  this->right_hand.resize(3 * this->P_Num);
+  Eigen::Map<Eigen::Matrix<float, Eigen::Dynamic, 3, Eigen::RowMajor> > right_hand_mat(this->right_hand.data(), this->P_Num, 3);
+  right_hand_mat =
     (this->k_strech * this->J_strech_matrix
    + this->k_bending * this->J_bending_matrix)
-   * this->d_vector;
+   * d_mat;
 }
 
 void FastMassSpring::getRightHand(VectorXf& right_hand)
@@ -258,8 +259,39 @@ void FastMassSpring::getRightHand(VectorXf& right_hand)
 
 void FastMassSpring::getLinearSys(SparseMatrix& linear_sys)
 {
-  linear_sys = this->k_strech * this->L_strech_matrix
-             + this->k_bending * this->L_bending_matrix;
+  SparseMatrix linear_sys_block;
+  this->getLinearSysBlock(linear_sys_block);
+  expandCoordBlock(linear_sys_block, linear_sys);
+}
+
+void FastMassSpring::getLinearSysBlock(SparseMatrix& linear_sys_block)
+{
+  linear_sys_block = this->k_strech * this->L_strech_matrix
+                   + this->k_bending * this->L_bending_matrix;
+}
+
+float FastMassSpring::getEnergy()
+{
+  // k / 2 * sum_e |(p1 - p2) - d_e|^2, stretch edges first, then bending edges
+  const VectorXf& P_Opt = this->solver->P_Opt;
+  int n_strech = int(this->strech_edges.size());
+  int n_edge = n_strech + int(this->bending_edges.size());
+  double energy = 0.0;
+
+#pragma omp parallel for schedule(static) reduction(+:energy)
+  for (int i = 0; i < n_edge; ++i)
+  {
+    const Edge& edge = i < n_strech ? this->strech_edges[i] : this->bending_edges[i - n_strech];
+    float k = i < n_strech ? this->k_strech : this->k_bending;
+    Vector3f diff;
+    for (int j = 0; j < 3; ++j)
+    {
+      diff[j] = P_Opt[3 * edge.first + j] - P_Opt[3 * edge.second + j] - this->d_vector[3 * i + j];
+    }
+    energy += 0.5 * k * diff.squaredNorm();
+  }
+
+  return float(energy);
 }
 
 void FastMassSpring::setSolver(std::shared_ptr<Solver> solver)
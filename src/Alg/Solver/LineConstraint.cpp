@@ -33,12 +33,10 @@ void LineConstraint::initMatrix(STLVectori& feature_line, VertexList& vertex_lis
   for (size_t i = 0; i < feature_line.size(); ++i)
   {
     int v_id = feature_line[i];
-    line_triplets.push_back(Triplet(3 * v_id + 0, 3 * v_id + 0, 1.0));
-    line_triplets.push_back(Triplet(3 * v_id + 1, 3 * v_id + 1, 1.0));
-    line_triplets.push_back(Triplet(3 * v_id + 2, 3 * v_id + 2, 1.0));
+    line_triplets.push_back(Triplet(v_id, v_id, 1.0));
   }
 
-  this->constraint_matrix.resize(3 * this->P_Num, 3 * this->P_Num);
+  this->constraint_matrix.resize(this->P_Num, this->P_Num);
   this->constraint_matrix.setFromTriplets(line_triplets.begin(), line_triplets.end());
 }
 
@@ -86,7 +84,17 @@ void LineConstraint::getRightHand(VectorXf& right_hand)
 
 void LineConstraint::getLinearSys(SparseMatrix& linear_sys)
 {
-  linear_sys = this->lamd_feature_line * this->constraint_matrix;
+  expandCoordBlock(this->lamd_feature_line * this->constraint_matrix, linear_sys);
+}
+
+void LineConstraint::getLinearSysBlock(SparseMatrix& linear_sys_block)
+{
+  linear_sys_block = this->lamd_feature_line * this->constraint_matrix;
+}
+
+float LineConstraint::getEnergy()
+{
+  return this->lamd_feature_line * targetEnergy(this->constraint_matrix, this->solver->P_Opt, this->right_hand);
 }
 
 void LineConstraint::setSolver(std::shared_ptr<Solver> solver)
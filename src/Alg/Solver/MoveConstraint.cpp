@@ -30,11 +30,9 @@ void MoveConstraint::initMatrix(const STLVectori& vertex_id, const VertexList& v
   for (size_t i = 0; i < vertex_id.size(); ++i)
   {
     int v_id = vertex_id[i];
-    line_triplets.push_back(Triplet(3 * v_id + 0, 3 * v_id + 0, 1.0));
-    line_triplets.push_back(Triplet(3 * v_id + 1, 3 * v_id + 1, 1.0));
-    line_triplets.push_back(Triplet(3 * v_id + 2, 3 * v_id + 2, 1.0));
+    line_triplets.push_back(Triplet(v_id, v_id, 1.0));
   }
-  this->constraint_matrix.resize(3 * this->P_Num, 3 * this->P_Num);
+  this->constraint_matrix.resize(this->P_Num, this->P_Num);
   this->constraint_matrix.setFromTriplets(line_triplets.begin(), line_triplets.end());
 
   // set right hand
@@ -95,7 +93,17 @@ void MoveConstraint::getRightHand(VectorXf& right_hand)
 
 void MoveConstraint::getLinearSys(SparseMatrix& linear_sys)
 {
-  linear_sys = this->lamd_move * this->constraint_matrix;
+  expandCoordBlock(this->lamd_move * this->constraint_matrix, linear_sys);
+}
+
+void MoveConstraint::getLinearSysBlock(SparseMatrix& linear_sys_block)
+{
+  linear_sys_block = this->lamd_move * this->constraint_matrix;
+}
+
+float MoveConstraint::getEnergy()
+{
+  return this->lamd_move * targetEnergy(this->constraint_matrix, this->solver->P_Opt, this->right_hand);
 }
 
 void MoveConstraint::setSolver(std::shared_ptr<Solver> solver)
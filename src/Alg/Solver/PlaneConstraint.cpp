@@ -35,12 +35,10 @@ void PlaneConstraint::initMatrix(STLVectori& _plane_vertex)
   for (size_t i = 0; i < plane_vertex.size(); ++i)
   {
     int v_id = plane_vertex[i];
-    line_triplets.push_back(Triplet(3 * v_id + 0, 3 * v_id + 0, 1.0));
-    line_triplets.push_back(Triplet(3 * v_id + 1, 3 * v_id + 1, 1.0));
-    line_triplets.push_back(Triplet(3 * v_id + 2, 3 * v_id + 2, 1.0));
+    line_triplets.push_back(Triplet(v_id, v_id, 1.0));
   }
 
-  this->constraint_matrix.resize(3 * this->P_Num, 3 * this->P_Num);
+  this->constraint_matrix.resize(this->P_Num, this->P_Num);
   this->constraint_matrix.setFromTriplets(line_triplets.begin(), line_triplets.end());
 }
 
@@ -104,7 +102,17 @@ void PlaneConstraint::getRightHand(VectorXf& right_hand)
 
 void PlaneConstraint::getLinearSys(SparseMatrix& linear_sys)
 {
-  linear_sys = this->lamd_plane * this->constraint_matrix;
+  expandCoordBlock(this->lamd_plane * this->constraint_matrix, linear_sys);
+}
+
+void PlaneConstraint::getLinearSysBlock(SparseMatrix& linear_sys_block)
+{
+  linear_sys_block = this->lamd_plane * this->constraint_matrix;
+}
+
+float PlaneConstraint::getEnergy()
+{
+  return this->lamd_plane * targetEnergy(this->constraint_matrix, this->solver->P_Opt, this->right_hand);
 }
 
 void PlaneConstraint::setSolver(std::shared_ptr<Solver> solver)
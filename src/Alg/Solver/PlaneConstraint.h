@@ -45,6 +45,9 @@ public:
   virtual void projection();
   virtual void getRightHand(VectorXf& right_hand);
   virtual void getLinearSys(SparseMatrix& linear_sys);
+  virtual bool isCoordDecoupled() { return true; };
+  virtual void getLinearSysBlock(SparseMatrix& linear_sys_block);
+  virtual float getEnergy();
   virtual void setSolver(std::shared_ptr<Solver> solver);
 
   inline void setLamdPlane(float lamd) { this->lamd_plane = lamd; };
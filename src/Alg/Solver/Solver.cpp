@@ -1,9 +1,17 @@
 #include "Solver.h"
 #include "Constraint.h"
 
+#include <algorithm>
+#include <cmath>
+
 Solver::Solver()
 {
-
+  problem_size = 0;
+  max_iter = 20;
+  converge_tol = 1e-4f;
+  anderson_m = 0;
+  coord_decoupled = false;
+  anderson_size = 0;
 }
 
 Solver::~Solver()
@@ -41,13 +49,114 @@ void Solver::preFactorize()
   chol.factorize(this->system_matrix);
 }
 
-void Solver::solve()
+int Solver::solve()
 {
-  for (int i = 0; i < max_iter; ++i)
+  this->energy_log.clear();
+  this->anderson_size = 0;
+
+  this->runLocalStep();
+  float energy = this->getEnergy();
+  this->energy_log.push_back(energy);
+  std::cout << "Solver: start energy " << energy << std::endl;
+
+  VectorXf x = P_Opt;
+  VectorXf x_plain;
+  int cur_iter = 0;
+  while (cur_iter < max_iter)
   {
-    this->runLocalStep();
     this->runGlobalStep();
+    ++cur_iter;
+
+    bool accelerated = false;
+    if (this->anderson_m > 0)
+    {
+      x_plain = P_Opt;
+      this->runAndersonStep(x, cur_iter);
+      accelerated = this->anderson_size > 0;
+    }
+
+    this->runLocalStep();
+    float new_energy = this->getEnergy();
+    if (accelerated && new_energy > energy)
+    {
+      // safeguard, take the plain global step and start the history again
+      P_Opt = x_plain;
+      this->anderson_size = 0;
+      this->runLocalStep();
+      new_energy = this->getEnergy();
+    }
+    this->energy_log.push_back(new_energy);
+
+    // without energy (no constraint computes it) the relative step length is used
+    float rel_change = 0.0f;
+    if (energy > 0.0f)
+    {
+      rel_change = std::abs(energy - new_energy) / energy;
+    }
+    else
+    {
+      float x_norm = x.norm();
+      rel_change = (P_Opt - x).norm() / (x_norm > 0.0f ? x_norm : 1.0f);
+    }
+    std::cout << "Solver: iteration " << cur_iter << " energy " << new_energy << " relative change " << rel_change << std::endl;
+
+    energy = new_energy;
+    x = P_Opt;
+    if (rel_change < this->converge_tol) break;
+  }
+
+  std::cout << "Solver: " << cur_iter << " iterations, energy " << this->energy_log.front() << " -> " << energy << std::endl;
+  return cur_iter;
+}
+
+void Solver::runAndersonStep(const VectorXf& x, int iter)
+{
+  // P_Opt is G(x), it is replaced by the Anderson mixing of the last iterates
+  // G(x) - dG * theta, theta = argmin |F - dF * theta|
+  VectorXf F = P_Opt - x;
+  if (iter == 1 || this->anderson_G.size() != P_Opt.size())
+  {
+    this->anderson_dG.resize(P_Opt.size(), this->anderson_m);
+    this->anderson_dF.resize(P_Opt.size(), this->anderson_m);
+    this->anderson_size = 0;
+  }
+  else
+  {
+    // the oldest column is dropped when the history is full
+    int col = 0;
+    if (this->anderson_size < this->anderson_m)
+    {
+      col = this->anderson_size;
+      ++this->anderson_size;
+    }
+    else
+    {
+      for (int i = 1; i < this->anderson_m; ++i)
+      {
+        this->anderson_dG.col(i - 1) = this->anderson_dG.col(i);
+        this->anderson_dF.col(i - 1) = this->anderson_dF.col(i);
+      }
+      col = this->anderson_m - 1;
+    }
+    this->anderson_dG.col(col) = P_Opt - this->anderson_G;
+    this->anderson_dF.col(col) = F - this->anderson_F;
+  }
+  this->anderson_G = P_Opt;
+  this->anderson_F = F;
+
+  if (this->anderson_size == 0) return;
+
+  int m = this->anderson_size;
+  MatrixXf normal_mat = this->anderson_dF.leftCols(m).transpose() * this->anderson_dF.leftCols(m);
+  VectorXf normal_rhs = this->anderson_dF.leftCols(m).transpose() * F;
+  normal_mat.diagonal().array() += 1e-10f * std::max(normal_mat.trace(), 1e-10f);
+  VectorXf theta = normal_mat.ldlt().solve(normal_rhs);
+  if (!theta.allFinite())
+  {
+    this->anderson_size = 0;
+    return;
   }
+  P_Opt -= this->anderson_dG.leftCols(m) * theta;
 }
 
 void Solver::runOneStep()
@@ -58,7 +167,20 @@ void Solver::runOneStep()
 
 void Solver::runGlobalStep()
 {
-  P_Opt = chol.solve(this->right_hand);
+  if (this->coord_decoupled)
+  {
+    // interleaved xyz as rows of an N x 3 matrix, one column per coordinate
+    typedef Eigen::Matrix<float, Eigen::Dynamic, 3, Eigen::RowMajor> CoordMatrix;
+    int n_vertex = int(this->problem_size / 3);
+    Eigen::Map<const CoordMatrix> right_hand_mat(this->right_hand.data(), n_vertex, 3);
+    this->coord_solution = chol.solve(right_hand_mat);
+    P_Opt.resize(this->problem_size);
+    Eigen::Map<CoordMatrix>(P_Opt.data(), n_vertex, 3) = this->coord_solution;
+  }
+  else
+  {
+    P_Opt = chol.solve(this->right_hand);
+  }
 }
 
 void Solver::runLocalStep()
@@ -80,22 +202,51 @@ void Solver::setSystemMatrix()
     return;
   }
 
-  this->constraints[0]->getLinearSys(this->system_matrix);
-  for (decltype(this->constraints.size()) i = 1; i < this->constraints.size(); ++i)
+  this->coord_decoupled = true;
+  for (decltype(this->constraints.size()) i = 0; i < this->constraints.size(); ++i)
+  {
+    if (!this->constraints[i]->isCoordDecoupled()) this->coord_decoupled = false;
+  }
+
+  if (this->coord_decoupled)
   {
-    SparseMatrix temp_matrix;
-    this->constraints[i]->getLinearSys(temp_matrix);
-    this->system_matrix += temp_matrix;
+    this->constraints[0]->getLinearSysBlock(this->system_matrix);
+    for (decltype(this->constraints.size()) i = 1; i < this->constraints.size(); ++i)
+    {
+      SparseMatrix temp_matrix;
+      this->constraints[i]->getLinearSysBlock(temp_matrix);
+      this->system_matrix += temp_matrix;
+    }
+  }
+  else
+  {
+    this->constraints[0]->getLinearSys(this->system_matrix);
+    for (decltype(this->constraints.size()) i = 1; i < this->constraints.size(); ++i)
+    {
+      SparseMatrix temp_matrix;
+      this->constraints[i]->getLinearSys(temp_matrix);
+      this->system_matrix += temp_matrix;
+    }
   }
 }
 
 void Solver::setRightHand()
 {
-  this->right_hand = VectorXf::Zero(problem_size);
+  this->right_hand.resize(problem_size); // no allocation if the size is the same
+  this->right_hand.setZero();
+  for (decltype(this->constraints.size()) i = 0; i < this->constraints.size(); ++i)
+  {
+    this->constraints[i]->getRightHand(this->temp_right_hand);
+    this->right_hand += this->temp_right_hand;
+  }
+}
+
+float Solver::getEnergy()
+{
+  float energy = 0.0f;
   for (decltype(this->constraints.size()) i = 0; i < this->constraints.size(); ++i)
   {
-    VectorXf temp_right_hand;
-    this->constraints[i]->getRightHand(temp_right_hand);
-    this->right_hand += temp_right_hand;
+    energy += this->constraints[i]->getEnergy();
   }
+  return energy;
 }
\ No newline at end of file
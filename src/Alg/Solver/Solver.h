@@ -52,23 +52,53 @@ public:
   void addConstraint(std::shared_ptr<Constraint> constraint);
   void initCholesky();
   void preFactorize();
-  void solve();
+  // local / global steps until the relative change of the energy is below
+  // converge_tol or max_iter steps are done, energy_log gets the energy of
+  // the start point and of each step. with anderson_m > 0 the global step
+  // iterates are Anderson accelerated, a step that increases the energy
+  // falls back to the plain iterate.
+  int solve();
   void runOneStep();
   void setRightHand();
   void setSystemMatrix();
   void runGlobalStep();
   void runLocalStep();
 
+  // P_Opt and right_hand are interleaved xyz of problem_size / 3 vertices.
+  // if all constraints are coordinate decoupled (see Constraint), system_matrix
+  // is the N x N block shared by x, y and z, and the global step solves the
+  // three coordinates as three right hand sides of one factorization.
+  // otherwise it is the full 3N x 3N system
   VectorXf P_Opt;
   SimplicialCholesky chol;
   SparseMatrix system_matrix;
   VectorXf right_hand;
   size_t problem_size;
   int max_iter;
+  float converge_tol;
+  int anderson_m; // 0: no acceleration
+  std::vector<float> energy_log;
+  bool coord_decoupled;
+
+private:
+  float getEnergy();
+  void runAndersonStep(const VectorXf& x, int iter);
 
 private:
   std::vector<std::shared_ptr<Constraint> > constraints;
 
+  // reused buffers
+  VectorXf temp_right_hand;
+  Eigen::Matrix<float, Eigen::Dynamic, 3> coord_solution;
+
+  // Anderson acceleration, columns of the last anderson_m differences
+  // of the global step results G and of the residuals F = G - x
+  MatrixXf anderson_dG;
+  MatrixXf anderson_dF;
+  VectorXf anderson_G;
+  VectorXf anderson_F;
+  int anderson_size;
+
 private:
   Solver(const Solver&); // not implemented
   void operator = (const Solver&); // not implemented
@@ -9,3 +9,15 @@
 
 template<typename T>
 void wunderSVD3x3(const Eigen::Matrix<T, 3, 3>& A, Eigen::Matrix<T, 3, 3> &U, Eigen::Matrix<T, 3, 1> &S, Eigen::Matrix<T, 3, 3>&V);
+
+// The same kernel on a batch of matrices, one matrix per SIMD lane,
+// 8 lanes with AVX and 4 with SSE. Entries are given as arrays over the batch:
+// a[3 * col + row][lane] is A(row, col) of the matrix in that lane, same for u and v,
+// s[k][lane] is S[k]. Unused lanes can be filled with anything finite.
+#if defined(__AVX__)
+#define WUNDER_SVD_BATCH 8
+#else
+#define WUNDER_SVD_BATCH 4
+#endif
+
+void wunderSVD3x3Batch(const float a[9][WUNDER_SVD_BATCH], float u[9][WUNDER_SVD_BATCH], float s[3][WUNDER_SVD_BATCH], float v[9][WUNDER_SVD_BATCH]);
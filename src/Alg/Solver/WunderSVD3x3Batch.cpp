@@ -0,0 +1,65 @@
+#include "WunderSVD3x3.h"
+
+#include <cmath>
+#include <algorithm>
+
+// WunderSVD3x3.cpp builds the scalar kernel, the SIMD one needs its own translation unit
+#undef USE_SCALAR_IMPLEMENTATION
+#if defined(__AVX__)
+#define USE_AVX_IMPLEMENTATION
+#undef USE_SSE_IMPLEMENTATION
+#else
+#define USE_SSE_IMPLEMENTATION
+#undef USE_AVX_IMPLEMENTATION
+#endif
+#define COMPUTE_U_AS_MATRIX
+#define COMPUTE_V_AS_MATRIX
+#include "Singular_Value_Decomposition_Preamble.hpp"
+
+#pragma runtime_checks( "u", off )
+void wunderSVD3x3Batch(const float a[9][WUNDER_SVD_BATCH], float u[9][WUNDER_SVD_BATCH], float s[3][WUNDER_SVD_BATCH], float v[9][WUNDER_SVD_BATCH])
+{
+  const float *a11 = a[0], *a21 = a[1], *a31 = a[2], *a12 = a[3], *a22 = a[4], *a32 = a[5], *a13 = a[6], *a23 = a[7], *a33 = a[8];
+  float *u11 = u[0], *u21 = u[1], *u31 = u[2], *u12 = u[3], *u22 = u[4], *u32 = u[5], *u13 = u[6], *u23 = u[7], *u33 = u[8];
+  float *v11 = v[0], *v21 = v[1], *v31 = v[2], *v12 = v[3], *v22 = v[4], *v32 = v[5], *v13 = v[6], *v23 = v[7], *v33 = v[8];
+  float *sigma1 = s[0], *sigma2 = s[1], *sigma3 = s[2];
+
+#include "Singular_Value_Decomposition_Kernel_Declarations.hpp"
+
+  ENABLE_SSE_IMPLEMENTATION(Va11=_mm_loadu_ps(a11);)    ENABLE_AVX_IMPLEMENTATION(Va11=_mm256_loadu_ps(a11);)
+  ENABLE_SSE_IMPLEMENTATION(Va21=_mm_loadu_ps(a21);)    ENABLE_AVX_IMPLEMENTATION(Va21=_mm256_loadu_ps(a21);)
+  ENABLE_SSE_IMPLEMENTATION(Va31=_mm_loadu_ps(a31);)    ENABLE_AVX_IMPLEMENTATION(Va31=_mm256_loadu_ps(a31);)
+  ENABLE_SSE_IMPLEMENTATION(Va12=_mm_loadu_ps(a12);)    ENABLE_AVX_IMPLEMENTATION(Va12=_mm256_loadu_ps(a12);)
+  ENABLE_SSE_IMPLEMENTATION(Va22=_mm_loadu_ps(a22);)    ENABLE_AVX_IMPLEMENTATION(Va22=_mm256_loadu_ps(a22);)
+  ENABLE_SSE_IMPLEMENTATION(Va32=_mm_loadu_ps(a32);)    ENABLE_AVX_IMPLEMENTATION(Va32=_mm256_loadu_ps(a32);)
+  ENABLE_SSE_IMPLEMENTATION(Va13=_mm_loadu_ps(a13);)    ENABLE_AVX_IMPLEMENTATION(Va13=_mm256_loadu_ps(a13);)
+  ENABLE_SSE_IMPLEMENTATION(Va23=_mm_loadu_ps(a23);)    ENABLE_AVX_IMPLEMENTATION(Va23=_mm256_loadu_ps(a23);)
+  ENABLE_SSE_IMPLEMENTATION(Va33=_mm_loadu_ps(a33);)    ENABLE_AVX_IMPLEMENTATION(Va33=_mm256_loadu_ps(a33);)
+
+#include "Singular_Value_Decomposition_Main_Kernel_Body.hpp"
+
+  ENABLE_SSE_IMPLEMENTATION(_mm_storeu_ps(u11,Vu11);)   ENABLE_AVX_IMPLEMENTATION(_mm256_storeu_ps(u11,Vu11);)
+  ENABLE_SSE_IMPLEMENTATION(_mm_storeu_ps(u21,Vu21);)   ENABLE_AVX_IMPLEMENTATION(_mm256_storeu_ps(u21,Vu21);)
+  ENABLE_SSE_IMPLEMENTATION(_mm_storeu_ps(u31,Vu31);)   ENABLE_AVX_IMPLEMENTATION(_mm256_storeu_ps(u31,Vu31);)
+  ENABLE_SSE_IMPLEMENTATION(_mm_storeu_ps(u12,Vu12);)   ENABLE_AVX_IMPLEMENTATION(_mm256_storeu_ps(u12,Vu12);)
+  ENABLE_SSE_IMPLEMENTATION(_mm_storeu_ps(u22,Vu22);)   ENABLE_AVX_IMPLEMENTATION(_mm256_storeu_ps(u22,Vu22);)
+  ENABLE_SSE_IMPLEMENTATION(_mm_storeu_ps(u32,Vu32);)   ENABLE_AVX_IMPLEMENTATION(_mm256_storeu_ps(u32,Vu32);)
+  ENABLE_SSE_IMPLEMENTATION(_mm_storeu_ps(u13,Vu13);)   ENABLE_AVX_IMPLEMENTATION(_mm256_storeu_ps(u13,Vu13);)
+  ENABLE_SSE_IMPLEMENTATION(_mm_storeu_ps(u23,Vu23);)   ENABLE_AVX_IMPLEMENTATION(_mm256_storeu_ps(u23,Vu23);)
+  ENABLE_SSE_IMPLEMENTATION(_mm_storeu_ps(u33,Vu33);)   ENABLE_AVX_IMPLEMENTATION(_mm256_storeu_ps(u33,Vu33);)
+
+  ENABLE_SSE_IMPLEMENTATION(_mm_storeu_ps(v11,Vv11);)   ENABLE_AVX_IMPLEMENTATION(_mm256_storeu_ps(v11,Vv11);)
+  ENABLE_SSE_IMPLEMENTATION(_mm_storeu_ps(v21,Vv21);)   ENABLE_AVX_IMPLEMENTATION(_mm256_storeu_ps(v21,Vv21);)
+  ENABLE_SSE_IMPLEMENTATION(_mm_storeu_ps(v31,Vv31);)   ENABLE_AVX_IMPLEMENTATION(_mm256_storeu_ps(v31,Vv31);)
+  ENABLE_SSE_IMPLEMENTATION(_mm_storeu_ps(v12,Vv12);)   ENABLE_AVX_IMPLEMENTATION(_mm256_storeu_ps(v12,Vv12);)
+  ENABLE_SSE_IMPLEMENTATION(_mm_storeu_ps(v22,Vv22);)   ENABLE_AVX_IMPLEMENTATION(_mm256_storeu_ps(v22,Vv22);)
+  ENABLE_SSE_IMPLEMENTATION(_mm_storeu_ps(v32,Vv32);)   ENABLE_AVX_IMPLEMENTATION(_mm256_storeu_ps(v32,Vv32);)
+  ENABLE_SSE_IMPLEMENTATION(_mm_storeu_ps(v13,Vv13);)   ENABLE_AVX_IMPLEMENTATION(_mm256_storeu_ps(v13,Vv13);)
+  ENABLE_SSE_IMPLEMENTATION(_mm_storeu_ps(v23,Vv23);)   ENABLE_AVX_IMPLEMENTATION(_mm256_storeu_ps(v23,Vv23);)
+  ENABLE_SSE_IMPLEMENTATION(_mm_storeu_ps(v33,Vv33);)   ENABLE_AVX_IMPLEMENTATION(_mm256_storeu_ps(v33,Vv33);)
+
+  ENABLE_SSE_IMPLEMENTATION(_mm_storeu_ps(sigma1,Va11);)   ENABLE_AVX_IMPLEMENTATION(_mm256_storeu_ps(sigma1,Va11);)
+  ENABLE_SSE_IMPLEMENTATION(_mm_storeu_ps(sigma2,Va22);)   ENABLE_AVX_IMPLEMENTATION(_mm256_storeu_ps(sigma2,Va22);)
+  ENABLE_SSE_IMPLEMENTATION(_mm_storeu_ps(sigma3,Va33);)   ENABLE_AVX_IMPLEMENTATION(_mm256_storeu_ps(sigma3,Va33);)
+}
+#pragma runtime_checks( "u", restore )
@@ -38,15 +38,17 @@
 
 double tele2d::get_penalty(std::vector<double2> samples, int endp1, int endp2 ){
 
-	int i = endp1 ;
-	int j = endp2;
-	
+	return get_penalty( samples, osculatingCircles ) ;
+}
+
+double tele2d::get_penalty( const std::vector<double2> &samples, std::vector<Circle> &oscircle ){
+
 	// reduce samples to make the sampling step equal to 1.0/resolution
 	std::vector<double2> reduced_samples ;
 	reduced_samples.push_back( samples[0] ) ;
 	double length = 0;
 	for( int id=1; id<samples.size(); ++id){
-		length += ( samples[id] - samples[id-1] ).norm() ;
+		length += double2( samples[id].x - samples[id-1].x, samples[id].y - samples[id-1].y ).norm() ;
 		if( length > 0.25 / resolution ){
 			reduced_samples.push_back( samples[id] ) ;
 			length = 0;
@@ -110,14 +112,7 @@ double tele2d::get_penalty(std::vector<double2> samples, int endp1, int endp2 ){
 
 		}
 
-		double2 c1 = osculatingCircles[ i ].first ;
-		double2 c2 = osculatingCircles[ j ].first ;
-
-		double r1 = osculatingCircles[ i ].second ;
-		double r2 = osculatingCircles[ j ].second ;
-
-
-		penalty += (1 - getScalarValue( osculatingCircles , correspondence,  reduced_samples[id] ))  * scalar_weight;
+		penalty += (1 - getScalarValue( oscircle , correspondence,  reduced_samples[id] ))  * scalar_weight;
 
 	}
 	penalty /= reduced_samples.size() ;
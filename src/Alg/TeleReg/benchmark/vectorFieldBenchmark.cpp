@@ -0,0 +1,69 @@
+// Times tele2d::computeVectorField solved by cholmod and by multigrid at 256, 512, 1024 and
+// 2048 and reports how far apart the two fields are. Built with BUILD_VECTORFIELD_BENCHMARK.
+
+#include <iostream>
+#include <cstdio>
+#include <cmath>
+#include <ctime>
+#include <climits>
+
+#include "tele2d.h"
+
+
+// an arc, a wave and a line, sampled densely enough to mark connected cells at res
+static CURVES test_curves( int res ){
+
+	CURVES curves( 3 ) ;
+	int samples = 4 * res ;
+	for( int s=0; s<samples; ++s ){
+		double t = s / (double)samples ;
+		double a = 3.7699 * t ;
+		curves[0].push_back( double2( 0.3 + 0.15 * cos( a ), 0.3 + 0.15 * sin( a ) ) ) ;
+		curves[1].push_back( double2( 0.1 + 0.35 * t, 0.75 + 0.1 * sin( 10.0 * t ) ) ) ;
+		curves[2].push_back( double2( 0.65 + 0.2 * t, 0.2 + 0.5 * t ) ) ;
+	}
+	return curves ;
+}
+
+
+static double solve_time( tele2d &tele, std::vector<double2> &field ){
+
+	clock_t start = clock() ;
+	tele.computeVectorField() ;
+	field = tele.vector_field ;
+	return (double)( clock() - start ) / CLOCKS_PER_SEC ;
+}
+
+
+int main(){
+
+	const int resolutions[4] = { 256, 512, 1024, 2048 } ;
+
+	printf( "%6s %12s %12s %12s %12s %14s\n", "res", "cholmod(s)", "resolve(s)", "multigrid(s)", "resolve(s)", "max angle" ) ;
+	for( int r=0; r<4; ++r ){
+
+		int res = resolutions[r] ;
+		tele2d tele( res, 0.02, 1 ) ;
+		tele.curves = test_curves( res ) ;
+
+		// the second call of each has the same constraints: factor or hierarchy reused
+		std::vector<double2> cholmod_field, multigrid_field ;
+		tele.multigrid_resolution = INT_MAX ;
+		double cholmod_time = solve_time( tele, cholmod_field ) ;
+		double cholmod_resolve = solve_time( tele, cholmod_field ) ;
+		tele.multigrid_resolution = 0 ;
+		double multigrid_time = solve_time( tele, multigrid_field ) ;
+		double multigrid_resolve = solve_time( tele, multigrid_field ) ;
+
+		double max_angle = 0.0 ;
+		for( int i=0; i<cholmod_field.size(); ++i ){
+			double c = cholmod_field[i].x * multigrid_field[i].x + cholmod_field[i].y * multigrid_field[i].y ;
+			double angle = acos( c > 1.0 ? 1.0 : ( c < -1.0 ? -1.0 : c ) ) ;
+			if( angle > max_angle ) max_angle = angle ;
+		}
+
+		printf( "%6d %12.3f %12.3f %12.3f %12.3f %14.3e\n", res, cholmod_time, cholmod_resolve, multigrid_time, multigrid_resolve, max_angle ) ;
+	}
+
+	return 0 ;
+}
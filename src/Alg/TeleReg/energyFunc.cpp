@@ -90,4 +90,99 @@ double tele2d::energy_function( std::vector<double> X ){
 	curves = curves_backup ;
 
 	return penalty ;
-}
\ No newline at end of file
+}
+
+
+
+// rigid motion of a group, the same as in energy_function: translate by t, then rotate
+// by theta about the translated pivot, i.e. p' = R(theta) * (p - pivot) + pivot + t
+static inline double2 move_point( double2 p, double2 pivot, double2 t, double c, double s ){
+
+	double2 d( p.x - pivot.x, p.y - pivot.y ) ;
+	return double2( c * d.x + s * d.y + pivot.x + t.x, -s * d.x + c * d.y + pivot.y + t.y ) ;
+}
+
+static inline double2 rotate_vector( double2 v, double c, double s ){
+
+	return double2( c * v.x + s * v.y, -s * v.x + c * v.y ) ;
+}
+
+
+// Same value as energy_function() for the current vector field, but nothing of the
+// tele2d is changed so the gradient evaluations can run concurrently.
+// Only the ends of the curves are needed: the bridging curves are hermite curves between
+// the end points and end tangents, and the osculating circles are a property of the curve
+// shape, so the circles of a moved curve are the moved circles of registrationCircles.
+double tele2d::registration_energy( const std::vector<double> &X ){
+
+	std::vector<Circle> circles = registrationCircles ;
+
+	// p[0], p[1], p[n-2], p[n-1] of each curve
+	std::vector<std::vector<double2> > ends( curves.size() ) ;
+	for( int cvid = 0; cvid<curves.size(); ++cvid ){
+		const int n = curves[cvid].size() ;
+		ends[cvid].push_back( curves[cvid][0] ) ;
+		ends[cvid].push_back( curves[cvid][1] ) ;
+		ends[cvid].push_back( curves[cvid][n-2] ) ;
+		ends[cvid].push_back( curves[cvid][n-1] ) ;
+	}
+
+	for( int gid =0; gid<curves_group.size(); ++gid ){
+
+		const std::vector<int> &curves_id = curves_group[gid] ;
+		double2 pivot = curves[curves_id[0]].back() ;
+		double2 t( X[gid*3], X[gid*3+1] ) ;
+		double c = cos( X[gid*3+2] ) ;
+		double s = sin( X[gid*3+2] ) ;
+
+		for( int i = 0; i<curves_id.size(); ++i  ){
+			int cvid = curves_id[i] ;
+			for( int j=0; j<4; ++j )
+				ends[cvid][j] = move_point( ends[cvid][j], pivot, t, c, s ) ;
+
+			// tail and head circle of the curve
+			for( int k = 2*cvid; k<2*cvid+2; ++k ){
+				circles[k].first = move_point( circles[k].first, pivot, t, c, s ) ;
+				circles[k].touchpoint = move_point( circles[k].touchpoint, pivot, t, c, s ) ;
+				circles[k].tangent = rotate_vector( circles[k].tangent, c, s ) ;
+			}
+		}
+	}
+
+	// the bridging curves of interpolateBetweenPairedCurves()
+	double penalty = 0;
+	std::vector<double2> samples ;
+	for( int i =0; i<best_sequence.size()/2; ++ i){
+
+		int endpid1 = best_sequence[i*2] ;
+		int endpid2 = best_sequence[i*2+1] ;
+		const std::vector<double2> &end1 = ends[endpid1/2] ;
+		const std::vector<double2> &end2 = ends[endpid2/2] ;
+
+		double2 p0, p1, tan0, tan1 ;
+		if( endpid1%2 == 0 ){
+			p0 = end1[0] ;
+			tan0 = double2( end1[0].x - end1[1].x, end1[0].y - end1[1].y ) ;
+		}else{
+			p0 = end1[3] ;
+			tan0 = double2( end1[3].x - end1[2].x, end1[3].y - end1[2].y ) ;
+		}
+		if( endpid2%2 == 0 ){
+			p1 = end2[0] ;
+			tan1 = double2( end2[1].x - end2[0].x, end2[1].y - end2[0].y ) ;
+		}else{
+			p1 = end2[3] ;
+			tan1 = double2( end2[2].x - end2[3].x, end2[2].y - end2[3].y ) ;
+		}
+		tan0.normalize();
+		tan1.normalize();
+
+		samples.clear() ;
+		for( double ht=0.0; ht<=1.0; ht+=0.01 )
+			samples.push_back( get_hermite_value( p0, p1, tan0, tan1, ht ) );
+
+		penalty += get_penalty( samples, circles ) ;
+	}
+
+	return penalty ;
+}
@@ -0,0 +1,58 @@
+#ifndef __grid_multigrid_h
+#define __grid_multigrid_h
+
+#include <vector>
+
+
+// Matrix free multigrid for (L + P) x = b on a res x res grid of cells, L is the laplacian
+// of the 8 neighbour grid graph used by tele2d::computeVectorField (axis edges 1, diagonal
+// edges 0.7071, free boundary) and P a diagonal of soft constraint weights.
+//
+// The coarse levels come from the Galerkin operators of the piecewise constant prolongation
+// on 2x2 blocks, which are again 8 neighbour grid laplacians plus a diagonal, so no level
+// stores a matrix. The V-cycle (4 color Gauss-Seidel, parallel per color)
+// preconditions a conjugate gradient, the first guess comes from full multigrid.
+class GridMultigrid{
+
+public:
+	GridMultigrid() ;
+
+	// the fine level is L + P, P[i + j*res] the weight of cell (i,j)
+	void setSystem( int res, const std::vector<double> &P ) ;
+
+	// solves the system for b, x holds the initial guess if warm_start is true. Stops when
+	// the change of x estimated from the residual, |D^-1 r| / |D^-1 b|, is below tol.
+	// Returns the number of iterations.
+	int solve( const std::vector<double> &b, std::vector<double> &x, bool warm_start ) ;
+
+	int resolution() { return levels.empty() ? 0 : levels[0].n ; }
+
+	double tol ;
+	int max_iter ;
+	int pre_smooth ;
+	int post_smooth ;
+
+private:
+	struct Level{
+		int n ;
+		// edges to (i+1,j), (i,j+1), (i+1,j+1) and (i-1,j+1) of cell (i,j), 0 when outside
+		std::vector<double> wE, wN, wNE, wNW ;
+		std::vector<double> p ;				// soft constraint weights
+		std::vector<double> diag ;
+		std::vector<double> x, b, r ;
+	};
+
+	void coarsen( Level &fine, Level &coarse ) ;
+	void smooth( Level &l, int sweeps, bool forward ) ;
+	void residual( Level &l ) ;
+	void applyA( Level &l, const std::vector<double> &x, std::vector<double> &Ax ) ;
+	void restrictResidual( Level &fine, Level &coarse ) ;
+	void prolongate( Level &coarse, Level &fine ) ;
+	void vcycle( int level ) ;
+	void fullMultigrid( const std::vector<double> &b, std::vector<double> &x ) ;
+
+	std::vector<Level> levels ;
+};
+
+
+#endif
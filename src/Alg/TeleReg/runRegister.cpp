@@ -43,26 +43,52 @@ double efunc(const std::vector<double> &x, std::vector<double> &grad, void* regI
 	tele->updateVectorFieldWhenComputingEnegergy = false ;
 
 	grad.resize(x.size()) ;
-	std::vector<double> cppX = X0 ;
 
+	// the penalty samples the vector field at the nearest grid vertex and has no closed
+	// form derivative, it stays a finite difference. The moved curves do have one: a step
+	// only moves the end points and osculating circles of one group rigidly (see
+	// registration_energy), which is read only, so the steps run concurrently
+	if( tele->registrationCircles.size() == 2 * tele->curves.size() ){
 
+		double fx0 = tele->registration_energy( X0 ) ;
 
-	for( int i=0; i<x.size(); ++i ){
-		std::vector<double> cppX2 = cppX;
+		const int xn = x.size() ;
+#pragma omp parallel for schedule(dynamic)
+		for( int i=0; i<xn; ++i ){
+			std::vector<double> cppX2 = X0;
 
-		double step ;
-		if( i%3 == 2 )
-			step = energyGraAngStep*3.14/180.0 ;
-		else
-			step = energyGraTranStep / ((tele2d*)regInst)->resolution ;
+			double step ;
+			if( i%3 == 2 )
+				step = energyGraAngStep*3.14/180.0 ;
+			else
+				step = energyGraTranStep / tele->resolution ;
 
+			cppX2[i] += step ;
 
-		cppX2[i] += step ;
+			grad[i] = ( tele->registration_energy( cppX2 ) - fx0 ) / step ;
+		}
+	}
+	else{
 
-		grad[i] = (((tele2d*)regInst)->energy_function( cppX2 ) - fx ) / step ;
+		// a curve too short for osculating circles, the circle ids don't follow the curve ids
+		std::vector<double> cppX = X0 ;
+
+		for( int i=0; i<x.size(); ++i ){
+			std::vector<double> cppX2 = cppX;
+
+			double step ;
+			if( i%3 == 2 )
+				step = energyGraAngStep*3.14/180.0 ;
+			else
+				step = energyGraTranStep / ((tele2d*)regInst)->resolution ;
 
-	}
 
+			cppX2[i] += step ;
+
+			grad[i] = (((tele2d*)regInst)->energy_function( cppX2 ) - fx ) / step ;
+
+		}
+	}
 
 
 
@@ -84,6 +110,10 @@ void tele2d::runRegister() {
 	std::cout<<"begin registration"<<std::endl;
 	unsigned time1 = clock() ;
 
+	// osculating circles of the input curves, registration_energy moves them with the groups
+	computeOsculatingCircle() ;
+	registrationCircles = osculatingCircles ;
+
 	std::vector<double> x0(curves_group.size() *3, 0);
 
 	int xn = x0.size() ;
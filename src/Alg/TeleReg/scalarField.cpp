@@ -138,15 +138,14 @@ void tele2d::getDis(){
 
 	computeOsculatingCircle() ;
 
-	for( int i =0; i<800 ; ++i )
-		for( int j=0; j<800; ++j )
-			dis[i][j] = 1.0 ;
+	int n = dis_resolution ;
+	dis.assign( n, std::vector<double>( n, 1.0 ) ) ;
 
 
-	for( int i =0; i<800 ; ++i ){
-		for( int j=0; j<800; ++j ){
+	for( int i =0; i<n ; ++i ){
+		for( int j=0; j<n; ++j ){
 
-			double2 p( i/800.0, j/800.0 ) ;
+			double2 p( i/(double)n, j/(double)n ) ;
 			if( scalar_field_4cc )
 				dis[i][j] = getScalarValue_4cc( osculatingCircles, endpoints, p) ;
 			else
@@ -159,15 +158,15 @@ void tele2d::getDis(){
 
 	// scale dismap to [0,1]
 	double maxDis = 0;
-	for( int i=0;i<800;++i) for( int j=0; j<800; ++j )
+	for( int i=0;i<n;++i) for( int j=0; j<n; ++j )
 		if( dis[i][j] > maxDis) maxDis = dis[i][j] ;
 
 	double minDis = 1000;
-	for( int i=0;i<800;++i) for( int j=0; j<800; ++j )
+	for( int i=0;i<n;++i) for( int j=0; j<n; ++j )
 		if( dis[i][j] < minDis) minDis = dis[i][j] ;
 
 
-	for( int i=0;i<800;++i) for( int j=0; j<800; ++j ){
+	for( int i=0;i<n;++i) for( int j=0; j<n; ++j ){
 	
 		//if(scalar_field_4cc)
 		//	dis[i][j] = (1 - (dis[i][j]/ 2) )/2 ;
@@ -35,10 +35,14 @@
 #include "tele_basicType.h"
 
 #include <fstream>
+#include <memory>
 
 typedef std::vector<std::vector<double2>> CURVES ;
 typedef             std::vector<double2>  CURVE ;
 
+struct VectorFieldSolver ;  // cholmod factor of the vector field system, see vectorField.cpp
+struct VectorFieldMultigrid ;  // multigrid for the same system at high resolutions, see vectorField.cpp
+
 
 //#define  _use_openmp_
 
@@ -56,11 +60,15 @@ public:
 		resolution = 100 ;
 		gussian_h = 0.02 ;
 		scalar_weight = 1 ;
+		multigrid_resolution = 256 ;
+		dis_resolution = 800 ;
 	}
 	tele2d( int res, double h, double w ) {
 		resolution = res ;
 		gussian_h = h ;
 		scalar_weight = w ;
+		multigrid_resolution = 256 ;
+		dis_resolution = 800 ;
 	}
 
  
@@ -109,8 +117,10 @@ public:
 	void computeOsculatingCircle( ) ;
 	double interpolateBetweenPairedCurves( ) ;
 	double energy_function( std::vector<double> X );
+	double registration_energy( const std::vector<double> &X ) ;  // read only, safe to call concurrently
 	bool updateVectorFieldWhenComputingEnegergy ;
 	double get_penalty(std::vector<double2> samples, int endp1, int endp2 ) ;
+	double get_penalty( const std::vector<double2> &samples, std::vector<Circle> &oscircle ) ;
 
   static double2 get_hermite_value( double2 p0, double2 p1, double2 tan0, double2 tan1, double t );
 	
@@ -122,6 +132,7 @@ public:
 
 
 	int resolution; // resolution of vector field
+	int multigrid_resolution ;  // the vector field is solved by multigrid from this resolution on, by cholmod below
 	std::vector<std::vector<double2>> initialCurves ;	// the input curves
 	std::vector<std::vector<double2>> curves ;			 // the input curves for operating
 	std::vector<std::vector<double2>> resCurves ;	    // curves after registration
@@ -132,7 +143,9 @@ public:
 	std::vector<std::vector<int>> constrained_vertices_mark ;  // where in the field is constrained by the input curves
 	std::vector<int2> endpoints ;			// the endpoints selected to be bridged
 	std::vector<Circle> osculatingCircles ;			// osculating circles at ends of curves
-	double dis[800][800] ;						// scalar field. Only for visulization
+	std::vector<Circle> registrationCircles ;		// osculating circles of the curves before registration
+	std::vector<std::vector<double>> dis ;		// scalar field of dis_resolution x dis_resolution. Only for visulization
+	int dis_resolution ;
 	double gussian_h ;
 	double scalar_weight ;
 	std::vector<int2> correspondence ;
@@ -144,6 +157,9 @@ public:
 	double2 normalize_translate ;
 	double normalize_scale ;
 
+	std::shared_ptr<VectorFieldSolver> vector_field_solver ;	// kept between computeVectorField() calls
+	std::shared_ptr<VectorFieldMultigrid> vector_field_multigrid ;
+
 
 };
 
@@ -36,6 +36,7 @@
 #include <cstdio>
 #include <cstdlib>
 #include <ctime>
+#include <algorithm>
 #include "cholmod_matrix.h"
 
 #include "tele_basicType.h"
@@ -43,137 +44,16 @@
 
 
 #include "tele2d.h"
+#include "gridMultigrid.h"
 
 
-typedef Cholmod_matrix<double>			CMatrix;
+#define CONSTRAINT_PENALTY		1.0e8
+#define MAX_UPDOWN_PER_CALL		256		// more changed vertices than this: refactorize
+#define MAX_UPDOWN_PER_FACTOR	2048	// bound the round off of repeated 1e8 up/downdates, ~1e-8 relative to a fresh factor
 
 
-void tele2d::computeVectorField(){
-
-	unsigned time1, time2, time3 ;
-	time1 = clock() ;
-
-	std::vector<std::vector<double2>>  allcurves = curves ;
-	vector_field.clear() ;
-	vector_field.resize(resolution*resolution) ;
-
-	// delete too short curves
-	for( int i=0; i<allcurves.size(); ++i ){
-		if( allcurves[i].size() < 5 )
-			allcurves.erase( allcurves.begin() + i ) ;
-	}
-
-	if( allcurves.size() == 0 ){
-		std::cout<<"no valid curves!" ;
-		exit(1) ;
-	}
-
-	// mark constrained vertices
-	constrained_vertices_mark.clear() ;
-	for( int i=0; i<resolution; ++i ) {
-		std::vector<int> a ;
-		for( int j=0;j<resolution; ++j )
-			a.push_back(0) ;
-		constrained_vertices_mark.push_back(a) ;
-	}
-	for( int i=0; i<allcurves.size(); ++ i){
-		for( int j =0; j<allcurves[i].size(); ++ j){
-			// get x index of closest vertices
-			float x = allcurves[i][j].x * resolution - 0.5 ;
-			int ix ;
-			if( x-floor(x) < 0.5 ) ix = floor(x) ;
-			else	ix = ceil( x ) ;
-			// get y index of closest vertices
-			float y = allcurves[i][j].y * resolution - 0.5 ;
-			int iy ;
-			if( y-floor(y) < 0.5 ) iy = floor(y) ;
-			else	iy = ceil( y ) ;
-
-			if( ix < 0 ) ix = 0;
-			if( ix > resolution-1) ix = resolution -1;
-			if( iy < 0 ) iy = 0;
-			if( iy > resolution-1) iy = resolution -1;
-
-			constrained_vertices_mark[ix][iy] = 1 ;
-
-		}
-	}
-
-	// compute b
-	std::vector<double2> b ;
-	b.resize(resolution*resolution) ;
-	for( int i=0; i<resolution; ++i ){
-		for( int j=0; j<resolution; ++j){
-			
-			if(constrained_vertices_mark[i][j] == 0 ){
-				b[i+j*resolution].x = 0; 
-				b[i+j*resolution].y = 0;
-				continue ;
-			}
-
-			// otherwise, the vertex indexed by (i,j) is constrained
-			double vx = ((double)i+0.5)/(double)resolution ; 
-			double vy = ((double)j+0.5)/(double)resolution ; 
-			
-			// search for the closest points
-			int curveid_record = 0;
-			int pointid_record = 0;
-			double mindis = 1000.0f ;
-			for( int curveid=0; curveid<allcurves.size(); ++curveid ){				
-				for( int pointid=0; pointid<allcurves[curveid].size(); ++pointid  ){
-					double quadratic_dis = ( allcurves[curveid][pointid].x - vx )*( allcurves[curveid][pointid].x - vx ) + ( allcurves[curveid][pointid].y - vy )*( allcurves[curveid][pointid].y - vy ) ;
-					if( quadratic_dis < mindis ){
-							mindis = quadratic_dis ;
-							curveid_record = curveid ;
-							pointid_record = pointid ;
-					}
-				}
-			}
-
-
-
-			// compute the vector of the vertex indexed by (i,j)
-			int pid1 = pointid_record-1 > 0 ? pointid_record-1 : 0 ;
-			int pid2 = pointid_record+1 <  allcurves[curveid_record].size()-1 ? pointid_record+1 : allcurves[curveid_record].size()-1;
-
-			double2 vector_of_vertex ;
-			vector_of_vertex.x = allcurves[curveid_record][pid2].x - allcurves[curveid_record][pid1].x ;
-			vector_of_vertex.y = allcurves[curveid_record][pid2].y - allcurves[curveid_record][pid1].y ;
-			double norm = sqrt( vector_of_vertex.x * vector_of_vertex.x + vector_of_vertex.y * vector_of_vertex.y) ;
-			vector_of_vertex.x /= norm ;
-			vector_of_vertex.y /= norm ;
-
-      if (!(norm > 0 && norm < 1))
-      {
-        b[i+j*resolution ].x = 0;
-        b[i+j*resolution ].y = 0;
-      }
-      else
-      {
-        b[i+j*resolution ] = vector_of_vertex ;
-      }
-
-			//assert( norm > 0 && norm < 1) ;
-
-			//std::cout<<"norm "<<norm<<std::endl;
-			
-
-
-
-		}
-	}
-
-
-	// compute Pb
-	std::vector<double2> Pb = b ;
-	for( int i=0; i<Pb.size(); ++i ){
-		Pb[i].x *= 1.0e8 ;
-		Pb[i].y *= 1.0e8 ;
-	}
-
-	// compute L+P
-	int vnum =  resolution*resolution  ;
-	sparse_matrix L_add_P(vnum) ;  // create a sparse matrix of vnum rows
+// L (D - W) of the grid, it only depends on the resolution
+static void build_laplacian( int resolution, sparse_matrix &L_add_P ){
 
 	// L_add_P <- D - W
 	for( int id_x =0; id_x<resolution; ++id_x ){
@@ -271,90 +151,406 @@ void tele2d::computeVectorField(){
 
 		}
 	}
-	// L_add_P <- D - W + P
-	for( int i=0; i<resolution; ++i ){
-		for( int j=0; j<resolution; ++j){
-			if(constrained_vertices_mark[i][j] == 1  ){
-				int vid = i + j*resolution ;
-				//L_add_P[vid+vid*vnum]+=1e8 ; 
-				L_add_P.pluse(vid,vid, 1.0e8  ) ;
+}
+
+
+// The system of computeVectorField is (L + P) v = P b, L only depends on the resolution
+// and P is CONSTRAINT_PENALTY on the constrained vertices. The analysis and the factor are
+// kept: if the constrained vertices are the same as last time only the solve is done, if
+// a few of them changed the factor gets rank one up/downdates of P, otherwise it is
+// refactorized numerically with the same analysis (the pattern of L + P doesn't change).
+// A downdate takes the penalty off a diagonal of about 1e8, so it loses about eps * 1e8 of
+// the remaining entries: the field differs from the refactorized one by ~1e-8 relative, it
+// doesn't grow with the number of up/downdates up to MAX_UPDOWN_PER_FACTOR.
+struct VectorFieldSolver{
 
+	cholmod_common c ;
+	cholmod_sparse *A ;					// lower triangle of L + P
+	cholmod_factor *L ;
+	int resolution ;
+	std::vector<int> diag_pos ;			// index of the diagonal of each column in A->x
+	std::vector<int> inv_perm ;			// vertex -> row of the factor
+	std::vector<int> marks ;			// constrained vertices the factor is for
+	int n_updown ;						// up/downdated columns since the last factorization
+
+	VectorFieldSolver(){
+		cholmod_start( &c ) ;
+		c.supernodal = CHOLMOD_SIMPLICIAL ;	// up/downdates need a simplicial LDL' factor
+		A = NULL ;
+		L = NULL ;
+		resolution = 0 ;
+		n_updown = 0 ;
+	}
+
+	~VectorFieldSolver(){
+		if( L ) cholmod_free_factor( &L, &c ) ;
+		if( A ) cholmod_free_sparse( &A, &c ) ;
+		cholmod_finish( &c ) ;
+	}
+
+	void build( int res, const std::vector<int> &new_marks ){
+
+		if( L ) cholmod_free_factor( &L, &c ) ;
+		if( A ) cholmod_free_sparse( &A, &c ) ;
+
+		resolution = res ;
+		int vnum = res * res ;
+		sparse_matrix L_add_P( vnum ) ;
+		build_laplacian( res, L_add_P ) ;
+
+		// compressed columns of the lower triangle, the diagonal first
+		int nnz = 0 ;
+		for( int i=0; i<vnum; ++i )
+			for( int j=0; j<L_add_P.data[i].size(); ++j )
+				if( L_add_P.data[i][j].row >= i ) ++nnz ;
+
+		A = cholmod_allocate_sparse( vnum, vnum, nnz, TRUE, TRUE, -1, CHOLMOD_REAL, &c ) ;
+		int *Ap = (int*)A->p ;
+		int *Ai = (int*)A->i ;
+		double *Ax = (double*)A->x ;
+		diag_pos.resize( vnum ) ;
+		int pos = 0 ;
+		for( int i=0; i<vnum; ++i ){
+			Ap[i] = pos ;
+			std::vector<smnode> column ;
+			for( int j=0; j<L_add_P.data[i].size(); ++j )
+				if( L_add_P.data[i][j].row >= i ) column.push_back( L_add_P.data[i][j] ) ;
+			std::sort( column.begin(), column.end(), []( const smnode &a, const smnode &b ){ return a.row < b.row ; } ) ;
+			diag_pos[i] = pos ;
+			for( int j=0; j<column.size(); ++j ){
+				Ai[pos] = column[j].row ;
+				Ax[pos] = column[j].val ;
+				++pos ;
 			}
 		}
+		Ap[vnum] = pos ;
+
+		marks = new_marks ;
+		for( int i=0; i<vnum; ++i )
+			if( marks[i] ) Ax[diag_pos[i]] += CONSTRAINT_PENALTY ;
+
+		L = cholmod_analyze( A, &c ) ;
+		cholmod_factorize( A, L, &c ) ;
+		n_updown = 0 ;
+
+		inv_perm.resize( vnum ) ;
+		int *perm = (int*)L->Perm ;
+		for( int k=0; k<vnum; ++k )
+			inv_perm[perm[k]] = k ;
 	}
 
+	void update( const std::vector<int> &new_marks ){
+
+		std::vector<int> added, removed ;
+		for( int i=0; i<new_marks.size(); ++i ){
+			if( new_marks[i] && !marks[i] ) added.push_back( i ) ;
+			if( !new_marks[i] && marks[i] ) removed.push_back( i ) ;
+		}
+		if( added.empty() && removed.empty() )
+			return ;
+
+		double *Ax = (double*)A->x ;
+		for( int k=0; k<added.size(); ++k )		Ax[diag_pos[added[k]]] += CONSTRAINT_PENALTY ;
+		for( int k=0; k<removed.size(); ++k )	Ax[diag_pos[removed[k]]] -= CONSTRAINT_PENALTY ;
+		marks = new_marks ;
+
+		int n_changed = added.size() + removed.size() ;
+		if( n_changed <= MAX_UPDOWN_PER_CALL && n_updown + n_changed <= MAX_UPDOWN_PER_FACTOR ){
+			// P changes by sqrt(penalty)^2 * e_i e_i' for each vertex
+			bool ok = updown( TRUE, added ) && updown( FALSE, removed ) ;
+			n_updown += n_changed ;
+			if( ok ) return ;
+		}
 
+		cholmod_factorize( A, L, &c ) ;
+		n_updown = 0 ;
+	}
 
+	bool updown( int is_update, const std::vector<int> &vertices ){
+
+		if( vertices.empty() )
+			return true ;
+
+		// one column per vertex, rows in the permuted order of the factor
+		int n = vertices.size() ;
+		cholmod_sparse *C = cholmod_allocate_sparse( A->nrow, n, n, TRUE, TRUE, 0, CHOLMOD_REAL, &c ) ;
+		int *Cp = (int*)C->p ;
+		int *Ci = (int*)C->i ;
+		double *Cx = (double*)C->x ;
+		for( int k=0; k<n; ++k ){
+			Cp[k] = k ;
+			Ci[k] = inv_perm[vertices[k]] ;
+			Cx[k] = sqrt( CONSTRAINT_PENALTY ) ;
+		}
+		Cp[n] = n ;
 
-	// solve the linear system with cholmod
-	cholmod_sparse *A ;
-	cholmod_dense *x, *y, *b1 ;
-	double one [2] = {1,0}, m1 [2] = {-1,0} ; /* basic scalars */
-	cholmod_factor *L ;
-	cholmod_common c ;
-	cholmod_start (&c) ;; /* start CHOLMOD */
-	
-	//A = cholmod_read_sparse (pFile, &c) ; /* read in a matrix */
-	CMatrix  *SM = new CMatrix( vnum, true, &c) ;
-	//for( int i=0; i<vnum; ++i ){
-	//	for( int j=0; j<vnum; ++j ){
-	//		if( L_add_P.getValue(j,i)!=0 )
-	//			SM->set_coef(i, j,L_add_P.getValue(j,i) ) ;
-	//	}
-	//}
-	for( int i=0; i<L_add_P.data.size(); ++i){
-		for( int j=0; j<L_add_P.data[i].size(); ++j)
-			SM->set_coef(L_add_P.data[i][j].row, i,  L_add_P.data[i][j].val ) ;
+		int ok = cholmod_updown( is_update, C, L, &c ) ;
+		cholmod_free_sparse( &C, &c ) ;
+		return ok && c.status == CHOLMOD_OK ;
 	}
 
-	A =(cholmod_sparse *) SM->get_cholmod_sparse();
+	// both coordinates in one solve
+	void solve( const std::vector<double2> &Pb, std::vector<double2> &field ){
+
+		int vnum = Pb.size() ;
+		cholmod_dense *b = cholmod_allocate_dense( vnum, 2, vnum, CHOLMOD_REAL, &c ) ;
+		double *bx = (double*)b->x ;
+		for( int i=0; i<vnum; ++i ){
+			bx[i] = Pb[i].x ;
+			bx[vnum+i] = Pb[i].y ;
+		}
+
+		cholmod_dense *x = cholmod_solve( CHOLMOD_A, L, b, &c ) ;
+		double *xx = (double*)x->x ;
+		for( int i=0; i<vnum; ++i ){
+			field[i].x = xx[i] ;
+			field[i].y = xx[vnum+i] ;
+		}
+
+		cholmod_free_dense( &x, &c ) ;
+		cholmod_free_dense( &b, &c ) ;
+	}
+};
+
+
+// The same system by GridMultigrid, no factorization so the cost stays linear in the number
+// of cells. The hierarchy is rebuilt when the constrained vertices change, otherwise the last
+// solution is the initial guess.
+struct VectorFieldMultigrid{
+
+	GridMultigrid multigrid ;
+	std::vector<int> marks ;
+	std::vector<double> x, y ;
+
+	void solve( int res, const std::vector<int> &new_marks, const std::vector<double2> &Pb, std::vector<double2> &field ){
+
+		bool warm_start = multigrid.resolution() == res && new_marks == marks ;
+		if( !warm_start ){
+			std::vector<double> P( new_marks.size() ) ;
+			for( int i=0; i<new_marks.size(); ++i )
+				P[i] = new_marks[i] ? CONSTRAINT_PENALTY : 0.0 ;
+			multigrid.setSystem( res, P ) ;
+			marks = new_marks ;
+		}
+
+		int vnum = Pb.size() ;
+		std::vector<double> bx( vnum ), by( vnum ) ;
+		for( int i=0; i<vnum; ++i ){
+			bx[i] = Pb[i].x ;
+			by[i] = Pb[i].y ;
+		}
+		multigrid.solve( bx, x, warm_start ) ;
+		multigrid.solve( by, y, warm_start ) ;
+
+		for( int i=0; i<vnum; ++i ){
+			field[i].x = x[i] ;
+			field[i].y = y[i] ;
+		}
+	}
+};
 
 
-	time2 = clock() ;
+// curve points bucketed on the grid of the vector field, for the closest point of a vertex
+class CurvePointGrid{
+public:
+	CurvePointGrid( const std::vector<std::vector<double2>> &curves, int res ) : allcurves(curves), resolution(res){
 
-	//cholmod_print_sparse (A, "A", &c) ; /* print the matrix */
+		buckets.resize( res * res ) ;
+		for( int curveid=0; curveid<curves.size(); ++curveid )
+			for( int pointid=0; pointid<curves[curveid].size(); ++pointid )
+				buckets[ bucket_of( curves[curveid][pointid] ) ].push_back( int2( curveid, pointid ) ) ;
+	}
 
-	if (A == NULL || A->stype == 0) /* A must be symmetric */
-	{
-		cholmod_free_sparse (&A, &c) ;
-		cholmod_finish (&c) ;
-		std::cout << "fail to load the matrix or it's not symmeric!"<<std::endl;
+	// the same point as the brute force scan: the smallest distance, then the smallest
+	// (curveid, pointid)
+	void closest( double vx, double vy, int &curveid_record, int &pointid_record ){
+
+		int bx = clamp( (int)floor( vx * resolution ) ) ;
+		int by = clamp( (int)floor( vy * resolution ) ) ;
+		double h = 1.0 / resolution ;
+		double mindis = 1000.0f ;
+		curveid_record = 0;
+		pointid_record = 0;
+
+		for( int r = 0; r < resolution; ++r ){
+			// points in ring r are at least (r - 0.5) * h away from the center of a cell
+			double ring_dis = ( r - 0.5 ) * h ;
+			if( r > 0 && ring_dis * ring_dis > mindis )
+				break ;
+
+			for( int i = bx - r; i <= bx + r; ++i ){
+				for( int j = by - r; j <= by + r; ++j ){
+					if( i < 0 || j < 0 || i >= resolution || j >= resolution ) continue ;
+					if( std::max( abs(i-bx), abs(j-by) ) != r ) continue ;	// ring only
+
+					const std::vector<int2> &bucket = buckets[ i + j * resolution ] ;
+					for( int k=0; k<bucket.size(); ++k ){
+						const double2 &p = allcurves[bucket[k].x][bucket[k].y] ;
+						double quadratic_dis = ( p.x - vx )*( p.x - vx ) + ( p.y - vy )*( p.y - vy ) ;
+						if( quadratic_dis < mindis || ( quadratic_dis == mindis && 
+							( bucket[k].x < curveid_record || ( bucket[k].x == curveid_record && bucket[k].y < pointid_record ) ) ) ){
+							mindis = quadratic_dis ;
+							curveid_record = bucket[k].x ;
+							pointid_record = bucket[k].y ;
+						}
+					}
+				}
+			}
+		}
+	}
+
+private:
+	int clamp( int id ){
+		return id < 0 ? 0 : ( id > resolution-1 ? resolution-1 : id ) ;
+	}
+
+	int bucket_of( const double2 &p ){
+		return clamp( (int)floor( p.x * resolution ) ) + clamp( (int)floor( p.y * resolution ) ) * resolution ;
+	}
+
+	const std::vector<std::vector<double2>> &allcurves ;
+	int resolution ;
+	std::vector<std::vector<int2>> buckets ;
+};
+
+
+void tele2d::computeVectorField(){
+
+	unsigned time1, time2, time3 ;
+	time1 = clock() ;
+
+	std::vector<std::vector<double2>>  allcurves = curves ;
+	vector_field.clear() ;
+	vector_field.resize(resolution*resolution) ;
+
+	// delete too short curves
+	for( int i=0; i<allcurves.size(); ++i ){
+		if( allcurves[i].size() < 5 )
+			allcurves.erase( allcurves.begin() + i ) ;
+	}
+
+	if( allcurves.size() == 0 ){
+		std::cout<<"no valid curves!" ;
 		exit(1) ;
 	}
 
-	b1 = cholmod_zeros(vnum, 1, CHOLMOD_REAL, &c);
+	// mark constrained vertices
+	constrained_vertices_mark.clear() ;
+	for( int i=0; i<resolution; ++i ) {
+		std::vector<int> a ;
+		for( int j=0;j<resolution; ++j )
+			a.push_back(0) ;
+		constrained_vertices_mark.push_back(a) ;
+	}
+	for( int i=0; i<allcurves.size(); ++ i){
+		for( int j =0; j<allcurves[i].size(); ++ j){
+			// get x index of closest vertices
+			float x = allcurves[i][j].x * resolution - 0.5 ;
+			int ix ;
+			if( x-floor(x) < 0.5 ) ix = floor(x) ;
+			else	ix = ceil( x ) ;
+			// get y index of closest vertices
+			float y = allcurves[i][j].y * resolution - 0.5 ;
+			int iy ;
+			if( y-floor(y) < 0.5 ) iy = floor(y) ;
+			else	iy = ceil( y ) ;
+
+			if( ix < 0 ) ix = 0;
+			if( ix > resolution-1) ix = resolution -1;
+			if( iy < 0 ) iy = 0;
+			if( iy > resolution-1) iy = resolution -1;
+
+			constrained_vertices_mark[ix][iy] = 1 ;
+
+		}
+	}
+
+	// compute b
+	CurvePointGrid point_grid( allcurves, resolution ) ;
+	std::vector<double2> b ;
+	b.resize(resolution*resolution) ;
+	for( int i=0; i<resolution; ++i ){
+		for( int j=0; j<resolution; ++j){
+			
+			if(constrained_vertices_mark[i][j] == 0 ){
+				b[i+j*resolution].x = 0; 
+				b[i+j*resolution].y = 0;
+				continue ;
+			}
+
+			// otherwise, the vertex indexed by (i,j) is constrained
+			double vx = ((double)i+0.5)/(double)resolution ; 
+			double vy = ((double)j+0.5)/(double)resolution ; 
+			
+			// search for the closest points
+			int curveid_record = 0;
+			int pointid_record = 0;
+			point_grid.closest( vx, vy, curveid_record, pointid_record ) ;
+
+
+			// compute the vector of the vertex indexed by (i,j)
+			int pid1 = pointid_record-1 > 0 ? pointid_record-1 : 0 ;
+			int pid2 = pointid_record+1 <  allcurves[curveid_record].size()-1 ? pointid_record+1 : allcurves[curveid_record].size()-1;
 
+			double2 vector_of_vertex ;
+			vector_of_vertex.x = allcurves[curveid_record][pid2].x - allcurves[curveid_record][pid1].x ;
+			vector_of_vertex.y = allcurves[curveid_record][pid2].y - allcurves[curveid_record][pid1].y ;
+			double norm = sqrt( vector_of_vertex.x * vector_of_vertex.x + vector_of_vertex.y * vector_of_vertex.y) ;
+			vector_of_vertex.x /= norm ;
+			vector_of_vertex.y /= norm ;
 
-	// --------------------- x demension -----------------------
-	for( int i =0 ;i<Pb.size(); ++i ){
-		((double*)(b1->x))[i] = Pb[i].x ;
+      if (!(norm > 0 && norm < 1))
+      {
+        b[i+j*resolution ].x = 0;
+        b[i+j*resolution ].y = 0;
+      }
+      else
+      {
+        b[i+j*resolution ] = vector_of_vertex ;
+      }
+
+			//assert( norm > 0 && norm < 1) ;
+
+		}
+	}
+
+
+	// compute Pb
+	std::vector<double2> Pb = b ;
+	for( int i=0; i<Pb.size(); ++i ){
+		Pb[i].x *= CONSTRAINT_PENALTY ;
+		Pb[i].y *= CONSTRAINT_PENALTY ;
 	}
-	L = cholmod_analyze (A, &c) ; /* analyze */
-	cholmod_factorize (A, L, &c) ; /* factorize */
-	x = cholmod_solve (CHOLMOD_A, L, b1, &c) ; /* solve Ax=b */
 
+	// L + P, factorized only if the constrained vertices changed
+	int vnum =  resolution*resolution  ;
+	std::vector<int> marks( vnum, 0 ) ;
+	for( int i=0; i<resolution; ++i )
+		for( int j=0; j<resolution; ++j)
+			marks[i + j*resolution] = constrained_vertices_mark[i][j] ;
+
+	if( resolution >= multigrid_resolution ){
+
+		time2 = clock() ;
 
-	// write x-values
-	for( int i=0; i<vector_field.size(); ++i)
-		vector_field[i].x = ((double*)(x->x))[i] ;
-	// --------------------- y demension -----------------------
-	for( int i =0 ;i<Pb.size(); ++i ){
-		((double*)(b1->x))[i] = Pb[i].y ;
+		if( !vector_field_multigrid )
+			vector_field_multigrid.reset( new VectorFieldMultigrid ) ;
+		vector_field_multigrid->solve( resolution, marks, Pb, vector_field ) ;
 	}
-	y = cholmod_solve (CHOLMOD_A, L, b1, &c) ; /* solve Ay=b */
-	// write y-values
-	for( int i=0; i<vector_field.size(); ++i)
-		vector_field[i].y = ((double*)(y->x))[i] ;
+	else {
 
+		if( !vector_field_solver )
+			vector_field_solver.reset( new VectorFieldSolver ) ;
+		if( vector_field_solver->resolution != resolution )
+			vector_field_solver->build( resolution, marks ) ;
+		else
+			vector_field_solver->update( marks ) ;
 
+		time2 = clock() ;
 
-	cholmod_free_factor (&L, &c) ; 
-	cholmod_free_dense (&x, &c) ;
-	cholmod_free_dense (&y, &c) ;
-	cholmod_free_dense (&b1, &c) ;
-	//delete L_add_P ;
-	delete SM ;
-	cholmod_finish (&c) ; /* finish CHOLMOD */
+		// solve the linear system with cholmod
+		vector_field_solver->solve( Pb, vector_field ) ;
+	}
 
 
 
@@ -384,10 +580,5 @@ void tele2d::computeVectorField(){
 	//std::cout<<"time consumed by solving the system: " << (double)(time3-time2)/CLOCKS_PER_SEC <<" s" <<std::endl ;
 
 	//std::cout<<"vector field computing completed."<<std::endl; ;
-	int count = 0;
-	for( int i=0; i<L_add_P.data.size(); ++i)
-		count += L_add_P.data[i].size() ;
-
-	//std::cout << "nonzero number: " << count <<std::endl; 
 
-}
\ No newline at end of file
+}
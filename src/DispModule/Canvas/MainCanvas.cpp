@@ -3,6 +3,7 @@
 #include "PolygonMesh.h"
 
 #include "YMLHandler.h"
+#include "DebugExporter.h"
 #include "Colormap.h"
 #include "CurvesUtility.h"
 #include "ParameterMgr.h"
@@ -996,18 +997,15 @@ void MainCanvas::drawInfo(double z_scale)
 
   if (LG::GlobalParameterMgr::GetInstance()->get_parameter<int>("SnapShot:SaveToFile") == 1)
   {
+    // written in the background, the buffers are copied when queued
+    DebugExporter* exporter = DebugExporter::GetInstance();
     std::string data_path = model->getOutputPath();
-    cv::imwrite(data_path + "/r_img.png", r_img*255);
-    cv::imwrite(data_path + "/z_img.png", z_img*255);
-    cv::imwrite(data_path + "/primitive_img.png", primitive_ID_img*255);
-    
-    std::ofstream mat_output(data_path + "/height_img.mat");
-    if (mat_output)
-    {
-      Eigen::Map<Eigen::MatrixXf>temp_mat(z_img.ptr<float>(), z_img.cols, z_img.rows);
-      mat_output << ((1 - temp_mat.array()).matrix() * z_scale).transpose();
-      mat_output.close();
-    }
+    exporter->writeScaled(DebugExporter::EXPORT_ALWAYS, data_path + "/r_img.png", r_img, 255);
+    exporter->writeScaled(DebugExporter::EXPORT_ALWAYS, data_path + "/z_img.png", z_img, 255);
+    exporter->writeScaled(DebugExporter::EXPORT_ALWAYS, data_path + "/primitive_img.png", primitive_ID_img, 255);
+
+    cv::Mat height_img = (1 - z_img) * z_scale;
+    exporter->writeText(DebugExporter::EXPORT_ALWAYS, data_path + "/height_img.mat", height_img);
     //YMLHandler::saveToFile(data_path, std::string("rendered.yml"), r_img);
     //YMLHandler::saveToFile(data_path, std::string("primitive.yml"), primitive_ID);
   }
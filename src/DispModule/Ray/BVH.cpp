@@ -0,0 +1,445 @@
+#include "BVH.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <iostream>
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define BVH_USE_SSE
+#endif
+
+namespace
+{
+  const int PACKET_SIZE = 4;
+  const int SAH_BIN_NUM = 16;
+  const int MAX_LEAF_SIZE = 16; // triangles, a larger node is always split
+  const int MAX_DEPTH = 64;
+  const float TRAVERSAL_COST = 1.0f; // relative to testing one packet
+
+  inline float surfaceArea(const float bmin[3], const float bmax[3])
+  {
+    float dx = bmax[0] - bmin[0], dy = bmax[1] - bmin[1], dz = bmax[2] - bmin[2];
+    return 2.0f * (dx * dy + dy * dz + dz * dx);
+  }
+
+  inline int packetNum(int n_tri)
+  {
+    return (n_tri + PACKET_SIZE - 1) / PACKET_SIZE;
+  }
+
+  inline void resetBox(float bmin[3], float bmax[3])
+  {
+    for (int i = 0; i < 3; ++i)
+    {
+      bmin[i] = std::numeric_limits<float>::max();
+      bmax[i] = -std::numeric_limits<float>::max();
+    }
+  }
+
+  inline void growBox(float bmin[3], float bmax[3], const float pmin[3], const float pmax[3])
+  {
+    for (int i = 0; i < 3; ++i)
+    {
+      bmin[i] = std::min(bmin[i], pmin[i]);
+      bmax[i] = std::max(bmax[i], pmax[i]);
+    }
+  }
+
+  inline bool hitBox(const float bmin[3], const float bmax[3], const float origin[3], const float inv_dir[3], float t_max)
+  {
+    float t_near = 0.0f, t_far = t_max;
+    for (int i = 0; i < 3; ++i)
+    {
+      float t0 = (bmin[i] - origin[i]) * inv_dir[i];
+      float t1 = (bmax[i] - origin[i]) * inv_dir[i];
+      if (t0 > t1) std::swap(t0, t1);
+      t_near = std::max(t_near, t0);
+      t_far = std::min(t_far, t1);
+    }
+    return t_near <= t_far;
+  }
+}
+
+BVH::BVH()
+{
+  tolerance = 0.001f;
+}
+
+BVH::~BVH()
+{}
+
+void BVH::clear()
+{
+  nodes.clear();
+  packets.clear();
+  tri_index.clear();
+  tri_vertices.clear();
+}
+
+void BVH::build(const std::vector<float>& vertices, const std::vector<unsigned int>& faces)
+{
+  this->clear();
+
+  int n_tri = (int)faces.size() / 3;
+  if (n_tri == 0) return;
+
+  tri_vertices.resize(9 * size_t(n_tri));
+  std::vector<BuildTriangle> build_tris(n_tri);
+  for (int i = 0; i < n_tri; ++i)
+  {
+    float* tri = &tri_vertices[9 * size_t(i)];
+    for (int j = 0; j < 3; ++j)
+    {
+      const float* v = &vertices[3 * size_t(faces[3 * i + j])];
+      tri[3 * j + 0] = v[0];
+      tri[3 * j + 1] = v[1];
+      tri[3 * j + 2] = v[2];
+    }
+
+    // the box grows with the tolerance so a grazing hit is not culled by the nodes
+    BuildTriangle& build_tri = build_tris[i];
+    for (int k = 0; k < 3; ++k)
+    {
+      float lo = std::min(tri[k], std::min(tri[3 + k], tri[6 + k]));
+      float hi = std::max(tri[k], std::max(tri[3 + k], tri[6 + k]));
+      float pad = tolerance * (hi - lo) + 1e-6f * (std::fabs(lo) + std::fabs(hi));
+      build_tri.bmin[k] = lo - pad;
+      build_tri.bmax[k] = hi + pad;
+      build_tri.centroid[k] = 0.5f * (lo + hi);
+    }
+  }
+
+  tri_index.resize(n_tri);
+  for (int i = 0; i < n_tri; ++i) tri_index[i] = i;
+
+  nodes.reserve(2 * size_t(n_tri / PACKET_SIZE + 1));
+  packets.reserve(size_t(n_tri / PACKET_SIZE + 1));
+  this->buildNode(build_tris, 0, n_tri, 0);
+
+  // the packets have a copy of everything the queries need
+  std::vector<float>().swap(tri_vertices);
+
+  std::cout << "BVH built: " << n_tri << " triangles, " << nodes.size() << " nodes, " << packets.size() << " packets.\n";
+}
+
+int BVH::buildNode(std::vector<BuildTriangle>& build_tris, int begin, int end, int depth)
+{
+  int node_id = (int)nodes.size();
+  nodes.push_back(BVHNode());
+
+  float bmin[3], bmax[3], cmin[3], cmax[3];
+  resetBox(bmin, bmax);
+  resetBox(cmin, cmax);
+  for (int i = begin; i < end; ++i)
+  {
+    const BuildTriangle& tri = build_tris[tri_index[i]];
+    growBox(bmin, bmax, tri.bmin, tri.bmax);
+    growBox(cmin, cmax, tri.centroid, tri.centroid);
+  }
+  for (int i = 0; i < 3; ++i)
+  {
+    nodes[node_id].bmin[i] = bmin[i];
+    nodes[node_id].bmax[i] = bmax[i];
+  }
+
+  int n_tri = end - begin;
+  if (n_tri <= PACKET_SIZE || depth >= MAX_DEPTH)
+  {
+    this->makeLeaf(nodes[node_id], begin, end);
+    return node_id;
+  }
+
+  // binned SAH, the cost of a side counts the packets, not the triangles
+  float best_cost = std::numeric_limits<float>::max();
+  int best_axis = -1;
+  int best_split = 0;
+  for (int axis = 0; axis < 3; ++axis)
+  {
+    float extent = cmax[axis] - cmin[axis];
+    if (extent <= 0.0f) continue;
+
+    int bin_count[SAH_BIN_NUM] = { 0 };
+    float bin_min[SAH_BIN_NUM][3], bin_max[SAH_BIN_NUM][3];
+    for (int b = 0; b < SAH_BIN_NUM; ++b) resetBox(bin_min[b], bin_max[b]);
+
+    float scale = SAH_BIN_NUM / extent;
+    for (int i = begin; i < end; ++i)
+    {
+      const BuildTriangle& tri = build_tris[tri_index[i]];
+      int b = std::min(SAH_BIN_NUM - 1, (int)((tri.centroid[axis] - cmin[axis]) * scale));
+      ++bin_count[b];
+      growBox(bin_min[b], bin_max[b], tri.bmin, tri.bmax);
+    }
+
+    float left_area[SAH_BIN_NUM];
+    int left_count[SAH_BIN_NUM];
+    float acc_min[3], acc_max[3];
+    resetBox(acc_min, acc_max);
+    int acc_count = 0;
+    for (int b = 0; b < SAH_BIN_NUM - 1; ++b)
+    {
+      acc_count += bin_count[b];
+      if (bin_count[b] > 0) growBox(acc_min, acc_max, bin_min[b], bin_max[b]);
+      left_count[b] = acc_count;
+      left_area[b] = acc_count > 0 ? surfaceArea(acc_min, acc_max) : 0.0f;
+    }
+
+    resetBox(acc_min, acc_max);
+    acc_count = 0;
+    for (int b = SAH_BIN_NUM - 1; b > 0; --b)
+    {
+      acc_count += bin_count[b];
+      if (bin_count[b] > 0) growBox(acc_min, acc_max, bin_min[b], bin_max[b]);
+      if (acc_count == 0 || left_count[b - 1] == 0) continue;
+
+      float cost = left_area[b - 1] * packetNum(left_count[b - 1]) + surfaceArea(acc_min, acc_max) * packetNum(acc_count);
+      if (cost < best_cost)
+      {
+        best_cost = cost;
+        best_axis = axis;
+        best_split = b;
+      }
+    }
+  }
+
+  int mid = begin;
+  if (best_axis >= 0)
+  {
+    float node_area = surfaceArea(bmin, bmax);
+    float leaf_cost = node_area * packetNum(n_tri);
+    float split_cost = node_area * TRAVERSAL_COST + best_cost;
+    if (n_tri <= MAX_LEAF_SIZE && leaf_cost <= split_cost)
+    {
+      this->makeLeaf(nodes[node_id], begin, end);
+      return node_id;
+    }
+
+    float split_min = cmin[best_axis];
+    float scale = SAH_BIN_NUM / (cmax[best_axis] - cmin[best_axis]);
+    int axis = best_axis;
+    int split = best_split;
+    mid = (int)(std::partition(tri_index.begin() + begin, tri_index.begin() + end, [&](int id)
+    {
+      return std::min(SAH_BIN_NUM - 1, (int)((build_tris[id].centroid[axis] - split_min) * scale)) < split;
+    }) - tri_index.begin());
+  }
+
+  if (mid == begin || mid == end)
+  {
+    // all the centroids are at the same place, split in the middle of the list
+    if (n_tri <= MAX_LEAF_SIZE)
+    {
+      this->makeLeaf(nodes[node_id], begin, end);
+      return node_id;
+    }
+    best_axis = 0;
+    for (int i = 1; i < 3; ++i)
+    {
+      if (bmax[i] - bmin[i] > bmax[best_axis] - bmin[best_axis]) best_axis = i;
+    }
+    mid = begin + n_tri / 2;
+  }
+
+  this->buildNode(build_tris, begin, mid, depth + 1);
+  int right = this->buildNode(build_tris, mid, end, depth + 1);
+  nodes[node_id].first = right;
+  nodes[node_id].count = -1 - best_axis;
+  return node_id;
+}
+
+void BVH::makeLeaf(BVHNode& node, int begin, int end)
+{
+  node.first = (int)packets.size();
+  node.count = packetNum(end - begin);
+
+  for (int i = begin; i < end; i += PACKET_SIZE)
+  {
+    TrianglePacket packet;
+    for (int lane = 0; lane < PACKET_SIZE; ++lane)
+    {
+      if (i + lane < end)
+      {
+        int id = tri_index[i + lane];
+        const float* tri = &tri_vertices[9 * size_t(id)];
+        for (int k = 0; k < 3; ++k)
+        {
+          packet.v0[k][lane] = tri[k];
+          packet.e1[k][lane] = tri[3 + k] - tri[k];
+          packet.e2[k][lane] = tri[6 + k] - tri[k];
+        }
+        packet.id[lane] = id;
+      }
+      else
+      {
+        for (int k = 0; k < 3; ++k)
+        {
+          packet.v0[k][lane] = 0.0f;
+          packet.e1[k][lane] = 0.0f;
+          packet.e2[k][lane] = 0.0f;
+        }
+        packet.id[lane] = -1;
+      }
+    }
+    packets.push_back(packet);
+  }
+}
+
+bool BVH::anyHit(const Eigen::Vector3d& start, const Eigen::Vector3d& end) const
+{
+  float origin[3] = { (float)start[0], (float)start[1], (float)start[2] };
+  float dir[3] = { (float)(end[0] - start[0]), (float)(end[1] - start[1]), (float)(end[2] - start[2]) };
+  float t_hit;
+  int face_id;
+  return this->traverse(origin, dir, true, t_hit, face_id);
+}
+
+bool BVH::closestHit(const Eigen::Vector3d& start, const Eigen::Vector3d& end, double& t, int& face_id) const
+{
+  float origin[3] = { (float)start[0], (float)start[1], (float)start[2] };
+  float dir[3] = { (float)(end[0] - start[0]), (float)(end[1] - start[1]), (float)(end[2] - start[2]) };
+  float t_hit;
+  if (this->traverse(origin, dir, false, t_hit, face_id))
+  {
+    t = t_hit;
+    return true;
+  }
+  return false;
+}
+
+bool BVH::traverse(const float origin[3], const float dir[3], bool any_hit, float& t_hit, int& face_id) const
+{
+  if (nodes.empty()) return false;
+
+  // a zero component gets a tiny one instead, keeps the slab test free of 0 * inf
+  float inv_dir[3];
+  for (int i = 0; i < 3; ++i)
+  {
+    float d = std::fabs(dir[i]) > 1e-20f ? dir[i] : (dir[i] < 0.0f ? -1e-20f : 1e-20f);
+    inv_dir[i] = 1.0f / d;
+  }
+
+  // the segment is t in [0, 1], a little more so a hit at the end point is kept
+  float t_max = 1.0f + 1e-6f;
+  bool is_hit = false;
+  int stack[2 * MAX_DEPTH + 2];
+  int n_stack = 0;
+  int node_id = 0;
+  while (true)
+  {
+    const BVHNode& node = nodes[node_id];
+    if (hitBox(node.bmin, node.bmax, origin, inv_dir, t_max))
+    {
+      if (node.count > 0)
+      {
+        for (int i = node.first; i < node.first + node.count; ++i)
+        {
+          float t;
+          int lane = this->intersectPacket(packets[i], origin, dir, t_max, t);
+          if (lane >= 0)
+          {
+            t_hit = t;
+            face_id = packets[i].id[lane];
+            is_hit = true;
+            if (any_hit) return true;
+            t_max = t;
+          }
+        }
+      }
+      else
+      {
+        // visit the near child first so the closest hit shrinks t_max early
+        int axis = -1 - node.count;
+        int near_child = node_id + 1;
+        int far_child = node.first;
+        if (dir[axis] < 0.0f) std::swap(near_child, far_child);
+        stack[n_stack++] = far_child;
+        node_id = near_child;
+        continue;
+      }
+    }
+    if (n_stack == 0) break;
+    node_id = stack[--n_stack];
+  }
+  return is_hit;
+}
+
+int BVH::intersectPacket(const TrianglePacket& packet, const float origin[3], const float dir[3], float t_max, float& t_hit) const
+{
+  // Moller-Trumbore on the 4 lanes, returns the lane of the closest hit before t_max or -1
+  float t_lane[PACKET_SIZE];
+  int mask = 0;
+
+#if defined(BVH_USE_SSE)
+  __m128 dx = _mm_set1_ps(dir[0]), dy = _mm_set1_ps(dir[1]), dz = _mm_set1_ps(dir[2]);
+  __m128 e1x = _mm_loadu_ps(packet.e1[0]), e1y = _mm_loadu_ps(packet.e1[1]), e1z = _mm_loadu_ps(packet.e1[2]);
+  __m128 e2x = _mm_loadu_ps(packet.e2[0]), e2y = _mm_loadu_ps(packet.e2[1]), e2z = _mm_loadu_ps(packet.e2[2]);
+
+  __m128 px = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(dz, e2y));
+  __m128 py = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(dx, e2z));
+  __m128 pz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(dy, e2x));
+  __m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)), _mm_mul_ps(e1z, pz));
+
+  __m128 sx = _mm_sub_ps(_mm_set1_ps(origin[0]), _mm_loadu_ps(packet.v0[0]));
+  __m128 sy = _mm_sub_ps(_mm_set1_ps(origin[1]), _mm_loadu_ps(packet.v0[1]));
+  __m128 sz = _mm_sub_ps(_mm_set1_ps(origin[2]), _mm_loadu_ps(packet.v0[2]));
+
+  __m128 qx = _mm_sub_ps(_mm_mul_ps(sy, e1z), _mm_mul_ps(sz, e1y));
+  __m128 qy = _mm_sub_ps(_mm_mul_ps(sz, e1x), _mm_mul_ps(sx, e1z));
+  __m128 qz = _mm_sub_ps(_mm_mul_ps(sx, e1y), _mm_mul_ps(sy, e1x));
+
+  // the division gives inf or nan on the padding lanes, all the compares below fail on them
+  __m128 inv_det = _mm_div_ps(_mm_set1_ps(1.0f), det);
+  __m128 u = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(sx, px), _mm_mul_ps(sy, py)), _mm_mul_ps(sz, pz)), inv_det);
+  __m128 v = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx), _mm_mul_ps(dy, qy)), _mm_mul_ps(dz, qz)), inv_det);
+  __m128 t = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)), inv_det);
+
+  __m128 neg_tol = _mm_set1_ps(-tolerance);
+  __m128 valid = _mm_cmpneq_ps(det, _mm_setzero_ps());
+  valid = _mm_and_ps(valid, _mm_cmpge_ps(u, neg_tol));
+  valid = _mm_and_ps(valid, _mm_cmpge_ps(v, neg_tol));
+  valid = _mm_and_ps(valid, _mm_cmple_ps(_mm_add_ps(u, v), _mm_set1_ps(1.0f + tolerance)));
+  valid = _mm_and_ps(valid, _mm_cmpge_ps(t, _mm_setzero_ps()));
+  valid = _mm_and_ps(valid, _mm_cmplt_ps(t, _mm_set1_ps(t_max)));
+  mask = _mm_movemask_ps(valid);
+  if (mask == 0) return -1;
+  _mm_storeu_ps(t_lane, t);
+#else
+  for (int lane = 0; lane < PACKET_SIZE; ++lane)
+  {
+    float e1[3] = { packet.e1[0][lane], packet.e1[1][lane], packet.e1[2][lane] };
+    float e2[3] = { packet.e2[0][lane], packet.e2[1][lane], packet.e2[2][lane] };
+    float p[3] = { dir[1] * e2[2] - dir[2] * e2[1], dir[2] * e2[0] - dir[0] * e2[2], dir[0] * e2[1] - dir[1] * e2[0] };
+    float det = e1[0] * p[0] + e1[1] * p[1] + e1[2] * p[2];
+    if (det == 0.0f) continue;
+
+    float inv_det = 1.0f / det;
+    float s[3] = { origin[0] - packet.v0[0][lane], origin[1] - packet.v0[1][lane], origin[2] - packet.v0[2][lane] };
+    float u = (s[0] * p[0] + s[1] * p[1] + s[2] * p[2]) * inv_det;
+    if (!(u >= -tolerance)) continue;
+
+    float q[3] = { s[1] * e1[2] - s[2] * e1[1], s[2] * e1[0] - s[0] * e1[2], s[0] * e1[1] - s[1] * e1[0] };
+    float v = (dir[0] * q[0] + dir[1] * q[1] + dir[2] * q[2]) * inv_det;
+    if (!(v >= -tolerance) || !(u + v <= 1.0f + tolerance)) continue;
+
+    float t = (e2[0] * q[0] + e2[1] * q[1] + e2[2] * q[2]) * inv_det;
+    if (t >= 0.0f && t < t_max)
+    {
+      t_lane[lane] = t;
+      mask |= (1 << lane);
+    }
+  }
+  if (mask == 0) return -1;
+#endif
+
+  int best_lane = -1;
+  for (int lane = 0; lane < PACKET_SIZE; ++lane)
+  {
+    if ((mask & (1 << lane)) && (best_lane < 0 || t_lane[lane] < t_lane[best_lane]))
+    {
+      best_lane = lane;
+    }
+  }
+  t_hit = t_lane[best_lane];
+  return best_lane;
+}
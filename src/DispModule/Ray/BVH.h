@@ -0,0 +1,70 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include "Eigen\Eigen"
+#include <vector>
+
+// Bounding volume hierarchy of a triangle mesh for segment queries.
+// Built with binned SAH, the nodes are kept in one flat array in depth first
+// order (the left child follows its parent) and the triangles of a leaf are
+// stored as packets of 4 so one packet is tested at once with SSE.
+// Queries don't change the tree, so it can be shared by many threads.
+class BVH
+{
+public:
+  BVH();
+  ~BVH();
+
+  void build(const std::vector<float>& vertices, const std::vector<unsigned int>& faces);
+  void clear();
+  inline bool empty() const { return nodes.empty(); };
+  inline int getNodeNum() const { return (int)nodes.size(); };
+
+  // tolerance on the barycentric coordinates, set it before build()
+  inline void setTolerance(float tol) { tolerance = tol; };
+
+  // true if the segment from start to end hits any triangle
+  bool anyHit(const Eigen::Vector3d& start, const Eigen::Vector3d& end) const;
+  // t is the parameter of the closest hit on the segment, in [0, 1]
+  bool closestHit(const Eigen::Vector3d& start, const Eigen::Vector3d& end, double& t, int& face_id) const;
+
+private:
+  struct BVHNode
+  {
+    float bmin[3];
+    int first;  // first packet of a leaf, right child of an inner node
+    float bmax[3];
+    int count;  // number of packets of a leaf, -1 - split axis of an inner node
+  };
+
+  // 4 triangles in SoA layout, v0 and the two edges of each lane
+  // padding lanes have zero edges and id -1, they never hit
+  struct TrianglePacket
+  {
+    float v0[3][4];
+    float e1[3][4];
+    float e2[3][4];
+    int id[4];
+  };
+
+  struct BuildTriangle
+  {
+    float bmin[3];
+    float bmax[3];
+    float centroid[3];
+  };
+
+  int buildNode(std::vector<BuildTriangle>& build_tris, int begin, int end, int depth);
+  void makeLeaf(BVHNode& node, int begin, int end);
+  bool traverse(const float origin[3], const float dir[3], bool any_hit, float& t_hit, int& face_id) const;
+  int intersectPacket(const TrianglePacket& packet, const float origin[3], const float dir[3], float t_max, float& t_hit) const;
+
+private:
+  std::vector<BVHNode> nodes;
+  std::vector<TrianglePacket> packets;
+  std::vector<int> tri_index;   // triangle order of the build
+  std::vector<float> tri_vertices; // v0, v1, v2 of each input triangle
+  float tolerance;
+};
+
+#endif // !BVH_H
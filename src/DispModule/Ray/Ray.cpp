@@ -1,4 +1,5 @@
 #include "Ray.h"
+#include <iostream>
 
 // TODO: use BSP tree or consider using GPU
 bool intersectTriangle(Eigen::Vector3f &p, Eigen::Vector3f &d,
@@ -66,86 +67,27 @@ void Ray::passModel(const std::vector<float> &vertices, const std::vector<unsign
 {
     std::cout<<"Init Ray class...\n";
 
+    // same tolerance the vtkModifiedBSPTree queries used
+    bvh.setTolerance(0.001f);
+    bvh.build(vertices, faces);
 
-    vtkSmartPointer<vtkPoints> points = vtkSmartPointer<vtkPoints>::New();
-
-    points->SetNumberOfPoints(vertices.size()/3);
-
-    for (size_t i = 0; i < vertices.size()/3; ++i)
-    {
-        points->SetPoint(i, vertices[3*i+0], vertices[3*i+1], vertices[3*i+2]);
-
-    }
-
-    vtkSmartPointer<vtkCellArray> triangles = vtkSmartPointer<vtkCellArray>::New();
-    vtkSmartPointer<vtkTriangle> triangle = vtkSmartPointer<vtkTriangle>::New();
-
-    for (size_t i = 0; i < faces.size()/3; ++i)
-    {
-        triangle->GetPointIds()->SetId ( 0, faces[3*i+0] );
-        triangle->GetPointIds()->SetId ( 1, faces[3*i+1] );
-        triangle->GetPointIds()->SetId ( 2, faces[3*i+2] );
-        triangles->InsertNextCell(triangle);
-    }
-
-    //triangles->InsertNextCell(triangle);
-
-    poly_mesh = vtkSmartPointer<vtkPolyData>::New();
-    
-    poly_mesh->SetPoints(points);
-    //std::cout<<"Check mesh right2\n";
-    poly_mesh->SetPolys(triangles);
-    //std::cout<<"Check mesh right3\n";
-
-    bsptree = vtkSmartPointer< vtkModifiedBSPTree >::New();
-    bsptree->SetDataSet(poly_mesh);
-    bsptree->BuildLocator();
-    bsptree->Update();
-
-    //vtkSmartPointer< vtkVertexGlyphFilter > vertex_glyph = vtkSmartPointer< vtkVertexGlyphFilter >::New();
-    //vertex_glyph->SetInputData(poly_mesh);
-    //vertex_glyph->Update();
-
-    std::cout<<"BSP tree updated...\n";
-
-    //vtkSmartPointer<vtkPolyDataMapper> mapper =	vtkSmartPointer<vtkPolyDataMapper>::New();
-    //std::cout<<"Check mesh right4\n";
-    //mapper->SetInputData(poly_mesh);
-    //std::cout<<"Check mesh right5\n";
-    //vtkSmartPointer<vtkActor> actor = vtkSmartPointer<vtkActor>::New();
-    //std::cout<<"Check mesh right6\n";
-    //actor->SetMapper(mapper);
-    //std::cout<<"Check mesh right7\n";
-    //vtkSmartPointer<vtkRenderer> renderer =	vtkSmartPointer<vtkRenderer>::New();
-    //std::cout<<"Check mesh right8\n";
-    //vtkSmartPointer<vtkRenderWindow> renderWindow =	vtkSmartPointer<vtkRenderWindow>::New();
-    //std::cout<<"Check mesh right9\n";
-    //renderWindow->AddRenderer(renderer);
-    //std::cout<<"Check mesh right10\n";
-    //vtkSmartPointer<vtkRenderWindowInteractor> renderWindowInteractor =	vtkSmartPointer<vtkRenderWindowInteractor>::New();
-    //std::cout<<"Check mesh right11\n";
-    //renderWindowInteractor->SetRenderWindow(renderWindow);
-    //std::cout<<"Check mesh right12\n";
-    //renderer->AddActor(actor);
-    //std::cout<<"Check mesh right13\n";
-    //renderWindow->Render();
-    //renderWindowInteractor->Start();
+    std::cout<<"BVH updated...\n";
 }
 
 bool Ray::intersectModel(Eigen::Vector3d &ray_start, Eigen::Vector3d &ray_end)
 {
-    int id = bsptree->IntersectWithLine(ray_start.data(), ray_end.data(), 0.001, t, intersect_point, pt_coord, sub_id);
-
-    if (id == 0) return true; // no intersection so return true
-    else return false;
-
+    return !bvh.anyHit(ray_start, ray_end); // no intersection so return true
 }
 
 bool Ray::intersectModel(const Eigen::Vector3d &ray_start, const Eigen::Vector3d &ray_end, double* intersect_point)
 {
-  int id = bsptree->IntersectWithLine(const_cast<double*>(ray_start.data()), const_cast<double*>(ray_end.data()), 0.001, t, intersect_point, pt_coord, sub_id);
-
-  if (id == 0) return false; // no intersection so return false
-  else return true;
+  double t;
+  int face_id;
+  if (!bvh.closestHit(ray_start, ray_end, t, face_id)) return false; // no intersection so return false
+
+  Eigen::Vector3d point = ray_start + t * (ray_end - ray_start);
+  intersect_point[0] = point[0];
+  intersect_point[1] = point[1];
+  intersect_point[2] = point[2];
+  return true;
 }
-
@@ -2,12 +2,7 @@
 #define Ray_H
 
 #include "Eigen\Eigen"
-#include <vtkSmartPointer.h>
-#include <vtkModifiedBSPTree.h>
-#include <vtkPoints.h>
-#include <vtkTriangle.h>
-#include <vtkCellArray.h>
-#include <vtkPolyData.h>
+#include "BVH.h"
 #include <vector>
 
 // parametric equation of ray point(t) = P + t * D
@@ -26,13 +21,11 @@ public:
   bool intersectModel(const Eigen::Vector3d &ray_start, const Eigen::Vector3d &ray_end, double* intersect_point);
 	void passModel(const std::vector<float> &vertices, const std::vector<unsigned int> &faces);
 
-public:
-	vtkSmartPointer< vtkModifiedBSPTree > bsptree;
-	vtkSmartPointer< vtkPolyData > poly_mesh;
-	double intersect_point[3];
-	double pt_coord[3];
-	double t;
-	int sub_id;
+  // both queries only read the tree, one Ray can be used by many threads
+  inline const BVH& getBVH() const { return bvh; };
+
+private:
+  BVH bvh;
 };
 
 #endif
\ No newline at end of file
@@ -6,8 +6,45 @@
 #include "ShapeUtility.h"
 #include "tiny_obj_loader.h"
 #include "ParaShape.h"
+#include "MappedFile.h"
+#include <fstream>
+#include <cstring>
+#include <cstdint>
 using namespace LG;
 
+// binary appearance model
+// header | chunk table | chunk data, each chunk starts at a 64 bytes boundary
+// a chunk is a raw row major cv::Mat, so it can be used in place from the mapping
+namespace
+{
+  const char APPMOD_MAGIC[8] = { 'A', 'P', 'P', 'M', 'O', 'D', 'B', 'N' };
+  const uint32_t APPMOD_VERSION = 1;
+  const uint64_t APPMOD_ALIGN = 64;
+
+  struct AppModHeader
+  {
+    char magic[8];
+    uint32_t version;
+    uint32_t n_chunk;
+  };
+
+  struct AppModChunk
+  {
+    char name[48];
+    int32_t mat_type;
+    int32_t rows;
+    int32_t cols;
+    uint32_t compression; // 0 is raw, no codec is supported yet
+    uint64_t offset;      // from the beginning of the file
+    uint64_t bytes;
+  };
+
+  inline uint64_t alignChunk(uint64_t offset)
+  {
+    return (offset + APPMOD_ALIGN - 1) / APPMOD_ALIGN * APPMOD_ALIGN;
+  }
+}
+
 
 
 
@@ -77,6 +114,17 @@ void AppearanceModel::importAppMod(std::string file_name_, std::string file_path
 {
   file_name = file_name_;
   file_path = file_path_;
+
+  // use the binary container if there is one, the given file may also be one
+  std::string bin_name = this->binaryFileName(file_name);
+  if (this->importBinary(file_path + '/' + bin_name)) return;
+  if (bin_name != file_name && this->importBinary(file_path + '/' + file_name)) return;
+
+  this->importAppModYAML();
+}
+
+void AppearanceModel::importAppModYAML()
+{
   cv::FileStorage fs(file_path + '/' + file_name, cv::FileStorage::READ);
 
   if (!fs.isOpened())
@@ -183,6 +231,15 @@ void AppearanceModel::readMaps(cv::FileStorage& fs, std::vector<cv::Mat>& maps,
 }
 
 void AppearanceModel::exportAppMod(std::string file_name_, std::string file_path_)
+{
+  file_name = file_name_;
+  file_path = file_path_;
+
+  ShapeUtility::savePolyMesh(base_mesh.get(), file_path + "/" + mesh_file_name);
+  this->exportBinary(file_path + '/' + this->binaryFileName(file_name));
+}
+
+void AppearanceModel::exportAppModYAML(std::string file_name_, std::string file_path_)
 {
   file_name = file_name_;
   file_path = file_path_;
@@ -234,6 +291,248 @@ void AppearanceModel::exportAppMod(std::string file_name_, std::string file_path
   fs.release();
 }
 
+std::string AppearanceModel::binaryFileName(const std::string& file_name_)
+{
+  size_t dot = file_name_.find_last_of('.');
+  return file_name_.substr(0, dot) + ".appmod";
+}
+
+bool AppearanceModel::importBinary(const std::string& file)
+{
+  std::shared_ptr<MappedFile> mapped(new MappedFile);
+  if (!mapped->open(file)) return false;
+
+  if (mapped->size() < sizeof(AppModHeader)) return false;
+  const AppModHeader* header = (const AppModHeader*)mapped->data();
+  if (std::memcmp(header->magic, APPMOD_MAGIC, sizeof(APPMOD_MAGIC)) != 0) return false;
+  if (header->version != APPMOD_VERSION)
+  {
+    std::cout << "Unsupported appearance model version " << header->version << ": " << file << std::endl;
+    return false;
+  }
+  if (sizeof(AppModHeader) + uint64_t(header->n_chunk) * sizeof(AppModChunk) > mapped->size())
+  {
+    std::cout << "Broken appearance model: " << file << std::endl;
+    return false;
+  }
+
+  std::cout << std::endl << "*** Reading Binary Appearance Model: " << file << " ***" << std::endl;
+
+  // the chunks are not read here, pages of the mapping are loaded when a map is first used
+  std::map<std::string, cv::Mat> chunks;
+  const AppModChunk* table = (const AppModChunk*)(mapped->data() + sizeof(AppModHeader));
+  for (uint32_t i = 0; i < header->n_chunk; ++i)
+  {
+    const AppModChunk& chunk = table[i];
+    std::string name(chunk.name, strnlen(chunk.name, sizeof(chunk.name)));
+    uint64_t bytes = uint64_t(chunk.rows) * chunk.cols * CV_ELEM_SIZE(chunk.mat_type);
+    if (chunk.compression != 0)
+    {
+      std::cout << "Skip compressed chunk " << name << ", codec " << chunk.compression << " is not supported" << std::endl;
+      continue;
+    }
+    if (chunk.bytes != bytes || chunk.offset + chunk.bytes > mapped->size())
+    {
+      std::cout << "Broken chunk " << name << " in " << file << std::endl;
+      return false;
+    }
+    chunks[name] = cv::Mat(chunk.rows, chunk.cols, chunk.mat_type, mapped->data() + chunk.offset);
+  }
+
+  // 1. mesh name
+  cv::Mat& mesh_name = chunks["meshFileName"];
+  if (!mesh_name.empty()) mesh_file_name = std::string((const char*)mesh_name.data, mesh_name.cols);
+  std::cout << std::endl << "*** Reading Mesh File: " << mesh_file_name << " ***" << std::endl;
+  base_mesh = std::make_unique<PolygonMesh>();
+  if (!ShapeUtility::loadPolyMesh(base_mesh.get(), file_path + "/" + mesh_file_name))
+  {
+    std::cout << "Cannot open mesh file: " << file_path + '/' + mesh_file_name << std::endl;
+  }
+
+  // 2. vertex feature, stored as "mesh:" + attribute name
+  for (std::map<std::string, cv::Mat>::iterator it = chunks.begin(); it != chunks.end(); ++it)
+  {
+    if (it->first.compare(0, 5, "mesh:") != 0) continue;
+    cv::Mat& data = it->second;
+    if (data.cols != 3 || data.rows != (int)base_mesh->n_vertices())
+    {
+      std::cout << "read feature data error, dimensions don't match" << std::endl;
+      continue;
+    }
+    PolygonMesh::Vertex_attribute<Vec3> feature_data = base_mesh->vertex_attribute<Vec3>(it->first.substr(5));
+    for (int i = 0; i < data.rows; ++i)
+    {
+      feature_data[PolygonMesh::Vertex(i)][0] = data.at<float>(i, 0);
+      feature_data[PolygonMesh::Vertex(i)][1] = data.at<float>(i, 1);
+      feature_data[PolygonMesh::Vertex(i)][2] = data.at<float>(i, 2);
+    }
+  }
+
+  // 3. - 6. feature and detail maps
+  this->readMaps(chunks, d0_feature_maps, "d0Feature");
+  this->readMaps(chunks, d0_detail_maps, "d0Detail");
+  this->readMaps(chunks, d1_feature_maps, "d1Feature");
+  this->readMaps(chunks, d1_detail_maps, "d1Detail");
+
+  // 7. resolution
+  if (!chunks["resolution"].empty()) resolution = chunks["resolution"].at<int>(0, 0);
+
+  // 8. - 10. cca
+  cca_mat = chunks["CCAMat"];
+  cv::Mat& cca_min_mat = chunks["cca_min"];
+  cca_min.assign((float*)cca_min_mat.data, (float*)cca_min_mat.data + cca_min_mat.total());
+  cv::Mat& cca_max_mat = chunks["cca_max"];
+  cca_max.assign((float*)cca_max_mat.data, (float*)cca_max_mat.data + cca_max_mat.total());
+
+  // camera info
+  z_img = chunks["z_img"];
+  primitive_ID = chunks["primitive_ID"];
+  if (!chunks["m_modelview"].empty() && !chunks["m_projection"].empty() && !chunks["m_viewport"].empty())
+  {
+    m_modelview = Eigen::Map<Matrix4f>((float*)chunks["m_modelview"].data);
+    m_projection = Eigen::Map<Matrix4f>((float*)chunks["m_projection"].data);
+    m_viewport = Eigen::Map<Vector4i>((int*)chunks["m_viewport"].data);
+    m_inv_modelview_projection = (m_projection*m_modelview).inverse();
+  }
+
+  // photo
+  photo = chunks["photo"];
+
+  // keep the mapping alive as long as the maps use it
+  mapped_file = mapped;
+
+  std::cout << std::endl << "*** Import Appearance Model Finished ***" << std::endl;
+  return true;
+}
+
+void AppearanceModel::readMaps(std::map<std::string, cv::Mat>& chunks, std::vector<cv::Mat>& maps, std::string map_name)
+{
+  maps.clear();
+  for (int i = 0; ; ++i)
+  {
+    std::map<std::string, cv::Mat>::iterator it = chunks.find(map_name + ":" + std::to_string(i));
+    if (it == chunks.end()) break;
+    maps.push_back(it->second);
+  }
+}
+
+void AppearanceModel::addMapChunks(std::vector<std::string>& names, std::vector<cv::Mat>& mats, std::vector<cv::Mat>& maps, std::string map_name)
+{
+  for (size_t i = 0; i < maps.size(); ++i)
+  {
+    names.push_back(map_name + ":" + std::to_string(i));
+    mats.push_back(maps[i]);
+  }
+}
+
+void AppearanceModel::exportBinary(const std::string& file)
+{
+  std::vector<std::string> names;
+  std::vector<cv::Mat> mats;
+
+  // 1. mesh name
+  names.push_back("meshFileName");
+  mats.push_back(cv::Mat(1, (int)mesh_file_name.size(), CV_8UC1, (void*)mesh_file_name.data()));
+
+  // 2. vertex feature
+  const char* mesh_features[] = { "v:local_transform", "v:tangent" };
+  for (int k = 0; k < 2; ++k)
+  {
+    PolygonMesh::Vertex_attribute<Vec3> feature_data = base_mesh->vertex_attribute<Vec3>(mesh_features[k]);
+    cv::Mat data(base_mesh->n_vertices(), 3, CV_32FC1);
+    for (auto vit : base_mesh->vertices())
+    {
+      data.at<float>(vit.idx(), 0) = feature_data[vit][0];
+      data.at<float>(vit.idx(), 1) = feature_data[vit][1];
+      data.at<float>(vit.idx(), 2) = feature_data[vit][2];
+    }
+    names.push_back(std::string("mesh:") + mesh_features[k]);
+    mats.push_back(data);
+  }
+
+  // 3. - 6. feature and detail maps
+  this->addMapChunks(names, mats, d0_feature_maps, "d0Feature");
+  this->addMapChunks(names, mats, d0_detail_maps, "d0Detail");
+  this->addMapChunks(names, mats, d1_feature_maps, "d1Feature");
+  this->addMapChunks(names, mats, d1_detail_maps, "d1Detail");
+
+  // 7. resolution
+  names.push_back("resolution");
+  mats.push_back(cv::Mat(1, 1, CV_32SC1, cv::Scalar(resolution)));
+
+  // 8. - 10. cca
+  names.push_back("CCAMat");
+  mats.push_back(cca_mat);
+  names.push_back("cca_min");
+  mats.push_back(cv::Mat(cca_min, true).reshape(1, 1));
+  names.push_back("cca_max");
+  mats.push_back(cv::Mat(cca_max, true).reshape(1, 1));
+
+  // camera info
+  names.push_back("z_img");
+  mats.push_back(z_img);
+  names.push_back("primitive_ID");
+  mats.push_back(primitive_ID);
+  names.push_back("m_modelview");
+  mats.push_back(cv::Mat(4, 4, CV_32FC1, m_modelview.data()));
+  names.push_back("m_projection");
+  mats.push_back(cv::Mat(4, 4, CV_32FC1, m_projection.data()));
+  names.push_back("m_viewport");
+  mats.push_back(cv::Mat(1, 4, CV_32SC1, m_viewport.data()));
+
+  // photo
+  names.push_back("photo");
+  mats.push_back(photo);
+
+  // build the chunk table, empty mats are not stored
+  std::vector<AppModChunk> table;
+  std::vector<cv::Mat> chunk_data;
+  for (size_t i = 0; i < mats.size(); ++i)
+  {
+    if (mats[i].empty()) continue;
+    AppModChunk chunk;
+    std::memset(&chunk, 0, sizeof(chunk));
+    std::strncpy(chunk.name, names[i].c_str(), sizeof(chunk.name) - 1);
+    chunk.mat_type = mats[i].type();
+    chunk.rows = mats[i].rows;
+    chunk.cols = mats[i].cols;
+    chunk.compression = 0;
+    chunk.bytes = uint64_t(mats[i].total()) * mats[i].elemSize();
+    table.push_back(chunk);
+    chunk_data.push_back(mats[i].isContinuous() ? mats[i] : mats[i].clone());
+  }
+
+  uint64_t offset = alignChunk(sizeof(AppModHeader) + table.size() * sizeof(AppModChunk));
+  for (size_t i = 0; i < table.size(); ++i)
+  {
+    table[i].offset = offset;
+    offset = alignChunk(offset + table[i].bytes);
+  }
+
+  std::ofstream outFile(file, std::ios::binary);
+  if (!outFile)
+  {
+    std::cout << "Cannot open file: " << file << std::endl;
+    return;
+  }
+
+  AppModHeader header;
+  std::memcpy(header.magic, APPMOD_MAGIC, sizeof(APPMOD_MAGIC));
+  header.version = APPMOD_VERSION;
+  header.n_chunk = (uint32_t)table.size();
+  outFile.write((const char*)&header, sizeof(header));
+  if (!table.empty()) outFile.write((const char*)&table[0], table.size() * sizeof(AppModChunk));
+
+  const char padding[APPMOD_ALIGN] = { 0 };
+  for (size_t i = 0; i < table.size(); ++i)
+  {
+    uint64_t pos = (uint64_t)outFile.tellp();
+    outFile.write(padding, table[i].offset - pos);
+    outFile.write((const char*)chunk_data[i].data, table[i].bytes);
+  }
+  outFile.close();
+}
+
 void AppearanceModel::writeMeshFeatures(cv::FileStorage& fs, LG::PolygonMesh* mesh)
 {
   PolygonMesh::Vertex_attribute<Vec3> local_transform = mesh->vertex_attribute<Vec3>("v:local_transform");
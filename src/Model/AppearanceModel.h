@@ -5,11 +5,13 @@
 #include <vector>
 #include <cv.h>
 #include <memory>
+#include <map>
 #include "BasicHeader.h"
 #include "PolygonMesh.h"
 namespace LG {
   class PolygonMesh;
 }
+class MappedFile;
 
 class AppearanceModel
 {
@@ -23,8 +25,11 @@ public:
   AppearanceModel() : mesh_file_name("base_mesh.obj"), resolution(0) {};
   ~AppearanceModel() {};
 
+  // the binary container (file name with .appmod extension) is written,
+  // import reads it if it exists and falls back to the legacy yaml file
   void importAppMod(std::string file_name_, std::string file_path_);
   void exportAppMod(std::string file_name_, std::string file_path_);
+  void exportAppModYAML(std::string file_name_, std::string file_path_);
 
 
   void get_mask_from_origin_image_to_uv(const cv::Mat& mask_origin_image, cv::Mat& mask_uv);
@@ -69,6 +74,13 @@ public:
   void coordFaceToUV(std::vector<CvPoint>& coords, std::vector<int>& f_ids);
 
 private:
+  void importAppModYAML();
+  bool importBinary(const std::string& file);
+  void exportBinary(const std::string& file);
+  std::string binaryFileName(const std::string& file_name_);
+  void readMaps(std::map<std::string, cv::Mat>& chunks, std::vector<cv::Mat>& maps, std::string map_name);
+  void addMapChunks(std::vector<std::string>& names, std::vector<cv::Mat>& mats, std::vector<cv::Mat>& maps, std::string map_name);
+
   void writeMaps(cv::FileStorage& fs, std::vector<cv::Mat>& maps, std::string map_name);
   void readMaps(cv::FileStorage& fs, std::vector<cv::Mat>& maps, std::string map_name);
 
@@ -111,6 +123,9 @@ private:
   Matrix4f m_inv_modelview_projection;
   Vector4i m_viewport;
 
+  // maps imported from the binary container point into this mapping
+  std::shared_ptr<MappedFile> mapped_file;
+
 private:
   AppearanceModel(const AppearanceModel&);
   void operator = (const AppearanceModel&);
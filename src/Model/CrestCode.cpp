@@ -1,9 +1,11 @@
 #include "CrestCode.h"
 #include "BasicHeader.h"
 #include "Shape.h"
-#include "KDTreeWrapper.h"
-#include "fstream"
+#include "ParameterMgr.h"
+
 #include <set>
+#include <cmath>
+#include <algorithm>
 
 CrestCode::CrestCode()
 {
@@ -18,102 +20,68 @@ CrestCode::~CrestCode()
 void CrestCode::setShape(std::shared_ptr<Shape> in_shape)
 {
   shape = in_shape;
-  exportInputFile();
   computeCrestLines();
 }
 
-void CrestCode::exportInputFile()
+void CrestCode::mergeCrestEdges(std::vector<Edge>& edges, std::vector<STLVectori>& lines)
 {
-  FILE *fp,*fp_ply2;
-  fp = fopen("input.txt","w+");
-  fp_ply2 = fopen("model.ply2","w+");
-  size_t vertexNum = (shape->getVertexList()).size();
-  size_t faceNum = (shape->getFaceList()).size();
-  int neighborhoodSize = 1;                            //need to be reset!
-  fprintf(fp,"%d\n",vertexNum / 3);
-  fprintf(fp,"%d\n",faceNum / 3);
-  fprintf(fp,"%d\n",neighborhoodSize);
-  fprintf(fp,"%d\n",1);
-
-  fprintf(fp_ply2,"%d\n",vertexNum / 3);
-  fprintf(fp_ply2,"%d\n",faceNum / 3);
-
-  for(size_t i = 0 ; i < vertexNum ; i ++)
-  {
-    fprintf(fp,"%f\n",(shape->getVertexList())[i]);
-    fprintf(fp_ply2,"%f\n",(shape->getVertexList())[i]);
-  }
-  for(size_t j = 0 ; j < faceNum ; j ++)
-  {
-    fprintf(fp,"%d\n",(shape->getFaceList())[j]);
-    if(j % 3 == 0)
-    {
-      fprintf(fp_ply2,"%d\n",3);
-    }
-    fprintf(fp_ply2,"%d\n",(shape->getFaceList())[j]);
-  }
-  fclose(fp);
-  fclose(fp_ply2);
-}
-
-void CrestCode::mergeCrestEdges()
-{
-  for (size_t i = 0; i < crest_edges.size(); ++i)
+  lines.clear();
+  for (size_t i = 0; i < edges.size(); ++i)
   {
     STLVectori temp_edges;
-    temp_edges.push_back(crest_edges[i].first);
-    temp_edges.push_back(crest_edges[i].second);
-    crest_lines.push_back(temp_edges);
+    temp_edges.push_back(edges[i].first);
+    temp_edges.push_back(edges[i].second);
+    lines.push_back(temp_edges);
   }
   // merge connected edge
   int tag = 0;
   size_t i = 0;
-  while (i < crest_lines.size())
+  while (i < lines.size())
   {
-    int start = crest_lines[i][0];
-    int end   = crest_lines[i][crest_lines[i].size() - 1];
+    int start = lines[i][0];
+    int end   = lines[i][lines[i].size() - 1];
 
-    for (size_t j = i + 1; j < crest_lines.size(); ++j)
+    for (size_t j = i + 1; j < lines.size(); ++j)
     {
-      int cur_start = crest_lines[j][0];
-      int cur_end   = crest_lines[j][crest_lines[j].size() - 1];
+      int cur_start = lines[j][0];
+      int cur_end   = lines[j][lines[j].size() - 1];
 
       // four types
       if (start == cur_start)
       {
-        int start_n = crest_lines[i][1]; // the next v_id from start
-        int cur_start_n = crest_lines[j][1]; // the next v_id from start
-        std::reverse(crest_lines[i].begin(), crest_lines[i].end());
-        crest_lines[i].insert(crest_lines[i].end(), crest_lines[j].begin() + 1, crest_lines[j].end());
-        crest_lines.erase(crest_lines.begin() + j);
+        int start_n = lines[i][1]; // the next v_id from start
+        int cur_start_n = lines[j][1]; // the next v_id from start
+        std::reverse(lines[i].begin(), lines[i].end());
+        lines[i].insert(lines[i].end(), lines[j].begin() + 1, lines[j].end());
+        lines.erase(lines.begin() + j);
         tag = 1;
         break;
       }
       else if (start == cur_end)
       {
-        int start_n = crest_lines[i][1]; // the next v_id from start
-        int cur_end_p = crest_lines[j][crest_lines[j].size() - 2];
-        crest_lines[i].insert(crest_lines[i].begin(), crest_lines[j].begin(), crest_lines[j].end() - 1);
-        crest_lines.erase(crest_lines.begin() + j);
+        int start_n = lines[i][1]; // the next v_id from start
+        int cur_end_p = lines[j][lines[j].size() - 2];
+        lines[i].insert(lines[i].begin(), lines[j].begin(), lines[j].end() - 1);
+        lines.erase(lines.begin() + j);
         tag = 1;
         break;
       }
       else if (end == cur_start)
       {
-        int end_p = crest_lines[i][crest_lines[i].size() - 2];
-        int cur_start_n = crest_lines[j][1]; // the next v_id from start
-        crest_lines[i].insert(crest_lines[i].end(), crest_lines[j].begin() + 1, crest_lines[j].end());
-        crest_lines.erase(crest_lines.begin() + j);
+        int end_p = lines[i][lines[i].size() - 2];
+        int cur_start_n = lines[j][1]; // the next v_id from start
+        lines[i].insert(lines[i].end(), lines[j].begin() + 1, lines[j].end());
+        lines.erase(lines.begin() + j);
         tag = 1;
         break;
       }
       else if (end == cur_end)
       {
-        int end_p = crest_lines[i][crest_lines[i].size() - 2];
-        int cur_end_p = crest_lines[j][crest_lines[j].size() - 2];
-        std::reverse(crest_lines[j].begin(), crest_lines[j].end());
-        crest_lines[i].insert(crest_lines[i].end(), crest_lines[j].begin() + 1, crest_lines[j].end());
-        crest_lines.erase(crest_lines.begin() + j);
+        int end_p = lines[i][lines[i].size() - 2];
+        int cur_end_p = lines[j][lines[j].size() - 2];
+        std::reverse(lines[j].begin(), lines[j].end());
+        lines[i].insert(lines[i].end(), lines[j].begin() + 1, lines[j].end());
+        lines.erase(lines.begin() + j);
         tag = 1;
         break;
       }
@@ -132,106 +100,251 @@ void CrestCode::mergeCrestEdges()
 
 void CrestCode::computeCrestLines()
 {
-  system("Crest.exe input.txt output.txt");
-  FILE *fp1,*fp2;
-  fp1 = fopen("ravines.txt","r");
-  fp2 = fopen("ridges.txt","r");
-  int vertexNum_ravines,vertexNum_ridges,crestEdgesNum_ravines,crestEdgesNum_ridges,crestLinesNum_ravines,crestLinesNum_ridges;
-  Vector3f point;
-  float x,y,z;
-  int id;
-  std::vector<Vector3f> crestLinesPoints;
-  fscanf(fp1,"%d%d%d",&vertexNum_ravines,&crestEdgesNum_ravines,&crestLinesNum_ravines);
-  fscanf(fp2,"%d%d%d",&vertexNum_ridges,&crestEdgesNum_ridges,&crestLinesNum_ridges);
-  //crest_lines.resize(crestLinesNum_ravines + crestLinesNum_ridges);
-  for(int i = 0; i < vertexNum_ravines; i ++)
-  {
-    fscanf(fp1,"%f%f%f%d",&x,&y,&z,&id);
-    point << x,y,z;
-    crestLinesPoints.push_back(point);
-    //crest_lines[id].push_back(i);
-  }
-  for(int i = 0; i < vertexNum_ridges; i ++)
-  {
-    fscanf(fp2,"%f%f%f%d",&x,&y,&z,&id);
-    point << x,y,z;
-    crestLinesPoints.push_back(point);
-    //crest_lines[id + crestLinesNum_ravines].push_back(i + vertexNum_ravines);
-  }
-  /*size_t sum = 0;
-  for(size_t i = 0; i < crestLinesPoints.size(); i ++)
-    sum += crestLinesPoints[i].size();*/
-  float ridgeness, sphericalness , cyclideness;
-  Vector3f attributes;
-  for(int i = 0; i < crestLinesNum_ravines; i ++)
-  {
-    fscanf(fp1,"%f%f%f",&ridgeness,&sphericalness,&cyclideness);
-    attributes << ridgeness,sphericalness,cyclideness;
-    crest_lines_attributes.push_back(attributes);
-  }
-  for(int i = 0; i < crestLinesNum_ridges; i ++)
+  crest_edges.clear();
+  crest_lines.clear();
+  crest_lines_attributes.clear();
+
+  this->computeCurvature();
+  this->computeExtremality();
+
+  // ravines first, then ridges, the two kinds are never merged into one line
+  for (int type = 0; type < 2; ++type)
   {
-    fscanf(fp2,"%f%f%f",&ridgeness,&sphericalness,&cyclideness);
-    attributes << ridgeness,sphericalness,cyclideness;
-    crest_lines_attributes.push_back(attributes);
+    bool is_ridge = (type == 1);
+    std::vector<Edge> edges;
+    std::vector<STLVectori> lines;
+    this->extractCrestEdges(is_ridge, edges);
+    this->mergeCrestEdges(edges, lines);
+    this->filterCrestLines(is_ridge, lines);
+    crest_edges.insert(crest_edges.end(), edges.begin(), edges.end());
+    crest_lines.insert(crest_lines.end(), lines.begin(), lines.end());
   }
-  int endPoint1,endPoint2,triangleId;
-  Edge e;
-  for(int i = 0; i < crestEdgesNum_ravines; i ++)
+  std::cout << "Crest lines: " << crest_lines.size() << " from " << crest_edges.size() << " crest edges." << std::endl;
+}
+
+void CrestCode::computeCurvature()
+{
+  // shape operator of each vertex, least squares fit of the normal variation
+  // over the one ring: dn = II * dp in the tangent plane
+  const VertexList& vertex_list = shape->getVertexList();
+  const NormalList& normal_list = shape->getNormalList();
+  const AdjList& vertex_adj = shape->getVertexAdjList();
+  int n_vertex = (int)(vertex_list.size() / 3);
+
+  k_max.assign(n_vertex, 0.0f);
+  k_min.assign(n_vertex, 0.0f);
+  t_max.assign(n_vertex, Vector3f::Zero());
+  t_min.assign(n_vertex, Vector3f::Zero());
+
+#pragma omp parallel for
+  for (int i = 0; i < n_vertex; ++i)
   {
-    fscanf(fp1,"%d%d%d",&endPoint1,&endPoint2,&triangleId);
-    e.first = endPoint1;
-    e.second = endPoint2;
-    crest_edges.push_back(e);
+    Vector3f p_i(vertex_list[3 * i + 0], vertex_list[3 * i + 1], vertex_list[3 * i + 2]);
+    Vector3f n_i(normal_list[3 * i + 0], normal_list[3 * i + 1], normal_list[3 * i + 2]);
+    n_i.normalize();
+    Vector3f u = n_i.cross(std::fabs(n_i.x()) < 0.9f ? Vector3f::UnitX() : Vector3f::UnitY()).normalized();
+    Vector3f v = n_i.cross(u);
+
+    // unknowns (l, m, n) of II = [l m; m n]
+    Matrix3f AtA = Matrix3f::Zero();
+    Vector3f Atb = Vector3f::Zero();
+    const STLVectori& ring = vertex_adj[i];
+    for (size_t k = 0; k < ring.size(); ++k)
+    {
+      int j = ring[k];
+      Vector3f d = Vector3f(vertex_list[3 * j + 0], vertex_list[3 * j + 1], vertex_list[3 * j + 2]) - p_i;
+      Vector3f dn = Vector3f(normal_list[3 * j + 0], normal_list[3 * j + 1], normal_list[3 * j + 2]).normalized() - n_i;
+      float a = d.dot(u);
+      float b = d.dot(v);
+      Vector3f row_u(a, b, 0);
+      Vector3f row_v(0, a, b);
+      AtA += row_u * row_u.transpose() + row_v * row_v.transpose();
+      Atb += row_u * dn.dot(u) + row_v * dn.dot(v);
+    }
+
+    if (ring.size() < 2)
+    {
+      t_max[i] = u;
+      t_min[i] = v;
+      continue;
+    }
+
+    Vector3f lmn = AtA.ldlt().solve(Atb);
+    Eigen::Matrix2f II;
+    II << lmn(0), lmn(1),
+          lmn(1), lmn(2);
+    Eigen::SelfAdjointEigenSolver<Eigen::Matrix2f> eigen_solver(II);
+    k_min[i] = eigen_solver.eigenvalues()(0);
+    k_max[i] = eigen_solver.eigenvalues()(1);
+    Eigen::Vector2f dir = eigen_solver.eigenvectors().col(1);
+    t_max[i] = (dir(0) * u + dir(1) * v).normalized();
+    t_min[i] = n_i.cross(t_max[i]);
   }
-  for(int i = 0; i < crestEdgesNum_ridges; i ++)
+}
+
+void CrestCode::computeExtremality()
+{
+  // gradient of k_max and k_min in the principal frame, least squares over the one ring
+  const VertexList& vertex_list = shape->getVertexList();
+  const AdjList& vertex_adj = shape->getVertexAdjList();
+  int n_vertex = (int)(vertex_list.size() / 3);
+
+  grad_k_max.assign(n_vertex, Vector3f::Zero());
+  grad_k_min.assign(n_vertex, Vector3f::Zero());
+  e_max.assign(n_vertex, 0.0f);
+  e_min.assign(n_vertex, 0.0f);
+
+#pragma omp parallel for
+  for (int i = 0; i < n_vertex; ++i)
   {
-    fscanf(fp2,"%d%d%d",&endPoint1,&endPoint2,&triangleId);
-    e.first = endPoint1 + vertexNum_ravines;
-    e.second = endPoint2 + vertexNum_ravines;
-    crest_edges.push_back(e);
+    const STLVectori& ring = vertex_adj[i];
+    if (ring.size() < 2) continue;
+
+    Vector3f p_i(vertex_list[3 * i + 0], vertex_list[3 * i + 1], vertex_list[3 * i + 2]);
+    Eigen::Matrix2f AtA = Eigen::Matrix2f::Zero();
+    Eigen::Vector2f Atb_max = Eigen::Vector2f::Zero();
+    Eigen::Vector2f Atb_min = Eigen::Vector2f::Zero();
+    for (size_t k = 0; k < ring.size(); ++k)
+    {
+      int j = ring[k];
+      Vector3f d = Vector3f(vertex_list[3 * j + 0], vertex_list[3 * j + 1], vertex_list[3 * j + 2]) - p_i;
+      Eigen::Vector2f row(d.dot(t_max[i]), d.dot(t_min[i]));
+      AtA += row * row.transpose();
+      Atb_max += row * (k_max[j] - k_max[i]);
+      Atb_min += row * (k_min[j] - k_min[i]);
+    }
+
+    Eigen::LDLT<Eigen::Matrix2f> ldlt(AtA);
+    Eigen::Vector2f g_max = ldlt.solve(Atb_max);
+    Eigen::Vector2f g_min = ldlt.solve(Atb_min);
+    grad_k_max[i] = g_max(0) * t_max[i] + g_max(1) * t_min[i];
+    grad_k_min[i] = g_min(0) * t_max[i] + g_min(1) * t_min[i];
+    e_max[i] = g_max(0);
+    e_min[i] = g_min(1);
   }
+}
 
-  fclose(fp1);
-  fclose(fp2);
+void CrestCode::extractCrestEdges(bool is_ridge, std::vector<Edge>& edges)
+{
+  // each face holds at most one crest segment, its two edge crossings snapped
+  // to the nearer edge vertex give a mesh edge
+  const VertexList& vertex_list = shape->getVertexList();
+  const FaceList& face_list = shape->getFaceList();
+  const std::vector<float>& k_crest = is_ridge ? k_max : k_min;
+  const std::vector<float>& k_other = is_ridge ? k_min : k_max;
+  const std::vector<Vector3f>& t_crest = is_ridge ? t_max : t_min;
+  const std::vector<float>& e_crest = is_ridge ? e_max : e_min;
+  int n_face = (int)(face_list.size() / 3);
+  std::vector<Edge> face_edge(n_face, Edge(-1, -1));
 
-  mergeCrestEdges();
-  /*size_t sum = 0;
-  for(size_t i = 0; i < crest_lines.size(); i ++)
-    sum += crest_lines[i].size();*/
-  std::vector<float> pt;
-  pt.resize(3);
-  std::vector<STLVectori> tmp_crestLines;
-  tmp_crestLines.resize(crest_lines.size());
-  int pt_id;
-  for(size_t i = 0; i < crest_lines.size(); i ++)
+#pragma omp parallel for
+  for (int f = 0; f < n_face; ++f)
   {
-    for(size_t j = 0; j < crest_lines[i].size(); j++)
+    int v[3];
+    Vector3f p[3];
+    Vector3f t[3];
+    float e[3];
+    bool in_region = true;
+    for (int m = 0; m < 3; ++m)
+    {
+      v[m] = face_list[3 * f + m];
+      p[m] = Vector3f(vertex_list[3 * v[m] + 0], vertex_list[3 * v[m] + 1], vertex_list[3 * v[m] + 2]);
+      t[m] = t_crest[v[m]];
+      e[m] = e_crest[v[m]];
+      // the crest curvature must dominate at every corner
+      float k = is_ridge ? k_crest[v[m]] : -k_crest[v[m]];
+      if (k <= std::fabs(k_other[v[m]])) in_region = false;
+    }
+    if (!in_region) continue;
+
+    // principal directions have no sign, orient them and e like the first corner
+    for (int m = 1; m < 3; ++m)
     {
-      pt[0] = crestLinesPoints[crest_lines[i][j]].x();
-      pt[1] = crestLinesPoints[crest_lines[i][j]].y();
-      pt[2] = crestLinesPoints[crest_lines[i][j]].z();
-      (shape->getKDTree())->nearestPt(pt,pt_id);
-      if(j != 0)
+      if (t[m].dot(t[0]) < 0)
       {
-        int endId = tmp_crestLines[i][tmp_crestLines[i].size() - 1];
-        if(endId != pt_id)
-        {
-          tmp_crestLines[i].push_back(pt_id);
-        }
+        t[m] = -t[m];
+        e[m] = -e[m];
       }
-      else
+    }
+
+    // e decreases along t across a maximum of k_max, increases across a minimum of k_min
+    Vector3f face_normal = (p[1] - p[0]).cross(p[2] - p[0]);
+    float double_area = face_normal.norm();
+    if (double_area < 1e-12f) continue;
+    face_normal /= double_area;
+    Vector3f grad_e = (e[0] * face_normal.cross(p[2] - p[1])
+                     + e[1] * face_normal.cross(p[0] - p[2])
+                     + e[2] * face_normal.cross(p[1] - p[0])) / double_area;
+    float slope = grad_e.dot(t[0] + t[1] + t[2]);
+    if (is_ridge ? (slope >= 0) : (slope <= 0)) continue;
+
+    int n_cross = 0;
+    int snapped[2];
+    for (int m = 0; m < 3; ++m)
+    {
+      int a = m;
+      int b = (m + 1) % 3;
+      if (e[a] * e[b] < 0)
       {
-        tmp_crestLines[i].push_back(pt_id);
+        float s = e[a] / (e[a] - e[b]);
+        if (n_cross < 2) snapped[n_cross] = (s < 0.5f) ? v[a] : v[b];
+        ++n_cross;
       }
     }
+    if (n_cross == 2 && snapped[0] != snapped[1])
+    {
+      face_edge[f] = Edge(std::min(snapped[0], snapped[1]), std::max(snapped[0], snapped[1]));
+    }
+  }
+
+  // two faces sharing an edge may snap to it both
+  edges.clear();
+  std::set<Edge> added;
+  for (int f = 0; f < n_face; ++f)
+  {
+    if (face_edge[f].first >= 0 && added.insert(face_edge[f]).second)
+    {
+      edges.push_back(face_edge[f]);
+    }
+  }
+}
+
+void CrestCode::filterCrestLines(bool is_ridge, std::vector<STLVectori>& lines)
+{
+  // integrals along the line
+  // ridgeness: |k|, sphericalness: |k_max - k_min|, cyclideness: |derivative of k along the line|
+  // lines with a ridgeness below the threshold are noise
+  const VertexList& vertex_list = shape->getVertexList();
+  const std::vector<float>& k_crest = is_ridge ? k_max : k_min;
+  const std::vector<Vector3f>& grad_k = is_ridge ? grad_k_max : grad_k_min;
+  const std::vector<Vector3f>& t_other = is_ridge ? t_min : t_max;
+  double threshold = LG::GlobalParameterMgr::GetInstance()->get_parameter<double>("ShapCrest:crest_ridgeness_threshhold");
+
+  std::vector<STLVectori> kept_lines;
+  for (size_t i = 0; i < lines.size(); ++i)
+  {
+    float ridgeness = 0, sphericalness = 0, cyclideness = 0;
+    for (size_t j = 0; j + 1 < lines[i].size(); ++j)
+    {
+      int v0 = lines[i][j];
+      int v1 = lines[i][j + 1];
+      float length = (Vector3f(vertex_list[3 * v0 + 0], vertex_list[3 * v0 + 1], vertex_list[3 * v0 + 2])
+                    - Vector3f(vertex_list[3 * v1 + 0], vertex_list[3 * v1 + 1], vertex_list[3 * v1 + 2])).norm();
+      ridgeness += 0.5f * (std::fabs(k_crest[v0]) + std::fabs(k_crest[v1])) * length;
+      sphericalness += 0.5f * (std::fabs(k_max[v0] - k_min[v0]) + std::fabs(k_max[v1] - k_min[v1])) * length;
+      cyclideness += 0.5f * (std::fabs(grad_k[v0].dot(t_other[v0])) + std::fabs(grad_k[v1].dot(t_other[v1]))) * length;
+    }
+    if (ridgeness < threshold) continue;
+
+    kept_lines.push_back(lines[i]);
+    crest_lines_attributes.push_back(Vector3f(ridgeness, sphericalness, cyclideness));
   }
-  crest_lines = tmp_crestLines;
+  lines.swap(kept_lines);
 }
 
 std::vector<STLVectori>& CrestCode::getCrestLines()
 {
-  std::set<length_id> candidate;
+  std::multiset<length_id> candidate; // lines of the same length are all kept
   for(size_t i = 0; i < crest_lines.size(); i ++)
   {
     length_id temp;
@@ -242,7 +355,7 @@ std::vector<STLVectori>& CrestCode::getCrestLines()
   int best_candidate = std::min(10, int(candidate.size()));
   std::vector<STLVectori> temp_crest_lines = crest_lines;
   crest_lines.clear();
-  std::set<length_id>::const_iterator it = candidate.begin();
+  std::multiset<length_id>::const_iterator it = candidate.begin();
   for(int i = 0; i < best_candidate; i ++)
   {
     crest_lines.push_back(temp_crest_lines[it->id]);
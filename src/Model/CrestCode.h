@@ -16,6 +16,10 @@ struct length_id
 
 class Shape;
 
+// ridge / ravine lines of a triangle mesh
+// ridges are the zero crossings of e_max = <grad k_max, t_max> where k_max > |k_min|
+// and k_max has a maximum across the line, ravines are the same for k_min
+// the crossings are snapped to the nearer vertex of their edge, so lines are vertex ids
 class CrestCode
 {
 public:
@@ -23,17 +27,31 @@ public:
   ~CrestCode();
 
   void setShape(std::shared_ptr<Shape> in_shape);
-  void exportInputFile();
   std::vector<STLVectori>& getCrestLines();
   void computeCrestLines();
-  void mergeCrestEdges();
+  void mergeCrestEdges(std::vector<Edge>& edges, std::vector<STLVectori>& lines);
+
+private:
+  void computeCurvature();
+  void computeExtremality();
+  void extractCrestEdges(bool is_ridge, std::vector<Edge>& edges);
+  void filterCrestLines(bool is_ridge, std::vector<STLVectori>& lines);
 
 private:
   std::shared_ptr<Shape> shape;
   std::vector<Edge> crest_edges;
   std::vector<STLVectori> crest_lines;
-  std::vector<Vector3f> crest_lines_attributes;
-
+  std::vector<Vector3f> crest_lines_attributes; // ridgeness, sphericalness, cyclideness
+
+  // per vertex differential quantities
+  std::vector<float> k_max;
+  std::vector<float> k_min;
+  std::vector<Vector3f> t_max;
+  std::vector<Vector3f> t_min;
+  std::vector<Vector3f> grad_k_max;
+  std::vector<Vector3f> grad_k_min;
+  std::vector<float> e_max; // <grad k_max, t_max>
+  std::vector<float> e_min; // <grad k_min, t_min>
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -16,6 +16,7 @@
 
 #include "ParameterMgr.h"
 #include "Colormap.h"
+#include "FeatureCache.h"
 
 Model::Model()
 {
@@ -122,42 +123,53 @@ bool Model::loadOBJ(const std::string name, const std::string path)
     return false;
   }
 
-  // 4/20/2016 loaded shapes
-  shapes.resize(t_obj.size(), nullptr);
-  for (size_t i = 0; i < t_obj.size(); i++)
+  // merge shapes, the indices of a part are offset by the vertices of the parts before it
+  VertexList vertex_list, t_list;
+  FaceList face_list, t_ind_list;
+  size_t n_position = 0, n_index = 0, n_texcoord = 0, n_uv_index = 0;
+  for (size_t i = 0; i < t_obj.size(); ++i)
   {
-    shapes[i] = new Shape();
-    shapes[i]->init(t_obj[i].mesh.positions, t_obj[i].mesh.indices, t_obj[i].mesh.uv_indices, t_obj[i].mesh.texcoords);
-    shapes[i]->set_model(this);
+    n_position += t_obj[i].mesh.positions.size();
+    n_index += t_obj[i].mesh.indices.size();
+    n_texcoord += t_obj[i].mesh.texcoords.size();
+    n_uv_index += t_obj[i].mesh.uv_indices.size();
   }
+  vertex_list.reserve(n_position);
+  face_list.reserve(n_index);
+  t_list.reserve(n_texcoord);
+  t_ind_list.reserve(n_uv_index);
 
-  // merge shapes
-  VertexList vertex_list, t_list;
-  FaceList face_list, t_ind_list;
-  int vert_accu = 0, t_accu = 0;
+  part_vertex_start.resize(t_obj.size(), 0);
   for (size_t i = 0; i < t_obj.size(); ++i)
   {
-    for (auto j : t_obj[i].mesh.positions)
-    {
-      vertex_list.push_back(j);
-    }
+    unsigned int vert_accu = (unsigned int)(vertex_list.size() / 3);
+    unsigned int t_accu = (unsigned int)(t_list.size() / 2);
+    part_vertex_start[i] = int(vert_accu);
+
+    vertex_list.insert(vertex_list.end(), t_obj[i].mesh.positions.begin(), t_obj[i].mesh.positions.end());
     for (auto j : t_obj[i].mesh.indices)
     {
       face_list.push_back(j + vert_accu);
     }
-    vert_accu += int(vertex_list.size() / 3);
 
-    for (auto j : t_obj[i].mesh.texcoords)
-    {
-      t_list.push_back(j);
-    }
+    t_list.insert(t_list.end(), t_obj[i].mesh.texcoords.begin(), t_obj[i].mesh.texcoords.end());
     for (auto j : t_obj[i].mesh.uv_indices)
     {
       t_ind_list.push_back(j + t_accu);
     }
-    t_accu += int(t_list.size() / 2);
   }
 
+  // 4/20/2016 loaded shapes
+  // the parts are only displayed and moved, the analysis runs on the merged shape
+  shapes.resize(t_obj.size(), nullptr);
+  for (size_t i = 0; i < t_obj.size(); i++)
+  {
+    shapes[i] = new Shape();
+    shapes[i]->initPart(t_obj[i].mesh.positions, t_obj[i].mesh.indices, t_obj[i].mesh.uv_indices, t_obj[i].mesh.texcoords);
+    shapes[i]->set_model(this);
+  }
+  t_obj.clear();
+
   shape.reset(new Shape());
   shape->init(vertex_list, face_list, t_ind_list, t_list);
 
@@ -170,25 +182,23 @@ bool Model::loadOBJ(const std::string name, const std::string path)
 }
 void Model::divide_shape_to_list()
 {
-	int num_start = 0;
 	std::vector<Shape*> shapes_tmp;
 	this->getShapeVector(shapes_tmp);
 
-	LG::PolygonMesh::Vertex_container vc = this->shape->getPolygonMesh()->vertices();
-	LG::PolygonMesh::Vertex_iterator vci = vc.begin();
+	PolygonMesh* merged_mesh = this->shape->getPolygonMesh();
 
-		for (unsigned int i = 0; i < shapes_tmp.size(); i++)
+#pragma omp parallel for
+	for (int i = 0; i < int(shapes_tmp.size()); i++)
+	{
+		PolygonMesh* pl = shapes_tmp[i]->getPolygonMesh();
+		int num_start = part_vertex_start[i];
+
+		for (auto j : pl->vertices())
 		{
-			PolygonMesh* pl = shapes_tmp[i]->getPolygonMesh();
-
-			for (auto j : pl->vertices())
-			{
-				LG::Vec3& v = pl->position(j);
-				const LG::Vec3& vv = this->shape->getPolygonMesh()->position(*vci);
-				v = LG::Vec3(vv.x(), vv.y(), vv.z());
-				vci++;
-			}
+			const LG::Vec3& vv = merged_mesh->position(PolygonMesh::Vertex(num_start + j.idx()));
+			pl->position(j) = LG::Vec3(vv.x(), vv.y(), vv.z());
 		}
+	}
 };
 void Model::merge_shapes_to_show()
 {
@@ -268,6 +278,15 @@ Bound* Model::getBoundBox()
 //  return shape_crest;
 //}
 
+FeatureCache* Model::getFeatureCache()
+{
+  if (!feature_cache)
+  {
+    feature_cache.reset(new FeatureCache(data_path + "/" + file_name + ".features"));
+  }
+  return feature_cache.get();
+}
+
 std::string Model::getDataPath()
 {
   return data_path;
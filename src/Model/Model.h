@@ -17,6 +17,7 @@ class ShapePlane;
 class ShapeSymmetry;
 class Bound;
 class DispObject;
+class FeatureCache;
 namespace LG {
 class PolygonMesh;
 }
@@ -42,6 +43,7 @@ public:
   std::string getDataPath();
   std::string getOutputPath();
   inline std::string getFileName() { return file_name; };
+  FeatureCache* getFeatureCache();
 
   // 4/20/2016 get vector of polymesh
   void getPolygonMeshVector(std::vector<LG::PolygonMesh*>& polymesh_vec);
@@ -131,6 +133,8 @@ private:
   std::shared_ptr<ShapePlane> shape_plane;
   std::shared_ptr<ShapeSymmetry> shape_symmetry;
   std::vector<Shape*> shapes; // 4/20/2016 added shapes for part-based model sha
+  STLVectori part_vertex_start; // first vertex of each part in the merged shape
+  std::shared_ptr<FeatureCache> feature_cache; // per-vertex features, loaded on first use
 
   // file system data
   std::string data_path;
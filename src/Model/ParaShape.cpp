@@ -4,6 +4,7 @@
 #include "PolygonMesh.h"
 
 #include "KDTreeWrapper.h"
+#include "UVGBuffer.h"
 #include "ShapeUtility.h"
 
 using namespace LG;
@@ -12,6 +13,7 @@ ParaShape::ParaShape()
 {
   cut_shape = nullptr;
   kdTree_UV = nullptr;
+  uv_gbuffer = nullptr;
 }
 
 ParaShape::~ParaShape()
@@ -43,6 +45,31 @@ void ParaShape::initUVKDTree()
   }
   kdTree_UV_f.reset(new KDTreeWrapper);
   kdTree_UV_f->initKDTree(uv_f_center, poly_mesh->n_faces(), 2);
+
+  // the parameterization changed
+  uv_gbuffer = nullptr;
+}
+
+UVGBuffer* ParaShape::getUVGBuffer(int resolution)
+{
+  if (uv_gbuffer && uv_gbuffer->getResolution() == resolution)
+  {
+    return uv_gbuffer.get();
+  }
+
+  // same uv as the face walk, the texcoord attribute of the cut shape
+  PolygonMesh* poly_mesh = cut_shape->getPolygonMesh();
+  PolygonMesh::Vertex_attribute<Vec2> tex_coords = poly_mesh->vertex_attribute<Vec2>("v:texcoord");
+  STLVectorf uv_list(2 * poly_mesh->n_vertices(), 0);
+  for (auto vit : poly_mesh->vertices())
+  {
+    uv_list[2 * vit.idx() + 0] = tex_coords[vit][0];
+    uv_list[2 * vit.idx() + 1] = tex_coords[vit][1];
+  }
+
+  uv_gbuffer.reset(new UVGBuffer);
+  uv_gbuffer->build(uv_list, cut_shape->getFaceList(), resolution);
+  return uv_gbuffer.get();
 }
 
 void ParaShape::initWithExtShape(std::shared_ptr<Model> model)
@@ -11,6 +11,7 @@
 class Shape;
 class Model;
 class KDTreeWrapper;
+class UVGBuffer;
 namespace LG {
   class PolygonMesh;
 }
@@ -25,6 +26,9 @@ public:
   void initWithExtShape(std::shared_ptr<Model> model);
   void initWithExtPolygonMesh(LG::PolygonMesh* poly_mesh);
 
+  // texel to uv face lookup of a resolution x resolution map, rasterized on first use
+  UVGBuffer* getUVGBuffer(int resolution);
+
 public:
   FaceList cut_face_list; // triplets which store the old vertex id of the faces
   STLVectori vertex_set; // vertex id mapping from new id to old id
@@ -32,6 +36,7 @@ public:
   std::shared_ptr<Shape> cut_shape;
   std::shared_ptr<KDTreeWrapper> kdTree_UV;
   std::shared_ptr<KDTreeWrapper> kdTree_UV_f; // now we store the center of each face here
+  std::shared_ptr<UVGBuffer> uv_gbuffer;
   std::set<int> cut_faces; // face id in original model
   STLVectori face_set; // face id mapping from new id to old id
   std::vector<cv::Mat> feature_map;
@@ -25,7 +25,8 @@ Shape::Shape()
 	m_is_selected_(false),
 	m_show_manipulator_(false),
 	m_sm_(NULL),
-	m_model_(NULL)
+	m_model_(NULL),
+	has_topology(false)
 {
 
 	m_viewer_ = NULL;
@@ -41,8 +42,20 @@ Shape::~Shape()
 }
 
 void Shape::init(VertexList& vertexList, FaceList& faceList, FaceList& UVIdList, STLVectorf& UVList)
+{
+  this->initPart(vertexList, faceList, UVIdList, UVList);
+
+  std::cout << "Computing laplacian cotangent weight...\n";
+  poly_mesh->update_laplacian_cot();
+
+  buildKDTree();
+}
+
+void Shape::initPart(VertexList& vertexList, FaceList& faceList, FaceList& UVIdList, STLVectorf& UVList)
 {
   poly_mesh.reset(new PolygonMesh());
+  has_topology = false;
+  kdTree.reset();
 
   setVertexList(vertexList);
   setFaceList(faceList);
@@ -58,6 +71,20 @@ void Shape::init(VertexList& vertexList, FaceList& faceList, FaceList& UVIdList,
   }
   face_color_list.resize(face_list.size(), 0.5);
 
+  std::cout<<"Computing bounding box...\n";
+  computeBounds();
+
+  std::cout<<"Computing face normals...\n";
+  computeFaceNormal();
+  computeVertexNormal();
+}
+
+void Shape::buildTopology()
+{
+  if (has_topology) return;
+
+  std::lock_guard<std::mutex> lock(topology_mutex);
+  if (has_topology) return;
 
   std::cout<<"Building face adjacent list...\n";
   buildFaceAdj();
@@ -71,17 +98,7 @@ void Shape::init(VertexList& vertexList, FaceList& faceList, FaceList& UVIdList,
   std::cout << "Building edge connectivity...\n";
   computeEdgeConnectivity();
 
-  std::cout<<"Computing bounding box...\n";
-  computeBounds();
-
-  std::cout<<"Computing face normals...\n";
-  computeFaceNormal();
-  computeVertexNormal();
-
-  std::cout << "Computing laplacian cotangent weight...\n";
-  poly_mesh->update_laplacian_cot();
-
-  buildKDTree();
+  has_topology = true;
 }
 
 const void Shape::draw_manipulator()
@@ -446,21 +463,25 @@ const STLVectorf& Shape::getFaceColorList()
 
 const AdjList& Shape::getVertexShareFaces()
 {
+  this->buildTopology();
   return vertex_adj_faces;
 }
 
 const AdjList& Shape::getVertexAdjList()
 {
+  this->buildTopology();
   return vertex_adjlist;
 }
 
 const AdjList& Shape::getFaceAdjList()
 {
+  this->buildTopology();
   return face_adjlist;
 }
 
 const STLVectori& Shape::getEdgeConnectivity()
 {
+  this->buildTopology();
   return edge_connectivity;
 }
 
@@ -531,15 +552,17 @@ void Shape::buildFaceAdj()
   //}
 
   // test LgMesh
-  for (auto fit : poly_mesh->faces())
+  int n_face = (int)poly_mesh->n_faces();
+  face_adjlist.resize(n_face);
+#pragma omp parallel for
+  for (int i = 0; i < n_face; ++i)
   {
-    std::vector<int> cur_adj;
-    for (auto hffc_it : poly_mesh->halfedges(fit))
+    std::vector<int>& cur_adj = face_adjlist[i];
+    for (auto hffc_it : poly_mesh->halfedges(PolygonMesh::Face(i)))
     {
       int f_id = poly_mesh->face(poly_mesh->opposite_halfedge(hffc_it)).idx();
       cur_adj.push_back(f_id);
     }
-    face_adjlist.push_back(cur_adj);
   }
 
  /* LG::PolygonMesh::Halfedge_around_face_circulator hfc, hfce;
@@ -591,14 +614,16 @@ void Shape::buildVertexShareFaces()
   //}
 
   AdjList temp_fvc_list;
-  for (auto vit : poly_mesh->vertices())
+  int n_vertex = (int)poly_mesh->n_vertices();
+  vertex_adj_faces.resize(n_vertex);
+#pragma omp parallel for
+  for (int i = 0; i < n_vertex; ++i)
   {
-    std::vector<int> cur_adj;
-    for (auto fit : poly_mesh->faces(vit))
+    std::vector<int>& cur_adj = vertex_adj_faces[i];
+    for (auto fit : poly_mesh->faces(PolygonMesh::Vertex(i)))
     {
       cur_adj.push_back(fit.idx());
     }
-    vertex_adj_faces.push_back(cur_adj);
   }
 
   //std::ofstream f_vert_share_face("vert_share_face.txt");
@@ -654,14 +679,16 @@ void Shape::buildVertexAdj()
   //}
 
   AdjList temp_v_adjlist;
-  for (auto vit : poly_mesh->vertices())
+  int n_vertex = (int)poly_mesh->n_vertices();
+  vertex_adjlist.resize(n_vertex);
+#pragma omp parallel for
+  for (int i = 0; i < n_vertex; ++i)
   {
-    std::vector<int> cur_adj;
-    for (auto vvc_it : poly_mesh->vertices(vit))
+    std::vector<int>& cur_adj = vertex_adjlist[i];
+    for (auto vvc_it : poly_mesh->vertices(PolygonMesh::Vertex(i)))
     {
       cur_adj.push_back(vvc_it.idx());
     }
-    vertex_adjlist.push_back(cur_adj);
   }
 
   //std::ofstream f_debug("vertex_adj.txt");
@@ -837,38 +864,34 @@ void Shape::computeVertexNormal()
 
 void Shape::computeEdgeConnectivity()
 {
+  // edge j of face i goes from corner j to corner j + 1, the other half edge
+  // is the one going back in a face around its start vertex
+  // needs vertex_adj_faces
   edge_connectivity.clear();
   edge_connectivity.resize(face_list.size(), -1);
 
-  // for each edge in each face
-  int start;
-  int end;
-  int edge_id = 0;
-  int inner_index[6] = {0, 1, 1, 2, 2, 0};
-  // the edge map stores edges occurred before in the "key" and the edgeIdx in the value
-  std::map<std::pair<int, int>, int> edge_map;
-  std::map<std::pair<int, int>, int>::iterator iter;
-  for (size_t i = 0; i < face_list.size() / 3; ++i)
+  int n_face = (int)(face_list.size() / 3);
+#pragma omp parallel for
+  for (int i = 0; i < n_face; ++i)
   {
-    // iterate 3 edges in a face
     for (int j = 0; j < 3; ++j)
     {
-      start = face_list[3 * i + inner_index[2 * j + 0]];
-      end = face_list[3 * i + inner_index[2 * j + 1]];
-      iter = edge_map.find(std::pair<int, int>(end, start));
-      if (iter == edge_map.end())
-      {
-        // if not occurred before, store it
-        edge_map[std::pair<int, int>(start, end)] = edge_id;
-      }
-      else
+      int start = face_list[3 * i + j];
+      int end = face_list[3 * i + (j + 1) % 3];
+      const std::vector<int>& start_faces = vertex_adj_faces[start];
+      for (size_t k = 0; k < start_faces.size() && edge_connectivity[3 * i + j] == -1; ++k)
       {
-        // found an opposite edge
-        // set the two into the connectivityOut
-        edge_connectivity[iter->second] = edge_id;
-        edge_connectivity[edge_id] = iter->second;
+        int f = start_faces[k];
+        if (f == i) continue;
+        for (int m = 0; m < 3; ++m)
+        {
+          if (face_list[3 * f + m] == end && face_list[3 * f + (m + 1) % 3] == start)
+          {
+            edge_connectivity[3 * i + j] = 3 * f + m;
+            break;
+          }
+        }
       }
-      ++edge_id;
     }
   }
 }
@@ -894,6 +917,7 @@ float Shape::avgEdgeLength()
 
 std::shared_ptr<KDTreeWrapper> Shape::getKDTree()
 {
+  if (!kdTree) buildKDTree();
   return kdTree;
 }
 
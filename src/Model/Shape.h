@@ -4,6 +4,8 @@
 #include "BasicHeader.h"
 #include "geometry_types.h"
 #include <memory>
+#include <atomic>
+#include <mutex>
 
 class Bound;
 class KDTreeWrapper;
@@ -25,6 +27,9 @@ public:
   virtual ~Shape();
 
   void init(VertexList& vertexList, FaceList& faceList, FaceList& UVIdList, STLVectorf& UVList);
+  // a part of a multi-part model, the merged shape does the analysis, so only
+  // what display and the manipulator need is computed here
+  void initPart(VertexList& vertexList, FaceList& faceList, FaceList& UVIdList, STLVectorf& UVList);
   void setVertexList(VertexList& vertexList);
   void setFaceList(FaceList& faceList);
   void setColorList(STLVectorf& colorList);
@@ -79,6 +84,7 @@ public:
   void	 set_model(Model* m);
 private:
   void computeBaryCentreCoord(float pt[3], float v0[3], float v1[3], float v2[3], float lambd[3]);
+  void buildTopology(); // adjacency and edge connectivity, built on first use
   void buildFaceAdj();
   void buildVertexShareFaces();
   void buildVertexAdj();
@@ -106,6 +112,8 @@ private:
   AdjList    vertex_adjlist;
   AdjList    vertex_adj_faces; // vertex one-ring faces
   STLVectori edge_connectivity; // edge id is stored implicitly in the array index, the value stores edge id of the other half edge to it
+  std::atomic<bool> has_topology;
+  std::mutex topology_mutex;
 
   // attribute
   NormalList vertex_normal;
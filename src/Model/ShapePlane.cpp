@@ -2,7 +2,12 @@
 #include "Shape.h"
 #include "Bound.h"
 #include "Colormap.h"
+#include "ParameterMgr.h"
 #include <fstream>
+#include <algorithm>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 #include "obj_writer.h"
 
@@ -33,64 +38,165 @@ std::vector<std::set<int> >& ShapePlane::getFlats()
 
 void ShapePlane::findFlats()
 {
-  const FaceList& face_list = shape->getFaceList();
+  // faces are visited in order, a face not covered by any flat yet seeds a new
+  // flat of all faces reachable from it whose normal is within the threshold of
+  // the seed normal. A flat may take faces of earlier flats, covered only
+  // decides the seeds.
+  int n_face = (int)(shape->getFaceList().size() / 3);
   flat_surfaces.clear();
-  std::set<int> flat_surface;
-  
-  for (size_t i = 0; i < face_list.size() / 3; ++i)
+  std::vector<bool> covered(n_face, false);
+  bool parallel_seeding = LG::GlobalParameterMgr::GetInstance()->get_parameter<bool>("ShapePlane:parallel_seeding");
+
+  if (!parallel_seeding)
+  {
+    std::vector<int> stamp(n_face, -1);
+    std::vector<int> stack;
+    std::vector<int> region;
+    for (int i = 0; i < n_face; ++i)
+    {
+      if (covered[i]) continue;
+
+      this->flatSurface(i, (int)flat_surfaces.size(), stamp, stack, region);
+      for (size_t k = 0; k < region.size(); ++k) covered[region[k]] = true;
+      flat_surfaces.push_back(std::set<int>(region.begin(), region.end()));
+    }
+  }
+  else
   {
-    bool already_visited = false;
-    for (size_t j = 0; j < flat_surfaces.size(); ++j)
+    // speculative: the next uncovered faces grow their flats concurrently, then the
+    // flats are committed in face order and the ones whose seed got covered by an
+    // earlier commit are dropped, which gives the same flats as the serial scan
+#ifdef _OPENMP
+    int n_thread = omp_get_max_threads();
+#else
+    int n_thread = 1;
+#endif
+    std::vector<std::vector<int> > stamps(n_thread, std::vector<int>(n_face, -1));
+    std::vector<std::vector<int> > stacks(n_thread);
+    std::vector<std::vector<int> > regions(n_thread);
+    std::vector<int> seeds;
+    int next_face = 0;
+    int n_grown = 0;
+    while (true)
     {
-      if (flat_surfaces[j].find(i) != flat_surfaces[j].end())
+      seeds.clear();
+      for (; next_face < n_face && (int)seeds.size() < n_thread; ++next_face)
+      {
+        if (!covered[next_face]) seeds.push_back(next_face);
+      }
+      if (seeds.empty()) break;
+
+#pragma omp parallel for schedule(dynamic, 1)
+      for (int k = 0; k < (int)seeds.size(); ++k)
       {
-        already_visited = true;
-        break;
+        // a stamp only has to differ from the ones its buffer used before
+        this->flatSurface(seeds[k], n_grown + k, stamps[k], stacks[k], regions[k]);
+      }
+      n_grown += (int)seeds.size();
+
+      for (size_t k = 0; k < seeds.size(); ++k)
+      {
+        if (covered[seeds[k]]) continue;
+
+        std::vector<int>& region = regions[k];
+        for (size_t m = 0; m < region.size(); ++m) covered[region[m]] = true;
+        flat_surfaces.push_back(std::set<int>(region.begin(), region.end()));
       }
     }
+  }
 
-    if (already_visited)
+  this->fitPlanes();
+  std::cout << "Found " << flat_surfaces.size() << " flats in " << n_face << " faces." << std::endl;
+}
+
+void ShapePlane::flatSurface(int seed, int region_stamp, std::vector<int>& stamp, std::vector<int>& stack, std::vector<int>& region)
+{
+  // flood fill with an explicit stack, stamp marks the faces this region has tested
+  const NormalList& face_normal = shape->getFaceNormal();
+  const AdjList& adj_list = shape->getFaceAdjList();
+  float ref_normal[3];
+  ref_normal[0] = face_normal[3 * seed + 0];
+  ref_normal[1] = face_normal[3 * seed + 1];
+  ref_normal[2] = face_normal[3 * seed + 2];
+
+  region.clear();
+  stack.clear();
+  stack.push_back(seed);
+  stamp[seed] = region_stamp;
+  while (!stack.empty())
+  {
+    int f_id = stack.back();
+    stack.pop_back();
+
+    float face_cos = 0.0f;
+    face_cos += face_normal[3 * f_id + 0] * ref_normal[0];
+    face_cos += face_normal[3 * f_id + 1] * ref_normal[1];
+    face_cos += face_normal[3 * f_id + 2] * ref_normal[2];
+    if (face_cos < 0.99)
     {
       continue;
     }
-    else
+
+    region.push_back(f_id);
+    for (size_t i = 0; i < adj_list[f_id].size(); ++i)
     {
-      flat_surface.clear();
-      float ref_normal[3];
-      ref_normal[0] = shape->getFaceNormal()[3 * i + 0];
-      ref_normal[1] = shape->getFaceNormal()[3 * i + 1];
-      ref_normal[2] = shape->getFaceNormal()[3 * i + 2];
-      this->flatSurface(flat_surface, i, ref_normal);
-      flat_surfaces.push_back(flat_surface);
+      int adj_f = adj_list[f_id][i];
+      if (stamp[adj_f] != region_stamp)
+      {
+        stamp[adj_f] = region_stamp;
+        stack.push_back(adj_f);
+      }
     }
   }
-
+  std::sort(region.begin(), region.end());
 }
 
-void ShapePlane::flatSurface(std::set<int>& surface, int f_id, float ref_normal[3])
+void ShapePlane::fitPlanes()
 {
-  if (surface.find(f_id) != surface.end())
+  // least squares plane of each flat, area weighted over the face corners
+  // the normal is the eigenvector of the smallest eigenvalue of the covariance,
+  // oriented like the face normals, residual is the rms distance to the plane
+  const FaceList& face_list = shape->getFaceList();
+  const VertexList& vertex_list = shape->getVertexList();
+  const NormalList& face_normal = shape->getFaceNormal();
+  int n_flat = (int)flat_surfaces.size();
+  plane_fits.assign(n_flat, Vector4f::Zero());
+  plane_fit_residual.assign(n_flat, 0.0f);
+
+#pragma omp parallel for schedule(dynamic, 16)
+  for (int i = 0; i < n_flat; ++i)
   {
-    return;
-  }
+    double weight = 0;
+    Eigen::Vector3d sum_p = Eigen::Vector3d::Zero();
+    Eigen::Matrix3d sum_pp = Eigen::Matrix3d::Zero();
+    Eigen::Vector3d sum_n = Eigen::Vector3d::Zero();
+    for (auto j : flat_surfaces[i])
+    {
+      Eigen::Vector3d v[3];
+      for (int k = 0; k < 3; ++k)
+      {
+        int v_id = face_list[3 * j + k];
+        v[k] = Eigen::Vector3d(vertex_list[3 * v_id + 0], vertex_list[3 * v_id + 1], vertex_list[3 * v_id + 2]);
+      }
+      double area = 0.5 * (v[1] - v[0]).cross(v[2] - v[0]).norm();
+      for (int k = 0; k < 3; ++k)
+      {
+        sum_p += (area / 3) * v[k];
+        sum_pp += (area / 3) * v[k] * v[k].transpose();
+      }
+      weight += area;
+      sum_n += Eigen::Vector3d(face_normal[3 * j + 0], face_normal[3 * j + 1], face_normal[3 * j + 2]);
+    }
+    if (weight <= 0) continue;
 
-  float face_cos = 0.0f;
-  face_cos += shape->getFaceNormal()[3 * f_id + 0] * ref_normal[0];
-  face_cos += shape->getFaceNormal()[3 * f_id + 1] * ref_normal[1];
-  face_cos += shape->getFaceNormal()[3 * f_id + 2] * ref_normal[2];
-  //ref_normal[0] = shape->getFaceNormal()[3 * f_id + 0];
-  //ref_normal[1] = shape->getFaceNormal()[3 * f_id + 1];
-  //ref_normal[2] = shape->getFaceNormal()[3 * f_id + 2];
-  if (face_cos < 0.99)
-  {
-    return;
-  }
+    Eigen::Vector3d center = sum_p / weight;
+    Eigen::Matrix3d covariance = sum_pp / weight - center * center.transpose();
+    Eigen::SelfAdjointEigenSolver<Eigen::Matrix3d> eigen_solver(covariance);
+    Eigen::Vector3d normal = eigen_solver.eigenvectors().col(0);
+    if (normal.dot(sum_n) < 0) normal = -normal;
 
-  surface.insert(f_id);
-  const AdjList& adj_list = shape->getFaceAdjList();
-  for (size_t i = 0; i < adj_list[f_id].size(); ++i)
-  {
-    this->flatSurface(surface, adj_list[f_id][i], ref_normal);
+    plane_fits[i] = Vector4f(float(normal(0)), float(normal(1)), float(normal(2)), float(-normal.dot(center)));
+    plane_fit_residual[i] = float(std::sqrt(std::max(eigen_solver.eigenvalues()(0), 0.0)));
   }
 }
 
@@ -321,6 +427,7 @@ bool ShapePlane::loadExtPlaneInfo(std::string fname)
     }
   }
   inFile.close();
+  this->fitPlanes();
   std::cout << "Loading plane_info.txt finished." << std::endl;
   return true;
 }
@@ -363,6 +470,16 @@ std::vector<std::set<int>>& ShapePlane::getFlatSurfaces()
   return this->flat_surfaces;
 }
 
+std::vector<Vector4f>& ShapePlane::getPlaneFits()
+{
+  return this->plane_fits;
+}
+
+std::vector<float>& ShapePlane::getPlaneFitResidual()
+{
+  return this->plane_fit_residual;
+}
+
 void ShapePlane::findSymmetricPlane(int input_face_id, int& output_face_id, std::vector<int>& candidate)
 {
   double min = std::numeric_limits<double>::max();
@@ -33,16 +33,21 @@ public:
   std::vector<std::pair<Vector3f, Vector3f>>& getPlaneCenter();
   std::vector<std::pair<Vector3f, Vector3f>>& getOriginalPlaneCenter();
   std::vector<std::set<int>>& getFlatSurfaces();
+  std::vector<Vector4f>& getPlaneFits();
+  std::vector<float>& getPlaneFitResidual();
   void findSymmetricPlane(int input_face_id, int& output_face_id, std::vector<int>& candidate);
 
   void exportPlane(std::string fname);
 
 private:
-  void flatSurface(std::set<int>& surface, int f_id, float ref_normal[3]);
+  void flatSurface(int seed, int region_stamp, std::vector<int>& stamp, std::vector<int>& stack, std::vector<int>& region);
+  void fitPlanes();
 
 private:
   std::shared_ptr<Shape> shape;
   std::vector<std::set<int> > flat_surfaces; // face id here
+  std::vector<Vector4f> plane_fits; // a, b, c, d of the least squares plane of each flat
+  std::vector<float> plane_fit_residual; // rms distance of each flat to its plane
   std::vector<bool> tagged_planes; // face id here
   std::map<int, int> face_plane_mapper;
   double symmetric_plane_a, symmetric_plane_b, symmetric_plane_c, symmetric_plane_d;
@@ -0,0 +1,96 @@
+#include "CCASolver.h"
+
+#include <iostream>
+#include <algorithm>
+#include <cmath>
+
+CCASolver::CCASolver(int dim_x_, int dim_y_)
+  : dim_x(dim_x_), dim_y(dim_y_), n_sample(0)
+{
+  sum_x = Eigen::VectorXd::Zero(dim_x);
+  sum_y = Eigen::VectorXd::Zero(dim_y);
+  sum_xx = Eigen::MatrixXd::Zero(dim_x, dim_x);
+  sum_yy = Eigen::MatrixXd::Zero(dim_y, dim_y);
+  sum_xy = Eigen::MatrixXd::Zero(dim_x, dim_y);
+  x_sample.resize(dim_x);
+  y_sample.resize(dim_y);
+}
+
+void CCASolver::addSample(const float* x, const float* y)
+{
+  for (int i = 0; i < dim_x; ++i) x_sample[i] = x[i];
+  for (int i = 0; i < dim_y; ++i) y_sample[i] = y[i];
+
+  sum_x += x_sample;
+  sum_y += y_sample;
+  sum_xx.noalias() += x_sample * x_sample.transpose();
+  sum_yy.noalias() += y_sample * y_sample.transpose();
+  sum_xy.noalias() += x_sample * y_sample.transpose();
+  ++n_sample;
+}
+
+bool CCASolver::solve(double regularization, cv::Mat& cca_mat, std::vector<double>& correlation)
+{
+  if (n_sample < 2 || dim_x == 0 || dim_y == 0)
+  {
+    std::cout << "CCA needs at least 2 samples." << std::endl;
+    return false;
+  }
+
+  // covariance from the moments
+  double n = n_sample;
+  Eigen::VectorXd mean_x = sum_x / n;
+  Eigen::VectorXd mean_y = sum_y / n;
+  Eigen::MatrixXd C_xx = (sum_xx - n * mean_x * mean_x.transpose()) / (n - 1);
+  Eigen::MatrixXd C_yy = (sum_yy - n * mean_y * mean_y.transpose()) / (n - 1);
+  Eigen::MatrixXd C_xy = (sum_xy - n * mean_x * mean_y.transpose()) / (n - 1);
+
+  // constant features have no variance, the regularization keeps the factorization alive
+  double reg_x = regularization * std::max(C_xx.trace() / dim_x, 1e-12);
+  double reg_y = regularization * std::max(C_yy.trace() / dim_y, 1e-12);
+  C_xx.diagonal().array() += reg_x;
+  C_yy.diagonal().array() += reg_y;
+
+  Eigen::LLT<Eigen::MatrixXd> llt_x(C_xx);
+  Eigen::LLT<Eigen::MatrixXd> llt_y(C_yy);
+  if (llt_x.info() != Eigen::Success || llt_y.info() != Eigen::Success)
+  {
+    std::cout << "CCA: covariance is not positive definite." << std::endl;
+    return false;
+  }
+
+  // whitened cross covariance Lx^-1 * Cxy * Ly^-T
+  Eigen::MatrixXd M = llt_x.matrixL().solve(C_xy);
+  M = llt_y.matrixL().solve(M.transpose()).transpose();
+
+  // left singular vectors of M, eigenvalues come in increasing order
+  Eigen::SelfAdjointEigenSolver<Eigen::MatrixXd> eigen_solver(M * M.transpose());
+  if (eigen_solver.info() != Eigen::Success)
+  {
+    std::cout << "CCA: eigen decomposition failed." << std::endl;
+    return false;
+  }
+
+  int n_component = std::min(dim_x, dim_y);
+  Eigen::MatrixXd U(dim_x, n_component);
+  correlation.resize(n_component);
+  for (int i = 0; i < n_component; ++i)
+  {
+    int col = dim_x - 1 - i;
+    U.col(i) = eigen_solver.eigenvectors().col(col);
+    correlation[i] = std::sqrt(std::max(eigen_solver.eigenvalues()[col], 0.0));
+  }
+
+  // back to the feature space, A^T * Cxx * A = I
+  Eigen::MatrixXd A = llt_x.matrixU().solve(U);
+
+  cca_mat = cv::Mat(dim_x, n_component, CV_32FC1);
+  for (int i = 0; i < dim_x; ++i)
+  {
+    for (int j = 0; j < n_component; ++j)
+    {
+      cca_mat.at<float>(i, j) = float(A(i, j));
+    }
+  }
+  return true;
+}
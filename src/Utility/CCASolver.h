@@ -0,0 +1,40 @@
+#ifndef CCASolver_H
+#define CCASolver_H
+
+#include <cv.h>
+#include <vector>
+#include "BasicHeader.h"
+
+// Regularized canonical correlation analysis of paired samples x, y.
+// Samples are streamed in, only the sums of the first and second moments
+// are kept. solve() whitens both sides with the Cholesky factors of the
+// covariances and eigen-decomposes the small whitened cross covariance.
+// The projection has the layout of MATLAB canoncorr's A: X * cca_mat gives
+// the canonical variates, strongest correlation first.
+class CCASolver
+{
+public:
+  CCASolver(int dim_x_, int dim_y_);
+  ~CCASolver() {};
+
+  void addSample(const float* x, const float* y);
+  inline int getSampleNum() const { return n_sample; };
+
+  // regularization is relative to the mean variance of each side
+  // cca_mat is dim_x x min(dim_x, dim_y), CV_32FC1
+  bool solve(double regularization, cv::Mat& cca_mat, std::vector<double>& correlation);
+
+private:
+  int dim_x;
+  int dim_y;
+  int n_sample;
+  Eigen::VectorXd sum_x;
+  Eigen::VectorXd sum_y;
+  Eigen::MatrixXd sum_xx;
+  Eigen::MatrixXd sum_yy;
+  Eigen::MatrixXd sum_xy;
+  Eigen::VectorXd x_sample; // buffers of addSample()
+  Eigen::VectorXd y_sample;
+};
+
+#endif // !CCASolver_H
@@ -0,0 +1,98 @@
+#ifndef CandidateHeap_H
+#define CandidateHeap_H
+
+#include <vector>
+#include <algorithm>
+
+struct distance_position
+{
+  double d;
+  std::pair<int, int> pos;
+  bool operator < (const distance_position& a) const
+  {
+    return a.d > d;
+  }
+  distance_position(double _d = 0, std::pair<int, int> _pos = std::pair<int, int>(0, 0)) : d(_d), pos(_pos) {};
+};
+
+// Best candidates of one target pixel, at most capacity of them.
+// The storage is owned by a CandidateArena. Candidates are kept as a max heap
+// on the distance, so the worst one is at the front and is replaced in place
+// when a better one comes. Like the std::set on d it replaces, a distance is kept
+// only once, the first candidate pushed with it wins.
+class CandidateHeap
+{
+public:
+  CandidateHeap() : data(nullptr), n(nullptr), capacity(0) {};
+  CandidateHeap(distance_position* _data, int* _n, int _capacity) : data(_data), n(_n), capacity(_capacity) {};
+
+  inline int size() const { return *n; };
+  inline bool empty() const { return *n == 0; };
+  inline void clear() { *n = 0; };
+  inline distance_position* begin() const { return data; };
+  inline distance_position* end() const { return data + *n; };
+  inline const distance_position& worst() const { return data[0]; }; // only valid before sort()
+
+  // returns false if the candidate is not better than the ones we have
+  inline bool push(double d, const std::pair<int, int>& pos)
+  {
+    if (*n == capacity && !(d < data[0].d)) return false;
+    for (int i = 0; i < *n; ++i)
+    {
+      if (data[i].d == d) return false;
+    }
+    if (*n < capacity)
+    {
+      data[*n] = distance_position(d, pos);
+      ++(*n);
+      std::push_heap(data, data + *n);
+    }
+    else
+    {
+      std::pop_heap(data, data + *n);
+      data[*n - 1] = distance_position(d, pos);
+      std::push_heap(data, data + *n);
+    }
+    return true;
+  };
+
+  // ascending order of distance, the list can not be pushed anymore after this
+  inline void sort() { std::sort_heap(data, data + *n); };
+
+private:
+  distance_position* data;
+  int* n;
+  int capacity;
+};
+
+// One flat buffer of n_pixel * capacity candidates for a whole image,
+// replaces a set per pixel so a level does no allocation per pixel.
+class CandidateArena
+{
+public:
+  CandidateArena() : capacity(0) {};
+  CandidateArena(int n_pixel, int _capacity) { this->init(n_pixel, _capacity); };
+  ~CandidateArena() {};
+
+  inline void init(int n_pixel, int _capacity)
+  {
+    capacity = _capacity;
+    buffer.resize(size_t(n_pixel) * capacity);
+    count.assign(n_pixel, 0);
+  };
+  inline CandidateHeap at(int pixel) { return CandidateHeap(&buffer[size_t(pixel) * capacity], &count[pixel], capacity); };
+  inline int size() const { return (int)count.size(); };
+  inline void swap(CandidateArena& other)
+  {
+    std::swap(capacity, other.capacity);
+    buffer.swap(other.buffer);
+    count.swap(other.count);
+  };
+
+private:
+  int capacity;
+  std::vector<distance_position> buffer;
+  std::vector<int> count;
+};
+
+#endif // !CandidateHeap_H
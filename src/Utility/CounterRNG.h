@@ -0,0 +1,53 @@
+#ifndef CounterRNG_H
+#define CounterRNG_H
+
+// Counter based random numbers: the n-th number of a stream is a hash of
+// (key, n), so there is no state but a counter. A stream is keyed by a seed
+// and up to three ids (e.g. level, pass, tile), every worker can build the
+// stream of its own work item and the numbers don't depend on which thread
+// runs it or in which order. The hash is the splitmix64 finalizer.
+class CounterRNG
+{
+public:
+  CounterRNG(unsigned int seed = 0, unsigned int id_0 = 0, unsigned int id_1 = 0, unsigned int id_2 = 0)
+  {
+    key = mix(seed);
+    key = mix(key ^ id_0);
+    key = mix(key ^ id_1);
+    key = mix(key ^ id_2);
+    counter = 0;
+  };
+
+  inline unsigned int next()
+  {
+    ++counter;
+    return (unsigned int)(mix(key + counter * 0x9E3779B97F4A7C15ULL) >> 32);
+  };
+
+  // uniform in [0, n), n > 0
+  inline int uniformInt(int n)
+  {
+    return (int)(((unsigned long long)this->next() * (unsigned int)n) >> 32);
+  };
+
+  // uniform in [0, 1)
+  inline double uniform()
+  {
+    return this->next() * (1.0 / 4294967296.0);
+  };
+
+private:
+  static inline unsigned long long mix(unsigned long long z)
+  {
+    z += 0x9E3779B97F4A7C15ULL;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+  };
+
+private:
+  unsigned long long key;
+  unsigned long long counter;
+};
+
+#endif // !CounterRNG_H
@@ -0,0 +1,226 @@
+#include "DebugExporter.h"
+#include "YMLHandler.h"
+#include "ParameterMgr.h"
+
+#include <highgui.h>
+#include <fstream>
+#include <iostream>
+
+namespace
+{
+  const size_t MAX_PENDING_JOB = 8;
+  const size_t MAX_FREE_BUFFER = 32;
+}
+
+DebugExporter::DebugExporter()
+{
+  n_writing = 0;
+  is_stopping = false;
+}
+
+DebugExporter::~DebugExporter()
+{
+  {
+    std::unique_lock<std::mutex> lock(job_mutex);
+    is_stopping = true;
+  }
+  job_cond.notify_all();
+  if (writer.joinable()) writer.join();
+}
+
+bool DebugExporter::isEnabled(int level)
+{
+  return level <= LG::GlobalParameterMgr::GetInstance()->get_parameter<int>("DebugOutput:ExportLevel");
+}
+
+void DebugExporter::writeNormalized(int level, const std::string& file_name, const cv::Mat& img)
+{
+  if (!this->isEnabled(level)) return;
+
+  ExportJob job;
+  job.type = JOB_NORMALIZED;
+  job.file_name = file_name;
+  std::vector<const cv::Mat*> mats(1, &img);
+  this->enqueue(job, mats);
+}
+
+void DebugExporter::writeNormalized(int level, const std::string& file_name, const cv::Mat& r, const cv::Mat& g, const cv::Mat& b)
+{
+  if (!this->isEnabled(level)) return;
+
+  ExportJob job;
+  job.type = JOB_NORMALIZED;
+  job.file_name = file_name;
+  std::vector<const cv::Mat*> mats;
+  mats.push_back(&b);
+  mats.push_back(&g);
+  mats.push_back(&r);
+  this->enqueue(job, mats);
+}
+
+void DebugExporter::writeScaled(int level, const std::string& file_name, const cv::Mat& img, double scale)
+{
+  if (!this->isEnabled(level)) return;
+
+  ExportJob job;
+  job.type = JOB_SCALED;
+  job.file_name = file_name;
+  job.scale = scale;
+  std::vector<const cv::Mat*> mats(1, &img);
+  this->enqueue(job, mats);
+}
+
+void DebugExporter::writeMat(int level, const std::string& file_path, const std::string& file_name, const cv::Mat& mat)
+{
+  if (!this->isEnabled(level)) return;
+
+  ExportJob job;
+  job.type = JOB_MAT;
+  job.file_path = file_path;
+  job.file_name = file_name;
+  std::vector<const cv::Mat*> mats(1, &mat);
+  this->enqueue(job, mats);
+}
+
+void DebugExporter::writeText(int level, const std::string& file_name, const cv::Mat& mat)
+{
+  if (!this->isEnabled(level)) return;
+
+  ExportJob job;
+  job.type = JOB_TEXT;
+  job.file_name = file_name;
+  std::vector<const cv::Mat*> mats(1, &mat);
+  this->enqueue(job, mats);
+}
+
+void DebugExporter::flush()
+{
+  std::unique_lock<std::mutex> lock(job_mutex);
+  while (!jobs.empty() || n_writing > 0)
+  {
+    done_cond.wait(lock);
+  }
+}
+
+void DebugExporter::enqueue(ExportJob& job, const std::vector<const cv::Mat*>& mats)
+{
+  std::unique_lock<std::mutex> lock(job_mutex);
+  while (jobs.size() >= MAX_PENDING_JOB)
+  {
+    done_cond.wait(lock);
+  }
+  for (size_t i = 0; i < mats.size(); ++i)
+  {
+    job.mats.push_back(this->acquireBuffer(*mats[i]));
+  }
+  lock.unlock();
+
+  // copy on enqueue, into the buffers of written jobs if they fit
+  for (size_t i = 0; i < mats.size(); ++i)
+  {
+    mats[i]->copyTo(job.mats[i]);
+  }
+
+  lock.lock();
+  jobs.push_back(job);
+  if (!writer.joinable())
+  {
+    writer = std::thread(&DebugExporter::writerLoop, this);
+  }
+  lock.unlock();
+  job_cond.notify_one();
+}
+
+cv::Mat DebugExporter::acquireBuffer(const cv::Mat& mat)
+{
+  for (size_t i = 0; i < free_buffers.size(); ++i)
+  {
+    if (free_buffers[i].size() == mat.size() && free_buffers[i].type() == mat.type())
+    {
+      cv::Mat buffer = free_buffers[i];
+      free_buffers[i] = free_buffers.back();
+      free_buffers.pop_back();
+      return buffer;
+    }
+  }
+  return cv::Mat(mat.size(), mat.type());
+}
+
+void DebugExporter::releaseBuffers(std::vector<cv::Mat>& mats)
+{
+  for (size_t i = 0; i < mats.size() && free_buffers.size() < MAX_FREE_BUFFER; ++i)
+  {
+    free_buffers.push_back(mats[i]);
+  }
+  mats.clear();
+}
+
+void DebugExporter::writerLoop()
+{
+  std::unique_lock<std::mutex> lock(job_mutex);
+  while (true)
+  {
+    while (jobs.empty() && !is_stopping)
+    {
+      job_cond.wait(lock);
+    }
+    if (jobs.empty()) break; // stopping and nothing left
+
+    ExportJob job = jobs.front();
+    jobs.pop_front();
+    ++n_writing;
+
+    lock.unlock();
+    this->write(job);
+    lock.lock();
+
+    --n_writing;
+    this->releaseBuffers(job.mats);
+    done_cond.notify_all();
+  }
+}
+
+void DebugExporter::write(ExportJob& job)
+{
+  switch (job.type)
+  {
+  case JOB_NORMALIZED:
+    {
+      cv::Mat output;
+      if (job.mats.size() == 1) output = job.mats[0];
+      else cv::merge(&job.mats[0], job.mats.size(), output);
+      double min, max;
+      cv::minMaxLoc(output.reshape(1), &min, &max);
+      if (max > 1.0) output = output / max;
+      cv::imwrite(job.file_name, output * 255);
+    }
+    break;
+  case JOB_SCALED:
+    cv::imwrite(job.file_name, job.mats[0] * job.scale);
+    break;
+  case JOB_MAT:
+    YMLHandler::saveToMat(job.file_path, job.file_name, job.mats[0]);
+    break;
+  case JOB_TEXT:
+    {
+      std::ofstream outFile(job.file_name);
+      if (!outFile)
+      {
+        std::cout << "DebugExporter: can't open " << job.file_name << std::endl;
+        break;
+      }
+      cv::Mat& mat = job.mats[0];
+      for (int i = 0; i < mat.rows; ++i)
+      {
+        const float* row = mat.ptr<float>(i);
+        for (int j = 0; j < mat.cols; ++j)
+        {
+          outFile << row[j] << (j + 1 < mat.cols ? " " : "");
+        }
+        outFile << "\n";
+      }
+      outFile.close();
+    }
+    break;
+  }
+}
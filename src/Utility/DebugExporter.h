@@ -0,0 +1,92 @@
+#ifndef DebugExporter_H
+#define DebugExporter_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <cv.h>
+
+// Writes the intermediate images and matrices of the algorithms on a background thread.
+// An export is only done if its level is not above "DebugOutput:ExportLevel", callers
+// test isEnabled() first so a disabled export costs nothing. The data is copied into
+// a pooled buffer when it is queued, the caller can change it right after the call.
+// The queue is bounded, a caller waits if the writer is too far behind.
+class DebugExporter
+{
+public:
+  enum ExportLevel
+  {
+    EXPORT_ALWAYS = 0,    // asked for explicitly, e.g. snapshot
+    EXPORT_STAGE = 1,     // once per pyramid level or algorithm stage
+    EXPORT_ITERATION = 2  // every iteration
+  };
+
+  static DebugExporter* GetInstance()
+  {
+    static DebugExporter instance;
+    return &instance;
+  }
+
+  bool isEnabled(int level);
+
+  // image / max if max > 1, then * 255
+  void writeNormalized(int level, const std::string& file_name, const cv::Mat& img);
+  // r, g, b merged into one color image, then normalized
+  void writeNormalized(int level, const std::string& file_name, const cv::Mat& r, const cv::Mat& g, const cv::Mat& b);
+  // image * scale
+  void writeScaled(int level, const std::string& file_name, const cv::Mat& img, double scale);
+  // YMLHandler::saveToMat
+  void writeMat(int level, const std::string& file_path, const std::string& file_name, const cv::Mat& mat);
+  // plain text matrix of a one channel float image
+  void writeText(int level, const std::string& file_name, const cv::Mat& mat);
+
+  void flush(); // wait until everything queued is written
+
+private:
+  enum JobType
+  {
+    JOB_NORMALIZED,
+    JOB_SCALED,
+    JOB_MAT,
+    JOB_TEXT
+  };
+
+  struct ExportJob
+  {
+    JobType type;
+    std::string file_path;
+    std::string file_name;
+    std::vector<cv::Mat> mats;
+    double scale;
+
+    ExportJob() : type(JOB_NORMALIZED), scale(1.0) {};
+  };
+
+  DebugExporter();
+  ~DebugExporter();
+
+  void enqueue(ExportJob& job, const std::vector<const cv::Mat*>& mats);
+  cv::Mat acquireBuffer(const cv::Mat& mat);
+  void releaseBuffers(std::vector<cv::Mat>& mats);
+  void writerLoop();
+  void write(ExportJob& job);
+
+private:
+  std::deque<ExportJob> jobs;
+  std::vector<cv::Mat> free_buffers;
+  std::mutex job_mutex;
+  std::condition_variable job_cond;  // a job is queued or the writer should stop
+  std::condition_variable done_cond; // a job is written
+  std::thread writer;
+  int n_writing;
+  bool is_stopping;
+
+private:
+  DebugExporter(const DebugExporter&);
+  void operator = (const DebugExporter&);
+};
+
+#endif // !DebugExporter_H
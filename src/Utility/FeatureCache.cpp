@@ -0,0 +1,194 @@
+#include "FeatureCache.h"
+
+#include <iostream>
+#include <fstream>
+#include <cstring>
+
+// feature cache file
+// header | block table | block data, each block is n_vertex * dim raw floats
+namespace
+{
+  const char FEATURE_MAGIC[8] = { 'F', 'E', 'A', 'T', 'C', 'A', 'C', 'H' };
+  const uint32_t FEATURE_VERSION = 1;
+  const size_t FEATURE_NAME_SIZE = 48;
+
+  struct FeatureHeader
+  {
+    char magic[8];
+    uint32_t version;
+    uint32_t n_block;
+  };
+
+  struct FeatureBlockEntry
+  {
+    char name[FEATURE_NAME_SIZE];
+    uint64_t key;
+    int32_t n_vertex;
+    int32_t dim;
+    uint64_t offset; // from the beginning of the file
+  };
+}
+
+FeatureCache::FeatureCache(const std::string& file_name_)
+  : file_name(file_name_), is_loaded(false), is_dirty(false)
+{
+}
+
+FeatureCache::~FeatureCache()
+{
+  this->flush();
+}
+
+uint64_t FeatureCache::hashBytes(const void* data, size_t n_bytes, uint64_t seed)
+{
+  const uint64_t prime = 1099511628211ULL;
+  uint64_t hash = seed;
+
+  const unsigned char* bytes = (const unsigned char*)data;
+  for (size_t i = 0; i < n_bytes; ++i)
+  {
+    hash = (hash ^ bytes[i]) * prime;
+  }
+  return hash;
+}
+
+bool FeatureCache::get(const std::string& name, uint64_t key, int n_vertex, int dim, std::vector<float>& data)
+{
+  this->load();
+
+  std::map<std::string, FeatureBlock>::iterator it = blocks.find(name);
+  if (it == blocks.end()) return false;
+
+  const FeatureBlock& block = it->second;
+  if (block.key != key || block.n_vertex != n_vertex || block.dim != dim)
+  {
+    std::cout << "Feature cache " << name << " is out of date." << std::endl;
+    return false;
+  }
+  data = block.data;
+  return true;
+}
+
+void FeatureCache::put(const std::string& name, uint64_t key, int n_vertex, int dim, const std::vector<float>& data)
+{
+  if (name.size() >= FEATURE_NAME_SIZE || data.size() != size_t(n_vertex) * dim)
+  {
+    std::cout << "Can't cache feature " << name << std::endl;
+    return;
+  }
+
+  this->load();
+
+  FeatureBlock& block = blocks[name];
+  block.key = key;
+  block.n_vertex = n_vertex;
+  block.dim = dim;
+  block.data = data;
+  is_dirty = true;
+}
+
+bool FeatureCache::flush()
+{
+  if (!is_dirty) return true;
+
+  if (!this->save())
+  {
+    std::cout << "failed to write feature cache " << file_name << std::endl;
+    return false;
+  }
+  is_dirty = false;
+  return true;
+}
+
+void FeatureCache::clear()
+{
+  blocks.clear();
+  is_loaded = false;
+  is_dirty = false;
+}
+
+void FeatureCache::load()
+{
+  if (is_loaded) return;
+  is_loaded = true;
+  blocks.clear();
+
+  std::ifstream inFile(file_name, std::ios::binary | std::ios::ate);
+  if (!inFile.is_open()) return;
+
+  // one read for the whole file
+  std::streamoff file_size = inFile.tellg();
+  if (file_size < (std::streamoff)sizeof(FeatureHeader)) return;
+  std::vector<char> buffer((size_t)file_size);
+  inFile.seekg(0, std::ios::beg);
+  if (!inFile.read(&buffer[0], file_size)) return;
+  inFile.close();
+
+  const FeatureHeader* header = (const FeatureHeader*)&buffer[0];
+  if (std::memcmp(header->magic, FEATURE_MAGIC, sizeof(FEATURE_MAGIC)) != 0 || header->version != FEATURE_VERSION)
+  {
+    std::cout << "Unsupported feature cache, it will be regenerated: " << file_name << std::endl;
+    return;
+  }
+  if (sizeof(FeatureHeader) + uint64_t(header->n_block) * sizeof(FeatureBlockEntry) > buffer.size())
+  {
+    std::cout << "Broken feature cache: " << file_name << std::endl;
+    return;
+  }
+
+  const FeatureBlockEntry* table = (const FeatureBlockEntry*)(&buffer[0] + sizeof(FeatureHeader));
+  for (uint32_t i = 0; i < header->n_block; ++i)
+  {
+    const FeatureBlockEntry& entry = table[i];
+    uint64_t bytes = uint64_t(entry.n_vertex) * entry.dim * sizeof(float);
+    if (entry.n_vertex < 0 || entry.dim < 0 || entry.offset + bytes > buffer.size())
+    {
+      std::cout << "Broken feature cache: " << file_name << std::endl;
+      blocks.clear();
+      return;
+    }
+
+    FeatureBlock& block = blocks[std::string(entry.name, strnlen(entry.name, sizeof(entry.name)))];
+    block.key = entry.key;
+    block.n_vertex = entry.n_vertex;
+    block.dim = entry.dim;
+    block.data.resize(size_t(entry.n_vertex) * entry.dim);
+    if (bytes > 0) std::memcpy(&block.data[0], &buffer[0] + entry.offset, (size_t)bytes);
+  }
+
+  std::cout << "Feature cache loaded: " << file_name << ", " << blocks.size() << " blocks." << std::endl;
+}
+
+bool FeatureCache::save()
+{
+  std::vector<FeatureBlockEntry> table;
+  uint64_t offset = sizeof(FeatureHeader) + blocks.size() * sizeof(FeatureBlockEntry);
+  for (std::map<std::string, FeatureBlock>::iterator it = blocks.begin(); it != blocks.end(); ++it)
+  {
+    FeatureBlockEntry entry;
+    std::memset(&entry, 0, sizeof(entry));
+    std::memcpy(entry.name, it->first.c_str(), it->first.size());
+    entry.key = it->second.key;
+    entry.n_vertex = it->second.n_vertex;
+    entry.dim = it->second.dim;
+    entry.offset = offset;
+    offset += it->second.data.size() * sizeof(float);
+    table.push_back(entry);
+  }
+
+  std::ofstream outFile(file_name, std::ios::binary);
+  if (!outFile.is_open()) return false;
+
+  FeatureHeader header;
+  std::memcpy(header.magic, FEATURE_MAGIC, sizeof(FEATURE_MAGIC));
+  header.version = FEATURE_VERSION;
+  header.n_block = (uint32_t)table.size();
+  outFile.write((const char*)&header, sizeof(header));
+  if (!table.empty()) outFile.write((const char*)&table[0], table.size() * sizeof(FeatureBlockEntry));
+  for (std::map<std::string, FeatureBlock>::iterator it = blocks.begin(); it != blocks.end(); ++it)
+  {
+    if (!it->second.data.empty()) outFile.write((const char*)&it->second.data[0], it->second.data.size() * sizeof(float));
+  }
+  outFile.close();
+  return !outFile.fail();
+}
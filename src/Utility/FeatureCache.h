@@ -0,0 +1,52 @@
+#ifndef FeatureCache_H
+#define FeatureCache_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <cstdint>
+
+// Binary cache of the per-vertex features of one mesh, <data_path>/<file_name>.features.
+// Every block is a n_vertex x dim float array with a name and the key of the
+// mesh it was computed on, so a block of an edited mesh is never reused.
+// The whole file is read at once the first time it is asked for a block,
+// put() only changes the blocks in memory, flush() writes the file once for all
+// of them and it is also called on destruction.
+class FeatureCache
+{
+public:
+  FeatureCache(const std::string& file_name_);
+  ~FeatureCache();
+
+  bool get(const std::string& name, uint64_t key, int n_vertex, int dim, std::vector<float>& data);
+  void put(const std::string& name, uint64_t key, int n_vertex, int dim, const std::vector<float>& data);
+  bool flush(); // write the file if a block was put since the last write
+  void clear();
+
+  // 64 bit FNV-1a over the bytes, chain the calls with seed
+  static uint64_t hashBytes(const void* data, size_t n_bytes, uint64_t seed = 14695981039346656037ULL);
+
+private:
+  struct FeatureBlock
+  {
+    uint64_t key;
+    int n_vertex;
+    int dim;
+    std::vector<float> data;
+  };
+
+  void load();
+  bool save();
+
+private:
+  std::string file_name;
+  std::map<std::string, FeatureBlock> blocks;
+  bool is_loaded;
+  bool is_dirty;
+
+private:
+  FeatureCache(const FeatureCache&);
+  void operator = (const FeatureCache&);
+};
+
+#endif // !FeatureCache_H
@@ -0,0 +1,91 @@
+#include "MappedFile.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+MappedFile::MappedFile()
+{
+  ptr = nullptr;
+  length = 0;
+#ifdef _WIN32
+  file_handle = INVALID_HANDLE_VALUE;
+  map_handle = nullptr;
+#else
+  fd = -1;
+#endif
+}
+
+MappedFile::~MappedFile()
+{
+  this->close();
+}
+
+bool MappedFile::open(const std::string& file_name)
+{
+  this->close();
+
+#ifdef _WIN32
+  file_handle = CreateFileA(file_name.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (file_handle == INVALID_HANDLE_VALUE) return false;
+
+  LARGE_INTEGER file_size;
+  if (!GetFileSizeEx(file_handle, &file_size) || file_size.QuadPart == 0)
+  {
+    this->close();
+    return false;
+  }
+  length = (size_t)file_size.QuadPart;
+
+  map_handle = CreateFileMappingA(file_handle, NULL, PAGE_WRITECOPY, 0, 0, NULL);
+  if (map_handle == nullptr)
+  {
+    this->close();
+    return false;
+  }
+  ptr = (char*)MapViewOfFile(map_handle, FILE_MAP_COPY, 0, 0, 0);
+#else
+  fd = ::open(file_name.c_str(), O_RDONLY);
+  if (fd < 0) return false;
+
+  struct stat file_stat;
+  if (fstat(fd, &file_stat) != 0 || file_stat.st_size == 0)
+  {
+    this->close();
+    return false;
+  }
+  length = (size_t)file_stat.st_size;
+
+  void* addr = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  ptr = (addr == MAP_FAILED) ? nullptr : (char*)addr;
+#endif
+
+  if (ptr == nullptr)
+  {
+    this->close();
+    return false;
+  }
+  return true;
+}
+
+void MappedFile::close()
+{
+#ifdef _WIN32
+  if (ptr != nullptr) UnmapViewOfFile(ptr);
+  if (map_handle != nullptr) CloseHandle(map_handle);
+  if (file_handle != INVALID_HANDLE_VALUE) CloseHandle(file_handle);
+  map_handle = nullptr;
+  file_handle = INVALID_HANDLE_VALUE;
+#else
+  if (ptr != nullptr) munmap(ptr, length);
+  if (fd >= 0) ::close(fd);
+  fd = -1;
+#endif
+  ptr = nullptr;
+  length = 0;
+}
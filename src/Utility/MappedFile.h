@@ -0,0 +1,36 @@
+#ifndef MappedFile_H
+#define MappedFile_H
+
+#include <string>
+
+// Read a whole file through a copy on write memory mapping.
+// Pages are read from disk only when they are touched, and writing to
+// the mapped memory never changes the file.
+class MappedFile
+{
+public:
+  MappedFile();
+  ~MappedFile();
+
+  bool open(const std::string& file_name);
+  void close();
+  inline bool isOpen() const { return ptr != nullptr; };
+  inline char* data() const { return ptr; };
+  inline size_t size() const { return length; };
+
+private:
+  char* ptr;
+  size_t length;
+#ifdef _WIN32
+  void* file_handle;
+  void* map_handle;
+#else
+  int fd;
+#endif
+
+private:
+  MappedFile(const MappedFile&);
+  void operator = (const MappedFile&);
+};
+
+#endif // !MappedFile_H
@@ -225,7 +225,7 @@ void InitMaterial(material_t& material) {
 static bool
 exportFaceGroupToShape(
   shape_t& shape,
-  std::map<vertex_index, unsigned int> vertexCache,
+  std::map<vertex_index, unsigned int>& vertexCache,
   const std::vector<float> &in_positions,
   const std::vector<float> &in_normals,
   const std::vector<float> &in_texcoords,
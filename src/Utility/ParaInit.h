@@ -5,7 +5,7 @@
 
 #include "BasicHeader.h"
 
-void InitGlobalParameter()
+inline void InitGlobalParameter()
 {
   LG::GlobalParameterMgr::GetInstance()->add_parameter<float>("SField:DistAttenuation", 0.0f);
   LG::GlobalParameterMgr::GetInstance()->add_parameter<int>("TrackballView:ShowTrackball", 1);
@@ -17,6 +17,7 @@ void InitGlobalParameter()
   LG::GlobalParameterMgr::GetInstance()->add_parameter<double>("SField:d", 5.0);
   LG::GlobalParameterMgr::GetInstance()->add_parameter<double>("SField:e", 2.5);
   LG::GlobalParameterMgr::GetInstance()->add_parameter<int>("SField:crsp_type", 1);
+  LG::GlobalParameterMgr::GetInstance()->add_parameter<int>("SField:hmm_beam_width", 0); // 0: exact Viterbi in LargeFeatureCrsp::solveHMM
 
   LG::GlobalParameterMgr::GetInstance()->add_parameter<double>("SField:WinWidth", 1.0);
   LG::GlobalParameterMgr::GetInstance()->add_parameter<double>("SField:WinCenter", 0.5);
@@ -43,8 +44,14 @@ void InitGlobalParameter()
   LG::GlobalParameterMgr::GetInstance()->add_parameter<double>("ShapCrest:source_curves_threshhold", 0.75);
   LG::GlobalParameterMgr::GetInstance()->add_parameter<double>("ShapCrest:source_curves_conntect_threshhold", -0.85);
   LG::GlobalParameterMgr::GetInstance()->add_parameter<bool>("ShapCrest:source_curves_show_color", false);
+  LG::GlobalParameterMgr::GetInstance()->add_parameter<double>("ShapCrest:crest_ridgeness_threshhold", 1.0);
+  LG::GlobalParameterMgr::GetInstance()->add_parameter<bool>("ShapePlane:parallel_seeding", false);
   LG::GlobalParameterMgr::GetInstance()->add_parameter<double>("FeatureGuided:target_curves_threshhold", 0.5);
 
+  LG::GlobalParameterMgr::GetInstance()->add_parameter<int>("GeometryTransfer:max_iter", 20);
+  LG::GlobalParameterMgr::GetInstance()->add_parameter<double>("GeometryTransfer:converge_tol", 1e-3);
+  LG::GlobalParameterMgr::GetInstance()->add_parameter<int>("GeometryTransfer:anderson_m", 5);
+
   LG::GlobalParameterMgr::GetInstance()->add_parameter<double>("Synthesis:scale", 0.07);
   LG::GlobalParameterMgr::GetInstance()->add_parameter<bool>("Synthesis:is_wait", true);
   LG::GlobalParameterMgr::GetInstance()->add_parameter<int>("Synthesis:n_ring", 0);
@@ -57,13 +64,26 @@ void InitGlobalParameter()
   LG::GlobalParameterMgr::GetInstance()->add_parameter<double>("Synthesis:bias_rate", 0.1);
   LG::GlobalParameterMgr::GetInstance()->add_parameter<double>("Synthesis:beta_center", 0.0);
   LG::GlobalParameterMgr::GetInstance()->add_parameter<double>("Synthesis:beta_mult", 5.0);
+  LG::GlobalParameterMgr::GetInstance()->add_parameter<bool>("Synthesis:parallel_nnf", false); // opt in, ref_cnt is frozen within a phase, check with Synthesis:benchmark_parallel_nnf
+  LG::GlobalParameterMgr::GetInstance()->add_parameter<int>("Synthesis:nnf_tile_size", 32);
+  LG::GlobalParameterMgr::GetInstance()->add_parameter<bool>("Synthesis:vote_mode", false); // vote the fullest value bin instead of the mean
+  LG::GlobalParameterMgr::GetInstance()->add_parameter<int>("Synthesis:rand_seed", 0); // same seed, same result
+  LG::GlobalParameterMgr::GetInstance()->add_parameter<bool>("Synthesis:window_search", false);
+  LG::GlobalParameterMgr::GetInstance()->add_parameter<bool>("Synthesis:candidate_index", false); // approximate feature candidates from the PCA kd-tree
+  LG::GlobalParameterMgr::GetInstance()->add_parameter<int>("Synthesis:ann_oversample", 4);
+  LG::GlobalParameterMgr::GetInstance()->add_parameter<bool>("Synthesis:benchmark_candidate_index", false);
+  LG::GlobalParameterMgr::GetInstance()->add_parameter<bool>("Synthesis:benchmark_parallel_nnf", false); // serial against parallel nnf energy and time on each level
+  LG::GlobalParameterMgr::GetInstance()->add_parameter<int>("Synthesis:batch_workers", 2);
+  LG::GlobalParameterMgr::GetInstance()->add_parameter<int>("Synthesis:batch_cache_size", 4);
   LG::GlobalParameterMgr::GetInstance()->add_parameter<bool>("Synthesis:geo_transfer_use_para_map", false);
+  LG::GlobalParameterMgr::GetInstance()->add_parameter<double>("Synthesis:cca_regularization", 1e-4);
   LG::GlobalParameterMgr::GetInstance()->add_parameter<cv::Mat>("Synthesis:SrcAppMask");
   LG::GlobalParameterMgr::GetInstance()->add_parameter<cv::Mat>("Synthesis:SrcAppOriginImageMask");
   LG::GlobalParameterMgr::GetInstance()->add_parameter<cv::Mat>("Synthesis:TarAppMask");
   LG::GlobalParameterMgr::GetInstance()->add_parameter<bool>("ShapeManipulator:Axis", true);
 
   LG::GlobalParameterMgr::GetInstance()->add_parameter<bool>("DebugOutput:ShowRefineCrspTime", true);
+  LG::GlobalParameterMgr::GetInstance()->add_parameter<int>("DebugOutput:ExportLevel", 0); // 0 none, 1 per stage, 2 per iteration
 }
 
 #endif
\ No newline at end of file
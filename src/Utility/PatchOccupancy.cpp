@@ -0,0 +1,49 @@
+#include "PatchOccupancy.h"
+
+#include <algorithm>
+#include <cstdlib>
+
+PatchOccupancy::PatchOccupancy()
+{
+  nnf_width = 0;
+  nnf_height = 0;
+  patch_size = 0;
+}
+
+PatchOccupancy::PatchOccupancy(int img_width, int img_height, int patch_size)
+{
+  this->init(img_width, img_height, patch_size);
+}
+
+void PatchOccupancy::init(int img_width, int img_height, int patch_size)
+{
+  this->patch_size = patch_size;
+  nnf_width = std::max(0, img_width - patch_size + 1);
+  nnf_height = std::max(0, img_height - patch_size + 1);
+  patch_sum.assign(nnf_width * nnf_height, 0.0f);
+
+  overlap.resize(2 * patch_size - 1);
+  for (int d = -(patch_size - 1); d < patch_size; ++d)
+  {
+    overlap[d + patch_size - 1] = float(patch_size - std::abs(d));
+  }
+}
+
+void PatchOccupancy::addPatch(int x, int y)
+{
+  // only patches within patch_size in both direction overlap
+  int i_min = std::max(0, y - patch_size + 1);
+  int i_max = std::min(nnf_height - 1, y + patch_size - 1);
+  int j_min = std::max(0, x - patch_size + 1);
+  int j_max = std::min(nnf_width - 1, x + patch_size - 1);
+  for (int i = i_min; i <= i_max; ++i)
+  {
+    float w_y = overlap[i - y + patch_size - 1];
+    float* row = &patch_sum[i * nnf_width];
+    const float* w_x = &overlap[j_min - x + patch_size - 1];
+    for (int j = j_min; j <= j_max; ++j)
+    {
+      row[j] += w_y * w_x[j - j_min];
+    }
+  }
+}
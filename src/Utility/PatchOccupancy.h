@@ -0,0 +1,31 @@
+#ifndef PatchOccupancy_H
+#define PatchOccupancy_H
+
+#include <vector>
+
+// Reference count of the source patches used by patch match.
+// Instead of the per pixel count we keep, for every patch position, the sum of
+// the per pixel count over that patch. Using a patch at q adds the overlap area
+// of q with every patch p around it, which is separable:
+//   (patch_size - |dx|) * (patch_size - |dy|)
+// so the occupancy of a patch is a single lookup.
+class PatchOccupancy
+{
+public:
+  PatchOccupancy();
+  PatchOccupancy(int img_width, int img_height, int patch_size);
+  ~PatchOccupancy() {};
+
+  void init(int img_width, int img_height, int patch_size);
+  void addPatch(int x, int y); // patch with upper left corner (x, y) is used once more
+  inline float patchSum(int x, int y) const { return patch_sum[y * nnf_width + x]; };
+
+private:
+  int nnf_width;
+  int nnf_height;
+  int patch_size;
+  std::vector<float> patch_sum;
+  std::vector<float> overlap; // overlap length for offset -(patch_size - 1) ~ (patch_size - 1)
+};
+
+#endif // !PatchOccupancy_H
@@ -10,6 +10,8 @@
 #include <cv.h>
 #include <highgui.h>
 
+#include <algorithm>
+
 double sigmoid(double x, double center, double k)
 {
   return 1 - (1 / (1 + k * exp(center - x)));
@@ -58,37 +60,73 @@ void ScalarField::setSearchRad(float radius)
 
 void ScalarField::computeVariationMap()
 {
+  // variance of v . center over the (2r+1)^2 window without the row and column of the cell,
+  // E[(v.c)^2] - E[v.c]^2 expands into window sums of vx, vy, vx^2, vx*vy and vy^2 which
+  // come from summed area tables in constant time per cell
   std::vector<double2>& vector_field = tele_register->vector_field;
-  float max_var = std::numeric_limits<float>::min();
-  float min_var = std::numeric_limits<float>::max();
-  for (int i = 0; i < resolution; ++i)
+  int n = resolution + 1;
+  std::vector<double> sat(5 * n * n, 0.0);
+  for (int j = 0; j < resolution; ++j)
   {
-    for (int j = 0; j < resolution; ++j)
+    for (int i = 0; i < resolution; ++i)
     {
-
-      std::vector<double2> neighbour_area;
-      double2 center = vector_field[i + j * resolution];
-      for (int i_step = i - search_rad; i_step <= i + search_rad; ++i_step)
+      double vx = vector_field[i + j * resolution].x;
+      double vy = vector_field[i + j * resolution].y;
+      double val[5] = { vx, vy, vx * vx, vx * vy, vy * vy };
+      for (int k = 0; k < 5; ++k)
       {
-        for (int j_step = j - search_rad; j_step <= j + search_rad; ++j_step)
-        {
-          if (i_step >= 0 && i_step < resolution
-           && j_step >= 0 && j_step < resolution
-           && i_step != i && j_step != j)
-          {
-            neighbour_area.push_back(vector_field[i_step + j_step * resolution]);
-          }
-        }
+        double* s = &sat[k * n * n];
+        s[(i + 1) + (j + 1) * n] = val[k] + s[i + (j + 1) * n] + s[(i + 1) + j * n] - s[i + j * n];
       }
-      variation_map[i + j * resolution] = (float)computeVariation(neighbour_area, center);
-      if (variation_map[i + j * resolution] > max_var)
+    }
+  }
+
+  #pragma omp parallel for schedule(static)
+  for (int j = 0; j < resolution; ++j)
+  {
+    int j_lo = std::max(0, int(floor(j - search_rad)));
+    int j_hi = std::min(resolution - 1, int(floor(j + search_rad)));
+    for (int i = 0; i < resolution; ++i)
+    {
+      int i_lo = std::max(0, int(floor(i - search_rad)));
+      int i_hi = std::min(resolution - 1, int(floor(i + search_rad)));
+      int count = (i_hi - i_lo) * (j_hi - j_lo);
+      if (count <= 0)
       {
-        max_var = variation_map[i + j * resolution];
+        variation_map[i + j * resolution] = std::numeric_limits<float>::quiet_NaN();
+        continue;
       }
-      if (variation_map[i + j * resolution] < min_var)
+
+      double sum[5];
+      for (int k = 0; k < 5; ++k)
       {
-        min_var = variation_map[i + j * resolution];
+        const double* s = &sat[k * n * n];
+        // window, minus row j and column i of the window, plus the cell itself removed twice
+        sum[k] = s[(i_hi + 1) + (j_hi + 1) * n] - s[i_lo + (j_hi + 1) * n] - s[(i_hi + 1) + j_lo * n] + s[i_lo + j_lo * n]
+               - (s[(i_hi + 1) + (j + 1) * n] - s[i_lo + (j + 1) * n] - s[(i_hi + 1) + j * n] + s[i_lo + j * n])
+               - (s[(i + 1) + (j_hi + 1) * n] - s[i + (j_hi + 1) * n] - s[(i + 1) + j_lo * n] + s[i + j_lo * n])
+               + (s[(i + 1) + (j + 1) * n] - s[i + (j + 1) * n] - s[(i + 1) + j * n] + s[i + j * n]);
       }
+      double cx = vector_field[i + j * resolution].x;
+      double cy = vector_field[i + j * resolution].y;
+      double mean = (cx * sum[0] + cy * sum[1]) / count;
+      double mean_sq = (cx * cx * sum[2] + 2 * cx * cy * sum[3] + cy * cy * sum[4]) / count;
+      // a single neighbour has no variation, keep it from turning into round off noise
+      variation_map[i + j * resolution] = (count == 1) ? 0.0f : (float)std::max(0.0, mean_sq - mean * mean);
+    }
+  }
+
+  float max_var = std::numeric_limits<float>::min();
+  float min_var = std::numeric_limits<float>::max();
+  for (size_t i = 0; i < variation_map.size(); ++i)
+  {
+    if (variation_map[i] > max_var)
+    {
+      max_var = variation_map[i];
+    }
+    if (variation_map[i] < min_var)
+    {
+      min_var = variation_map[i];
     }
   }
 
@@ -135,6 +173,50 @@ void ScalarField::computeMatchingMap(std::vector<double2>& ext_vector_field)
   }
 }
 
+// lower envelope of the parabolas (q - p[k])^2 + f[k] over sites p sorted increasingly (Felzenszwalb
+// and Huttenlocher), evaluated at q = 0 .. n - 1, arg[q] is the index of the minimizing site
+static void distanceTransform1D(const double* p, const double* f, int n_site, int n, double* d, int* arg, int* v, double* z)
+{
+  int k = 0;
+  v[0] = 0;
+  z[0] = -std::numeric_limits<double>::max();
+  z[1] = std::numeric_limits<double>::max();
+  for (int q = 1; q < n_site; ++q)
+  {
+    double s = ((f[q] + p[q] * p[q]) - (f[v[k]] + p[v[k]] * p[v[k]])) / (2 * (p[q] - p[v[k]]));
+    while (s <= z[k])
+    {
+      --k;
+      s = ((f[q] + p[q] * p[q]) - (f[v[k]] + p[v[k]] * p[v[k]])) / (2 * (p[q] - p[v[k]]));
+    }
+    ++k;
+    v[k] = q;
+    z[k] = s;
+    z[k + 1] = std::numeric_limits<double>::max();
+  }
+  k = 0;
+  for (int q = 0; q < n; ++q)
+  {
+    while (z[k + 1] < q)
+    {
+      ++k;
+    }
+    d[q] = (q - p[v[k]]) * (q - p[v[k]]) + f[v[k]];
+    arg[q] = v[k];
+  }
+}
+
+struct DistanceSource
+{
+  double x, y;    // position of the point in cells
+  double offset;  // squared saliency term in cells^2, 0 for SField:Type 0
+  int id;         // kd-tree id of the point
+  bool operator < (const DistanceSource& other) const
+  {
+    return x < other.x;
+  }
+};
+
 void ScalarField::computeDistanceMap(FeatureGuided* feature_model)
 {
   double scale = feature_model->curve_scale;
@@ -143,42 +225,6 @@ void ScalarField::computeDistanceMap(FeatureGuided* feature_model)
   float min_val = std::numeric_limits<float>::max();
   int SField_type = LG::GlobalParameterMgr::GetInstance()->get_parameter<int>("SField:Type");
 
-  std::shared_ptr<KDTreeWrapper> tuned_kdTree(new KDTreeWrapper);
-  if (SField_type == 1)
-  {
-    // build tuned kdtree
-    std::vector<float> tree_data;
-    size_t n_pts = 0;
-
-    //for (int i = 0; i < feature_model->target_edge_saliency.rows; ++i)
-    //{
-    //  for (int j = 0; j < feature_model->target_edge_saliency.cols; ++j)
-    //  {
-    //    tree_data.push_back((float)j);
-    //    tree_data.push_back((float)(feature_model->target_edge_saliency.rows - 1 - i));
-    //    tree_data.push_back(feature_model->target_edge_saliency.at<float>(i, j) / scale);
-    //    ++ n_pts;
-    //  }
-    //}
-
-
-    for (size_t i = 0; i < feature_model->target_curves.size(); ++i)
-    {
-      for (size_t j = 0; j < feature_model->target_curves[i].size(); ++j)
-      {
-        tree_data.push_back((float)feature_model->target_curves[i][j].x);
-        tree_data.push_back((float)feature_model->target_curves[i][j].y);
-        // to normalize the distance and saliency
-        // saliency need to multiply the scale
-        // para_a control the importance
-        tree_data.push_back((float)((para_w / (1 - para_w + 1e-3)) / scale * feature_model->target_edges_sp_sl[i][j]));
-        ++ n_pts;
-      }
-    }
-    tuned_kdTree->initKDTree(tree_data, n_pts, 3);
-  }
-
-
   double avg_edge_len = 0;
   for (size_t i = 0; i < feature_model->target_edges_sp_len.size(); ++i)
   {
@@ -190,83 +236,154 @@ void ScalarField::computeDistanceMap(FeatureGuided* feature_model)
 
   std::cout << "dist attenuation: " << dist_attenuation << "\tsearch radius: " << search_rad << "\n";
 
-  for (int i = 0; i < resolution; ++i)
+  nearest_source_map.assign(resolution * resolution, -1);
+
+  if (SField_type == 0 || SField_type == 1)
   {
-    for (int j = 0; j < resolution; ++j)
+    // Type 0 is the distance to the closest target point, type 1 the distance in (x, y, c * saliency)
+    // to (x, y, c) which is the distance in the plane plus a per point offset (c * (saliency - 1))^2.
+    // Along row i every point is the parabola (j - x)^2 + (i - y)^2 + offset in j, so each row is
+    // the 1D distance transform of the points sorted by x and the map is exact, in
+    // O(resolution * (n_points + resolution)) with rows in parallel.
+    double cell = 1.0 / (scale * resolution); // grid spacing in curve space
+    double c = para_w / (1 - para_w + 1e-3) / scale;
+
+    std::vector<DistanceSource> sources;
+    int kd_id = 0;
+    for (size_t i = 0; i < feature_model->target_curves.size(); ++i)
     {
-      std::vector<float> pos(3, 0.0);
-      pos[0] = float(j) / resolution;
-      pos[1] = float(i) / resolution;
-      pos[0] = (pos[0] - 0.5) / scale + 0.5 - curve_translate.x;
-      pos[1] = (pos[1] - 0.5) / scale + 0.5 - curve_translate.y;
-
-      // here the radius for rNearestPt is r^2 and returned dist is also square distance
-      std::vector<float> nearest_sp;
-      std::vector<float> nearest_sp_dist;
-      std::vector<int>   nearest_sp_id;
-      if (SField_type == 0)
-      {
-        feature_model->target_KDTree->nearestPt(1, pos, nearest_sp, nearest_sp_dist, nearest_sp_id);
-      }
-      else if (SField_type == 2)
+      for (size_t j = 0; j < feature_model->target_curves[i].size(); ++j, ++kd_id)
       {
-        feature_model->target_KDTree->rNearestPt(search_rad * search_rad, pos, nearest_sp, nearest_sp_dist, nearest_sp_id);
-      }
-      else if (SField_type == 1)
-      {
-        pos[2] = para_w / (1 - para_w + 1e-3) / scale;
-        tuned_kdTree->nearestPt(1, pos, nearest_sp, nearest_sp_dist, nearest_sp_id);
-        //nearest_sp.resize(3, 0.0);nearest_sp_id.push_back(0);
-        //int imgy = std::max(0, std::min(feature_model->target_edge_saliency.rows - 1 - int(pos[1] + 0.5), feature_model->target_edge_saliency.rows - 1));
-        //int imgx = std::max(0, std::min(int(pos[0] + 0.5), feature_model->target_edge_saliency.cols - 1));
-        //float s = feature_model->target_edge_saliency.at<float>(imgy, imgx);
-        //nearest_sp_dist.push_back(s * s);
+        DistanceSource source;
+        source.x = ((feature_model->target_curves[i][j].x + curve_translate.x - 0.5) * scale + 0.5) * resolution;
+        source.y = ((feature_model->target_curves[i][j].y + curve_translate.y - 0.5) * scale + 0.5) * resolution;
+        source.offset = 0.0;
+        if (SField_type == 1)
+        {
+          source.offset = pow(c * (feature_model->target_edges_sp_sl[i][j] - 1) / cell, 2);
+        }
+        source.id = kd_id;
+        sources.push_back(source);
       }
-      float cur_dist = std::numeric_limits<float>::min();
-      for (size_t k = 0; k < nearest_sp_id.size(); ++k)
-      {
-        std::pair<int, int> curve_id = feature_model->kdtree_id_mapper[nearest_sp_id[k]];
-        double saliency = feature_model->target_edges_sp_sl[curve_id.first][curve_id.second];
+    }
+    std::sort(sources.begin(), sources.end());
+    int n_source = int(sources.size());
 
-        double score = 0;
-        if (SField_type == 0 || SField_type == 1)
+    if (n_source > 0)
+    {
+      #pragma omp parallel
+      {
+        std::vector<double> p(n_source);
+        std::vector<double> f(n_source);
+        std::vector<int> site_source(n_source);
+        std::vector<double> d(resolution);
+        std::vector<int> arg(resolution);
+        std::vector<int> v(n_source + 1);
+        std::vector<double> z(n_source + 2);
+        #pragma omp for schedule(static)
+        for (int i = 0; i < resolution; ++i)
         {
-          score = sqrt(nearest_sp_dist[k]);
+          // the envelope needs distinct sites, points sharing x keep the lowest one
+          int n_site = 0;
+          for (int k = 0; k < n_source; ++k)
+          {
+            double h = (i - sources[k].y) * (i - sources[k].y) + sources[k].offset;
+            if (n_site > 0 && p[n_site - 1] == sources[k].x)
+            {
+              if (h < f[n_site - 1])
+              {
+                f[n_site - 1] = h;
+                site_source[n_site - 1] = k;
+              }
+              continue;
+            }
+            p[n_site] = sources[k].x;
+            f[n_site] = h;
+            site_source[n_site] = k;
+            ++n_site;
+          }
+          distanceTransform1D(&p[0], &f[0], n_site, resolution, &d[0], &arg[0], &v[0], &z[0]);
+          for (int j = 0; j < resolution; ++j)
+          {
+            distance_map[i * resolution + j] = float(cell * sqrt(d[j]));
+            nearest_source_map[i * resolution + j] = sources[site_source[arg[j]]].id;
+          }
         }
-        else if (SField_type == 2)
+      }
+
+      for (int i = 0; i < resolution * resolution; ++i)
+      {
+        if (distance_map[i] > max_val)
         {
-          score = pow(saliency, para_a) / pow((sqrt(nearest_sp_dist[k]) / search_rad + 0.0001), para_b);
+          max_val = distance_map[i];
         }
-        if (cur_dist < score)
+        if (distance_map[i] < min_val)
         {
-          cur_dist = score;
+          min_val = distance_map[i];
         }
       }
-      if (nearest_sp_id.size() == 0)
-      {
-        distance_map[i * resolution + j] = -1;
-      }
-      else
+    }
+    else
+    {
+      distance_map.assign(resolution * resolution, -1);
+    }
+  }
+  else if (SField_type == 2)
+  {
+    // saliency weighted score of all target points within search_rad, stays a radius query
+    std::vector<float> pos(3, 0.0);
+    std::vector<float> nearest_sp;
+    std::vector<float> nearest_sp_dist;
+    std::vector<int>   nearest_sp_id;
+    for (int i = 0; i < resolution; ++i)
+    {
+      for (int j = 0; j < resolution; ++j)
       {
-        if (cur_dist > max_val)
+        pos[0] = float(j) / resolution;
+        pos[1] = float(i) / resolution;
+        pos[0] = (pos[0] - 0.5) / scale + 0.5 - curve_translate.x;
+        pos[1] = (pos[1] - 0.5) / scale + 0.5 - curve_translate.y;
+
+        // here the radius for rNearestPt is r^2 and returned dist is also square distance
+        nearest_sp.clear();
+        nearest_sp_dist.clear();
+        nearest_sp_id.clear();
+        feature_model->target_KDTree->rNearestPt(search_rad * search_rad, pos, nearest_sp, nearest_sp_dist, nearest_sp_id);
+        float cur_dist = std::numeric_limits<float>::min();
+        for (size_t k = 0; k < nearest_sp_id.size(); ++k)
         {
-          max_val = cur_dist;
+          std::pair<int, int> curve_id = feature_model->kdtree_id_mapper[nearest_sp_id[k]];
+          double saliency = feature_model->target_edges_sp_sl[curve_id.first][curve_id.second];
+
+          double score = pow(saliency, para_a) / pow((sqrt(nearest_sp_dist[k]) / search_rad + 0.0001), para_b);
+          if (cur_dist < score)
+          {
+            cur_dist = score;
+          }
         }
-        if (cur_dist < min_val)
+        if (nearest_sp_id.size() == 0)
         {
-          min_val = cur_dist;
+          distance_map[i * resolution + j] = -1;
+        }
+        else
+        {
+          if (cur_dist > max_val)
+          {
+            max_val = cur_dist;
+          }
+          if (cur_dist < min_val)
+          {
+            min_val = cur_dist;
+          }
+          distance_map[i * resolution + j] = cur_dist;
         }
-        distance_map[i * resolution + j] = cur_dist;
       }
-      //int img_i = feature_model->target_edge_saliency.rows - pos[1] - 0.5;
-      //int img_j = pos[0];
-      //if (img_i < feature_model->target_edge_saliency.rows && img_i >= 0
-      // && img_j < feature_model->target_edge_saliency.cols && img_j >= 0)
-      //{
-      //  distance_map[i * resolution + j] = feature_model->target_edge_saliency.at<float>(img_i, img_j);
-      //}
     }
   }
+  else
+  {
+    distance_map.assign(resolution * resolution, -1);
+  }
 
   std::ofstream f_debug(feature_model->source_model->getDataPath() + "/SField.mat");
 
@@ -302,8 +419,6 @@ void ScalarField::computeDistanceMap(FeatureGuided* feature_model)
 
   std::cout << "max val: " << max_val << "\tmin val: " << min_val << "\n";
 
-  updateDistanceMapGrad();
-
   //cv::Mat temp_img(resolution, resolution, CV_32FC1, &distance_map[0]);
   //cv::Mat tempp_img;
   //cv::flip(temp_img, tempp_img, 0);
@@ -316,67 +431,83 @@ double ScalarField::curveIntegrate(std::vector<std::vector<double2> >& curves, F
   double2 curve_translate = feature_model->curve_translate;
 
   double integ = 0.0;
+  double grad_x, grad_y;
   for (size_t i = 0; i < curves.size(); ++i)
   {
     for (size_t j = 0; j < curves[i].size(); ++j)
     {
       double2 pos = (curves[i][j] + curve_translate - double2(0.5, 0.5)) * scale + double2(0.5, 0.5);
-      int field_j = int(pos.x * resolution);
-      int field_i = int(pos.y * resolution);
-      field_j = (field_j < 0) ? 0 : ((field_j >= resolution) ? (resolution - 1) : field_j);
-      field_i = (field_i < 0) ? 0 : ((field_i >= resolution) ? (resolution - 1) : field_i);
-      integ += pow(distance_map[field_i * resolution + field_j], 2);
+      integ += pow(sampleDistanceMap(pos, grad_x, grad_y), 2);
     }
   }
   //std::cout << "curve integrate: " << integ << std::endl;
   return integ;
 }
 
-void ScalarField::updateDistanceMapGrad()
-{
-  cv::Mat dist_img = cv::Mat(resolution, resolution, CV_32FC1, &distance_map[0]).clone();
-  distance_map_grad_x.resize(distance_map.size(), 0);
-  distance_map_grad_y.resize(distance_map.size(), 0);
-  cv::Mat grad_x(resolution, resolution, CV_32FC1, &distance_map_grad_x[0]);
-  cv::Mat grad_y(resolution, resolution, CV_32FC1, &distance_map_grad_y[0]);
-  //cv::Mat abs_grad_x, abs_grad_y;
-  //Scharr( src_gray, grad_x, ddepth, 1, 0, scale, delta, BORDER_DEFAULT );
-  cv::Sobel( dist_img, grad_x, CV_32F, 1, 0, 3, 1.0 / 8, 0, cv::BORDER_DEFAULT );
-  //cv::convertScaleAbs( grad_x, abs_grad_x );
-  /// Gradient Y
-  //Scharr( src_gray, grad_y, ddepth, 0, 1, scale, delta, BORDER_DEFAULT );
-  cv::Sobel( dist_img, grad_y, CV_32F, 0, 1, 3, 1.0 / 8, 0, cv::BORDER_DEFAULT );
-  //cv::convertScaleAbs( grad_y, abs_grad_y );
-  //abs_grad_y = cv::abs(grad_y);
-
-  //cv::Mat gmag = dist_img.clone();
-  //for (int i = 0; i < gmag.rows; ++i)
-  //{
-  //  for (int j = 0; j < gmag.cols; ++j)
-  //  {
-  //    gmag.at<float>(i, j) = sqrt(pow(grad_x.at<float>(i, j), 2) + pow(grad_y.at<float>(i, j), 2));
-  //  }
-  //}
-
-  //cv::flip(gmag, gmag, 0);
-  //cv::imshow("gmag", gmag);
-  //cv::imwrite("gmag.png", 255 * gmag);
-}
-
 void ScalarField::getDistanceMapGrad(double2& n_curve_pt, double& grad_x, double& grad_y, double& field_value)
 {
-  int field_j = int(n_curve_pt.x * resolution);
-  int field_i = int(n_curve_pt.y * resolution);
-  if (field_j >= resolution || field_i >= resolution || field_j < 0 || field_i < 0)
+  field_value = sampleDistanceMap(n_curve_pt, grad_x, grad_y);
+  if (n_curve_pt.x * resolution >= resolution || n_curve_pt.y * resolution >= resolution
+   || n_curve_pt.x < 0 || n_curve_pt.y < 0)
   {
     grad_x = 0;
     grad_y = 0;
     //std::cout<<"warning.";
-    return;
   }
-  field_j = (field_j < 0) ? 0 : ((field_j >= resolution) ? (resolution - 1) : field_j);
-  field_i = (field_i < 0) ? 0 : ((field_i >= resolution) ? (resolution - 1) : field_i);
-  grad_x = distance_map_grad_x[field_i * resolution + field_j];
-  grad_y = distance_map_grad_y[field_i * resolution + field_j];
-  field_value = distance_map[field_i * resolution + field_j];
+}
+
+// Catmull-Rom weights of the 4 nodes around t in [0, 1) and their derivatives
+static void catmullRomWeights(double t, double w[4], double dw[4])
+{
+  double t2 = t * t;
+  double t3 = t2 * t;
+  w[0] = 0.5 * (-t3 + 2 * t2 - t);
+  w[1] = 0.5 * (3 * t3 - 5 * t2 + 2);
+  w[2] = 0.5 * (-3 * t3 + 4 * t2 + t);
+  w[3] = 0.5 * (t3 - t2);
+  dw[0] = 0.5 * (-3 * t2 + 4 * t - 1);
+  dw[1] = 0.5 * (9 * t2 - 10 * t);
+  dw[2] = 0.5 * (-9 * t2 + 8 * t + 1);
+  dw[3] = 0.5 * (3 * t2 - 2 * t);
+}
+
+double ScalarField::sampleDistanceMap(double2& n_pt, double& grad_x, double& grad_y)
+{
+  // cell (i, j) holds the value at (j, i) / resolution, positions off the grid take the border value
+  double u = n_pt.x * resolution;
+  double v = n_pt.y * resolution;
+  bool inside_u = (u >= 0 && u <= resolution - 1);
+  bool inside_v = (v >= 0 && v <= resolution - 1);
+  u = std::max(0.0, std::min(u, double(resolution - 1)));
+  v = std::max(0.0, std::min(v, double(resolution - 1)));
+  int j0 = std::min(int(u), resolution - 2);
+  int i0 = std::min(int(v), resolution - 2);
+
+  double wu[4], dwu[4], wv[4], dwv[4];
+  catmullRomWeights(u - j0, wu, dwu);
+  catmullRomWeights(v - i0, wv, dwv);
+
+  double value = 0;
+  grad_x = 0;
+  grad_y = 0;
+  for (int a = 0; a < 4; ++a)
+  {
+    int field_i = std::max(0, std::min(i0 - 1 + a, resolution - 1));
+    double row_value = 0;
+    double row_grad = 0;
+    for (int b = 0; b < 4; ++b)
+    {
+      int field_j = std::max(0, std::min(j0 - 1 + b, resolution - 1));
+      double f = distance_map[field_i * resolution + field_j];
+      row_value += wu[b] * f;
+      row_grad += dwu[b] * f;
+    }
+    value += wv[a] * row_value;
+    grad_x += wv[a] * row_grad;
+    grad_y += dwv[a] * row_value;
+  }
+  // d/du to d/d(n_pt), u = n_pt.x * resolution
+  grad_x = inside_u ? grad_x * resolution : 0;
+  grad_y = inside_v ? grad_y * resolution : 0;
+  return value;
 }
\ No newline at end of file
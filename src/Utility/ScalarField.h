@@ -23,8 +23,10 @@ public:
   void computeVariationMap();
   void computeMatchingMap(std::vector<double2>& ext_vector_field);
   void computeDistanceMap(FeatureGuided* feature_model);
-  void updateDistanceMapGrad();
   void getDistanceMapGrad(double2& n_curve_pt, double& grad_x, double& grad_y, double& field_value);
+  // bicubic (Catmull-Rom) sample of the distance map at a normalized position, the gradient
+  // is analytic and with respect to n_pt, zero outside the grid along that axis
+  double sampleDistanceMap(double2& n_pt, double& grad_x, double& grad_y);
 
   double curveIntegrate(std::vector<std::vector<double2> >& curves, FeatureGuided* feature_model);
 
@@ -33,8 +35,7 @@ public:
   STLVectorf distance_map;
   STLVectorf variation_map;
   STLVectorf matching_map;
-  STLVectorf distance_map_grad_x;
-  STLVectorf distance_map_grad_y;
+  STLVectori nearest_source_map; // kd-tree id of the target point each cell is closest to, -1 if none
 
   float search_rad;
   float dist_attenuation;
@@ -6,6 +6,7 @@
 #include "PolygonMesh.h"
 #include "Bound.h"
 #include "ParaShape.h"
+#include "UVGBuffer.h"
 #include "Voxeler.h"
 
 #include "Ray.h"
@@ -16,9 +17,98 @@
 #include "obj_writer.h"
 
 #include "VtkUtility.h"
+#include "FeatureCache.h"
 
 using namespace LG;
 
+namespace
+{
+  // key of the cached features of a mesh, from the positions and the faces,
+  // with_normal for the features that depend on the vertex normals too
+  uint64_t featureCacheKey(PolygonMesh* poly_mesh, bool with_normal)
+  {
+    int n_vertices = (int)poly_mesh->n_vertices();
+    uint64_t key = FeatureCache::hashBytes(&n_vertices, sizeof(int));
+    for (auto vit : poly_mesh->vertices())
+    {
+      const Vec3& pos = poly_mesh->position(vit);
+      float p[3] = { pos[0], pos[1], pos[2] };
+      key = FeatureCache::hashBytes(p, sizeof(p), key);
+    }
+    for (auto fit : poly_mesh->faces())
+    {
+      for (auto vfc_it : poly_mesh->vertices(fit))
+      {
+        int v_id = vfc_it.idx();
+        key = FeatureCache::hashBytes(&v_id, sizeof(int), key);
+      }
+      int separator = -1;
+      key = FeatureCache::hashBytes(&separator, sizeof(int), key);
+    }
+    if (with_normal)
+    {
+      PolygonMesh::Vertex_attribute<Vec3> v_normals = poly_mesh->vertex_attribute<Vec3>("v:normal");
+      for (auto vit : poly_mesh->vertices())
+      {
+        float n[3] = { v_normals[vit][0], v_normals[vit][1], v_normals[vit][2] };
+        key = FeatureCache::hashBytes(n, sizeof(n), key);
+      }
+    }
+    return key;
+  }
+
+  bool loadCachedFeature(std::shared_ptr<Model> model, const std::string& name, uint64_t key, PolygonMesh::Vertex_attribute<STLVectorf>& feature, int dim)
+  {
+    PolygonMesh* poly_mesh = model->getPolygonMesh();
+    STLVectorf data;
+    if (!model->getFeatureCache()->get(name, key, (int)poly_mesh->n_vertices(), dim, data)) return false;
+
+    for (auto vit : poly_mesh->vertices())
+    {
+      feature[vit].assign(data.begin() + size_t(vit.idx()) * dim, data.begin() + size_t(vit.idx() + 1) * dim);
+    }
+    return true;
+  }
+
+  bool loadCachedFeature(std::shared_ptr<Model> model, const std::string& name, uint64_t key, PolygonMesh::Vertex_attribute<Scalar>& feature)
+  {
+    PolygonMesh* poly_mesh = model->getPolygonMesh();
+    STLVectorf data;
+    if (!model->getFeatureCache()->get(name, key, (int)poly_mesh->n_vertices(), 1, data)) return false;
+
+    for (auto vit : poly_mesh->vertices())
+    {
+      feature[vit] = data[vit.idx()];
+    }
+    return true;
+  }
+
+  void saveCachedFeature(std::shared_ptr<Model> model, const std::string& name, uint64_t key, PolygonMesh::Vertex_attribute<STLVectorf>& feature, int dim)
+  {
+    PolygonMesh* poly_mesh = model->getPolygonMesh();
+    STLVectorf data(size_t(poly_mesh->n_vertices()) * dim, 0.0f);
+    for (auto vit : poly_mesh->vertices())
+    {
+      for (int i = 0; i < dim && i < (int)feature[vit].size(); ++i)
+      {
+        data[size_t(vit.idx()) * dim + i] = feature[vit][i];
+      }
+    }
+    model->getFeatureCache()->put(name, key, (int)poly_mesh->n_vertices(), dim, data);
+  }
+
+  void saveCachedFeature(std::shared_ptr<Model> model, const std::string& name, uint64_t key, PolygonMesh::Vertex_attribute<Scalar>& feature)
+  {
+    PolygonMesh* poly_mesh = model->getPolygonMesh();
+    STLVectorf data(poly_mesh->n_vertices(), 0.0f);
+    for (auto vit : poly_mesh->vertices())
+    {
+      data[vit.idx()] = feature[vit];
+    }
+    model->getFeatureCache()->put(name, key, (int)poly_mesh->n_vertices(), 1, data);
+  }
+}
+
 namespace ShapeUtility
 {
   void computeBaryCentreCoord(float pt[3], float v0[3], float v1[3], float v2[3], float lambd[3])
@@ -73,66 +163,38 @@ namespace ShapeUtility
     PolygonMesh* mesh = model->getPolygonMesh();
     PolygonMesh::Vertex_attribute<Scalar> normalized_height = mesh->vertex_attribute<Scalar>("v:NormalizedHeight");
 
+    uint64_t key = featureCacheKey(mesh, false);
+    if (loadCachedFeature(model, "v:NormalizedHeight", key, normalized_height)) return;
+
     for (auto vit : mesh->vertices())
     {
       normalized_height[vit] = (mesh->position(vit)[2] - boundbox->minZ) / (boundbox->maxZ - boundbox->minZ);
     }
+    saveCachedFeature(model, "v:NormalizedHeight", key, normalized_height);
   }
 
   void computeDirectionalOcclusion(std::shared_ptr<Model> model, bool enforce_update)
   {
     // only called when the shape is changed
 
-    std::string file_name = model->getDataPath() + "/" + model->getFileName() + ".SH.txt";
-    if (enforce_update)
-    {
-      file_name = model->getDataPath() + "/" + model->getFileName() + ".normal_transferred_SH.txt";
-    }
+    // the normal transferred shape keeps its own block, so both versions stay in the cache
+    std::string feature_name = enforce_update ? "v:DirectionalOcclusion:normal_transferred" : "v:DirectionalOcclusion";
+    int num_band = 2;
 
     std::cout << "Generate or Load directional occlusion feature." << std::endl;
+    PolygonMesh* cache_mesh = model->getPolygonMesh();
+    PolygonMesh::Vertex_attribute<STLVectorf> v_sh = cache_mesh->vertex_attribute<STLVectorf>("v:DirectionalOcclusion");
+    uint64_t key = featureCacheKey(cache_mesh, true);
     bool regenerate = true;
-    // test if the file exist
-    std::ifstream inFile(file_name);
-    if (inFile.is_open())
+    if (loadCachedFeature(model, feature_name, key, v_sh, num_band * num_band))
     {
-      std::cout << "Load feature." << std::endl;
+      std::cout << "Loading directional occlusion feature finished." << std::endl;
       regenerate = false;
-
-      PolygonMesh* poly_mesh = model->getPolygonMesh();
-      PolygonMesh::Vertex_attribute<std::vector<float>> v_sh = poly_mesh->vertex_attribute<std::vector<float>>("v:DirectionalOcclusion");
-
-      std::string line_str;
-      int n_line = 0;
-      for (auto vit : poly_mesh->vertices())
-      {
-        getline(inFile, line_str);
-        std::stringstream line_parser(line_str);
-        //Vec3 cur_v_symmetry(0,0,0);
-        std::vector<float> cur_v_sh;
-        cur_v_sh.resize(4);
-        line_parser >> cur_v_sh[0] >> cur_v_sh[1] >> cur_v_sh[2] >> cur_v_sh[3];
-        v_sh[vit] = cur_v_sh;
-        ++n_line;
-      }
-
-      inFile.close();
-      if (n_line == poly_mesh->n_vertices()) 
-      {
-        std::cout << "Loading directional occlusion feature finished." << std::endl;
-      }
-      else 
-      {
-        std::cout << "Loading errors. Need to regenerate." << std::endl;
-        regenerate = true;
-      }
     }
 
-
-
     // 1. initialize BSPTree
     if (regenerate)
     {
-      int num_band = 2;
       std::cout << "Initialize BSPTree.\n";
       std::shared_ptr<Ray> ray(new Ray);
       ray->passModel(model->getShapeVertexList(), model->getShapeFaceList());
@@ -154,24 +216,33 @@ namespace ShapeUtility
       PolygonMesh::Vertex_attribute<Vec3> v_normals = poly_mesh->vertex_attribute<Vec3>("v:normal");
       STLVectorf max_coeff(numFunctions, -std::numeric_limits<float>::max());
       STLVectorf min_coeff(numFunctions, std::numeric_limits<float>::max());
-      float perc = 0;
-      for (auto i : poly_mesh->vertices())
-      {
-        shadowCoeff[i].clear();
-        shadowCoeff[i].resize(numFunctions, 0.0f);
+      float radius = bound->getRadius();
+      int n_vertices = (int)poly_mesh->n_vertices();
+      int progress_step = std::max(1, n_vertices / 20);
+      int n_progress = 0;
+
+      // the BVH queries don't change the ray, each vertex only writes its own coefficients
+#pragma omp parallel for schedule(dynamic, 256)
+      for (int v_id = 0; v_id < n_vertices; ++v_id)
+      {
+        PolygonMesh::Vertex i(v_id);
+        const Vec3& normal = v_normals[i];
+        Eigen::Vector3d ray_start = (poly_mesh->position(i) + 2 * 0.01 * radius * normal).cast<double>();
+        STLVectorf& cur_coeff = shadowCoeff[i];
+        cur_coeff.clear();
+        cur_coeff.resize(numFunctions, 0.0f);
         for (int k = 0; k < numSamples; ++k)
         {
-          double dot = (double)samples[k].direction.dot(v_normals[i]);
+          double dot = (double)samples[k].direction.dot(normal);
 
           if (dot > 0.0)
           {
-            Eigen::Vector3d ray_start = (poly_mesh->position(i) + 2 * 0.01 * bound->getRadius() * v_normals[i]).cast<double>();
-            Eigen::Vector3d ray_end   = ray_start + (5 * bound->getRadius() * samples[k].direction).cast<double>();
+            Eigen::Vector3d ray_end   = ray_start + (5 * radius * samples[k].direction).cast<double>();
             if (ray->intersectModel(ray_start, ray_end))
             {
               for (int l = 0; l < numFunctions; ++l)
               {
-                shadowCoeff[i][l] += dot * samples[k].shValues[l];
+                cur_coeff[l] += dot * samples[k].shValues[l];
               }
             }
           }
@@ -180,23 +251,31 @@ namespace ShapeUtility
         // rescale
         for (int l = 0; l < numFunctions; ++l)
         {
-          shadowCoeff[i][l] *= 4.0 * M_PI / numSamples;
-
-          if (l == 3) shadowCoeff[i][l] = fabs(shadowCoeff[i][l]);
+          cur_coeff[l] *= 4.0 * M_PI / numSamples;
 
-          if (shadowCoeff[i][l] > max_coeff[l]) max_coeff[l] = shadowCoeff[i][l];
-          if (shadowCoeff[i][l] < min_coeff[l]) min_coeff[l] = shadowCoeff[i][l];
+          if (l == 3) cur_coeff[l] = fabs(cur_coeff[l]);
         }
 
-        float cur_perc = (float)i.idx() / poly_mesh->n_vertices();
-        if (cur_perc - perc >= 0.05)
+        if (v_id % progress_step == 0)
         {
-          perc = cur_perc;
-          std::cout << perc << "...";
+#pragma omp critical (directional_occlusion_progress)
+          {
+            ++n_progress;
+            std::cout << std::min(1.0f, (float)n_progress * progress_step / n_vertices) << "...";
+          }
         }
       }
       std::cout << std::endl;
 
+      for (auto i : poly_mesh->vertices())
+      {
+        for (int l = 0; l < numFunctions; ++l)
+        {
+          if (shadowCoeff[i][l] > max_coeff[l]) max_coeff[l] = shadowCoeff[i][l];
+          if (shadowCoeff[i][l] < min_coeff[l]) min_coeff[l] = shadowCoeff[i][l];
+        }
+      }
+
       for (auto i : poly_mesh->vertices())
       {
         for (int l = 0; l < numFunctions; ++l)
@@ -211,19 +290,7 @@ namespace ShapeUtility
       }
       std::cout << "Compute Directional Occlusion Feature finished.\n";
 
-      std::ofstream outFile(file_name);
-      if (outFile.is_open())
-      {
-        for (auto i : poly_mesh->vertices())
-        {
-          outFile << shadowCoeff[i][0] << "\t" << shadowCoeff[i][1] << "\t" << shadowCoeff[i][2] << "\t" << shadowCoeff[i][3] << std::endl;
-        }
-        outFile.close();
-      }
-      else
-      {
-        std::cout << "failed to open output file." << std::endl;
-      }
+      saveCachedFeature(model, feature_name, key, shadowCoeff, numFunctions);
     }
   }
 
@@ -320,136 +387,88 @@ namespace ShapeUtility
     //  Vec3 cur_sym = v_symmetry[vit];
     //  v_symmetry[vit] = ((cur_sym - mins).array() / (maxs - mins).array()).matrix();
     //}
-    std::cout << "Generate or Load symmetry.txt." << std::endl;
-    bool regenerate = false;
-    // test if the file exist
-    std::ifstream inFile(model->getDataPath() + "/symmetry.txt");
-    //if (!inFile.is_open())
-    {
-      std::cout << "Not existed or failed to load." << std::endl;
-      regenerate = true;
-    }
-    inFile.close();
-
     PolygonMesh* poly_mesh = model->getPolygonMesh();
     PolygonMesh::Vertex_attribute<std::vector<float>> v_symmetry = poly_mesh->vertex_attribute<std::vector<float>>("v:symmetry");
 
-    if (!regenerate)
+    std::cout << "Generate or Load symmetry_plane.txt." << std::endl;
+    bool regenerate_sym_plane = false;
+    // test if the file exist
+    std::ifstream inFile(model->getDataPath() + "/symmetry_plane.txt");
+    if (!inFile.is_open())
     {
-      // symmetry information should use original coarse model
-      // because after large alignment, symmetry information would be broken
-      // we assume the ground plane are xoy plane
-      // symmetry plane are yoz plane
-      // symmetry information are stored like this
-      // first two scalars store projection position on the symmetry plane (y,z)
-      // last scalar stores the distance to symmetry plane |x|
-
-      // no need to regenerate, read from file
-      std::cout << "Loading symmetry.txt" << std::endl;
+      std::cout << "Not existed or failed to load symmetry_plane.txt." << std::endl;
+      regenerate_sym_plane = true;
+    }
+    double a, b, c, d;
+    if(!regenerate_sym_plane)
+    {
+      std::cout << "Loading symmetry_plane.txt" << std::endl;
       std::string line_str;
-      int n_line = 0;
-      float min_v = std::numeric_limits<float>::max();
-      float max_v = -std::numeric_limits<float>::max();
-      for (auto vit : poly_mesh->vertices())
-      {
-        getline(inFile, line_str);
-        std::stringstream line_parser(line_str);
-        //Vec3 cur_v_symmetry(0,0,0);
-        std::vector<float> cur_v_symmetry;
-        cur_v_symmetry.resize(5);
-        line_parser >> cur_v_symmetry[0] >> cur_v_symmetry[1] >> cur_v_symmetry[2] >> cur_v_symmetry[3] >> cur_v_symmetry[4];
-        v_symmetry[vit] = cur_v_symmetry;
-        ++n_line;
-      }
-      
-      inFile.close();
-      if (n_line == poly_mesh->n_vertices()) 
-      {
-        std::cout << "Loading symmetry.txt finished." << std::endl;
-      }
-      else 
-      {
-        std::cout << "Loading errors. Need to regenerate symmetry.txt." << std::endl;
-        regenerate = true;
-      }
+      getline(inFile, line_str);
+      std::stringstream line_parser(line_str);
+      line_parser >> a >> b >> c >> d;
     }
-    
-    if (regenerate)
+    else
     {
-      std::cout << "Generating Symmetry.txt." << std::endl;
-      std::ofstream outFile(model->getDataPath() + "/symmetry.txt");
+      a = 1;
+      b = 0;
+      c = 0;
+      d = 0;
+      std::cout << "Generating Symmetry_plane.txt." << std::endl;
+      std::ofstream outFile_sym_plane(model->getDataPath() + "/symmetry_plane.txt");
       // read from the file
-      if (!outFile.is_open())
+      if (!outFile_sym_plane.is_open())
       {
-        std::cout << "failed to open the symmetry.txt file, return." << std::endl;
+        std::cout << "failed to open the symmetry_plane.txt file, return." << std::endl;
         return;
       }
-      std::cout << "Generate or Load symmetry_plane.txt." << std::endl;
-      bool regenerate_sym_plane = false;
-      // test if the file exist
-      std::ifstream inFile(model->getDataPath() + "/symmetry_plane.txt");
-      if (!inFile.is_open())
-      {
-        std::cout << "Not existed or failed to load symmetry_plane.txt." << std::endl;
-        regenerate_sym_plane = true;
-      }
-      double a, b, c, d;
-      if(!regenerate_sym_plane)
-      {
-        std::cout << "Loading symmetry_plane.txt" << std::endl;
-        std::string line_str;
-        getline(inFile, line_str);
-        std::stringstream line_parser(line_str);
-        line_parser >> a >> b >> c >> d;
-      }
-      else
-      {
-        a = 1;
-        b = 0;
-        c = 0;
-        d = 0;
-        std::cout << "Generating Symmetry_plane.txt." << std::endl;
-        std::ofstream outFile_sym_plane(model->getDataPath() + "/symmetry_plane.txt");
-        // read from the file
-        if (!outFile_sym_plane.is_open())
-        {
-          std::cout << "failed to open the symmetry_plane.txt file, return." << std::endl;
-          return;
-        }
-        outFile_sym_plane << a << "\t" << b << "\t" << c << "\t" << d << "\n";
-        outFile_sym_plane.close();
-        std::cout << "Generating symmetry_plane.txt finished." << std::endl;
-      }
-      std::vector<double> symmetric_plane_coef;
-      symmetric_plane_coef.push_back(a);
-      symmetric_plane_coef.push_back(b);
-      symmetric_plane_coef.push_back(c);
-      symmetric_plane_coef.push_back(d);
-      PolygonMesh::Vertex_attribute<Vec3> v_normals = poly_mesh->vertex_attribute<Vec3>("v:normal");
-      Bound* bounding = model->getBoundBox();
-      for (auto vit : poly_mesh->vertices())
-      {
-        Vec3 pos = poly_mesh->position(vit);
-        pos << (pos(0) - bounding->minX) / (bounding->maxX - bounding->minX), 
-                       (pos(1) - bounding->minY) / (bounding->maxY - bounding->minY),
-                       (pos(2) - bounding->minZ) / (bounding->maxZ - bounding->minZ);
-        Vec3 normal = v_normals[vit];
-        ShapeUtility::computeVertexSymmetryProjection(pos, normal, symmetric_plane_coef);
-        normal = (normal + Vec3(1, 1, 1)) / 2 ; // Why? Need to check // To make it between [0,1]
-
-        std::vector<float> cur_v_symmetry;
-        cur_v_symmetry.push_back(pos(0));
-        cur_v_symmetry.push_back(pos(1));
-        cur_v_symmetry.push_back(pos(2));
-        cur_v_symmetry.push_back(normal(0));
-        cur_v_symmetry.push_back(normal(1));
-        //v_symmetry[vit] = Vec3(fabs(pos[1]), pos[0], pos[2]);
-        v_symmetry[vit] = cur_v_symmetry;
-        outFile << cur_v_symmetry[0] << "\t" << cur_v_symmetry[1] << "\t" << cur_v_symmetry[2] << "\t" << cur_v_symmetry[3] << "\t" << cur_v_symmetry[4] << std::endl;
-      }
-      outFile.close();
-      std::cout << "Generating symmetrt.txt finished." << std::endl;
+      outFile_sym_plane << a << "\t" << b << "\t" << c << "\t" << d << "\n";
+      outFile_sym_plane.close();
+      std::cout << "Generating symmetry_plane.txt finished." << std::endl;
     }
+    inFile.close();
+    std::vector<double> symmetric_plane_coef;
+    symmetric_plane_coef.push_back(a);
+    symmetric_plane_coef.push_back(b);
+    symmetric_plane_coef.push_back(c);
+    symmetric_plane_coef.push_back(d);
+
+    // symmetry information are stored like this
+    // first three scalars store projection position on the symmetry plane
+    // last two scalars store the projected normal
+    // the plane is a part of the key, editing symmetry_plane.txt regenerates it
+    uint64_t key = featureCacheKey(poly_mesh, true);
+    key = FeatureCache::hashBytes(&symmetric_plane_coef[0], symmetric_plane_coef.size() * sizeof(double), key);
+    if (loadCachedFeature(model, "v:symmetry", key, v_symmetry, 5))
+    {
+      std::cout << "Loading symmetry feature finished." << std::endl;
+      return;
+    }
+
+    std::cout << "Generating symmetry feature." << std::endl;
+    PolygonMesh::Vertex_attribute<Vec3> v_normals = poly_mesh->vertex_attribute<Vec3>("v:normal");
+    Bound* bounding = model->getBoundBox();
+    for (auto vit : poly_mesh->vertices())
+    {
+      Vec3 pos = poly_mesh->position(vit);
+      pos << (pos(0) - bounding->minX) / (bounding->maxX - bounding->minX), 
+                     (pos(1) - bounding->minY) / (bounding->maxY - bounding->minY),
+                     (pos(2) - bounding->minZ) / (bounding->maxZ - bounding->minZ);
+      Vec3 normal = v_normals[vit];
+      ShapeUtility::computeVertexSymmetryProjection(pos, normal, symmetric_plane_coef);
+      normal = (normal + Vec3(1, 1, 1)) / 2 ; // Why? Need to check // To make it between [0,1]
+
+      std::vector<float> cur_v_symmetry;
+      cur_v_symmetry.push_back(pos(0));
+      cur_v_symmetry.push_back(pos(1));
+      cur_v_symmetry.push_back(pos(2));
+      cur_v_symmetry.push_back(normal(0));
+      cur_v_symmetry.push_back(normal(1));
+      //v_symmetry[vit] = Vec3(fabs(pos[1]), pos[0], pos[2]);
+      v_symmetry[vit] = cur_v_symmetry;
+    }
+    saveCachedFeature(model, "v:symmetry", key, v_symmetry, 5);
+    std::cout << "Generating symmetry feature finished." << std::endl;
 
     //// normalize the value
     //Vector3f mins(std::numeric_limits<float>::max(), std::numeric_limits<float>::max(), std::numeric_limits<float>::max());
@@ -1268,7 +1287,21 @@ namespace ShapeUtility
     //computeHalfedgeAngle(model->getPolygonMesh());
     //computeMeanCurvature(model->getPolygonMesh());
     //computeGaussianCurvature(model->getPolygonMesh());
-    VtkUtility::getCurvature(model->getPolygonMesh());
+    PolygonMesh* poly_mesh = model->getPolygonMesh();
+    PolygonMesh::Vertex_attribute<Scalar> mean_curvature = poly_mesh->vertex_attribute<Scalar>("v:mean_curvature");
+    PolygonMesh::Vertex_attribute<Scalar> gaussian_curvature = poly_mesh->vertex_attribute<Scalar>("v:gaussian_curvature");
+
+    uint64_t key = featureCacheKey(poly_mesh, false);
+    if (loadCachedFeature(model, "v:mean_curvature", key, mean_curvature)
+      && loadCachedFeature(model, "v:gaussian_curvature", key, gaussian_curvature))
+    {
+      std::cout << "Loading curvature feature finished." << std::endl;
+      return;
+    }
+
+    VtkUtility::getCurvature(poly_mesh);
+    saveCachedFeature(model, "v:mean_curvature", key, mean_curvature);
+    saveCachedFeature(model, "v:gaussian_curvature", key, gaussian_curvature);
   }
 
   void computeMeanCurvature(LG::PolygonMesh* poly_mesh)
@@ -1881,17 +1914,15 @@ namespace ShapeUtility
     int f_id;
     std::vector<int> v_ids;
     std::vector<float> bary_coord;
-    std::vector<float> pt(2, 0);
     float min = std::numeric_limits<float>::max();
     float max = std::numeric_limits<float>::min();
 
+    UVGBuffer* uv_gbuffer = para_shape->getUVGBuffer(resolution);
     for(int x = 0; x < resolution; x ++)
     {
       for(int y = 0; y < resolution; y ++)
       {
-        pt[0] = float(x) / resolution;
-        pt[1] = float(y) / resolution;
-        if (ShapeUtility::findClosestUVFace(pt, para_shape.get(), bary_coord, f_id, v_ids))
+        if (uv_gbuffer->lookup(x, y, bary_coord, f_id, v_ids))
         {
           Vec3 lt_0 = local_transform[PolygonMesh::Vertex(v_set[v_ids[0]])];
           Vec3 lt_1 = local_transform[PolygonMesh::Vertex(v_set[v_ids[1]])];
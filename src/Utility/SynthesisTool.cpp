@@ -4,11 +4,58 @@
 #include "KDTreeWrapper.h"
 #include "ShapeUtility.h"
 #include "ImageUtility.h"
+#include "DebugExporter.h"
 
 #include <vector>
 #include <cv.h>
 #include <highgui.h>
 #include <fstream>
+#include <chrono>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#if defined(__AVX__)
+#include <immintrin.h>
+#define SYNTOOL_USE_SSE
+#elif defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define SYNTOOL_USE_SSE
+#endif
+
+// sum of w[i] * (a[i] - b[i])^2 over n floats
+static inline float weightedSqDist(const float* a, const float* b, const float* w, int n)
+{
+  int i = 0;
+  float sum = 0.0f;
+#if defined(__AVX__)
+  __m256 acc8 = _mm256_setzero_ps();
+  for (; i + 8 <= n; i += 8)
+  {
+    __m256 diff = _mm256_sub_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i));
+    acc8 = _mm256_add_ps(acc8, _mm256_mul_ps(_mm256_loadu_ps(w + i), _mm256_mul_ps(diff, diff)));
+  }
+  float lanes8[8];
+  _mm256_storeu_ps(lanes8, acc8);
+  sum += (lanes8[0] + lanes8[1]) + (lanes8[2] + lanes8[3]) + (lanes8[4] + lanes8[5]) + (lanes8[6] + lanes8[7]);
+#endif
+#if defined(SYNTOOL_USE_SSE)
+  __m128 acc4 = _mm_setzero_ps();
+  for (; i + 4 <= n; i += 4)
+  {
+    __m128 diff = _mm_sub_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i));
+    acc4 = _mm_add_ps(acc4, _mm_mul_ps(_mm_loadu_ps(w + i), _mm_mul_ps(diff, diff)));
+  }
+  float lanes4[4];
+  _mm_storeu_ps(lanes4, acc4);
+  sum += (lanes4[0] + lanes4[1]) + (lanes4[2] + lanes4[3]);
+#endif
+  for (; i < n; ++i)
+  {
+    float diff = a[i] - b[i];
+    sum += w[i] * diff * diff;
+  }
+  return sum;
+}
 
 SynthesisTool::SynthesisTool()
 {
@@ -34,6 +81,16 @@ SynthesisTool::SynthesisTool()
   lamd_gradient = 0.1;
   beta_func_center = 0.5;
   beta_func_mult = 5;
+  use_candidate_index = false;
+  ann_oversample = 4;
+  ann_dim = 8;
+  use_parallel_nnf = false;
+  benchmark_parallel_nnf = false;
+  use_vote_mode = false;
+  use_window_search = false;
+  nnf_tile_size = 32;
+  rand_seed = 0;
+  nnf_pass = 0;
 
   /*std::ofstream outFile(outputPath + "/parameter_info.txt");
   if (!outFile.is_open())
@@ -58,52 +115,73 @@ void SynthesisTool::init(std::vector<cv::Mat>& src_feature, std::vector<cv::Mat>
   // [1]  ----
   // [2]   --
 
-  // get image for pyramids
+  this->initSource(src_feature, src_detail);
+  this->initTarget(tar_feature);
+
+  //this->buildAllFeatureButkects(gpsrc_feature, gpsrc_feature_buckets);
+
+  std::cout << "SynthesisTool Init success !" << std::endl;
+}
+
+void SynthesisTool::initSource(std::vector<cv::Mat>& src_feature, std::vector<cv::Mat>& src_detail)
+{
+  // get image for source pyramids
   gpsrc_feature.clear();
-  gptar_feature.clear();
   gpsrc_detail.clear();
-  gptar_detail.clear();
+  packed_src.reset();
 
   gpsrc_feature.resize(src_feature.size());
-  gptar_feature.resize(tar_feature.size());
   gpsrc_detail.resize(src_detail.size());
-  gptar_detail.resize(src_detail.size());
-  for(size_t i = 0; i < src_feature.size(); i ++)
+  for (size_t i = 0; i < src_feature.size(); ++i)
   {
     gpsrc_feature[i].push_back(src_feature[i].clone());
-    gptar_feature[i].push_back(tar_feature[i].clone());
+    this->generatePyramid(gpsrc_feature[i], levels);
   }
   for (size_t i = 0; i < src_detail.size(); ++i)
   {
     gpsrc_detail[i].push_back(src_detail[i].clone());
-    gptar_detail[i].push_back(cv::Mat::zeros(tar_feature[0].rows, tar_feature[0].cols, CV_32FC1));
+    this->generatePyramid(gpsrc_detail[i], levels);
   }
-  for(size_t i = 0; i < gptar_feature.size(); i ++)
+}
+
+void SynthesisTool::initTarget(std::vector<cv::Mat>& tar_feature)
+{
+  // get image for target pyramids, the source needs to be set already
+  // target detail has the same channels as the source detail
+  gptar_feature.clear();
+  gptar_detail.clear();
+
+  gptar_feature.resize(tar_feature.size());
+  gptar_detail.resize(gpsrc_detail.size());
+  for (size_t i = 0; i < tar_feature.size(); ++i)
   {
-    this->generatePyramid(gpsrc_feature[i], levels);
+    gptar_feature[i].push_back(tar_feature[i].clone());
     this->generatePyramid(gptar_feature[i], levels);
   }
-  for (size_t i = 0; i < gpsrc_detail.size(); ++i)
+  for (size_t i = 0; i < gptar_detail.size(); ++i)
   {
-    this->generatePyramid(gpsrc_detail[i], levels);
+    gptar_detail[i].push_back(cv::Mat::zeros(tar_feature[0].rows, tar_feature[0].cols, CV_32FC1));
     this->generatePyramid(gptar_detail[i], levels);
   }
+}
 
-  //this->buildAllFeatureButkects(gpsrc_feature, gpsrc_feature_buckets);
-
-  std::cout << "SynthesisTool Init success !" << std::endl;
-  /*std::cout << "The size of gpsrc_detail is" << gpsrc_detail.size() << std::endl;
-  std::cout << "The size of gptar_detail is" << gptar_detail.size() << std::endl;
-  std::cout << "The size of gpsrc_feature is" << gpsrc_feature.size() << std::endl;
-  std::cout << "The size of gptar_feature is" << gptar_feature.size() << std::endl;
-  std::cout << "The size of gpsrc_feature[0] is" << gpsrc_feature[0].size() << std::endl;
-  std::cout << "The size of gpsrc_feature[1] is" << gpsrc_feature[1].size() << std::endl;
-  std::cout << "The size of gpsrc_feature[2] is" << gpsrc_feature[2].size() << std::endl;
-  std::cout << "The size of gptar_feature[0] is" << gptar_feature[0].size() << std::endl;
-  std::cout << "The size of gptar_feature[1] is" << gptar_feature[1].size() << std::endl;
-  std::cout << "The size of gptar_feature[2] is" << gptar_feature[2].size() << std::endl;*/
-
-  //std::cout << "The cols of gptar_detail[0] is :" << gptar_detail.at(0).cols << std::endl;
+bool SynthesisTool::shareSource(SynthesisTool& other)
+{
+  // source pyramids and their packed copies are only read during synthesis, so the
+  // cv::Mat headers are copied and the data is shared with the other tool
+  if (other.levels != levels)
+  {
+    std::cout << "shareSource: pyramid levels don't match, " << other.levels << " vs " << levels << std::endl;
+    return false;
+  }
+  if (!other.packed_src)
+  {
+    other.packSource();
+  }
+  gpsrc_feature = other.gpsrc_feature;
+  gpsrc_detail = other.gpsrc_detail;
+  packed_src = other.packed_src;
+  return true;
 }
 
 void SynthesisTool::generatePyramid(std::vector<cv::Mat>& pyr, int level)
@@ -119,12 +197,77 @@ void SynthesisTool::generatePyramid(std::vector<cv::Mat>& pyr, int level)
   }
 }
 
+void SynthesisTool::packLevel(ImagePyramidVec& gp, int level, std::vector<float>& packed)
+{
+  int dim = (int)gp.size();
+  int height = gp[0][level].rows;
+  int width  = gp[0][level].cols;
+  packed.resize(height * width * dim);
+  for (int k = 0; k < dim; ++k)
+  {
+    for (int i = 0; i < height; ++i)
+    {
+      const float* row = gp[k][level].ptr<float>(i);
+      float* dst = &packed[i * width * dim + k];
+      for (int j = 0; j < width; ++j)
+      {
+        dst[j * dim] = row[j];
+      }
+    }
+  }
+}
+
+void SynthesisTool::packSource()
+{
+  std::shared_ptr<PackedSource> packed(new PackedSource);
+  int n_level = (int)gpsrc_feature[0].size();
+  packed->feature.resize(n_level);
+  packed->detail.resize(n_level);
+  for (int l = 0; l < n_level; ++l)
+  {
+    this->packLevel(gpsrc_feature, l, packed->feature[l]);
+    this->packLevel(gpsrc_detail, l, packed->detail[l]);
+  }
+  packed_src = packed;
+}
+
+void SynthesisTool::packPyramids()
+{
+  // the feature and source detail pyramids don't change during synthesis, pack them once
+  // the source is only packed if it isn't yet, e.g. when it comes from shareSource
+  // the target detail is repacked at the beginning of every nnf pass since voting changes it
+  if (!packed_src)
+  {
+    this->packSource();
+  }
+  int n_level = (int)gpsrc_feature[0].size();
+  packed_tar_feature.resize(n_level);
+  packed_tar_detail.resize(n_level);
+  for (int l = 0; l < n_level; ++l)
+  {
+    this->packLevel(gptar_feature, l, packed_tar_feature[l]);
+    this->packLevel(gptar_detail, l, packed_tar_detail[l]);
+  }
+
+  // the 4th detail channel (displacement) has a larger weight
+  int ddim = (int)gpsrc_detail.size();
+  packed_detail_weight.resize(this->patch_size * ddim);
+  for (int j = 0; j < this->patch_size; ++j)
+  {
+    for (int k = 0; k < ddim; ++k)
+    {
+      packed_detail_weight[j * ddim + k] = (k == 3) ? 3.0f : 1.0f;
+    }
+  }
+}
+
 void SynthesisTool::doSynthesis()
 {
   // find best match for each level
   double totalTime = 0.0;
+  this->resetRandom(rand_seed);
   
-  std::vector<std::set<distance_position> > all_pixel_candidates;
+  ImageFCandidates all_pixel_candidates;
   for (int l = levels - 1; l >= 0; --l)                      
   {
     double duration;
@@ -139,11 +282,9 @@ void SynthesisTool::doSynthesis()
     if(l == levels - 1)
     {
       this->initializeTarDetail(gptar_detail, l);
+      if (use_candidate_index) this->buildCandidateIndex(gpsrc_feature, l);
 
-      FCandidates candidates;
-      FCandidates best_match;
-      all_pixel_candidates.clear();
-      all_pixel_candidates.resize(width * height);
+      all_pixel_candidates.init(width * height, candidate_size);
       //generateFeatureCandidateForLowestLevel(all_pixel_candidates, gpsrc_feature, gptar_feature);
       std::vector<float> reference_cnt(width * height, 0.0);
       for (int i = 0; i < height; ++i)
@@ -152,8 +293,7 @@ void SynthesisTool::doSynthesis()
         {
           int offset = i * width + j;
           // for lowest level we have generated the candidates
-          candidates.clear();
-          best_match.clear();
+          CandidateHeap candidates = all_pixel_candidates.at(offset);
           //this->findCandidates(gpsrc_feature, gptar_feature, l, j, i, candidates);//std::cout <<"found candidates finished. ";
           //std::cout << "The size of the candidates is :" << candidates.size() << std::endl;
           //this->findCandidatesInBuckets(gpsrc_feature_buckets, gptar_feature, l, j, i, candidates);
@@ -167,7 +307,6 @@ void SynthesisTool::doSynthesis()
           //}
           // add ref_cnt
           //reference_cnt[findY * width + findX] += 1.0;
-          all_pixel_candidates[offset].swap(candidates);
           //std::cout << "Here is OK !" << std::endl;
         }
       }
@@ -180,9 +319,7 @@ void SynthesisTool::doSynthesis()
       }
 
       // use candidates computed last time
-      FCandidates candidates;
-      FCandidates best_match;
-      ImageFCandidates new_all_pixel_candidates(width * height);
+      ImageFCandidates new_all_pixel_candidates(width * height, candidate_size);
       std::vector<float> reference_cnt(width * height, 0.0);
       //this->generateFeatureCandidateFromLastLevel(new_all_pixel_candidates, all_pixel_candidates, l, gpsrc_feature, gptar_feature);
       //all_pixel_candidates.swap(new_all_pixel_candidates);
@@ -193,23 +330,21 @@ void SynthesisTool::doSynthesis()
           int offset = i * width + j;
           //this->getFeatureCandidateFromLowestLevel(candidates, all_pixel_candidates, l, j, i);
           // for lowest level we have generated the candidates
-          candidates.clear();
-          best_match.clear();
-          //FCandidates candidates;
+          CandidateHeap last_candidates;
+          CandidateHeap candidates = new_all_pixel_candidates.at(offset);
           //this->findCandidates(gpsrc_feature, gptar_feature, l, j, i, candidates);//std::cout <<"found candidates finished. ";
           //std::cout << "The size of the candidates is :" << candidates.size() << std::endl;
           //this->findCandidatesInBuckets(gpsrc_feature_buckets, gptar_feature, l, j, i, candidates);
-          this->getLastLevelCandidate(gptar_feature, all_pixel_candidates, l, j, i, candidates);
+          this->getLastLevelCandidate(gptar_feature, all_pixel_candidates, l, j, i, last_candidates);
           //this->findCandidatesFromLastLevelWithRefCount(gpsrc_feature, gptar_feature, reference_cnt, l, j, i, candidates);
           //this->findBestMatchWithRefCount(gpsrc_detail, gptar_detail, reference_cnt, l, j, i, candidates, best_match);//std::cout<<"found best match finished.\n";
-          this->findCombineCandidatesFromLastLevel(gpsrc_feature, gptar_feature, gpsrc_detail, gptar_detail, reference_cnt, l, j, i, candidates);
+          this->findCombineCandidatesFromLastLevel(gpsrc_feature, gptar_feature, gpsrc_detail, gptar_detail, reference_cnt, l, j, i, last_candidates, candidates);
           this->getValFromBestMatch(gpsrc_detail, gptar_detail, reference_cnt, l, j, i, candidates);
           //for (int k = 0; k < detail_dim; ++k)
           //{
           //  gptar_detail[k].at(l).at<float>(i, j) = gpsrc_detail[k].at(l).at<float>(findY, findX);
           //}
           //reference_cnt[findY * width + findX] += 1.0;
-          new_all_pixel_candidates[offset].swap(candidates);
           //std::cout << "Here is OK !" << std::endl;
         }
       }
@@ -222,6 +357,7 @@ void SynthesisTool::doSynthesis()
     std::cout << "Level " << l << " is finished ! " << "Running time is : " << duration << " seconds." << std::endl;
   }
   std::cout << "All levels is finished !" << " The total running time is :" << totalTime << " seconds." << std::endl;
+  DebugExporter::GetInstance()->flush(); // the level exports are on disk when synthesis returns
 }
 
 void SynthesisTool::findCandidates(std::vector<ImagePyramid>& gpsrc, std::vector<ImagePyramid>& gptar, int level, int pointX, int pointY, std::set<distance_position>& candidates)
@@ -234,7 +370,23 @@ void SynthesisTool::findCandidates(std::vector<ImagePyramid>& gpsrc, std::vector
 
   // probably not research candidates
 
-  if (candidates.empty())
+  if (candidates.empty() && use_candidate_index && this->hasCandidateIndex(level))
+  {
+    // re-rank the approximate neighbors with the exact distance
+    std::vector<Point2D> ann_result;
+    this->queryCandidateIndex(gptar, level, pointX, pointY, ann_oversample * candidate_size, ann_result);
+    for (size_t i = 0; i < ann_result.size(); ++i)
+    {
+      d = this->distNeighborOnFeature(gpsrc, gptar, level, ann_result[i].first, ann_result[i].second, pointX, pointY);
+      candidates.insert(distance_position(d, ann_result[i]));
+      if(candidates.size() > candidate_size)
+      {
+        candidates.erase(--candidates.end());
+      }
+    }
+  }
+
+  else if (candidates.empty())
   {
     int sheight = gpsrc[0].at(level).rows;
     int swidth = gpsrc[0].at(level).cols;
@@ -379,8 +531,7 @@ void SynthesisTool::findBestMatch(std::vector<ImagePyramid>& gpsrc, std::vector<
     //}
   }
 
-  int choose = int((rand() / double(RAND_MAX)) * best_random_size);
-  choose = choose >= best_random_size ? (best_random_size - 1) : choose;
+  int choose = serial_rng.uniformInt(best_random_size);
   std::set<distance_position>::const_iterator iter = best_set.begin();
   std::advance(iter, choose);
   findX = iter->pos.first;
@@ -519,6 +670,7 @@ void SynthesisTool::doImageSynthesis(std::vector<cv::Mat>& src_detail)
   NeighborRange[2].width = 3;
   gpsrc_detail.clear();
   gptar_detail.clear();
+  packed_src.reset();
   gpsrc_detail.resize(src_detail.size());
   gptar_detail.resize(src_detail.size());
   for (size_t i = 0; i < src_detail.size(); ++i)
@@ -549,12 +701,12 @@ void SynthesisTool::doImageSynthesis(std::vector<cv::Mat>& src_detail)
       {
         double max, min;
         cv::minMaxLoc(gpsrc_detail[k].at(l),&min,&max);
-        srand((unsigned)time(NULL));
         for(int i = 0; i < height; i ++)
         {
+          CounterRNG rng(rand_seed, unsigned(l), INIT_STREAM, unsigned(k * height + i));
           for(int j = 0; j < width; j ++)
           {
-            gptar_detail[k].at(l).at<float>(i, j) = (rand() / double(RAND_MAX)) * (max - min) + min;
+            gptar_detail[k].at(l).at<float>(i, j) = rng.uniform() * (max - min) + min;
           }
         }
       }
@@ -583,6 +735,7 @@ void SynthesisTool::doImageSynthesis(std::vector<cv::Mat>& src_detail)
     std::cout << "Level " << l << " is finished ! " << "Running time is : " << duration << " seconds." << std::endl;
   }
   std::cout << "All levels is finished !" << " The total running time is :" << totalTime << " seconds." << std::endl;
+  DebugExporter::GetInstance()->flush(); // the level exports are on disk when synthesis returns
 }
 
 void SynthesisTool::findBest(std::vector<ImagePyramid>& gpsrc, std::vector<ImagePyramid>& gptar, int level, int pointX, int pointY, int& findX, int& findY)
@@ -645,8 +798,7 @@ void SynthesisTool::generateFeatureCandidateFromLastLevel(ImageFCandidates& new_
   int last_height = gptar[0][l + 1].rows;
   int last_width  = gptar[0][l + 1].cols;
 
-  new_image_candidates.clear();
-  new_image_candidates.resize(height * width, FCandidates());
+  new_image_candidates.init(height * width, candidate_size);
 
   for (int i = 0; i < height; ++i)
   {
@@ -654,20 +806,20 @@ void SynthesisTool::generateFeatureCandidateFromLastLevel(ImageFCandidates& new_
     {
       int offset = i * width + j;
       int last_offset = (i / 2) * last_width + (j / 2);
-      FCandidates last_candidates = last_image_candidates[last_offset];
-      this->findCandidatesFromLastLevel(gpsrc, gptar, l, j, i, last_candidates);
-      new_image_candidates[offset] = last_candidates;
+      CandidateHeap last_candidates = last_image_candidates.at(last_offset);
+      CandidateHeap candidates = new_image_candidates.at(offset);
+      this->findCandidatesFromLastLevel(gpsrc, gptar, l, j, i, last_candidates, candidates);
     }
   }
 }
 
-void SynthesisTool::findCandidatesFromLastLevel(std::vector<ImagePyramid>& gpsrc, std::vector<ImagePyramid>& gptar, int level, int tarpointX, int tarpointY, std::set<distance_position>& candidates)
+void SynthesisTool::findCandidatesFromLastLevel(std::vector<ImagePyramid>& gpsrc, std::vector<ImagePyramid>& gptar, int level, int tarpointX, int tarpointY, CandidateHeap& last_candidates, CandidateHeap& candidates)
 {
   int spy, spx;
   int ddim = gpsrc.size();
   double d1 = 0.0;
-  FCandidates new_candidates;
-  for (auto& i_candidates : candidates)
+  candidates.clear();
+  for (auto& i_candidates : last_candidates)
   {
     distance_position expanded;
     expanded.d = i_candidates.d;
@@ -697,19 +849,10 @@ void SynthesisTool::findCandidatesFromLastLevel(std::vector<ImagePyramid>& gpsrc
           d1 += pow(gpsrc[k].at(level).at<float>(spy, spx) - gptar[k].at(level).at<float>(tarpointY,tarpointX), 2);
         }
 
-        distance_position dis_pos;
-        dis_pos.d = sqrt(d1);
-        dis_pos.pos.first = spx;
-        dis_pos.pos.second = spy;
-        new_candidates.insert(dis_pos);
-        if(new_candidates.size() > candidate_size)
-        {
-          new_candidates.erase(--new_candidates.end());
-        }
+        candidates.push(sqrt(d1), Point2D(spx, spy));
       }
     }
   }
-  candidates = new_candidates;
 }
 
 void SynthesisTool::buildAllFeatureButkects(std::vector<ImagePyramid>& gpsrc, std::vector<FBucketPryamid>& gpsrc_buckets)
@@ -801,7 +944,24 @@ void SynthesisTool::findCandidatesWithRefCount(std::vector<ImagePyramid>& gpsrc,
 
   // probably not research candidates
 
-  if (candidates.empty())
+  if (candidates.empty() && use_candidate_index && this->hasCandidateIndex(level))
+  {
+    int swidth = gpsrc[0].at(level).cols;
+    std::vector<Point2D> ann_result;
+    this->queryCandidateIndex(gptar, level, pointX, pointY, ann_oversample * candidate_size, ann_result);
+    for (size_t i = 0; i < ann_result.size(); ++i)
+    {
+      d = this->distNeighborOnFeature(gpsrc, gptar, level, ann_result[i].first, ann_result[i].second, pointX, pointY);
+      d = sqrt(d * d + pow(ref_cnt[ann_result[i].second * swidth + ann_result[i].first], 2));
+      candidates.insert(distance_position(d, ann_result[i]));
+      if(candidates.size() > candidate_size)
+      {
+        candidates.erase(--candidates.end());
+      }
+    }
+  }
+
+  else if (candidates.empty())
   {
     int sheight = gpsrc[0].at(level).rows;
     int swidth = gpsrc[0].at(level).cols;
@@ -872,7 +1032,7 @@ void SynthesisTool::findCandidatesFromLastLevelWithRefCount(std::vector<ImagePyr
   candidates.swap(new_candidates);
 }
 
-void SynthesisTool::getLastLevelCandidate(std::vector<ImagePyramid>& gptar, ImageFCandidates& last_image_candidates, int level, int pointX, int pointY, std::set<distance_position>& candidates)
+void SynthesisTool::getLastLevelCandidate(std::vector<ImagePyramid>& gptar, ImageFCandidates& last_image_candidates, int level, int pointX, int pointY, CandidateHeap& candidates)
 {
   int height = gptar[0][level].rows;
   int width  = gptar[0][level].cols;
@@ -881,7 +1041,7 @@ void SynthesisTool::getLastLevelCandidate(std::vector<ImagePyramid>& gptar, Imag
 
   int offset = pointY * width + pointX;
   int last_offset = (pointY / 2) * last_width + (pointX / 2);
-  candidates = last_image_candidates[last_offset];
+  candidates = last_image_candidates.at(last_offset);
 }
 
 void SynthesisTool::findBestMatchWithRefCount(std::vector<ImagePyramid>& gpsrc, std::vector<ImagePyramid>& gptar, std::vector<float>& ref_cnt, int level, int pointX, int pointY, std::set<distance_position>& candidates, std::set<distance_position>& best_match)
@@ -922,12 +1082,13 @@ void SynthesisTool::findBestMatchWithRefCount(std::vector<ImagePyramid>& gpsrc,
   best_match.swap(best_set);
 }
 
-void SynthesisTool::getValFromBestMatch(std::vector<ImagePyramid>& gpsrc, std::vector<ImagePyramid>& gptar, std::vector<float>& ref_cnt, int level, int tarpointX, int tarpointY, std::set<distance_position>& best_match)
+void SynthesisTool::getValFromBestMatch(std::vector<ImagePyramid>& gpsrc, std::vector<ImagePyramid>& gptar, std::vector<float>& ref_cnt, int level, int tarpointX, int tarpointY, CandidateHeap& best_match)
 {
   int detail_dim = (int)gpsrc.size();
   int sheight = gpsrc[0].at(level).rows;
   int swidth = gpsrc[0].at(level).cols;
-  for (auto i : best_match)
+  best_match.sort();
+  for (auto& i : best_match)
   {
     for (int k = 0; k < detail_dim; ++k)
     {
@@ -943,7 +1104,7 @@ void SynthesisTool::getValFromBestMatch(std::vector<ImagePyramid>& gpsrc, std::v
   }
 }
 
-void SynthesisTool::findCombineCandidates(std::vector<ImagePyramid>& gpsrc_f, std::vector<ImagePyramid>& gptar_f, std::vector<ImagePyramid>& gpsrc_d, std::vector<ImagePyramid>& gptar_d, std::vector<float>& ref_cnt, int level, int tarpointX, int tarpointY, std::set<distance_position>& best_match)
+void SynthesisTool::findCombineCandidates(std::vector<ImagePyramid>& gpsrc_f, std::vector<ImagePyramid>& gptar_f, std::vector<ImagePyramid>& gpsrc_d, std::vector<ImagePyramid>& gptar_d, std::vector<float>& ref_cnt, int level, int tarpointX, int tarpointY, CandidateHeap& best_match)
 {
   double d1 = 0.0;
   double d2 = 0.0;
@@ -952,6 +1113,8 @@ void SynthesisTool::findCombineCandidates(std::vector<ImagePyramid>& gpsrc_f, st
   double lambda_d2 = 0;
   int sheight = gpsrc_f[0].at(level).rows;
   int swidth = gpsrc_f[0].at(level).cols;
+  // always a full scan, the feature index can't prefilter this one: where d1 >= 0.001 the
+  // ranking is on the detail distance and close detail patches may be far in feature space
   for (int i = 0; i < sheight - 0; i = i + 1)// should be i = i + 1
   {
     for (int j = 0; j < swidth - 0; j = j + 1)
@@ -963,16 +1126,258 @@ void SynthesisTool::findCombineCandidates(std::vector<ImagePyramid>& gpsrc_f, st
       if (d1 < 0.001)  lambda_d1 = 1, lambda_d2 = 0;
       else  lambda_d1 = 0, lambda_d2 = 1;
       d = lambda_d1 * d1 + lambda_d2 * d2 + pow(ref_cnt[i * swidth + j], 2);
-      best_match.insert(distance_position(d, Point2D(j, i)));
-      if(best_match.size() > candidate_size)
+      best_match.push(d, Point2D(j, i));
+    }
+  }
+}
+
+void SynthesisTool::indexFeature(ImagePyramidVec& gp, int level, int pointX, int pointY, std::vector<float>& feature)
+{
+  // feature of one pixel projected on the PCA basis of this level
+  int fdim = (int)gp.size();
+  VectorXf f(fdim);
+  for (int k = 0; k < fdim; ++k)
+  {
+    f(k) = gp[k][level].at<float>(pointY, pointX);
+  }
+  VectorXf proj = src_feature_basis[level].transpose() * (f - src_feature_mean[level]);
+  feature.resize(proj.size());
+  for (int k = 0; k < proj.size(); ++k)
+  {
+    feature[k] = proj(k);
+  }
+}
+
+void SynthesisTool::buildCandidateIndex(ImagePyramidVec& gpsrc, int level)
+{
+  // kd-tree over the per pixel source features of one level
+  // features are reduced to ann_dim dimensions by PCA when they have more
+  int fdim = (int)gpsrc.size();
+  int sheight = gpsrc[0][level].rows;
+  int swidth = gpsrc[0][level].cols;
+  int n_pts = sheight * swidth;
+
+  if ((int)src_feature_index.size() < levels)
+  {
+    src_feature_index.resize(levels);
+    src_feature_basis.resize(levels);
+    src_feature_mean.resize(levels);
+  }
+
+  MatrixXf samples(fdim, n_pts);
+  for (int i = 0; i < sheight; ++i)
+  {
+    for (int j = 0; j < swidth; ++j)
+    {
+      for (int k = 0; k < fdim; ++k)
       {
-        best_match.erase(--best_match.end());
+        samples(k, i * swidth + j) = gpsrc[k][level].at<float>(i, j);
       }
     }
   }
+  src_feature_mean[level] = samples.rowwise().mean();
+
+  int n_dim = (ann_dim > 0 && ann_dim < fdim) ? ann_dim : fdim;
+  if (n_dim == fdim)
+  {
+    src_feature_basis[level] = MatrixXf::Identity(fdim, fdim);
+  }
+  else
+  {
+    MatrixXf centered = samples.colwise() - src_feature_mean[level];
+    MatrixXf cov = centered * centered.transpose() / float(std::max(1, n_pts - 1));
+    Eigen::SelfAdjointEigenSolver<MatrixXf> eigen_solver(cov);
+    // eigenvalues are sorted in increasing order, keep the last ones
+    src_feature_basis[level] = eigen_solver.eigenvectors().rightCols(n_dim);
+  }
+
+  std::vector<float> kd_data;
+  kd_data.reserve(n_pts * n_dim);
+  std::vector<float> feature;
+  for (int i = 0; i < sheight; ++i)
+  {
+    for (int j = 0; j < swidth; ++j)
+    {
+      this->indexFeature(gpsrc, level, j, i, feature);
+      kd_data.insert(kd_data.end(), feature.begin(), feature.end());
+    }
+  }
+  src_feature_index[level].reset(new KDTreeWrapper);
+  src_feature_index[level]->initKDTree(kd_data, n_pts, n_dim);
+
+  std::cout << "Candidate index of level " << level << " built, dimension " << n_dim << " of " << fdim << std::endl;
+}
+
+bool SynthesisTool::hasCandidateIndex(int level)
+{
+  return level < (int)src_feature_index.size() && src_feature_index[level] != nullptr;
+}
+
+void SynthesisTool::queryCandidateIndex(ImagePyramidVec& gptar, int level, int pointX, int pointY, int n_query, std::vector<Point2D>& result)
+{
+  // approximate nearest source pixels of a target pixel, not sorted by the exact distance
+  int swidth = gpsrc_feature[0][level].cols;
+  n_query = std::min(n_query, src_feature_index[level]->nDataPt());
+
+  std::vector<float> feature;
+  this->indexFeature(gptar, level, pointX, pointY, feature);
+  std::vector<float> pt_out;
+  std::vector<float> dis;
+  std::vector<int> pt_id;
+  src_feature_index[level]->nearestPt(n_query, feature, pt_out, dis, pt_id);
+
+  result.clear();
+  for (size_t i = 0; i < pt_id.size(); ++i)
+  {
+    result.push_back(Point2D(pt_id[i] % swidth, pt_id[i] / swidth));
+  }
+}
+
+void SynthesisTool::benchmarkCandidateIndex(int level, int n_query)
+{
+  // compare findCandidates with and without the index on random target pixels
+  int height = gptar_feature[0][level].rows;
+  int width = gptar_feature[0][level].cols;
+  bool use_index = use_candidate_index;
+
+  clock_t start = clock();
+  this->buildCandidateIndex(gpsrc_feature, level);
+  double build_time = double(clock() - start) / CLOCKS_PER_SEC;
+
+  std::vector<Point2D> queries(n_query);
+  CounterRNG rng(rand_seed, unsigned(level), BENCHMARK_STREAM);
+  for (int i = 0; i < n_query; ++i)
+  {
+    queries[i] = Point2D(rng.uniformInt(width), rng.uniformInt(height));
+  }
+
+  std::vector<FCandidates> brute_force(n_query);
+  use_candidate_index = false;
+  start = clock();
+  for (int i = 0; i < n_query; ++i)
+  {
+    this->findCandidates(gpsrc_feature, gptar_feature, level, queries[i].first, queries[i].second, brute_force[i]);
+  }
+  double brute_force_time = double(clock() - start) / CLOCKS_PER_SEC;
+
+  std::vector<FCandidates> approximate(n_query);
+  use_candidate_index = true;
+  start = clock();
+  for (int i = 0; i < n_query; ++i)
+  {
+    this->findCandidates(gpsrc_feature, gptar_feature, level, queries[i].first, queries[i].second, approximate[i]);
+  }
+  double index_time = double(clock() - start) / CLOCKS_PER_SEC;
+  use_candidate_index = use_index;
+
+  // recall: fraction of the exact candidates also found by the index
+  // candidates with equal distance are interchangeable, so compare against the worst exact distance
+  int n_found = 0;
+  int n_total = 0;
+  for (int i = 0; i < n_query; ++i)
+  {
+    if (brute_force[i].empty()) continue;
+    double d_worst = (--brute_force[i].end())->d;
+    for (auto& c : approximate[i])
+    {
+      if (c.d <= d_worst + 1e-9) ++n_found;
+    }
+    n_total += (int)brute_force[i].size();
+  }
+
+  std::cout << "Candidate index benchmark, level " << level << ", " << n_query << " queries" << std::endl;
+  std::cout << "build time: " << build_time << " s" << std::endl;
+  std::cout << "brute force: " << brute_force_time << " s, index: " << index_time << " s" << std::endl;
+  std::cout << "recall: " << (n_total > 0 ? double(n_found) / n_total : 1.0) << std::endl;
+}
+
+void SynthesisTool::benchmarkParallelNNF(NNF& nnf, int level)
+{
+  // one forward and one reversed pass from the same nnf and rand_seed, as an iteration of
+  // doSynthesisNew does, serial against checkerboard with 1, 2, 4 and 8 threads
+  // the random state is put back, the synthesis goes on as if the benchmark didn't run
+  int src_width = gpsrc_detail[0].at(level).cols;
+  int src_height = gpsrc_detail[0].at(level).rows;
+  CounterRNG saved_rng = serial_rng;
+  int saved_pass = nnf_pass;
+
+  NNF serial_nnf = nnf;
+  PatchOccupancy serial_ref_cnt(src_width, src_height, this->patch_size);
+  serial_rng = CounterRNG(rand_seed);
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  this->updateNNF(gpsrc_feature, gptar_feature, gpsrc_detail, gptar_detail, serial_nnf, serial_ref_cnt, level, 0);
+  double serial_energy = this->updateNNF(gpsrc_feature, gptar_feature, gpsrc_detail, gptar_detail, serial_nnf, serial_ref_cnt, level, 1);
+  double serial_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  double serial_eval = this->evaluateNNF(serial_nnf, level);
+
+  // the pass energies see the occupancy as it was when each patch was chosen, frozen for a
+  // whole phase in the parallel pass, so both results are also scored the same way after
+  std::cout << "Parallel nnf benchmark, level " << level << ", tile size " << nnf_tile_size << std::endl;
+  std::cout << "serial: energy " << serial_energy << ", final nnf " << serial_eval << ", " << serial_time << " s" << std::endl;
+
+#ifdef _OPENMP
+  int max_threads = omp_get_max_threads();
+#endif
+  int thread_nums[4] = { 1, 2, 4, 8 };
+  for (int k = 0; k < 4; ++k)
+  {
+#ifdef _OPENMP
+    omp_set_num_threads(thread_nums[k]);
+#else
+    if (k > 0) break;
+#endif
+    NNF parallel_nnf = nnf;
+    PatchOccupancy parallel_ref_cnt(src_width, src_height, this->patch_size);
+    nnf_pass = saved_pass;
+    start = std::chrono::steady_clock::now();
+    this->updateNNFParallel(gpsrc_feature, gptar_feature, gpsrc_detail, gptar_detail, parallel_nnf, parallel_ref_cnt, level, 0);
+    double parallel_energy = this->updateNNFParallel(gpsrc_feature, gptar_feature, gpsrc_detail, gptar_detail, parallel_nnf, parallel_ref_cnt, level, 1);
+    double parallel_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    double parallel_eval = this->evaluateNNF(parallel_nnf, level);
+    std::cout << "parallel, " << thread_nums[k] << " threads: energy " << parallel_energy
+      << ", final nnf " << parallel_eval << " (" << 100.0 * (parallel_eval - serial_eval) / serial_eval << "% against serial), "
+      << parallel_time << " s, speedup " << serial_time / parallel_time << std::endl;
+  }
+#ifdef _OPENMP
+  omp_set_num_threads(max_threads);
+#endif
+
+  serial_rng = saved_rng;
+  nnf_pass = saved_pass;
 }
 
-void SynthesisTool::findCombineCandidatesFromLastLevel(std::vector<ImagePyramid>& gpsrc_f, std::vector<ImagePyramid>& gptar_f, std::vector<ImagePyramid>& gpsrc_d, std::vector<ImagePyramid>& gptar_d, std::vector<float>& ref_cnt, int level, int tarpointX, int tarpointY, std::set<distance_position>& best_match)
+double SynthesisTool::evaluateNNF(NNF& nnf, int level)
+{
+  int height = gptar_detail[0][level].rows;
+  int width  = gptar_detail[0][level].cols;
+  int nnf_height = (height - this->patch_size + 1);
+  int nnf_width  = (width - this->patch_size + 1);
+  PatchOccupancy ref_cnt(gpsrc_detail[0][level].cols, gpsrc_detail[0][level].rows, this->patch_size);
+  for (int i = 0; i < nnf_height; ++i)
+  {
+    for (int j = 0; j < nnf_width; ++j)
+    {
+      if (tar_patch_mask[level][i * nnf_width + j] == 1) continue;
+      this->updateRefCount(ref_cnt, nnf[i * nnf_width + j], gpsrc_detail, level);
+    }
+  }
+
+  double energy = 0;
+  int n_patches = 0;
+  for (int i = 0; i < nnf_height; ++i)
+  {
+    for (int j = 0; j < nnf_width; ++j)
+    {
+      if (tar_patch_mask[level][i * nnf_width + j] == 1) continue;
+      Point2D tar_patch(j, i);
+      energy += this->distPatch(gpsrc_feature, gptar_feature, gpsrc_detail, gptar_detail, ref_cnt, level, nnf[i * nnf_width + j], tar_patch);
+      ++n_patches;
+    }
+  }
+  return n_patches > 0 ? energy / n_patches : 0;
+}
+
+void SynthesisTool::findCombineCandidatesFromLastLevel(std::vector<ImagePyramid>& gpsrc_f, std::vector<ImagePyramid>& gptar_f, std::vector<ImagePyramid>& gpsrc_d, std::vector<ImagePyramid>& gptar_d, std::vector<float>& ref_cnt, int level, int tarpointX, int tarpointY, CandidateHeap& last_match, CandidateHeap& best_match)
 {
   int spy, spx;
   int ddim = gpsrc_d.size();
@@ -982,8 +1387,8 @@ void SynthesisTool::findCombineCandidatesFromLastLevel(std::vector<ImagePyramid>
   double d = 0.0;
   double lambda_d1 = 0;
   double lambda_d2 = 0;
-  FCandidates new_candidates;
-  for (auto& i_candidates : best_match)
+  best_match.clear();
+  for (auto& i_candidates : last_match)
   {
     distance_position expanded;
     expanded.d = i_candidates.d;
@@ -1013,15 +1418,10 @@ void SynthesisTool::findCombineCandidatesFromLastLevel(std::vector<ImagePyramid>
         if (d1 < 0.001)  lambda_d1 = 1, lambda_d2 = 0;
         else  lambda_d1 = 0, lambda_d2 = 1;
         d = lambda_d1 * d1 + lambda_d2 * d2 + pow(ref_cnt[i * gpsrc_d[0].at(level).cols + j], 2);
-        new_candidates.insert(distance_position(d1, Point2D(spx, spy)));
-        if(new_candidates.size() > candidate_size)
-        {
-          new_candidates.erase(--new_candidates.end());
-        }
+        best_match.push(d1, Point2D(spx, spy));
       }
     }
   }
-  best_match.swap(new_candidates);
 }
 
 void SynthesisTool::doSynthesisNew(bool is_doComplete)
@@ -1030,12 +1430,14 @@ void SynthesisTool::doSynthesisNew(bool is_doComplete)
 
   // find best match for each level
   double totalTime = 0.0;
-  srand((unsigned)time(NULL));
+  this->resetRandom(rand_seed);
   for(int l = 0; l < levels; l ++)
   {
     std::vector<int> source_patch_mask_l;
     this->buildSourcePatchMask(gpsrc_detail[0].at(l), source_patch_mask_l);
     src_patch_mask.push_back(source_patch_mask_l);
+    src_valid_patch.push_back(std::vector<int>());
+    this->buildValidPatchIndex(src_patch_mask.back(), src_valid_patch.back());
 
     std::vector<int> target_patch_mask_l;
     std::vector<int> target_pixel_mask_l;
@@ -1058,6 +1460,7 @@ void SynthesisTool::doSynthesisNew(bool is_doComplete)
   }
   this->exportSrcMask();
   this->exportTarMask();
+  this->packPyramids();
 
   // rebuild source detail pyramid after dialation
   /*for (size_t i = 0; i < gpsrc_detail.size(); ++i)
@@ -1126,6 +1529,7 @@ void SynthesisTool::doSynthesisNew(bool is_doComplete)
     {
       this->initializeNNF(gpsrc_detail[0], gptar_detail[0], nnf, l, is_doComplete);
       this->initializeTarDetail(gptar_detail, l, is_doComplete);
+      if (benchmark_parallel_nnf) this->benchmarkParallelNNF(nnf, l);
       for (int i_iter = 0; i_iter < max_iter; ++i_iter)
       {
         //tar_detail_gradient.clear();
@@ -1139,12 +1543,20 @@ void SynthesisTool::doSynthesisNew(bool is_doComplete)
         //  tar_detail_gradient.push_back(grad_y);
         //}
 
-        std::vector<float> ref_cnt(src_width * src_height, 0.0);
+        PatchOccupancy ref_cnt(src_width, src_height, this->patch_size);
         //if (i_iter % 2 == 0)
         {
           double cur_energy = 0;
-          this->updateNNF(gpsrc_feature, gptar_feature, gpsrc_detail, gptar_detail, nnf, ref_cnt, l, 0);
-          cur_energy = this->updateNNF(gpsrc_feature, gptar_feature, gpsrc_detail, gptar_detail, nnf, ref_cnt, l, 1);
+          if (use_parallel_nnf)
+          {
+            this->updateNNFParallel(gpsrc_feature, gptar_feature, gpsrc_detail, gptar_detail, nnf, ref_cnt, l, 0);
+            cur_energy = this->updateNNFParallel(gpsrc_feature, gptar_feature, gpsrc_detail, gptar_detail, nnf, ref_cnt, l, 1);
+          }
+          else
+          {
+            this->updateNNF(gpsrc_feature, gptar_feature, gpsrc_detail, gptar_detail, nnf, ref_cnt, l, 0);
+            cur_energy = this->updateNNF(gpsrc_feature, gptar_feature, gpsrc_detail, gptar_detail, nnf, ref_cnt, l, 1);
+          }
           std::cout << "Level: " << l << " Iter: " << i_iter << " Energy: " << cur_energy << std::endl;
         }
         //else
@@ -1184,6 +1596,7 @@ void SynthesisTool::doSynthesisNew(bool is_doComplete)
       std::vector<Point2D> nnf_new;
       this->initializeNNFFromLastLevel(gpsrc_detail[0], gptar_detail[0], nnf, l, nnf_new, is_doComplete);
       nnf.swap(nnf_new);
+      if (benchmark_parallel_nnf) this->benchmarkParallelNNF(nnf, l);
       for (int i_iter = 0; i_iter < max_iter; ++i_iter)
       {
         //tar_detail_gradient.clear();
@@ -1197,12 +1610,20 @@ void SynthesisTool::doSynthesisNew(bool is_doComplete)
         //  tar_detail_gradient.push_back(grad_y);
         //}
 
-        std::vector<float> ref_cnt(src_width * src_height, 0.0);
+        PatchOccupancy ref_cnt(src_width, src_height, this->patch_size);
         //if (i_iter % 2 == 0)
         {
           double cur_energy = 0;
-          this->updateNNF(gpsrc_feature, gptar_feature, gpsrc_detail, gptar_detail, nnf, ref_cnt, l, 0);
-          cur_energy = this->updateNNF(gpsrc_feature, gptar_feature, gpsrc_detail, gptar_detail, nnf, ref_cnt, l, 1);
+          if (use_parallel_nnf)
+          {
+            this->updateNNFParallel(gpsrc_feature, gptar_feature, gpsrc_detail, gptar_detail, nnf, ref_cnt, l, 0);
+            cur_energy = this->updateNNFParallel(gpsrc_feature, gptar_feature, gpsrc_detail, gptar_detail, nnf, ref_cnt, l, 1);
+          }
+          else
+          {
+            this->updateNNF(gpsrc_feature, gptar_feature, gpsrc_detail, gptar_detail, nnf, ref_cnt, l, 0);
+            cur_energy = this->updateNNF(gpsrc_feature, gptar_feature, gpsrc_detail, gptar_detail, nnf, ref_cnt, l, 1);
+          }
           std::cout << "Level: " << l << " Iter: " << i_iter << " Energy: " << cur_energy << std::endl;
         }
         //else
@@ -1221,6 +1642,7 @@ void SynthesisTool::doSynthesisNew(bool is_doComplete)
     std::cout << "Level " << l << " is finished ! " << "Running time is : " << duration << " seconds." << std::endl;
   }
   std::cout << "All levels is finished !" << " The total running time is :" << totalTime << " seconds." << std::endl;
+  DebugExporter::GetInstance()->flush(); // the level exports are on disk when synthesis returns
 }
 
 void SynthesisTool::initializeNNF(ImagePyramid& gpsrc_d, ImagePyramid& gptar_d, NNF& nnf, int level, bool is_doComplete /*= false*/)
@@ -1354,11 +1776,12 @@ void SynthesisTool::initializeTarDetail(ImagePyramidVec& gptar_d, int level, boo
   int width  = gptar_d[0][level].cols;
   for (int i = 0; i < height; ++i)
   {
+    CounterRNG rng(rand_seed, unsigned(level), INIT_STREAM, unsigned(i));
     for (int j = 0; j < width; ++j)
     {
       for (int k = 0; k < ddim; ++k)
       {
-        gptar_d[k][level].at<float>(i, j) = (rand() / double(RAND_MAX));
+        gptar_d[k][level].at<float>(i, j) = float(rng.uniform());
       }
     }
   }
@@ -1381,30 +1804,75 @@ void SynthesisTool::initializeTarDetail(ImagePyramidVec& gptar_d, int level, boo
   }
 }
 
-void SynthesisTool::getRandomPosition(int l, std::vector<Point2D>& random_set, int n_set, int max_height, int max_width, int min_height, int min_width)
+void SynthesisTool::resetRandom(unsigned int seed)
+{
+  rand_seed = seed;
+  nnf_pass = 0;
+  serial_rng = CounterRNG(seed);
+}
+
+void SynthesisTool::buildValidPatchIndex(std::vector<int>& patch_mask, std::vector<int>& valid_patch)
+{
+  // offsets of the valid (0) patches, random search samples from this list
+  // instead of drawing until it hits one
+  valid_patch.clear();
+  for (size_t i = 0; i < patch_mask.size(); ++i)
+  {
+    if (patch_mask[i] == 0) valid_patch.push_back(int(i));
+  }
+}
+
+void SynthesisTool::getRandomPosition(int l, std::vector<Point2D>& random_set, int n_set, int max_height, int max_width)
+{
+  this->getRandomPosition(l, random_set, n_set, max_height, max_width, serial_rng);
+}
+
+void SynthesisTool::getRandomPosition(int l, std::vector<Point2D>& random_set, int n_set, int max_height, int max_width, CounterRNG& rng)
 {
+  // uniform over the valid source patches of level l
   random_set.clear();
   random_set.resize(n_set);
-  int x, y;
+  std::vector<int>& valid_patch = src_valid_patch[l];
+  int n_valid = (int)valid_patch.size();
   for (int i = 0; i < n_set; ++i)
   {
-    do{
-    x = (rand() / double(RAND_MAX)) * (max_width - min_width) + min_width;
-    y = (rand() / double(RAND_MAX)) * (max_height - min_height) + min_height;
+    if (n_valid == 0)
+    {
+      // nothing is valid, any position is as good as another
+      random_set[i] = Point2D(rng.uniformInt(max_width), rng.uniformInt(max_height));
+      continue;
+    }
+    int offset = valid_patch[rng.uniformInt(n_valid)];
+    random_set[i] = Point2D(offset % max_width, offset / max_width);
+  }
+}
 
-    // clamp if the random value is 1
-    x = (x >= max_width) ? (max_width - 1) : x;
-    y = (y >= max_height) ? (max_height - 1) : y;
-    }while(src_patch_mask[l][y * max_width + x] == 1);
-    random_set[i] = Point2D(x, y);
+void SynthesisTool::getWindowPosition(int l, Point2D& center, std::vector<Point2D>& random_set, int max_height, int max_width, CounterRNG& rng)
+{
+  // PatchMatch random search, one sample in each window around the current match,
+  // the window radius starts at the source size and halves until it is one patch
+  // samples landing on an invalid patch are dropped
+  for (int radius = std::max(max_height, max_width); radius >= 1; radius /= 2)
+  {
+    int x_min = std::max(0, center.first - radius);
+    int x_max = std::min(max_width - 1, center.first + radius);
+    int y_min = std::max(0, center.second - radius);
+    int y_max = std::min(max_height - 1, center.second + radius);
+    int x = x_min + rng.uniformInt(x_max - x_min + 1);
+    int y = y_min + rng.uniformInt(y_max - y_min + 1);
+    if (src_patch_mask[l][y * max_width + x] == 0)
+    {
+      random_set.push_back(Point2D(x, y));
+    }
   }
 }
 
 double SynthesisTool::updateNNF(ImagePyramidVec& gpsrc_f, ImagePyramidVec& gptar_f,
   ImagePyramidVec& gpsrc_d, ImagePyramidVec& gptar_d,
-  NNF& nnf, std::vector<float>& ref_cnt, int level, int iter)
+  NNF& nnf, PatchOccupancy& ref_cnt, int level, int iter)
 {
   // update nnf based on current nnf, random position and position nearby
+  this->packLevel(gptar_d, level, packed_tar_detail[level]);
   int height = gptar_d[0][level].rows;
   int width  = gptar_d[0][level].cols;
   int nnf_height = (height - this->patch_size + 1);
@@ -1502,6 +1970,7 @@ double SynthesisTool::updateNNF(ImagePyramidVec& gpsrc_f, ImagePyramidVec& gptar
       
       // random search
       this->getRandomPosition(level, rand_pos, best_random_size, src_nnf_height, src_nnf_width);
+      if (use_window_search) this->getWindowPosition(level, nnf[offset], rand_pos, src_nnf_height, src_nnf_width, serial_rng);
       Point2D best_rand;
       double d_best_rand = this->bestPatchInSet(gpsrc_f, gptar_f, gpsrc_d, gptar_d, ref_cnt, level, Point2D(j, i), rand_pos, best_rand);
       
@@ -1551,9 +2020,163 @@ double SynthesisTool::updateNNF(ImagePyramidVec& gpsrc_f, ImagePyramidVec& gptar
   return energyNNF / n_patches;
 }
 
+double SynthesisTool::updateNNFParallel(ImagePyramidVec& gpsrc_f, ImagePyramidVec& gptar_f,
+  ImagePyramidVec& gpsrc_d, ImagePyramidVec& gptar_d,
+  NNF& nnf, PatchOccupancy& ref_cnt, int level, int iter)
+{
+  // same update as updateNNF, but the nnf is cut into tiles colored as a checkerboard
+  // propagation only looks at the left/up (right/down when reversed) neighbor, so tiles
+  // of the same color never read each other and can be updated concurrently
+  // each tile has its own random stream seeded from (rand_seed, level, pass, tile), and
+  // ref_cnt is only updated between the two phases in tile order, so the result doesn't
+  // depend on the number of threads
+  this->packLevel(gptar_d, level, packed_tar_detail[level]);
+  int height = gptar_d[0][level].rows;
+  int width  = gptar_d[0][level].cols;
+  int nnf_height = (height - this->patch_size + 1);
+  int nnf_width  = (width - this->patch_size + 1);
+
+  int tile_size = std::max(1, this->nnf_tile_size);
+  int n_tile_x = (nnf_width + tile_size - 1) / tile_size;
+  int n_tile_y = (nnf_height + tile_size - 1) / tile_size;
+  int n_tiles = n_tile_x * n_tile_y;
+  int pass = nnf_pass++;
+
+  std::vector<double> tile_energy(n_tiles, 0.0);
+  std::vector<std::vector<Point2D> > tile_chosen(n_tiles);
+
+  for (int phase = 0; phase < 2; ++phase)
+  {
+    // reversed scan also starts from the other color
+    int color = (iter % 2 == 1) ? (1 - phase) : phase;
+
+#pragma omp parallel for schedule(dynamic)
+    for (int t = 0; t < n_tiles; ++t)
+    {
+      int tile_x = t % n_tile_x;
+      int tile_y = t / n_tile_x;
+      if ((tile_x + tile_y) % 2 != color) continue;
+
+      CounterRNG rng(rand_seed, unsigned(level), unsigned(pass), unsigned(t));
+      tile_energy[t] = this->updateNNFTile(gpsrc_f, gptar_f, gpsrc_d, gptar_d, nnf, ref_cnt, level, iter,
+        tile_y * tile_size, std::min(nnf_height, (tile_y + 1) * tile_size),
+        tile_x * tile_size, std::min(nnf_width, (tile_x + 1) * tile_size),
+        rng, tile_chosen[t]);
+    }
+
+    for (int t = 0; t < n_tiles; ++t)
+    {
+      if ((t % n_tile_x + t / n_tile_x) % 2 != color) continue;
+      for (size_t k = 0; k < tile_chosen[t].size(); ++k)
+      {
+        this->updateRefCount(ref_cnt, tile_chosen[t][k], gpsrc_d, level);
+      }
+    }
+  }
+
+  double energyNNF = 0;
+  int n_patches = 0;
+  for (int t = 0; t < n_tiles; ++t)
+  {
+    energyNNF += tile_energy[t];
+    n_patches += (int)tile_chosen[t].size();
+  }
+
+  return energyNNF / n_patches;
+}
+
+double SynthesisTool::updateNNFTile(ImagePyramidVec& gpsrc_f, ImagePyramidVec& gptar_f,
+  ImagePyramidVec& gpsrc_d, ImagePyramidVec& gptar_d,
+  NNF& nnf, PatchOccupancy& ref_cnt, int level, int iter,
+  int i_min, int i_max, int j_min, int j_max,
+  CounterRNG& rng, std::vector<Point2D>& chosen)
+{
+  // one raster scan of updateNNF restricted to [i_min, i_max) x [j_min, j_max)
+  // ref_cnt is read only here, the chosen patches are returned for the caller to count
+  int height = gptar_d[0][level].rows;
+  int width  = gptar_d[0][level].cols;
+  int nnf_height = (height - this->patch_size + 1);
+  int nnf_width  = (width - this->patch_size + 1);
+  int src_height = gpsrc_d[0][level].rows;
+  int src_width  = gpsrc_d[0][level].cols;
+  int src_nnf_height = (src_height - this->patch_size + 1);
+  int src_nnf_width = (src_width - this->patch_size + 1);
+
+  int istart = i_min, iend = i_max, ichange = 1;
+  int jstart = j_min, jend = j_max, jchange = 1;
+  if (iter % 2 == 1)
+  {
+    istart = i_max - 1; iend = i_min - 1; ichange = -1;
+    jstart = j_max - 1; jend = j_min - 1; jchange = -1;
+  }
+
+  double energyNNF = 0;
+  chosen.clear();
+
+  std::vector<Point2D> rand_pos;
+  for (int i = istart; i != iend; i += ichange)
+  {
+    for (int j = jstart; j != jend; j += jchange)
+    {
+      int offset = i * nnf_width + j;
+
+      // if not in target patch mask skip
+      if (tar_patch_mask[level][offset] == 1) continue;
+
+      // random search
+      this->getRandomPosition(level, rand_pos, best_random_size, src_nnf_height, src_nnf_width, rng);
+      if (use_window_search) this->getWindowPosition(level, nnf[offset], rand_pos, src_nnf_height, src_nnf_width, rng);
+      Point2D best_rand;
+      double d_best_rand = this->bestPatchInSet(gpsrc_f, gptar_f, gpsrc_d, gptar_d, ref_cnt, level, Point2D(j, i), rand_pos, best_rand);
+
+      // propagation, the neighbor may lie in a tile of the other color
+      rand_pos.clear();
+      // left
+      if ((unsigned)(j - jchange) < (unsigned)nnf_width)
+      {
+        Point2D left_nnf = nnf[i * nnf_width + j - jchange];
+        if ((unsigned)(left_nnf.first + jchange) < unsigned(src_nnf_width))
+        {
+          left_nnf.first = left_nnf.first + jchange;
+          if(this->validPatchWithMask(left_nnf, src_patch_mask[level], src_nnf_height, src_nnf_width))
+            rand_pos.push_back(left_nnf);
+        }
+      }
+      // up
+      if ((unsigned)(i - ichange) < (unsigned)nnf_height)
+      {
+        Point2D up_nnf = nnf[(i - ichange) * nnf_width + j];
+        if ((unsigned)(up_nnf.second + ichange) < unsigned(src_nnf_height))
+        {
+          up_nnf.second = (up_nnf.second + ichange);
+          if(this->validPatchWithMask(up_nnf, src_patch_mask[level], src_nnf_height, src_nnf_width))
+            rand_pos.push_back(up_nnf);
+        }
+      }
+      Point2D best_bias;
+      rand_pos.push_back(nnf[offset]);
+      double d_best_bias = this->bestPatchInSet(gpsrc_f, gptar_f, gpsrc_d, gptar_d, ref_cnt, level, Point2D(j, i), rand_pos, best_bias);
+
+      if (d_best_rand < (bias_rate * d_best_bias))
+      {
+        nnf[offset] = best_rand;
+        energyNNF += d_best_rand;
+      }
+      else
+      {
+        nnf[offset] = best_bias;
+        energyNNF += d_best_bias;
+      }
+      chosen.push_back(nnf[offset]);
+    }
+  }
+
+  return energyNNF;
+}
+
 void SynthesisTool::updateNNFWithMask(std::vector<int>& source_patch_mask, ImagePyramidVec& gpsrc_f, ImagePyramidVec& gptar_f,
                  ImagePyramidVec& gpsrc_d, ImagePyramidVec& gptar_d,
-                 NNF& nnf, std::vector<float>& ref_cnt, int level, int iter)
+                 NNF& nnf, PatchOccupancy& ref_cnt, int level, int iter)
 {
   //// update nnf based on current nnf, random position and position nearby
   //int height = gptar_d[0][level].rows;
@@ -1623,9 +2246,10 @@ void SynthesisTool::updateNNFWithMask(std::vector<int>& source_patch_mask, Image
   //}
 }
 
-void SynthesisTool::updateNNFReverse(ImagePyramidVec& gpsrc_f, ImagePyramidVec& gptar_f, ImagePyramidVec& gpsrc_d, ImagePyramidVec& gptar_d, NNF& nnf, std::vector<float>& ref_cnt, int level)
+void SynthesisTool::updateNNFReverse(ImagePyramidVec& gpsrc_f, ImagePyramidVec& gptar_f, ImagePyramidVec& gpsrc_d, ImagePyramidVec& gptar_d, NNF& nnf, PatchOccupancy& ref_cnt, int level)
 {
   // update nnf based on current nnf, random position and position nearby
+  this->packLevel(gptar_d, level, packed_tar_detail[level]);
   int height = gptar_d[0][level].rows;
   int width  = gptar_d[0][level].cols;
   int nnf_height = (height - this->patch_size + 1);
@@ -1730,75 +2354,65 @@ void SynthesisTool::updateNNFReverse(ImagePyramidVec& gpsrc_f, ImagePyramidVec&
 
 double SynthesisTool::distPatch(ImagePyramidVec& gpsrc_f, ImagePyramidVec& gptar_f,
   ImagePyramidVec& gpsrc_d, ImagePyramidVec& gptar_d,
-  std::vector<float>& ref_cnt, int level, Point2D& srcPatch, Point2D& tarPatch)
+  PatchOccupancy& ref_cnt, int level, Point2D& srcPatch, Point2D& tarPatch, double d_max)
 {
+  // the pyramids only give the sizes here, values are read from the packed copies
+  // built by packPyramids() so a patch row of all channels is contiguous
   double d = 0.0;
   double d_f = 0.0;
   double d_d = 0.0;
   double d_occ = 0.0;
-  double d_g = 0.0;
-  double lambda_d_f = 0;
-  double lambda_d_d = 0;
   double beta = 0.0;
 
   int fdim = (int)gpsrc_f.size();
   int ddim = (int)gpsrc_d.size();
-  int width = gptar_d[0][level].cols;
-  int nnf_width  = (width - this->patch_size + 1);
-
-  // for each pixel in the patch
-  for (int i = 0; i < this->patch_size; ++i)
+  int src_f_width = gpsrc_f[0][level].cols;
+  int tar_f_width = gptar_f[0][level].cols;
+  int src_width = gpsrc_d[0][level].cols;
+  int tar_width = gptar_d[0][level].cols;
+  int center = this->patch_size / 2;
+
+  // feature distance, use only center pixel in case of resolution mismatch
+  const float* src_f = &packed_src->feature[level][((srcPatch.second + center) * src_f_width + srcPatch.first + center) * fdim];
+  const float* tar_f = &packed_tar_feature[level][((tarPatch.second + center) * tar_f_width + tarPatch.first + center) * fdim];
+  for (int k = 0; k < fdim; ++k)
   {
-    for (int j = 0; j < this->patch_size; ++j)
-    {
-      // for each feature dimension
-      if (i == this->patch_size / 2 && j == this->patch_size / 2)  // use only center pixel
-      {
-        for (int k = 0; k < fdim; ++k)
-        {
-          // TODO: experiment here probably only use the center pixel for feature comparision
-          // in case of resolution mismatch
-          d_f += pow(gpsrc_f[k][level].at<float>(srcPatch.second + i, srcPatch.first + j) - gptar_f[k][level].at<float>(tarPatch.second + i, tarPatch.first + j), 2);
-        }
-      }
-
-      // for each detail dimension
-      for (int k = 0; k < ddim; ++k)
-      {
-        if (k == 3)
-        {
-          d_d += 3 * pow(gpsrc_d[k][level].at<float>(srcPatch.second + i, srcPatch.first + j) - gptar_d[k][level].at<float>(tarPatch.second + i, tarPatch.first + j), 2);
-        }
-        else
-        {
-          d_d += pow(gpsrc_d[k][level].at<float>(srcPatch.second + i, srcPatch.first + j) - gptar_d[k][level].at<float>(tarPatch.second + i, tarPatch.first + j), 2);
-        }
-      }
-
-      d_occ += ref_cnt[(srcPatch.second + i) * gpsrc_d[0][level].cols + srcPatch.first + j];
-    }
+    d_f += (src_f[k] - tar_f[k]) * (src_f[k] - tar_f[k]);
   }
 
+  d_occ = ref_cnt.patchSum(srcPatch.first, srcPatch.second);
+
   d_f /= this->patch_size * this->patch_size * fdim;
-  d_d /= this->patch_size * this->patch_size * ddim;
   d_occ /= pow(this->patch_size, 4);
 
-  //if (d_f < 0.001)  lambda_d_f = 1, lambda_d_d = 0;
-  //else  lambda_d_f = 0, lambda_d_d = 1;
   beta = 1.0 / (1 + exp(beta_func_mult * (d_f - beta_func_center)));
-  d =  beta * d_f + (1 - beta) * d_d + lamd_occ * d_occ;// + lambda_d_d * d_d + d_occ;
+  d = beta * d_f + lamd_occ * d_occ;
+
+  // detail distance, all terms are positive so we can stop as soon as d_max is exceeded
+  double w_d = (1 - beta) / (this->patch_size * this->patch_size * ddim);
+  int row_len = this->patch_size * ddim;
+  const float* weight = &packed_detail_weight[0];
+  for (int i = 0; i < this->patch_size; ++i)
+  {
+    const float* src_row = &packed_src->detail[level][((srcPatch.second + i) * src_width + srcPatch.first) * ddim];
+    const float* tar_row = &packed_tar_detail[level][((tarPatch.second + i) * tar_width + tarPatch.first) * ddim];
+    d_d += weightedSqDist(src_row, tar_row, weight, row_len);
+    if (d + w_d * d_d >= d_max) break;
+  }
+
+  d += w_d * d_d;
   return d;
 }
 
 double SynthesisTool::bestPatchInSet(ImagePyramidVec& gpsrc_f, ImagePyramidVec& gptar_f,
   ImagePyramidVec& gpsrc_d, ImagePyramidVec& gptar_d,
-  std::vector<float>& ref_cnt, int level, Point2D& tarPatch, std::vector<Point2D>& srcPatches, Point2D& best_patch)
+  PatchOccupancy& ref_cnt, int level, Point2D& tarPatch, std::vector<Point2D>& srcPatches, Point2D& best_patch)
 {
   size_t best_id = 0;
   double min_dist = std::numeric_limits<double>::max();
   for (size_t i = 0; i < srcPatches.size(); ++i)
   {
-    double cur_dist = this->distPatch(gpsrc_f, gptar_f, gpsrc_d, gptar_d, ref_cnt, level, srcPatches[i], tarPatch);
+    double cur_dist = this->distPatch(gpsrc_f, gptar_f, gpsrc_d, gptar_d, ref_cnt, level, srcPatches[i], tarPatch, min_dist);
     if (cur_dist < min_dist)
     {
       best_id = i;
@@ -1812,90 +2426,91 @@ double SynthesisTool::bestPatchInSet(ImagePyramidVec& gpsrc_f, ImagePyramidVec&
 }
 
 void SynthesisTool::voteImage(ImagePyramidVec& gpsrc_d, ImagePyramidVec& gptar_d, NNF& nnf, int level)
+{
+  // vote the pixels out of the target mask
+  this->voteMaskedImage(gpsrc_d, gptar_d, nnf, tar_pixel_mask[level], false, level);
+}
+
+void SynthesisTool::voteMaskedImage(ImagePyramidVec& gpsrc_d, ImagePyramidVec& gptar_d, NNF& nnf, std::vector<int>& pixel_mask, bool in_mask, int level)
 {
   // compute the value of each pixel
+  // a pixel only reads the source and writes itself, so rows are voted in parallel
   int height = gptar_d[0][level].rows;
   int width  = gptar_d[0][level].cols;
 
-
+#pragma omp parallel for schedule(static)
   for (int i = 0; i < height; ++i)
   {
     for (int j = 0; j < width; ++j)
     {
-      if (tar_pixel_mask[level][i * width + j] == 1) continue;
+      if ((pixel_mask[i * width + j] == 1) != in_mask) continue;
       this->votePixel(gpsrc_d, gptar_d, nnf, level, Point2D(j, i));
     }
   }
 }
 
-void SynthesisTool::votePixel(ImagePyramidVec& gpsrc_d, ImagePyramidVec& gptar_d, NNF& nnf, int level, Point2D& tarPos)
+void SynthesisTool::votePixel(ImagePyramidVec& gpsrc_d, ImagePyramidVec& gptar_d, NNF& nnf, int level, const Point2D& tarPos)
 {
   int width  = gptar_d[0][level].cols;
   int height = gptar_d[0][level].rows;
   int nnf_width  = (width - this->patch_size + 1);
   int nnf_height = (height - this->patch_size + 1);
   int ddim = (int)gptar_d.size();
-  std::vector<float> final_val(ddim, 0.0);
-  int n_pixel = 0;
-  std::vector<std::vector<float> > bins_acc(ddim, std::vector<float>(10, 0));
-  std::vector<std::vector<int> > bins_cnt(ddim, std::vector<int>(10, 0));
 
-  for (int i = 0; i < this->patch_size; ++i)
+  // patches covering the pixel
+  int i_begin = std::max(0, tarPos.second - nnf_height + 1);
+  int i_end = std::min(this->patch_size, tarPos.second + 1);
+  int j_begin = std::max(0, tarPos.first - nnf_width + 1);
+  int j_end = std::min(this->patch_size, tarPos.first + 1);
+  int n_pixel = std::max(0, i_end - i_begin) * std::max(0, j_end - j_begin);
+  if (n_pixel == 0) return;
+
+  for (int k = 0; k < ddim; ++k)
   {
-    for (int j = 0; j < this->patch_size; ++j)
+    const cv::Mat& src = gpsrc_d[k][level];
+    float final_val = 0;
+    // assume all values are between 0~1
+    float bins_acc[10] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
+    int bins_cnt[10] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
+
+    for (int i = i_begin; i < i_end; ++i)
     {
-      // get patch position
-      int i_p = tarPos.second - i;
-      int j_p = tarPos.first - j;
-      // patch is out side of the image
-      if (i_p < 0 || i_p >= nnf_height || j_p < 0 || j_p >= nnf_width) continue;
-      Point2D patch = nnf[i_p * nnf_width + j_p];
-      // get the value of corresponding position
-      for (int k = 0; k < ddim; ++k)
+      int nnf_row = (tarPos.second - i) * nnf_width;
+      for (int j = j_begin; j < j_end; ++j)
       {
-        float cur_val = gpsrc_d[k][level].at<float>(patch.second + i, patch.first + j);
-        final_val[k] += cur_val;
-        int bin_id = std::max(0, std::min(9, int(cur_val * 10)));
-        bins_cnt[k][bin_id] += 1;
-        bins_acc[k][bin_id] += cur_val;
+        // get the value of corresponding position
+        const Point2D& patch = nnf[nnf_row + tarPos.first - j];
+        float cur_val = src.ptr<float>(patch.second + i)[patch.first + j];
+        final_val += cur_val;
+        if (use_vote_mode)
+        {
+          int bin_id = std::max(0, std::min(9, int(cur_val * 10)));
+          bins_cnt[bin_id] += 1;
+          bins_acc[bin_id] += cur_val;
+        }
       }
-      ++n_pixel;
     }
-  }
 
-  // assume all values are between 0~1
-  //for (size_t i = 0; i < bins_cnt.size(); ++i)
-  //{
-  //  int most = bins_cnt[i][0];
-  //  int most_bin_id = 0;
-  //  for (size_t j = 1; j < bins_cnt[i].size(); ++j)
-  //  {
-  //    if (bins_cnt[i][j] > most)
-  //    {
-  //      most = bins_cnt[i][j];
-  //      most_bin_id = j;
-  //    }
-  //  }
-  //  gptar_d[i][level].at<float>(tarPos.second, tarPos.first) = bins_acc[i][most_bin_id] / bins_cnt[i][most_bin_id];
-  //}
-
-
-  for (int k = 0; k < ddim; ++k)
-  {
-    gptar_d[k][level].at<float>(tarPos.second, tarPos.first) = final_val[k] / n_pixel;
+    if (use_vote_mode)
+    {
+      int most_bin_id = 0;
+      for (int b = 1; b < 10; ++b)
+      {
+        if (bins_cnt[b] > bins_cnt[most_bin_id]) most_bin_id = b;
+      }
+      gptar_d[k][level].ptr<float>(tarPos.second)[tarPos.first] = bins_acc[most_bin_id] / bins_cnt[most_bin_id];
+    }
+    else
+    {
+      gptar_d[k][level].ptr<float>(tarPos.second)[tarPos.first] = final_val / n_pixel;
+    }
   }
 }
 
-void SynthesisTool::updateRefCount(STLVectorf& ref_cnt, Point2D& best_patch, ImagePyramidVec& gpsrc_d, int level)
+void SynthesisTool::updateRefCount(PatchOccupancy& ref_cnt, Point2D& best_patch, ImagePyramidVec& gpsrc_d, int level)
 {
-  // add the reference count to each pixel
-  for (int i = 0; i < this->patch_size; ++i)
-  {
-    for (int j = 0; j < this->patch_size; ++j)
-    {
-      ref_cnt[(best_patch.second + i) * gpsrc_d[0][level].cols + best_patch.first + j] += 1.0;
-    }
-  }
+  // add the reference count to each pixel of the patch
+  ref_cnt.addPatch(best_patch.first, best_patch.second);
 };
 
 
@@ -1903,6 +2518,7 @@ void SynthesisTool::doNNFOptimization(std::vector<cv::Mat>& src_feature, std::ve
 {
   // get image for pyramids
   gpsrc_feature.clear();
+  packed_src.reset();
   gptar_feature.clear();
 
   gpsrc_feature.resize(src_feature.size());
@@ -1925,12 +2541,14 @@ void SynthesisTool::doNNFOptimization(std::vector<cv::Mat>& src_feature, std::ve
 
   // find best match for each level
   double totalTime = 0.0;
-  srand((unsigned)time(NULL));
+  this->resetRandom(rand_seed);
   for(int l = 0; l < levels; l ++)
   {
     std::vector<int> source_patch_mask_l;
     this->buildSourcePatchMask(gpsrc_feature[0].at(l), source_patch_mask_l);
     src_patch_mask.push_back(source_patch_mask_l);
+    src_valid_patch.push_back(std::vector<int>());
+    this->buildValidPatchIndex(src_patch_mask.back(), src_valid_patch.back());
 
     std::vector<int> target_patch_mask_l;
     std::vector<int> target_pixel_mask_l;
@@ -1995,7 +2613,7 @@ void SynthesisTool::doNNFOptimization(std::vector<cv::Mat>& src_feature, std::ve
       this->initializeNNF(gpsrc_feature[0], gptar_feature[0], nnf, l);
       for (int i_iter = 0; i_iter < max_iter; ++i_iter)
       {
-        std::vector<float> ref_cnt(src_width * src_height, 0.0);
+        PatchOccupancy ref_cnt(src_width, src_height, this->patch_size);
         //if (i_iter % 2 == 0)
         {
           double cur_energy = 0;
@@ -2013,7 +2631,7 @@ void SynthesisTool::doNNFOptimization(std::vector<cv::Mat>& src_feature, std::ve
       nnf.swap(nnf_new);
       for (int i_iter = 0; i_iter < max_iter; ++i_iter)
       {
-        std::vector<float> ref_cnt(src_width * src_height, 0.0);
+        PatchOccupancy ref_cnt(src_width, src_height, this->patch_size);
         //if (i_iter % 2 == 0)
         {
           double cur_energy = 0;
@@ -2031,11 +2649,12 @@ void SynthesisTool::doNNFOptimization(std::vector<cv::Mat>& src_feature, std::ve
     std::cout << "Level " << l << " is finished ! " << "Running time is : " << duration << " seconds." << std::endl;
   }
   std::cout << "All levels is finished !" << " The total running time is :" << totalTime << " seconds." << std::endl;
+  DebugExporter::GetInstance()->flush(); // the level exports are on disk when synthesis returns
 
   tar_feature_NNF = nnf;
 }
 
-double SynthesisTool::updateNNF(ImagePyramidVec& gpsrc_f, ImagePyramidVec& gptar_f, NNF& nnf, std::vector<float>& ref_cnt, int level, int iter /* = 0 */)
+double SynthesisTool::updateNNF(ImagePyramidVec& gpsrc_f, ImagePyramidVec& gptar_f, NNF& nnf, PatchOccupancy& ref_cnt, int level, int iter /* = 0 */)
 {
   int height = gptar_f[0][level].rows;
   int width  = gptar_f[0][level].cols;
@@ -2120,7 +2739,7 @@ double SynthesisTool::updateNNF(ImagePyramidVec& gpsrc_f, ImagePyramidVec& gptar
   return energyNNF / n_patches;
 }
 
-double SynthesisTool::bestPatchInSet(ImagePyramidVec& gpsrc_f, ImagePyramidVec& gptar_f, std::vector<float>& ref_cnt, int level, Point2D& tarPatch, std::vector<Point2D>& srcPatches, Point2D& best_patch)
+double SynthesisTool::bestPatchInSet(ImagePyramidVec& gpsrc_f, ImagePyramidVec& gptar_f, PatchOccupancy& ref_cnt, int level, Point2D& tarPatch, std::vector<Point2D>& srcPatches, Point2D& best_patch)
 {
   size_t best_id = 0;
   double min_dist = std::numeric_limits<double>::max();
@@ -2139,7 +2758,7 @@ double SynthesisTool::bestPatchInSet(ImagePyramidVec& gpsrc_f, ImagePyramidVec&
   return min_dist;
 }
 
-double SynthesisTool::distPatch(ImagePyramidVec& gpsrc_f, ImagePyramidVec& gptar_f, std::vector<float>& ref_cnt, int level, Point2D& srcPatch, Point2D& tarPatch)
+double SynthesisTool::distPatch(ImagePyramidVec& gpsrc_f, ImagePyramidVec& gptar_f, PatchOccupancy& ref_cnt, int level, Point2D& srcPatch, Point2D& tarPatch)
 {
   double d = 0.0;
   double d_f = 0.0;
@@ -2163,10 +2782,9 @@ double SynthesisTool::distPatch(ImagePyramidVec& gpsrc_f, ImagePyramidVec& gptar
       {
         d_f += pow(gpsrc_f[k][level].at<float>(srcPatch.second + i, srcPatch.first + j) - gptar_f[k][level].at<float>(tarPatch.second + i, tarPatch.first + j), 2);
       }
-
-      d_occ += ref_cnt[(srcPatch.second + i) * gpsrc_f[0][level].cols + srcPatch.first + j];
     }
   }
+  d_occ = ref_cnt.patchSum(srcPatch.first, srcPatch.second);
 
   d_f /= this->patch_size * this->patch_size * fdim;
   d_occ /= pow(this->patch_size, 4);
@@ -2,22 +2,16 @@
 #define SynthesisTool_H
 
 #include <memory>
+#include <limits>
 #include <cv.h>
 #include "BasicHeader.h"
-
-struct distance_position
-{
-  double d;
-  std::pair<int, int> pos;
-  bool operator < (const distance_position& a) const
-  {
-    return a.d > d;
-  }
-  distance_position(double _d = 0, std::pair<int, int> _pos = std::pair<int, int>(0, 0)) : d(_d), pos(_pos) {};
-};
+#include "PatchOccupancy.h"
+#include "CandidateHeap.h"
+#include "CounterRNG.h"
 
 class MeshParameterization;
 class DetailSynthesis;
+class KDTreeWrapper;
 
 class SynthesisTool
 {
@@ -25,7 +19,7 @@ public:
   typedef std::vector<cv::Mat> ImagePyramid;  
   typedef std::vector<ImagePyramid> ImagePyramidVec;
   typedef std::set<distance_position> FCandidates;
-  typedef std::vector<FCandidates> ImageFCandidates;
+  typedef CandidateArena ImageFCandidates;
   typedef std::pair<int, int> Point2D;
   typedef std::vector<std::set<Point2D> > FBucket;
   typedef std::vector<FBucket> FBucketPryamid;
@@ -36,6 +30,9 @@ public:
   ~SynthesisTool() {};
 
   void init(std::vector<cv::Mat>& src_feature, std::vector<cv::Mat>& tar_feature, std::vector<cv::Mat>& src_detail);
+  void initSource(std::vector<cv::Mat>& src_feature, std::vector<cv::Mat>& src_detail);
+  void initTarget(std::vector<cv::Mat>& tar_feature);
+  bool shareSource(SynthesisTool& other); // use the source pyramids of another tool without copying, false if the levels differ
   void doSynthesis();
   void doSynthesisNew(bool is_doComplete = false);
   void doFilling(std::vector<cv::Mat>& src_feature, std::vector<cv::Mat>& src_detail);
@@ -45,20 +42,23 @@ public:
 
   void doNNFOptimization(std::vector<cv::Mat>& src_feature, std::vector<cv::Mat>& tar_feature);
 
+  // the exports are written by DebugExporter, gated by "DebugOutput:ExportLevel"
   void setExportPath(std::string& path_in) { outputPath = path_in; };
-  void exportFeature(cv::Mat& f_mat, std::string fname);
+  void exportFeature(cv::Mat& f_mat, std::string fname, int export_level);
   void exportSrcFeature(ImagePyramidVec& gpsrc, int level);
   void exportTarFeature(ImagePyramidVec& gptar, int level);
-  void exportRelfectance(cv::Mat& r, cv::Mat& g, cv::Mat& b, std::string fname);
-  void exportDisplacement(cv::Mat& d_mat, std::string fname);
+  void exportRelfectance(cv::Mat& r, cv::Mat& g, cv::Mat& b, std::string fname, int export_level);
+  void exportDisplacement(cv::Mat& d_mat, std::string fname, int export_level);
   void exportSrcDetail(ImagePyramidVec& gpsrc, int level, int iter);
   void exportTarDetail(ImagePyramidVec& gptar, int level, int iter);
   void exportNNF(NNF& nnf, ImagePyramidVec& gpsrc, ImagePyramidVec& gptar, int level, int iter);
-  void exportMask(std::vector<int> mask, int mask_height, int mask_width, std::string fname);
+  void exportMask(std::vector<int>& mask, int mask_height, int mask_width, std::string fname, int export_level);
   void exportSrcMask();
   void exportTarMask();
 
   void findSrcCrsp(Point2D& tar_id, std::vector<Point2D>& src_id);
+  void benchmarkCandidateIndex(int level, int n_query = 1000); // recall and speed of the ANN index against brute force
+  void benchmarkParallelNNF(NNF& nnf, int level); // energy and scaling of updateNNFParallel against updateNNF
 
 private:
   void generatePyramid(ImagePyramid& pyr, int level);
@@ -70,7 +70,7 @@ private:
   void generateFeatureCandidateForLowestLevel(std::vector<std::set<distance_position> >& all_pixel_candidates, std::vector<ImagePyramid>& gpsrc, std::vector<ImagePyramid>& gptar);
   void getFeatureCandidateFromLowestLevel(std::set<distance_position>& candidates, std::vector<std::set<distance_position> >& all_pixel_candidates, int l, int pointX, int pointY);
   void generateFeatureCandidateFromLastLevel(ImageFCandidates& new_image_candidates, ImageFCandidates& last_image_candidates, int l, ImagePyramidVec& gpsrc, ImagePyramidVec gptar);
-  void findCandidatesFromLastLevel(std::vector<ImagePyramid>& gpsrc, std::vector<ImagePyramid>& gptar, int level, int tarpointX, int tarpointY, std::set<distance_position>& candidates);
+  void findCandidatesFromLastLevel(std::vector<ImagePyramid>& gpsrc, std::vector<ImagePyramid>& gptar, int level, int tarpointX, int tarpointY, CandidateHeap& last_candidates, CandidateHeap& candidates);
   void buildAllFeatureButkects(std::vector<ImagePyramid>& gpsrc, std::vector<FBucketPryamid>& gpsrc_buckets); // build feature buckets for all features' pyramid
   void buildPryFeatureBuckets(ImagePyramid& gpsrc, FBucketPryamid&  gpsrc_buckets); // build feature buckets for one feature's pyramid
   void buildImgFeatureBuckets(cv::Mat& img, FBucket& buket);
@@ -78,57 +78,80 @@ private:
   void getElementsFromBuckets(FBucket& bucket, std::set<Point2D>& elements, float val);
   void findCandidatesWithRefCount(std::vector<ImagePyramid>& gpsrc, std::vector<ImagePyramid>& gptar, std::vector<float>& ref_cnt, int level, int pointX, int pointY, std::set<distance_position>& candidates);
   void findCandidatesFromLastLevelWithRefCount(std::vector<ImagePyramid>& gpsrc, std::vector<ImagePyramid>& gptar, std::vector<float>& ref_cnt, int level, int tarpointX, int tarpointY, std::set<distance_position>& candidates);
-  void getLastLevelCandidate(std::vector<ImagePyramid>& gptar, ImageFCandidates& last_image_candidates, int level, int pointX, int pointY, std::set<distance_position>& candidates);
+  void getLastLevelCandidate(std::vector<ImagePyramid>& gptar, ImageFCandidates& last_image_candidates, int level, int pointX, int pointY, CandidateHeap& candidates);
   void findBestMatchWithRefCount(std::vector<ImagePyramid>& gpsrc, std::vector<ImagePyramid>& gptar, std::vector<float>& ref_cnt, int level, int pointX, int pointY, std::set<distance_position>& candidates, std::set<distance_position>& best_match);
-  void getValFromBestMatch(std::vector<ImagePyramid>& gpsrc, std::vector<ImagePyramid>& gptar, std::vector<float>& ref_cnt, int level, int tarpointX, int tarpointY, std::set<distance_position>& best_match);
-  void findCombineCandidates(std::vector<ImagePyramid>& gpsrc_f, std::vector<ImagePyramid>& gptar_f, std::vector<ImagePyramid>& gpsrc_d, std::vector<ImagePyramid>& gptar_d, std::vector<float>& ref_cnt, int level, int tarpointX, int tarpointY, std::set<distance_position>& best_match);
-  void findCombineCandidatesFromLastLevel(std::vector<ImagePyramid>& gpsrc_f, std::vector<ImagePyramid>& gptar_f, std::vector<ImagePyramid>& gpsrc_d, std::vector<ImagePyramid>& gptar_d, std::vector<float>& ref_cnt, int level, int tarpointX, int tarpointY, std::set<distance_position>& best_match);
+  void getValFromBestMatch(std::vector<ImagePyramid>& gpsrc, std::vector<ImagePyramid>& gptar, std::vector<float>& ref_cnt, int level, int tarpointX, int tarpointY, CandidateHeap& best_match);
+  void findCombineCandidates(std::vector<ImagePyramid>& gpsrc_f, std::vector<ImagePyramid>& gptar_f, std::vector<ImagePyramid>& gpsrc_d, std::vector<ImagePyramid>& gptar_d, std::vector<float>& ref_cnt, int level, int tarpointX, int tarpointY, CandidateHeap& best_match);
+  // approximate nearest neighbor index over the source features, used by the candidate search
+  void buildCandidateIndex(ImagePyramidVec& gpsrc, int level);
+  bool hasCandidateIndex(int level);
+  void indexFeature(ImagePyramidVec& gp, int level, int pointX, int pointY, std::vector<float>& feature);
+  void queryCandidateIndex(ImagePyramidVec& gptar, int level, int pointX, int pointY, int n_query, std::vector<Point2D>& result);
+  void findCombineCandidatesFromLastLevel(std::vector<ImagePyramid>& gpsrc_f, std::vector<ImagePyramid>& gptar_f, std::vector<ImagePyramid>& gpsrc_d, std::vector<ImagePyramid>& gptar_d, std::vector<float>& ref_cnt, int level, int tarpointX, int tarpointY, CandidateHeap& last_match, CandidateHeap& best_match);
 
   // patch match based method
-  void getRandomPosition(int l, std::vector<Point2D>& random_set, int n_set, int max_height, int max_width, int min_height = 0, int min_width = 0);
+  void resetRandom(unsigned int seed);
+  void buildValidPatchIndex(std::vector<int>& patch_mask, std::vector<int>& valid_patch);
+  void getRandomPosition(int l, std::vector<Point2D>& random_set, int n_set, int max_height, int max_width);
+  void getRandomPosition(int l, std::vector<Point2D>& random_set, int n_set, int max_height, int max_width, CounterRNG& rng);
+  void getWindowPosition(int l, Point2D& center, std::vector<Point2D>& random_set, int max_height, int max_width, CounterRNG& rng);
   void initializeNNF(ImagePyramid& gpsrc_d, ImagePyramid& gptar_d, NNF& nnf, int level, bool is_doComplete = false);
   void initializeNNFFromLastLevel(ImagePyramid& gpsrc_d, ImagePyramid& gptar_d, NNF& nnf_last, int level, NNF& nnf_new, bool is_doComplete = false);
   void initializeTarDetail(ImagePyramidVec& gptar_d, int level, bool is_doComplete = false);
   void voteImage(ImagePyramidVec& gpsrc_d, ImagePyramidVec& gptar_d, NNF& nnf, int level);
-  void votePixel(ImagePyramidVec& gpsrc_d, ImagePyramidVec& gptar_d, NNF& nnf, int level, Point2D& tarPos);
+  void voteMaskedImage(ImagePyramidVec& gpsrc_d, ImagePyramidVec& gptar_d, NNF& nnf, std::vector<int>& pixel_mask, bool in_mask, int level);
+  void votePixel(ImagePyramidVec& gpsrc_d, ImagePyramidVec& gptar_d, NNF& nnf, int level, const Point2D& tarPos);
   double updateNNF(ImagePyramidVec& gpsrc_f, ImagePyramidVec& gptar_f,
                  ImagePyramidVec& gpsrc_d, ImagePyramidVec& gptar_d,
-                 NNF& nnf, std::vector<float>& ref_cnt, int level, int iter = 0);
+                 NNF& nnf, PatchOccupancy& ref_cnt, int level, int iter = 0);
   void updateNNFReverse(ImagePyramidVec& gpsrc_f, ImagePyramidVec& gptar_f,
     ImagePyramidVec& gpsrc_d, ImagePyramidVec& gptar_d,
-    NNF& nnf, std::vector<float>& ref_cnt, int level);
+    NNF& nnf, PatchOccupancy& ref_cnt, int level);
+  double updateNNFParallel(ImagePyramidVec& gpsrc_f, ImagePyramidVec& gptar_f,
+                           ImagePyramidVec& gpsrc_d, ImagePyramidVec& gptar_d,
+                           NNF& nnf, PatchOccupancy& ref_cnt, int level, int iter = 0);
+  double updateNNFTile(ImagePyramidVec& gpsrc_f, ImagePyramidVec& gptar_f,
+                       ImagePyramidVec& gpsrc_d, ImagePyramidVec& gptar_d,
+                       NNF& nnf, PatchOccupancy& ref_cnt, int level, int iter,
+                       int i_min, int i_max, int j_min, int j_max,
+                       CounterRNG& rng, std::vector<Point2D>& chosen);
   double distPatch(ImagePyramidVec& gpsrc_f, ImagePyramidVec& gptar_f,
                    ImagePyramidVec& gpsrc_d, ImagePyramidVec& gptar_d,
-                   std::vector<float>& ref_cnt, int level, Point2D& srcPatch, Point2D& tarPatch);
+                   PatchOccupancy& ref_cnt, int level, Point2D& srcPatch, Point2D& tarPatch,
+                   double d_max = std::numeric_limits<double>::max()); // stops early once the distance exceeds d_max
+  void packPyramids(); // build the channel interleaved copies used by distPatch
+  void packSource(); // source part of packPyramids, kept until the source changes
+  void packLevel(ImagePyramidVec& gp, int level, std::vector<float>& packed);
   double bestPatchInSet(ImagePyramidVec& gpsrc_f, ImagePyramidVec& gptar_f,
                       ImagePyramidVec& gpsrc_d, ImagePyramidVec& gptar_d,
-                      std::vector<float>& ref_cnt, int level, Point2D& tarPatch, std::vector<Point2D>& srcPatches, Point2D& best_patch);
+                      PatchOccupancy& ref_cnt, int level, Point2D& tarPatch, std::vector<Point2D>& srcPatches, Point2D& best_patch);
 
   void buildMask(cv::Mat& tar_feature, std::vector<int>& pixel_mask, std::vector<int>& patch_mask, int level, bool is_doComplete = false);//0 -> valid; 1 -> invalid
   void initializeFillingNNF(ImagePyramid& gptar_d, NNF& nnf, std::vector<int>& patch_mask, int level);
   void initializeFillingTarDetail(ImagePyramidVec& gptar_d, std::vector<int>& pixel_mask, int level);
   void updateFillingNNF(ImagePyramidVec& gpsrc_f, ImagePyramidVec& gptar_f,
                         ImagePyramidVec& gpsrc_d, ImagePyramidVec& gptar_d,
-                        NNF& nnf, std::vector<float>& ref_cnt, std::vector<int>& patch_mask, int level);
+                        NNF& nnf, PatchOccupancy& ref_cnt, std::vector<int>& patch_mask, int level);
   void updateFillingNNFReverse(ImagePyramidVec& gpsrc_f, ImagePyramidVec& gptar_f,
                                ImagePyramidVec& gpsrc_d, ImagePyramidVec& gptar_d,
-                               NNF& nnf, std::vector<float>& ref_cnt, std::vector<int>& patch_mask, int level);
-  void getRandomPositionWithMask(std::vector<Point2D>& random_set, std::vector<int>& patch_mask,int nnf_width, int nnf_height, int n_set, int max_height, int max_width, int min_height = 0, int min_width = 0);
+                               NNF& nnf, PatchOccupancy& ref_cnt, std::vector<int>& patch_mask, int level);
+  void getRandomPositionWithMask(std::vector<Point2D>& random_set, std::vector<int>& valid_patch, int nnf_width, int nnf_height, int n_set);
   void voteFillingImage(ImagePyramidVec& gpsrc_d, ImagePyramidVec& gptar_d, NNF& nnf, std::vector<int>& pixel_mask, int level);
   void initializeFillingUpTarDetail(ImagePyramidVec& gpsrc_d, ImagePyramidVec& gptar_d, std::vector<int>& pixel_mask, int level);
   bool validPatchWithMask(Point2D& patch_pos, std::vector<int>& patch_mask, int nnf_height, int nnf_width);//0 -> valid; 1 -> invalid
-  void updateRefCount(STLVectorf& ref_cnt, Point2D& best_patch, ImagePyramidVec& gpsrc_d, int level);
+  void updateRefCount(PatchOccupancy& ref_cnt, Point2D& best_patch, ImagePyramidVec& gpsrc_d, int level);
+  double evaluateNNF(NNF& nnf, int level); // mean distPatch with the occupancy of the whole nnf
   void updateNNFWithMask(std::vector<int>& source_patch_mask, ImagePyramidVec& gpsrc_f, ImagePyramidVec& gptar_f,
                  ImagePyramidVec& gpsrc_d, ImagePyramidVec& gptar_d,
-                 NNF& nnf, std::vector<float>& ref_cnt, int level, int iter = 0);
+                 NNF& nnf, PatchOccupancy& ref_cnt, int level, int iter = 0);
   void buildSourcePatchMask(cv::Mat& src_detail, std::vector<int>& source_patch_mask);
   void buildTargetMask(cv::Mat& tar_detail, std::vector<int>& target_pixel_mask, std::vector<int>& target_patch_mask);
 
-  double updateNNF(ImagePyramidVec& gpsrc_f, ImagePyramidVec& gptar_f, NNF& nnf, std::vector<float>& ref_cnt, int level, int iter = 0);
+  double updateNNF(ImagePyramidVec& gpsrc_f, ImagePyramidVec& gptar_f, NNF& nnf, PatchOccupancy& ref_cnt, int level, int iter = 0);
   double distPatch(ImagePyramidVec& gpsrc_f, ImagePyramidVec& gptar_f,
-    std::vector<float>& ref_cnt, int level, Point2D& srcPatch, Point2D& tarPatch);
+    PatchOccupancy& ref_cnt, int level, Point2D& srcPatch, Point2D& tarPatch);
   double bestPatchInSet(ImagePyramidVec& gpsrc_f, ImagePyramidVec& gptar_f,
-    std::vector<float>& ref_cnt, int level, Point2D& tarPatch, std::vector<Point2D>& srcPatches, Point2D& best_patch);
+    PatchOccupancy& ref_cnt, int level, Point2D& tarPatch, std::vector<Point2D>& srcPatches, Point2D& best_patch);
 
 private:
   friend class DetailSynthesis;
@@ -148,11 +171,36 @@ private:
   float beta_func_mult;
   std::vector<cv::Size> NeighborRange;
 
+  bool use_parallel_nnf; // checkerboard tiled update instead of a single raster scan
+  bool benchmark_parallel_nnf; // run benchmarkParallelNNF on each level of doSynthesisNew
+  bool use_vote_mode; // vote the mean of the fullest of 10 value bins instead of the mean of all
+  int nnf_tile_size;
+  bool use_window_search; // also sample in windows halving around the current match, as in PatchMatch
+  unsigned int rand_seed; // base seed of all the random streams, "Synthesis:rand_seed"
+  int nnf_pass; // counts nnf update passes, to give each pass its own random streams
+  CounterRNG serial_rng; // stream of the single threaded passes
+  // pass ids of the streams outside the nnf passes, streams are keyed by (rand_seed, level, pass, row or tile)
+  static const unsigned int INIT_STREAM = 0xFFFFFFFFu;
+  static const unsigned int BENCHMARK_STREAM = 0xFFFFFFFEu;
+
   std::vector<ImagePyramid> gpsrc_feature;
   std::vector<ImagePyramid> gptar_feature;
   std::vector<ImagePyramid> gpsrc_detail;
   std::vector<ImagePyramid> gptar_detail;
 
+  // channel interleaved copies of the pyramids, [level][(y * width + x) * dim + k]
+  // so one patch row of all channels is a contiguous run of patch_size * dim floats
+  // the source copies are read only and shared with the tools of shareSource
+  struct PackedSource
+  {
+    std::vector<std::vector<float> > feature;
+    std::vector<std::vector<float> > detail;
+  };
+  std::shared_ptr<PackedSource> packed_src;
+  std::vector<std::vector<float> > packed_tar_feature;
+  std::vector<std::vector<float> > packed_tar_detail;
+  std::vector<float> packed_detail_weight; // channel weight of the detail distance for one patch row
+
   std::vector<cv::Mat> src_detail_gradient;
   std::vector<cv::Mat> tar_detail_gradient;
 
@@ -160,8 +208,16 @@ private:
 
   std::vector<FBucketPryamid> gpsrc_feature_buckets;
 
+  bool use_candidate_index; // query the ANN index instead of scanning every source pixel
+  int ann_oversample; // recall knob, query ann_oversample * candidate_size neighbors before re-ranking
+  int ann_dim; // PCA dimension of the indexed features, <= 0 keeps all dimensions
+  std::vector<std::shared_ptr<KDTreeWrapper> > src_feature_index;
+  std::vector<MatrixXf> src_feature_basis; // PCA basis of each level, one column per kept dimension
+  std::vector<VectorXf> src_feature_mean;
+
   std::string outputPath;
   std::vector<std::vector<int> > src_patch_mask;
+  std::vector<std::vector<int> > src_valid_patch; // offsets of the patches src_patch_mask leaves valid, per level
   std::vector<std::vector<int> > tar_patch_mask;
   std::vector<std::vector<int> > tar_pixel_mask;
 
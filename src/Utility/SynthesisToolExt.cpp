@@ -1,5 +1,6 @@
 #include "SynthesisTool.h"
 #include "MeshParameterization.h"
+#include "DebugExporter.h"
 
 #include <vector>
 #include <cv.h>
@@ -13,6 +14,7 @@ void SynthesisTool::doFilling(std::vector<cv::Mat>& src_feature, std::vector<cv:
   gptar_feature.clear();
   gpsrc_detail.clear();
   gptar_detail.clear();
+  packed_src.reset();
 
   gpsrc_feature.resize(src_feature.size());
   gptar_feature.resize(src_feature.size());
@@ -40,13 +42,14 @@ void SynthesisTool::doFilling(std::vector<cv::Mat>& src_feature, std::vector<cv:
     this->generatePyramid(gptar_detail[i], levels);
   }
 
+  this->packPyramids();
   std::cout << "FillingTool Init success !" << std::endl;
 
   // 
 
   // find best match for each level
   double totalTime = 0.0;
-  srand((unsigned)time(NULL));
+  this->resetRandom(rand_seed);
 
   std::vector<Point2D> nnf; // Point2D stores the nearest patch offset according to current pos
   for (int l = levels - 1; l >= 0; --l)                      
@@ -67,7 +70,7 @@ void SynthesisTool::doFilling(std::vector<cv::Mat>& src_feature, std::vector<cv:
       this->initializeFillingTarDetail(gptar_detail, pixel_mask, l);
       for (int i_iter = 0; i_iter < 5; ++i_iter)
       {
-        std::vector<float> ref_cnt(width * height, 0.0);
+        PatchOccupancy ref_cnt(width, height, this->patch_size); // source and target have the same size when filling
         if (i_iter % 2 == 0)
         {
           this->updateFillingNNF(gpsrc_feature, gptar_feature, gpsrc_detail, gptar_detail, nnf, ref_cnt, patch_mask, l);
@@ -90,7 +93,7 @@ void SynthesisTool::doFilling(std::vector<cv::Mat>& src_feature, std::vector<cv:
       nnf.swap(nnf_new);
       for (int i_iter = 0; i_iter < 5; ++i_iter)
       {
-        std::vector<float> ref_cnt(width * height, 0.0);
+        PatchOccupancy ref_cnt(width, height, this->patch_size); // source and target have the same size when filling
         if (i_iter % 2 == 0)
         {
           this->updateFillingNNF(gpsrc_feature, gptar_feature, gpsrc_detail, gptar_detail, nnf, ref_cnt, patch_mask, l);
@@ -109,6 +112,7 @@ void SynthesisTool::doFilling(std::vector<cv::Mat>& src_feature, std::vector<cv:
     std::cout << "Level " << l << " is finished ! " << "Running time is : " << duration << " seconds." << std::endl;
   }
   std::cout << "All levels is finished !" << " The total running time is :" << totalTime << " seconds." << std::endl;
+  DebugExporter::GetInstance()->flush(); // the level exports are on disk when synthesis returns
 }
 
 void SynthesisTool::buildMask(cv::Mat& tar_feature, std::vector<int>& pixel_mask, std::vector<int>& patch_mask, int level, bool is_doComplete)
@@ -225,28 +229,22 @@ void SynthesisTool::buildTargetMask(cv::Mat& tar_detail, std::vector<int>& targe
 
 }
 
-void SynthesisTool::getRandomPositionWithMask(std::vector<Point2D>& random_set, std::vector<int>& patch_mask, int nnf_width, int nnf_height,
-  int n_set, int max_height, int max_width, int min_height /* = 0 */, int min_width /* = 0 */)
+void SynthesisTool::getRandomPositionWithMask(std::vector<Point2D>& random_set, std::vector<int>& valid_patch, int nnf_width, int nnf_height, int n_set)
 {
+  // uniform over valid_patch, the offsets buildValidPatchIndex() kept from the patch mask
   random_set.clear();
   random_set.resize(n_set);
 
+  int n_valid = (int)valid_patch.size();
   for (int i = 0; i < n_set; ++i)
   {
-    int x;
-    int y;
-    do 
+    if (n_valid == 0)
     {
-      x = (rand() / double(RAND_MAX)) * (max_width - min_width) + min_width;
-      y = (rand() / double(RAND_MAX)) * (max_height - min_height) + min_height;
-
-      // clamp if the random value is 1
-      x = (x >= max_width) ? (max_width - 1) : x;
-      y = (y >= max_height) ? (max_height - 1) : y;
-
-    } while (patch_mask[y * nnf_width + x] != 0);
-
-    random_set[i] = Point2D(x, y);
+      random_set[i] = Point2D(serial_rng.uniformInt(nnf_width), serial_rng.uniformInt(nnf_height));
+      continue;
+    }
+    int offset = valid_patch[serial_rng.uniformInt(n_valid)];
+    random_set[i] = Point2D(offset % nnf_width, offset / nnf_width);
   }
 }
 
@@ -260,7 +258,9 @@ void SynthesisTool::initializeFillingNNF(ImagePyramid& gptar_d, NNF& nnf, std::v
   nnf.clear();
 
   // initialize the nnf with random position
-  this->getRandomPositionWithMask(nnf, patch_mask, nnf_width, nnf_height, nnf_height * nnf_width, nnf_height, nnf_width);
+  std::vector<int> valid_patch;
+  this->buildValidPatchIndex(patch_mask, valid_patch);
+  this->getRandomPositionWithMask(nnf, valid_patch, nnf_width, nnf_height, nnf_height * nnf_width);
 
   // patch mask has the same size with nnf
   for (int i = 0; i < nnf_height; ++i)
@@ -287,13 +287,14 @@ void SynthesisTool::initializeFillingTarDetail(ImagePyramidVec& gptar_d, std::ve
 
   for (int i = 0; i < height; ++i)
   {
+    CounterRNG rng(rand_seed, unsigned(level), INIT_STREAM, unsigned(i));
     for (int j = 0; j < width; ++j)
     {
       if (pixel_mask[i * width + j] == 1)
       {
         for (int k = 0; k < ddim; ++k)
         {
-          gptar_d[k][level].at<float>(i, j) = (rand() / double(RAND_MAX));
+          gptar_d[k][level].at<float>(i, j) = float(rng.uniform());
         }
       }
     }
@@ -302,20 +303,23 @@ void SynthesisTool::initializeFillingTarDetail(ImagePyramidVec& gptar_d, std::ve
 
 void SynthesisTool::updateFillingNNF(ImagePyramidVec& gpsrc_f, ImagePyramidVec& gptar_f,
   ImagePyramidVec& gpsrc_d, ImagePyramidVec& gptar_d,
-  NNF& nnf, std::vector<float>& ref_cnt, std::vector<int>& patch_mask, int level)
+  NNF& nnf, PatchOccupancy& ref_cnt, std::vector<int>& patch_mask, int level)
 {
   // update nnf based on current nnf, random position and position nearby
+  this->packLevel(gptar_d, level, packed_tar_detail[level]);
   int height = gptar_d[0][level].rows;
   int width  = gptar_d[0][level].cols;
   int nnf_height = (height - this->patch_size + 1);
   int nnf_width  = (width - this->patch_size + 1);
+  std::vector<int> valid_patch;
+  this->buildValidPatchIndex(patch_mask, valid_patch);
 
   // deal with the left upper corner
   int offset = 0 * nnf_width + 0;
   if (patch_mask[offset] == 1)
   {
     std::vector<Point2D> rand_pos;
-    this->getRandomPositionWithMask(rand_pos, patch_mask, nnf_width, nnf_height, best_random_size, nnf_height, nnf_width);
+    this->getRandomPositionWithMask(rand_pos, valid_patch, nnf_width, nnf_height, best_random_size);
     rand_pos.push_back(nnf[offset]);
     Point2D best_patch;
     this->bestPatchInSet(gpsrc_f, gptar_f, gpsrc_d, gptar_d, ref_cnt, level, Point2D(0, 0), rand_pos, best_patch);
@@ -330,7 +334,7 @@ void SynthesisTool::updateFillingNNF(ImagePyramidVec& gpsrc_f, ImagePyramidVec&
     {
       // random search
       std::vector<Point2D> rand_pos;
-      this->getRandomPositionWithMask(rand_pos, patch_mask, nnf_width, nnf_height, best_random_size, nnf_height, nnf_width);
+      this->getRandomPositionWithMask(rand_pos, valid_patch, nnf_width, nnf_height, best_random_size);
       // propagation
       Point2D left_nnf = nnf[j - 1];
       left_nnf.first = (left_nnf.first + 1) >= nnf_width ? (nnf_width - 1) : (left_nnf.first + 1);
@@ -350,7 +354,7 @@ void SynthesisTool::updateFillingNNF(ImagePyramidVec& gpsrc_f, ImagePyramidVec&
     if (patch_mask[offset] == 1)
     {
       std::vector<Point2D> rand_pos;
-      this->getRandomPositionWithMask(rand_pos, patch_mask, nnf_width, nnf_height, best_random_size, nnf_height, nnf_width);
+      this->getRandomPositionWithMask(rand_pos, valid_patch, nnf_width, nnf_height, best_random_size);
       Point2D up_nnf = nnf[(i - 1) * nnf_width];
       up_nnf.second = (up_nnf.second + 1) >= nnf_height ? (nnf_height - 1) : (up_nnf.second + 1);
       if (this->validPatchWithMask(up_nnf, patch_mask, nnf_height, nnf_width)) rand_pos.push_back(up_nnf);
@@ -370,7 +374,7 @@ void SynthesisTool::updateFillingNNF(ImagePyramidVec& gpsrc_f, ImagePyramidVec&
       if (patch_mask[offset] == 1)
       {
         std::vector<Point2D> rand_pos;
-        this->getRandomPositionWithMask(rand_pos, patch_mask, nnf_width, nnf_height, best_random_size, nnf_height, nnf_width);
+        this->getRandomPositionWithMask(rand_pos, valid_patch, nnf_width, nnf_height, best_random_size);
         Point2D left_nnf = nnf[i * nnf_width + j - 1];
         left_nnf.first = (left_nnf.first + 1) >= nnf_width ? (nnf_width - 1) : (left_nnf.first + 1);
         Point2D up_nnf = nnf[(i - 1) * nnf_width + j];
@@ -388,20 +392,23 @@ void SynthesisTool::updateFillingNNF(ImagePyramidVec& gpsrc_f, ImagePyramidVec&
 
 void SynthesisTool::updateFillingNNFReverse(ImagePyramidVec& gpsrc_f, ImagePyramidVec& gptar_f,
   ImagePyramidVec& gpsrc_d, ImagePyramidVec& gptar_d,
-  NNF& nnf, std::vector<float>& ref_cnt, std::vector<int>& patch_mask, int level)
+  NNF& nnf, PatchOccupancy& ref_cnt, std::vector<int>& patch_mask, int level)
 {
   // update nnf based on current nnf, random position and position nearby
+  this->packLevel(gptar_d, level, packed_tar_detail[level]);
   int height = gptar_d[0][level].rows;
   int width  = gptar_d[0][level].cols;
   int nnf_height = (height - this->patch_size + 1);
   int nnf_width  = (width - this->patch_size + 1);
+  std::vector<int> valid_patch;
+  this->buildValidPatchIndex(patch_mask, valid_patch);
 
   // deal with the right bottom corner
   int offset = (nnf_height - 1) * nnf_width + (nnf_width - 1);
   if (patch_mask[offset] == 1)
   {
     std::vector<Point2D> rand_pos;
-    this->getRandomPositionWithMask(rand_pos, patch_mask, nnf_width, nnf_height, best_random_size, nnf_height, nnf_width); // TODO: random sample in a more local region
+    this->getRandomPositionWithMask(rand_pos, valid_patch, nnf_width, nnf_height, best_random_size); // TODO: random sample in a more local region
     rand_pos.push_back(nnf[offset]);
     Point2D best_patch;
     this->bestPatchInSet(gpsrc_f, gptar_f, gpsrc_d, gptar_d, ref_cnt, level, Point2D(nnf_width - 1, nnf_height - 1), rand_pos, best_patch);
@@ -415,7 +422,7 @@ void SynthesisTool::updateFillingNNFReverse(ImagePyramidVec& gpsrc_f, ImagePyram
     if (patch_mask[offset] == 1)
     {
       std::vector<Point2D> rand_pos;
-      this->getRandomPositionWithMask(rand_pos, patch_mask, nnf_width, nnf_height, best_random_size, nnf_height, nnf_width);
+      this->getRandomPositionWithMask(rand_pos, valid_patch, nnf_width, nnf_height, best_random_size);
       Point2D right_nnf = nnf[(nnf_height - 1) * nnf_width + j + 1];
       right_nnf.first = (right_nnf.first - 1) < 0 ? 0 : (right_nnf.first - 1);
       if (this->validPatchWithMask(right_nnf, patch_mask, nnf_height, nnf_width)) rand_pos.push_back(right_nnf);
@@ -433,7 +440,7 @@ void SynthesisTool::updateFillingNNFReverse(ImagePyramidVec& gpsrc_f, ImagePyram
     if (patch_mask[offset] == 1)
     {
       std::vector<Point2D> rand_pos;
-      this->getRandomPositionWithMask(rand_pos, patch_mask, nnf_width, nnf_height, best_random_size, nnf_height, nnf_width);
+      this->getRandomPositionWithMask(rand_pos, valid_patch, nnf_width, nnf_height, best_random_size);
       Point2D down_nnf = nnf[(i + 1) * nnf_width + nnf_width - 1];
       down_nnf.second = (down_nnf.second - 1) < 0 ? 0 : (down_nnf.second - 1);
       if (this->validPatchWithMask(down_nnf, patch_mask, nnf_height, nnf_width)) rand_pos.push_back(down_nnf);
@@ -453,7 +460,7 @@ void SynthesisTool::updateFillingNNFReverse(ImagePyramidVec& gpsrc_f, ImagePyram
       if (patch_mask[offset] == 1)
       {
         std::vector<Point2D> rand_pos;
-        this->getRandomPositionWithMask(rand_pos, patch_mask, nnf_width, nnf_height, best_random_size, nnf_height, nnf_width);
+        this->getRandomPositionWithMask(rand_pos, valid_patch, nnf_width, nnf_height, best_random_size);
         Point2D right_nnf = nnf[i * nnf_width + j + 1];
         right_nnf.first = (right_nnf.first - 1) < 0 ? 0 : (right_nnf.first - 1);
         Point2D down_nnf = nnf[(i + 1) * nnf_width + j];
@@ -471,20 +478,8 @@ void SynthesisTool::updateFillingNNFReverse(ImagePyramidVec& gpsrc_f, ImagePyram
 
 void SynthesisTool::voteFillingImage(ImagePyramidVec& gpsrc_d, ImagePyramidVec& gptar_d, NNF& nnf, std::vector<int>& pixel_mask, int level)
 {
-  // compute the value of each pixel
-  int height = gptar_d[0][level].rows;
-  int width  = gptar_d[0][level].cols;
-
-  for (int i = 0; i < height; ++i)
-  {
-    for (int j = 0; j < width; ++j)
-    {
-      if (pixel_mask[i * width + j] == 1)
-      {
-        this->votePixel(gpsrc_d, gptar_d, nnf, level, Point2D(j, i));
-      }
-    }
-  }
+  // vote the pixels to fill, the ones in the mask
+  this->voteMaskedImage(gpsrc_d, gptar_d, nnf, pixel_mask, true, level);
 }
 
 void SynthesisTool::initializeFillingUpTarDetail(ImagePyramidVec& gpsrc_d, ImagePyramidVec& gptar_d, std::vector<int>& pixel_mask, int level)
@@ -525,6 +520,7 @@ void SynthesisTool::doSynthesisWithMask(std::vector<cv::Mat>& src_feature, std::
   gptar_feature.clear();
   gpsrc_detail.clear();
   gptar_detail.clear();
+  packed_src.reset();
 
   gpsrc_feature.resize(src_feature.size());
   gptar_feature.resize(tar_feature.size());
@@ -564,11 +560,12 @@ void SynthesisTool::doSynthesisWithMask(std::vector<cv::Mat>& src_feature, std::
     this->buildMask(gptar_detail[0][i], pixel_masks[i], patch_masks[i], i);
   }
 
+  this->packPyramids();
   std::cout << "MaskSynthesisTool Init success !" << std::endl;
 
   // find best match for each level
   double totalTime = 0.0;
-  srand((unsigned)time(NULL));
+  this->resetRandom(rand_seed);
 
   std::vector<Point2D> nnf; // Point2D stores the nearest patch offset according to current pos
   for (int l = levels - 1; l >= 0; --l)                      
@@ -590,7 +587,7 @@ void SynthesisTool::doSynthesisWithMask(std::vector<cv::Mat>& src_feature, std::
       this->initializeFillingTarDetail(gptar_detail, pixel_masks[l], l);
       for (int i_iter = 0; i_iter < 5; ++i_iter)
       {
-        std::vector<float> ref_cnt(width * height, 0.0);
+        PatchOccupancy ref_cnt(gpsrc_detail[0][l].cols, gpsrc_detail[0][l].rows, this->patch_size);
         if (i_iter % 2 == 0)
         {
           this->updateNNF(gpsrc_feature, gptar_feature, gpsrc_detail, gptar_detail, nnf, ref_cnt, l);
@@ -612,7 +609,7 @@ void SynthesisTool::doSynthesisWithMask(std::vector<cv::Mat>& src_feature, std::
       nnf.swap(nnf_new);
       for (int i_iter = 0; i_iter < 5; ++i_iter)
       {
-        std::vector<float> ref_cnt(width * height, 0.0);
+        PatchOccupancy ref_cnt(gpsrc_detail[0][l].cols, gpsrc_detail[0][l].rows, this->patch_size);
         if (i_iter % 2 == 0)
         {
           this->updateNNF(gpsrc_feature, gptar_feature, gpsrc_detail, gptar_detail, nnf, ref_cnt, l);
@@ -633,70 +630,68 @@ void SynthesisTool::doSynthesisWithMask(std::vector<cv::Mat>& src_feature, std::
     std::cout << "Level " << l << " is finished ! " << "Running time is : " << duration << " seconds." << std::endl;
   }
   std::cout << "All levels is finished !" << " The total running time is :" << totalTime << " seconds." << std::endl;
+  DebugExporter::GetInstance()->flush(); // the level exports are on disk when synthesis returns
 }
   
-void SynthesisTool::exportFeature(cv::Mat& f_mat, std::string fname)
+void SynthesisTool::exportFeature(cv::Mat& f_mat, std::string fname, int export_level)
 {
-  cv::Mat output = f_mat.clone();
-  double min,max;
-  cv::minMaxLoc(output,&min,&max);
-  if (max > 1.0) output = output / max;
-  cv::imwrite(outputPath + "/" + fname, output * 255);
+  DebugExporter::GetInstance()->writeNormalized(export_level, outputPath + "/" + fname, f_mat);
 }
 
 void SynthesisTool::exportSrcFeature(ImagePyramidVec& gpsrc, int level)
 {
+  if (!DebugExporter::GetInstance()->isEnabled(DebugExporter::EXPORT_STAGE)) return;
+
   int fdim = (int)gpsrc.size();
   for (int i = 0; i < fdim; ++i)
   {
-    this->exportFeature(gpsrc[i][level], "src_feature_" + std::to_string(i) + "_level_" + std::to_string(level) + ".png");
+    this->exportFeature(gpsrc[i][level], "src_feature_" + std::to_string(i) + "_level_" + std::to_string(level) + ".png", DebugExporter::EXPORT_STAGE);
   }
 }
 
 void SynthesisTool::exportTarFeature(ImagePyramidVec& gptar, int level)
 {
+  if (!DebugExporter::GetInstance()->isEnabled(DebugExporter::EXPORT_STAGE)) return;
+
   int fdim = (int)gptar.size();
   for (int i = 0; i < fdim; ++i)
   {
-    this->exportFeature(gptar[i][level], "tar_feature_" + std::to_string(i) + "_level_" + std::to_string(level) + ".png");
+    this->exportFeature(gptar[i][level], "tar_feature_" + std::to_string(i) + "_level_" + std::to_string(level) + ".png", DebugExporter::EXPORT_STAGE);
   }
 }
 
-void SynthesisTool::exportRelfectance(cv::Mat& r, cv::Mat& g, cv::Mat& b, std::string fname)
+void SynthesisTool::exportRelfectance(cv::Mat& r, cv::Mat& g, cv::Mat& b, std::string fname, int export_level)
 {
-  cv::Mat output;
-  std::vector<cv::Mat> output_detail;
-  output_detail.push_back(b);
-  output_detail.push_back(g);
-  output_detail.push_back(r);
-  cv::merge(&output_detail[0], 3, output);
-  double min,max;
-  cv::minMaxLoc(output,&min,&max);
-  if (max > 1.0) output = output / max;
-  cv::imwrite(outputPath + "/" + fname, output * 255);
+  DebugExporter::GetInstance()->writeNormalized(export_level, outputPath + "/" + fname, r, g, b);
 }
 
-void SynthesisTool::exportDisplacement(cv::Mat& d_mat, std::string fname)
+void SynthesisTool::exportDisplacement(cv::Mat& d_mat, std::string fname, int export_level)
 {
-  this->exportFeature(d_mat, fname);
+  this->exportFeature(d_mat, fname, export_level);
 }
 
 void SynthesisTool::exportSrcDetail(ImagePyramidVec& gpsrc, int level, int iter)
 {
-  this->exportRelfectance(gpsrc[0][level], gpsrc[1][level], gpsrc[2][level], "src_reflectance_level_" + std::to_string(level) + "_iter_" + std::to_string(iter) + ".png");
+  if (!DebugExporter::GetInstance()->isEnabled(DebugExporter::EXPORT_STAGE)) return;
 
-  if (gpsrc.size() == 4) this->exportDisplacement(gpsrc[3][level], "src_displacement_level_" + std::to_string(level) + "_iter_" + std::to_string(iter) + ".png");
+  this->exportRelfectance(gpsrc[0][level], gpsrc[1][level], gpsrc[2][level], "src_reflectance_level_" + std::to_string(level) + "_iter_" + std::to_string(iter) + ".png", DebugExporter::EXPORT_STAGE);
+
+  if (gpsrc.size() == 4) this->exportDisplacement(gpsrc[3][level], "src_displacement_level_" + std::to_string(level) + "_iter_" + std::to_string(iter) + ".png", DebugExporter::EXPORT_STAGE);
 }
 
 void SynthesisTool::exportTarDetail(ImagePyramidVec& gptar, int level, int iter)
 {
-  this->exportRelfectance(gptar[0][level], gptar[1][level], gptar[2][level], "tar_reflectance_level_" + std::to_string(level) + "_iter_" + std::to_string(iter) + ".png");
+  if (!DebugExporter::GetInstance()->isEnabled(DebugExporter::EXPORT_ITERATION)) return;
+
+  this->exportRelfectance(gptar[0][level], gptar[1][level], gptar[2][level], "tar_reflectance_level_" + std::to_string(level) + "_iter_" + std::to_string(iter) + ".png", DebugExporter::EXPORT_ITERATION);
 
-  if (gptar.size() == 4) this->exportDisplacement(gptar[3][level], "tar_displacement_level_" + std::to_string(level) + "_iter_" + std::to_string(iter) + ".png");
+  if (gptar.size() == 4) this->exportDisplacement(gptar[3][level], "tar_displacement_level_" + std::to_string(level) + "_iter_" + std::to_string(iter) + ".png", DebugExporter::EXPORT_ITERATION);
 }
 
 void SynthesisTool::exportNNF(NNF& nnf, ImagePyramidVec& gpsrc, ImagePyramidVec& gptar, int level, int iter)
 {
+  if (!DebugExporter::GetInstance()->isEnabled(DebugExporter::EXPORT_ITERATION)) return;
+
   int height = gptar[0][level].rows;
   int width  = gptar[0][level].cols;
   int nnf_height = (height - this->patch_size + 1);
@@ -715,11 +710,13 @@ void SynthesisTool::exportNNF(NNF& nnf, ImagePyramidVec& gpsrc, ImagePyramidVec&
     }
   }
 
-  cv::imwrite(outputPath + "/nnf_level_" + std::to_string(level) + "_iter_" + std::to_string(iter) + ".png", nnf_img * 255);
+  DebugExporter::GetInstance()->writeScaled(DebugExporter::EXPORT_ITERATION, outputPath + "/nnf_level_" + std::to_string(level) + "_iter_" + std::to_string(iter) + ".png", nnf_img, 255);
 }
 
-void SynthesisTool::exportMask(std::vector<int> mask, int mask_height, int mask_width, std::string fname)
+void SynthesisTool::exportMask(std::vector<int>& mask, int mask_height, int mask_width, std::string fname, int export_level)
 {
+  if (!DebugExporter::GetInstance()->isEnabled(export_level)) return;
+
   cv::Mat mask_img(mask_height, mask_width, CV_32FC1);
   for(int i = 0; i < mask_height; ++i)
   {
@@ -728,11 +725,13 @@ void SynthesisTool::exportMask(std::vector<int> mask, int mask_height, int mask_
       mask_img.at<float>(i, j) = mask[i * mask_width + j];
     }
   }
-  cv::imwrite(outputPath + "/" + fname , 255*mask_img);
+  DebugExporter::GetInstance()->writeScaled(export_level, outputPath + "/" + fname, mask_img, 255);
 }
 
 void SynthesisTool::exportSrcMask()
 {
+  if (!DebugExporter::GetInstance()->isEnabled(DebugExporter::EXPORT_STAGE)) return;
+
   // only patch mask
   for (size_t i = 0; i < gpsrc_feature[0].size(); ++i)
   {
@@ -740,19 +739,21 @@ void SynthesisTool::exportSrcMask()
     int width  = gpsrc_feature[0][i].cols;
     int nnf_height = (height - this->patch_size + 1);
     int nnf_width  = (width - this->patch_size + 1);  
-    this->exportMask(src_patch_mask[i], nnf_height, nnf_width, "src_patch_mask_level_" + std::to_string(i) + ".png");
+    this->exportMask(src_patch_mask[i], nnf_height, nnf_width, "src_patch_mask_level_" + std::to_string(i) + ".png", DebugExporter::EXPORT_STAGE);
   }
 }
 
 void SynthesisTool::exportTarMask()
 {
+  if (!DebugExporter::GetInstance()->isEnabled(DebugExporter::EXPORT_STAGE)) return;
+
   for (size_t i = 0; i < gptar_feature[0].size(); ++i)
   {
     int height = gptar_feature[0][i].rows;
     int width  = gptar_feature[0][i].cols;
     int nnf_height = (height - this->patch_size + 1);
     int nnf_width  = (width - this->patch_size + 1);  
-    this->exportMask(tar_patch_mask[i], nnf_height, nnf_width, "tar_patch_mask_level_" + std::to_string(i) + ".png");
-    this->exportMask(tar_pixel_mask[i], height, width, "tar_pixel_mask_level_" + std::to_string(i) + ".png");
+    this->exportMask(tar_patch_mask[i], nnf_height, nnf_width, "tar_patch_mask_level_" + std::to_string(i) + ".png", DebugExporter::EXPORT_STAGE);
+    this->exportMask(tar_pixel_mask[i], height, width, "tar_pixel_mask_level_" + std::to_string(i) + ".png", DebugExporter::EXPORT_STAGE);
   }
 }
\ No newline at end of file
@@ -0,0 +1,144 @@
+#include "UVGBuffer.h"
+
+#include <cmath>
+#include <algorithm>
+
+namespace
+{
+  const int BAND_HEIGHT = 32;
+  // same tolerance the face walk used, texels on the shared edges are never lost
+  const float BARY_TOLERANCE = 1e-4f;
+}
+
+UVGBuffer::UVGBuffer()
+{
+  resolution = 0;
+}
+
+void UVGBuffer::clear()
+{
+  resolution = 0;
+  face_id.clear();
+  bary_coord.clear();
+  face_list.clear();
+}
+
+void UVGBuffer::build(const STLVectorf& uv_list, const FaceList& face_list_, int resolution_)
+{
+  resolution = resolution_;
+  face_list = face_list_;
+  face_id.assign(resolution * resolution, -1);
+  bary_coord.assign(3 * resolution * resolution, 0.0f);
+  if (resolution <= 0) return;
+
+  // bin the faces into the bands of rows they cover
+  int n_band = (resolution + BAND_HEIGHT - 1) / BAND_HEIGHT;
+  std::vector<std::vector<int> > band_faces(n_band);
+  int n_face = (int)(face_list.size() / 3);
+  for (int f = 0; f < n_face; ++f)
+  {
+    float v_min = uv_list[2 * face_list[3 * f + 0] + 1];
+    float v_max = v_min;
+    for (int k = 1; k < 3; ++k)
+    {
+      float v = uv_list[2 * face_list[3 * f + k] + 1];
+      v_min = std::min(v_min, v);
+      v_max = std::max(v_max, v);
+    }
+    // one more texel on both sides for the tolerance
+    int y_begin = std::max(0, (int)std::floor(v_min * resolution) - 1);
+    int y_end = std::min(resolution - 1, (int)std::ceil(v_max * resolution) + 1);
+    for (int band = y_begin / BAND_HEIGHT; y_begin <= y_end && band <= y_end / BAND_HEIGHT; ++band)
+    {
+      band_faces[band].push_back(f);
+    }
+  }
+
+#pragma omp parallel for schedule(dynamic, 1)
+  for (int band = 0; band < n_band; ++band)
+  {
+    int y_begin = band * BAND_HEIGHT;
+    int y_end = std::min(resolution, y_begin + BAND_HEIGHT);
+    this->rasterizeBand(uv_list, band_faces[band], y_begin, y_end);
+  }
+}
+
+void UVGBuffer::rasterizeBand(const STLVectorf& uv_list, const std::vector<int>& band_faces, int y_begin, int y_end)
+{
+  // a texel covered by several faces (within the tolerance) goes to the face it is most inside of
+  std::vector<float> best_score(size_t(y_end - y_begin) * resolution, -BARY_TOLERANCE);
+
+  for (size_t i = 0; i < band_faces.size(); ++i)
+  {
+    int f = band_faces[i];
+    float x0 = uv_list[2 * face_list[3 * f + 0] + 0], y0 = uv_list[2 * face_list[3 * f + 0] + 1];
+    float x1 = uv_list[2 * face_list[3 * f + 1] + 0], y1 = uv_list[2 * face_list[3 * f + 1] + 1];
+    float x2 = uv_list[2 * face_list[3 * f + 2] + 0], y2 = uv_list[2 * face_list[3 * f + 2] + 1];
+
+    float denom = (y1 - y2) * (x0 - x2) + (x2 - x1) * (y0 - y2);
+    if (std::fabs(denom) < 1e-12f) continue;
+
+    // l0 = a0 * u + b0 * v + c0, l1 likewise, l2 = 1 - l0 - l1
+    float a0 = (y1 - y2) / denom, b0 = (x2 - x1) / denom;
+    float a1 = (y2 - y0) / denom, b1 = (x0 - x2) / denom;
+    float c0 = -(a0 * x2 + b0 * y2);
+    float c1 = -(a1 * x2 + b1 * y2);
+
+    float u_min = std::min(x0, std::min(x1, x2));
+    float u_max = std::max(x0, std::max(x1, x2));
+    float v_min = std::min(y0, std::min(y1, y2));
+    float v_max = std::max(y0, std::max(y1, y2));
+    int x_lo = std::max(0, (int)std::floor(u_min * resolution) - 1);
+    int x_hi = std::min(resolution - 1, (int)std::ceil(u_max * resolution) + 1);
+    int y_lo = std::max(y_begin, (int)std::floor(v_min * resolution) - 1);
+    int y_hi = std::min(y_end - 1, (int)std::ceil(v_max * resolution) + 1);
+
+    for (int y = y_lo; y <= y_hi; ++y)
+    {
+      float v = float(y) / resolution;
+      float row0 = b0 * v + c0;
+      float row1 = b1 * v + c1;
+      float* score = &best_score[size_t(y - y_begin) * resolution];
+      for (int x = x_lo; x <= x_hi; ++x)
+      {
+        float u = float(x) / resolution;
+        float l[3];
+        l[0] = a0 * u + row0;
+        l[1] = a1 * u + row1;
+        l[2] = 1.0f - l[0] - l[1];
+        float inside = std::min(l[0], std::min(l[1], l[2]));
+        if (inside < score[x] || (inside == score[x] && face_id[y * resolution + x] >= 0)) continue;
+
+        score[x] = inside;
+        int texel = y * resolution + x;
+        face_id[texel] = f;
+        for (int k = 0; k < 3; ++k)
+        {
+          bary_coord[3 * texel + k] = (std::fabs(l[k]) < BARY_TOLERANCE) ? 0 : l[k];
+        }
+      }
+    }
+  }
+}
+
+bool UVGBuffer::lookup(int x, int y, std::vector<float>& bary, int& f_id, std::vector<int>& v_ids) const
+{
+  bary.resize(3);
+  v_ids.resize(3);
+
+  int texel = y * resolution + x;
+  f_id = face_id[texel];
+  if (f_id < 0)
+  {
+    bary[0] = bary[1] = bary[2] = 0;
+    v_ids[0] = v_ids[1] = v_ids[2] = 0;
+    return false;
+  }
+
+  for (int k = 0; k < 3; ++k)
+  {
+    bary[k] = bary_coord[3 * texel + k];
+    v_ids[k] = face_list[3 * f_id + k];
+  }
+  return true;
+}
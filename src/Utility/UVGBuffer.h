@@ -0,0 +1,41 @@
+#ifndef UVGBuffer_H
+#define UVGBuffer_H
+
+#include <vector>
+#include "BasicHeader.h"
+
+// Face id and barycentric coordinates of every texel of a uv map.
+// Texel (x, y) samples the uv point (x / resolution, y / resolution), the same
+// point the map generators used to look up with a kd-tree, y goes up so the
+// texel is stored in row (resolution - y - 1) of the maps.
+// The uv triangles are rasterized once with edge functions, the texels are
+// split into bands of rows and the bands are filled in parallel.
+class UVGBuffer
+{
+public:
+  UVGBuffer();
+  ~UVGBuffer() {};
+
+  // uv_list stores 2 floats per vertex, face_list 3 vertex ids per face
+  void build(const STLVectorf& uv_list, const FaceList& face_list_, int resolution_);
+  void clear();
+
+  inline int getResolution() const { return resolution; };
+  inline int faceId(int x, int y) const { return face_id[y * resolution + x]; };
+  inline const float* baryCoord(int x, int y) const { return &bary_coord[3 * (y * resolution + x)]; };
+  inline const unsigned int* vertexIds(int f_id) const { return &face_list[3 * f_id]; };
+
+  // same outputs as ShapeUtility::findClosestUVFace, false if the texel is not covered
+  bool lookup(int x, int y, std::vector<float>& bary, int& f_id, std::vector<int>& v_ids) const;
+
+private:
+  void rasterizeBand(const STLVectorf& uv_list, const std::vector<int>& band_faces, int y_begin, int y_end);
+
+private:
+  int resolution;
+  std::vector<int> face_id; // -1 for the texels outside the uv mesh
+  std::vector<float> bary_coord;
+  FaceList face_list;
+};
+
+#endif // !UVGBuffer_H
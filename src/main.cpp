@@ -2,16 +2,35 @@
 #include "MainWindow.h"
 #include <QtWidgets/QApplication>
 #include "MainWindow_Texture.h"
+#include "ParaInit.h"
+#include "BatchSynthesis.h"
+#include "DebugExporter.h"
 #include <time.h>
 int main(int argc, char **argv)
 {
 	srand(time(NULL));
+
+	// headless batch synthesis, no window is created
+	// ImageToShape --batch job_list.txt [report.txt]
+	if (argc >= 3 && std::string(argv[1]) == "--batch")
+	{
+		InitGlobalParameter();
+		BatchSynthesis batch_synthesis;
+		if (!batch_synthesis.loadJobList(argv[2])) return 1;
+		batch_synthesis.run();
+		batch_synthesis.exportReport(argc >= 4 ? argv[3] : "batch_report.txt");
+		DebugExporter::GetInstance()->flush();
+		return 0;
+	}
+
   QApplication a(argc, argv);
 
   MainWindow *window = new MainWindow();
   window->show();
 
-  return a.exec();
+  int ret = a.exec();
+  DebugExporter::GetInstance()->flush(); // snapshots queued just before closing
+  return ret;
 }
 
 //#include<windows.h>